@@ -1,14 +1,23 @@
+#include "../cpp-server/move_codec.h"
 #include "../cpp-server/protocol.h"
+#include "../cpp-server/schema.h"
+#include "../cpp-server/shm_ring.h"
+#include "../cpp-server/wire.h"
+#include <algorithm>
 #include <arpa/inet.h>
 #include <atomic>
 #include <cstring>
 #include <iomanip>
 #include <iostream>
 #include <limits>
+#include <map>
+#include <mutex>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <thread>
 #include <unistd.h>
+#include <vector>
 
 // ANSI Color codes for terminal UI
 #define RESET "\033[0m"
@@ -29,10 +38,23 @@
 
 class GomokuClient {
 private:
-  int clientSocket;
+  std::atomic<int> clientSocket; // Replaced by the receive thread on resume
+  // Set when the server granted WIRE_SHM; frames then go through it, not
+  // the socket. Replaced with the socket, under sendMutex.
+  std::shared_ptr<ShmChannel> ring;
+  std::mutex sendMutex; // Frames are sent from both threads
   uint32_t userId;
   uint32_t sessionId;
+  uint64_t resumeToken;
+  std::string serverHost;
+  int serverPort;
+  std::string unixPath; // Connect to this local socket instead, if set
   std::atomic<bool> connected;
+  bool resuming; // Receive thread only
+  uint8_t preferredWireVersion;
+  uint8_t preferredFeatures;
+  std::atomic<uint8_t> wireVersion; // Agreed on the current connection
+  std::atomic<uint32_t> nextTag;    // Correlation tag of the next request
   std::atomic<bool> inGame;
   std::atomic<bool> isMyTurn;
   uint32_t currentGameId;
@@ -43,6 +65,34 @@ private:
   std::string opponentName;
   bool isPlayer1;
 
+  // Game watched as a spectator; only the id is read outside the receive
+  // thread
+  std::atomic<uint32_t> watchedGameId;
+  uint8_t watchedBoardSize;
+  std::vector<uint8_t> watchedBoard;
+  std::string watchedNames[2];
+  uint16_t watchedTimes[2];
+  uint16_t watchedTimeLimit;
+
+  // Game being replayed; receive thread only
+  uint32_t replayGameId;
+  uint8_t replayBoardSize;
+  uint32_t replayTotalMoves;
+  std::vector<uint8_t> replayBoard;
+  std::string replayNames[2];
+
+  // Replay chunks kept in flight; one more is granted per chunk received
+  static const uint16_t REPLAY_WINDOW = 4;
+
+  // Lobby kept current from pushed presence deltas
+  std::map<uint32_t, PlayerInfo> lobby;
+  std::mutex lobbyMutex;
+  std::atomic<bool> lobbySubscribed;
+
+  // Reconnect attempts after a drop, spread over the server's 30s grace
+  static const int RESUME_ATTEMPTS = 10;
+  static const int RESUME_RETRY_MS = 2500;
+
   // Stats
   uint16_t eloRating;
   uint16_t wins;
@@ -68,8 +118,17 @@ private:
 
 public:
   GomokuClient()
-      : userId(0), sessionId(0), connected(false), inGame(false),
+      : clientSocket(-1), userId(0), sessionId(0), resumeToken(0),
+        serverPort(0), connected(false), resuming(false),
+        preferredWireVersion(WIRE_VERSION_MAX),
+        preferredFeatures(WIRE_COMPRESS), wireVersion(WIRE_V1),
+        nextTag(1),
+        inGame(false),
         isMyTurn(false), currentGameId(0), gameBoard(nullptr), isPlayer1(true),
+        watchedGameId(0), watchedBoardSize(0), watchedTimes{0, 0},
+        watchedTimeLimit(0), replayGameId(0), replayBoardSize(0),
+        replayTotalMoves(0),
+        lobbySubscribed(false),
         eloRating(0), wins(0), losses(0), draws(0) {}
 
   void clearScreen() { std::cout << "\033[2J\033[1;1H"; }
@@ -93,28 +152,131 @@ public:
     }
   }
 
-  bool connectToServer(const char *host, int port) {
-    clientSocket = socket(AF_INET, SOCK_STREAM, 0);
-    if (clientSocket < 0) {
-      std::cerr << RED << "Error creating socket" << RESET << std::endl;
-      return false;
+  // Highest wire version to offer the server
+  void setWireVersion(uint8_t version) {
+    preferredWireVersion =
+        std::max<uint8_t>(WIRE_V1, std::min(version, WIRE_VERSION_MAX));
+  }
+
+  // Whether to ask the server to compress large payloads
+  void setCompression(bool enabled) {
+    preferredFeatures = enabled ? preferredFeatures | WIRE_COMPRESS
+                                : preferredFeatures & ~WIRE_COMPRESS;
+  }
+
+  // Connect to a server on this host through its Unix domain socket
+  void setUnixSocket(const std::string &path) { unixPath = path; }
+
+  // Whether to ask for shared memory; only granted on the Unix socket
+  void setSharedMemory(bool enabled) {
+    preferredFeatures = enabled ? preferredFeatures | WIRE_SHM
+                                : preferredFeatures & ~WIRE_SHM;
+  }
+
+  // Connected socket to the server, or -1, and the shared-memory channel
+  // if one was granted. The wire version is agreed before anything else is
+  // sent.
+  int openSocket(std::shared_ptr<ShmChannel> &channel) {
+    channel = nullptr;
+    int sock;
+    if (!unixPath.empty()) {
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      unixPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+      sock = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (sock < 0)
+        return -1;
+      if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+      }
+    } else {
+      sock = socket(AF_INET, SOCK_STREAM, 0);
+      if (sock < 0)
+        return -1;
+
+      struct sockaddr_in serverAddr;
+      serverAddr.sin_family = AF_INET;
+      serverAddr.sin_port = htons(serverPort);
+      inet_pton(AF_INET, serverHost.c_str(), &serverAddr.sin_addr);
+
+      if (connect(sock, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) <
+          0) {
+        close(sock);
+        return -1;
+      }
     }
+    wireVersion = negotiate(sock, channel);
+    return sock;
+  }
+
+  // Offer our highest wire version and the features we want. A server that
+  // predates negotiation answers with an error, and the connection stays on
+  // v1. Compressed frames are expanded as they are read, so whether the
+  // server granted compression needs no tracking here. A granted shared
+  // memory channel arrives as a descriptor with the reply.
+  uint8_t negotiate(int sock, std::shared_ptr<ShmChannel> &channel) {
+    if (preferredWireVersion == WIRE_V1 && preferredFeatures == 0)
+      return WIRE_V1;
+
+    Hello hello;
+    hello.version = preferredWireVersion;
+    hello.features = preferredFeatures;
+    std::vector<char> frame =
+        WireCodec::frame(WIRE_V1, MSG_HELLO, 0, 0, &hello, sizeof(hello));
+    send(sock, frame.data(), frame.size(), 0);
 
-    struct sockaddr_in serverAddr;
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(port);
-    inet_pton(AF_INET, host, &serverAddr.sin_addr);
+    MessageHeader header;
+    std::vector<char> payload;
+    size_t wireBytes;
+    uint32_t tag;
+    int fd = -1;
+    auto read = [sock, &fd](void *buffer, size_t len) {
+      int received;
+      if (!ShmChannel::recvWithFd(sock, buffer, len, received))
+        return false;
+      if (received >= 0 && fd < 0) {
+        fd = received;
+      } else if (received >= 0) {
+        close(received);
+      }
+      return true;
+    };
+    uint8_t version = WIRE_V1;
+    if (WireCodec::readFrame(WIRE_V1, read, header, payload, wireBytes,
+                             tag) &&
+        header.type == MSG_HELLO_RESPONSE &&
+        header.length >= sizeof(hello.version)) {
+      version = std::max<uint8_t>(
+          WIRE_V1, std::min<uint8_t>(payload[0], preferredWireVersion));
+      if (header.length >= sizeof(Hello) && (payload[1] & WIRE_SHM) &&
+          fd >= 0) {
+        channel = ShmChannel::attach(fd, sock);
+        fd = -1;
+      }
+    }
+    if (fd >= 0)
+      close(fd);
+    return version;
+  }
 
-    if (connect(clientSocket, (struct sockaddr *)&serverAddr,
-                sizeof(serverAddr)) < 0) {
-      std::cerr << RED << "Error connecting to server at " << host << ":"
-                << port << RESET << std::endl;
+  bool connectToServer(const char *host, int port) {
+    serverHost = host;
+    serverPort = port;
+    std::string address = unixPath.empty()
+                              ? serverHost + ":" + std::to_string(port)
+                              : unixPath;
+    clientSocket = openSocket(ring);
+    if (clientSocket < 0) {
+      std::cerr << RED << "Error connecting to server at " << address << RESET
+                << std::endl;
       return false;
     }
 
     connected = true;
-    std::cout << GREEN << "✓ Connected to server at " << host << ":" << port
-              << RESET << std::endl;
+    std::cout << GREEN << "✓ Connected to server at " << address
+              << (ring ? " (shared memory)" : "") << RESET << std::endl;
 
     // Start receive thread
     std::thread(&GomokuClient::receiveMessages, this).detach();
@@ -159,7 +321,22 @@ public:
 
   // ==================== PLAYER LIST ====================
 
-  void getOnlinePlayers() { sendMessage(MSG_GET_ONLINE_PLAYERS, nullptr, 0); }
+  void getOnlinePlayers() {
+    if (!lobbySubscribed) {
+      sendMessage(MSG_GET_ONLINE_PLAYERS, nullptr, 0);
+      return;
+    }
+
+    std::vector<PlayerInfo> players;
+    {
+      std::lock_guard<std::mutex> lock(lobbyMutex);
+      for (const auto &pair : lobby) {
+        if (pair.first != userId)
+          players.push_back(pair.second);
+      }
+    }
+    printPlayers(players);
+  }
 
   // ==================== CHALLENGE ====================
 
@@ -180,6 +357,23 @@ public:
     sendMessage(MSG_SEND_CHALLENGE, &req, sizeof(req));
   }
 
+  void joinQueue() {
+    QueueRequest req;
+    memset(&req, 0, sizeof(req));
+
+    std::cout << CYAN << "┌───── QUICK MATCH ────┐" << RESET << std::endl;
+    std::cout << "│ Board Size (10-19, default 15): ";
+    int boardSize = getIntInput();
+    req.boardSize = (boardSize >= 10 && boardSize <= 19) ? boardSize : 15;
+    std::cout << "│ Time Limit in seconds (0=unlimited): ";
+    req.timeLimit = getIntInput();
+    std::cout << CYAN << "└──────────────────────┘" << RESET << std::endl;
+
+    sendMessage(MSG_JOIN_QUEUE, &req, sizeof(req));
+  }
+
+  void leaveQueue() { sendMessage(MSG_LEAVE_QUEUE, nullptr, 0); }
+
   void acceptChallenge(uint32_t challengeId) {
     sendMessage(MSG_ACCEPT_CHALLENGE, &challengeId, sizeof(challengeId));
   }
@@ -288,6 +482,79 @@ public:
     sendMessage(MSG_GET_GAME_LOG, &gameId, sizeof(gameId));
   }
 
+  void tournamentMenu() {
+    std::cout << "1. Create  2. Join  3. Start  4. Standings: ";
+    int action = getIntInput();
+
+    if (action == 1) {
+      TournamentCreate req;
+      memset(&req, 0, sizeof(req));
+      std::cout << CYAN << "┌──── NEW TOURNAMENT ──┐" << RESET << std::endl;
+      std::cout << "│ Name: ";
+      std::string name;
+      std::cin >> name;
+      strncpy(req.name, name.c_str(), sizeof(req.name) - 1);
+      std::cout << "│ Format (0=Swiss, 1=Arena): ";
+      req.format = getIntInput() == 1 ? TOURNAMENT_ARENA : TOURNAMENT_SWISS;
+      std::cout << "│ Board Size (10-19, default 15): ";
+      int boardSize = getIntInput();
+      req.boardSize = (boardSize >= 10 && boardSize <= 19) ? boardSize : 15;
+      std::cout << "│ Time Limit in seconds (0=unlimited): ";
+      req.timeLimit = getIntInput();
+      std::cout << (req.format == TOURNAMENT_ARENA ? "│ Duration (minutes): "
+                                                   : "│ Rounds: ");
+      req.rounds = getIntInput();
+      std::cout << CYAN << "└──────────────────────┘" << RESET << std::endl;
+      sendMessage(MSG_TOURNAMENT_CREATE, &req, sizeof(req));
+      return;
+    }
+
+    std::cout << "Tournament ID: ";
+    uint32_t tournamentId = getIntInput();
+    if (action == 2) {
+      sendMessage(MSG_TOURNAMENT_JOIN, &tournamentId, sizeof(tournamentId));
+    } else if (action == 3) {
+      sendMessage(MSG_TOURNAMENT_START, &tournamentId, sizeof(tournamentId));
+    } else {
+      StandingsRequest req;
+      req.tournamentId = tournamentId;
+      req.offset = 0;
+      req.limit = 20;
+      sendMessage(MSG_GET_STANDINGS, &req, sizeof(req));
+    }
+  }
+
+  void getLeaderboard() {
+    std::cout << "1. Top players  2. Around me: ";
+    int mode = getIntInput();
+
+    LeaderboardRequest req;
+    req.limit = 10;
+    req.offset = 0;
+    if (mode == 2) {
+      req.mode = LEADERBOARD_AROUND_ME;
+    } else {
+      req.mode = LEADERBOARD_TOP;
+      std::cout << "Page (1 = top 10): ";
+      int page = getIntInput();
+      req.offset = page > 1 ? (page - 1) * req.limit : 0;
+    }
+    sendMessage(MSG_GET_LEADERBOARD, &req, sizeof(req));
+  }
+
+  void getRatingHistory() {
+    std::cout << "User ID (0 = you): ";
+    int target = getIntInput();
+    std::cout << "Last N days (0 = all time): ";
+    int days = getIntInput();
+
+    RatingHistoryRequest req;
+    req.userId = target > 0 ? target : 0;
+    req.days = days > 0 ? days : 0;
+    req.maxPoints = 12;
+    sendMessage(MSG_GET_RATING_HISTORY, &req, sizeof(req));
+  }
+
   // ==================== BOARD DISPLAY ====================
 
   void displayBoard() {
@@ -310,9 +577,21 @@ public:
               << RESET << " = " << (isPlayer1 ? "Opponent" : "You")
               << std::endl;
 
+    printGrid(gameBoard, currentBoardSize);
+
+    // Turn indicator
+    std::cout << std::endl;
+    if (isMyTurn) {
+      std::cout << GREEN << BOLD << ">>> YOUR TURN!" << RESET << std::endl;
+    } else {
+      std::cout << YELLOW << "Waiting for opponent..." << RESET << std::endl;
+    }
+  }
+
+  void printGrid(const uint8_t *board, int boardSize) {
     // Column headers
     std::cout << "      ";
-    for (int x = 0; x < currentBoardSize; x++) {
+    for (int x = 0; x < boardSize; x++) {
       if (x < 10)
         std::cout << " ";
       std::cout << CYAN << x << RESET << " ";
@@ -321,19 +600,19 @@ public:
 
     // Top border
     std::cout << "     ╔";
-    for (int x = 0; x < currentBoardSize; x++) {
+    for (int x = 0; x < boardSize; x++) {
       std::cout << "═══";
     }
     std::cout << "╗" << std::endl;
 
     // Board rows
-    for (int y = 0; y < currentBoardSize; y++) {
+    for (int y = 0; y < boardSize; y++) {
       if (y < 10)
         std::cout << " ";
       std::cout << CYAN << y << RESET << "   ║";
 
-      for (int x = 0; x < currentBoardSize; x++) {
-        uint8_t cell = gameBoard[y * currentBoardSize + x];
+      for (int x = 0; x < boardSize; x++) {
+        uint8_t cell = board[y * boardSize + x];
         if (cell == 0) {
           std::cout << DIM << " · " << RESET;
         } else if (cell == 1) {
@@ -347,75 +626,385 @@ public:
 
     // Bottom border
     std::cout << "     ╚";
-    for (int x = 0; x < currentBoardSize; x++) {
+    for (int x = 0; x < boardSize; x++) {
       std::cout << "═══";
     }
     std::cout << "╝" << std::endl;
+  }
 
-    // Turn indicator
+  // 2-bit packed cells of a BoardSnapshot into one byte per cell
+  static void unpackBoard(const uint8_t *cells, int totalCells,
+                          uint8_t *out) {
+    for (int i = 0; i < totalCells; i++) {
+      out[i] = (cells[i / 4] >> (2 * (i % 4))) & 3;
+    }
+  }
+
+  // ==================== SPECTATING ====================
+
+  void watchGame() {
+    WatchRequest req;
+    std::cout << "Game ID to watch: ";
+    req.gameId = getIntInput();
+    std::cout << "Rewind seconds (0 = from now): ";
+    req.rewindSeconds = std::max(0, std::min(getIntInput(), 65535));
+    sendMessage(MSG_WATCH_GAME, &req, sizeof(req));
+  }
+
+  void stopWatching() {
+    uint32_t gameId = watchedGameId.exchange(0);
+    if (gameId == 0) {
+      std::cout << YELLOW << "Not watching a game" << RESET << std::endl;
+      return;
+    }
+    sendMessage(MSG_UNWATCH_GAME, &gameId, sizeof(gameId));
+    std::cout << YELLOW << "Stopped watching game #" << gameId << RESET
+              << std::endl;
+  }
+
+  void displayWatchedBoard() {
     std::cout << std::endl;
-    if (isMyTurn) {
-      std::cout << GREEN << BOLD << ">>> YOUR TURN!" << RESET << std::endl;
-    } else {
-      std::cout << YELLOW << "Waiting for opponent..." << RESET << std::endl;
+    std::cout << BOLD << "  👁  WATCHING GAME #" << watchedGameId << ": "
+              << GREEN << watchedNames[0] << RESET << BOLD << " (X) vs "
+              << RED << watchedNames[1] << RESET << BOLD << " (O)" << RESET
+              << std::endl;
+    if (watchedTimeLimit > 0) {
+      std::cout << "  Clocks: " << watchedTimes[0] << "s / "
+                << watchedTimes[1] << "s" << std::endl;
+    }
+    printGrid(watchedBoard.data(), watchedBoardSize);
+  }
+
+  // ==================== REPLAY ====================
+
+  void replayGame() {
+    ReplayRequest req;
+    req.op = REPLAY_SEEK;
+    std::cout << "Game ID to replay: ";
+    req.gameId = getIntInput();
+    std::cout << "Start after move (0 = from the beginning): ";
+    req.moveNumber = std::max(0, getIntInput());
+    req.credit = REPLAY_WINDOW;
+    sendMessage(MSG_REPLAY_GAME, &req, sizeof(req));
+  }
+
+  void grantReplayCredit(uint32_t gameId, uint16_t chunks) {
+    ReplayRequest req;
+    req.op = REPLAY_CREDIT;
+    req.gameId = gameId;
+    req.moveNumber = 0;
+    req.credit = chunks;
+    sendMessage(MSG_REPLAY_GAME, &req, sizeof(req));
+  }
+
+  void displayReplayBoard(uint32_t moveNumber) {
+    std::cout << std::endl;
+    std::cout << BOLD << "  ⏵ REPLAY #" << replayGameId << ": " << GREEN
+              << replayNames[0] << RESET << BOLD << " (X) vs " << RED
+              << replayNames[1] << RESET << BOLD << " (O)" << RESET
+              << " - after move " << moveNumber << " of " << replayTotalMoves
+              << std::endl;
+    printGrid(replayBoard.data(), replayBoardSize);
+  }
+
+  // ==================== LOBBY ====================
+
+  void printPlayers(const std::vector<PlayerInfo> &players) {
+    std::cout << std::endl;
+    std::cout << CYAN
+              << "╔═══════════════════════════════════════════════════════╗"
+              << std::endl;
+    std::cout << "║              ONLINE PLAYERS (" << players.size()
+              << ")                        ║" << std::endl;
+    std::cout << "╠═══════════════════════════════════════════════════════╣"
+              << std::endl;
+    std::cout << "║  ID   │ Username          │  ELO  │ W/L/D   │ Status ║"
+              << std::endl;
+    std::cout << "╠═══════════════════════════════════════════════════════╣"
+              << RESET << std::endl;
+
+    for (const PlayerInfo &info : players) {
+      std::cout << CYAN << "║ " << RESET;
+      std::cout << std::setw(5) << info.userId << " │ ";
+      std::cout << std::setw(17) << std::left << info.username << std::right
+                << " │ ";
+      std::cout << std::setw(5) << info.eloRating << " │ ";
+      std::cout << std::setw(2) << info.wins << "/" << std::setw(2)
+                << info.losses << "/" << std::setw(2) << info.draws << " │ ";
+
+      if (info.inGame) {
+        std::cout << YELLOW << "In Game" << RESET;
+      } else {
+        std::cout << GREEN << " Ready " << RESET;
+      }
+      std::cout << CYAN << " ║" << RESET << std::endl;
     }
+
+    std::cout << CYAN
+              << "╚═══════════════════════════════════════════════════════╝"
+              << RESET << std::endl;
+  }
+
+  // Apply a MSG_PRESENCE_DELTA batch to the local lobby
+  void applyPresenceDelta(const char *payload, uint32_t length) {
+    PresenceDeltaHeaderView batch =
+        PresenceDeltaHeaderView::bind(payload, length);
+    if (!batch)
+      return;
+    size_t offset = PresenceDeltaHeaderView::SIZE;
+
+    std::lock_guard<std::mutex> lock(lobbyMutex);
+    if (batch.full())
+      lobby.clear();
+
+    for (uint32_t i = 0; i < batch.count(); i++) {
+      PresenceDeltaView delta =
+          PresenceDeltaView::bind(payload, length, offset);
+      if (!delta)
+        break;
+      offset += PresenceDeltaView::SIZE;
+
+      if (delta.kind() & PRESENCE_LEFT) {
+        lobby.erase(delta.userId());
+        continue;
+      }
+
+      PlayerInfo &info = lobby[delta.userId()];
+      if (delta.kind() & PRESENCE_JOINED) {
+        if (length - offset < sizeof(info.username))
+          break;
+        memcpy(info.username, payload + offset, sizeof(info.username));
+        info.username[sizeof(info.username) - 1] = '\0';
+        offset += sizeof(info.username);
+      }
+      info.userId = delta.userId();
+      info.eloRating = delta.eloRating();
+      info.wins = delta.wins();
+      info.losses = delta.losses();
+      info.draws = delta.draws();
+      info.isOnline = 1;
+      info.inGame = delta.inGame();
+    }
+    lobbySubscribed = true;
+  }
+
+  void printTournamentStatus(const TournamentStatus &status) {
+    static const char *states[] = {"open", "running", "finished"};
+    std::cout << YELLOW << "\n[*] Tournament #" << status.tournamentId << " '"
+              << std::string(status.name, strnlen(status.name, 32)) << "' ("
+              << (status.format == TOURNAMENT_ARENA ? "arena" : "swiss")
+              << "): " << states[status.state < 3 ? status.state : 0]
+              << ", round " << status.round << "/" << status.rounds << ", "
+              << status.players << " players, " << status.gamesInProgress
+              << " games in progress" << RESET << std::endl;
   }
 
   // ==================== MESSAGE HANDLING ====================
 
+  // Every request is tagged; on v3 the server echoes the tag in its answer
   void sendMessage(uint16_t type, void *payload, uint32_t length) {
-    MessageHeader header;
-    header.type = type;
-    header.length = length;
-    header.userId = userId;
-    header.sessionId = sessionId;
+    // One buffer so a frame is never split between two send() calls
+    std::vector<char> frame = WireCodec::frame(
+        wireVersion, type, userId, sessionId, payload, length, nextTag++);
+    std::lock_guard<std::mutex> lock(sendMutex);
+    if (ring) {
+      ring->write(frame.data(), frame.size());
+    } else {
+      send(clientSocket, frame.data(), frame.size(), 0);
+    }
+  }
 
-    send(clientSocket, &header, sizeof(header), 0);
-    if (length > 0 && payload) {
-      send(clientSocket, payload, length, 0);
+  // Read exactly len bytes; a single recv may return a partial payload
+  int recvAll(int sock, void *buffer, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+      int n = recv(sock, (char *)buffer + total, len - total, 0);
+      if (n <= 0)
+        return n;
+      total += n;
     }
+    return (int)total;
+  }
+
+  // Next message, with its payload in v1 form and the tag of the request
+  // it answers. v1 history entries follow their frame and are read into the
+  // payload here, so every handler finds its whole message in the payload.
+  bool readMessage(MessageHeader &header, std::vector<char> &payload,
+                   uint32_t &tag) {
+    int sock = clientSocket;
+    uint8_t version = wireVersion;
+    ShmChannel *channel = ring.get(); // Only this thread replaces it
+    auto read = [this, sock, channel](void *buffer, size_t len) {
+      if (channel)
+        return channel->read(buffer, len);
+      return recvAll(sock, buffer, len) > 0;
+    };
+    size_t wireBytes;
+    if (!WireCodec::readFrame(version, read, header, payload, wireBytes,
+                              tag))
+      return false;
+
+    // A compressed history frame already holds its entries
+    if (version == WIRE_V1 && header.type == MSG_GAME_HISTORY_RESPONSE &&
+        payload.size() == sizeof(uint32_t)) {
+      uint32_t count;
+      memcpy(&count, payload.data(), sizeof(count));
+      size_t entries = (size_t)count * sizeof(GameHistoryEntry);
+      payload.resize(sizeof(count) + entries);
+      if (entries > 0 && !read(payload.data() + sizeof(count), entries))
+        return false;
+      header.length = payload.size();
+    }
+    return true;
   }
 
   void receiveMessages() {
     while (connected) {
       MessageHeader header;
-      int bytesRead = recv(clientSocket, &header, sizeof(header), 0);
-
-      if (bytesRead <= 0) {
+      std::vector<char> payload;
+      uint32_t tag;
+      if (!readMessage(header, payload, tag)) {
+        if (reconnect())
+          continue;
         std::cout << RED << "\n[!] Disconnected from server" << RESET
                   << std::endl;
         connected = false;
         break;
       }
 
-      char *payload = nullptr;
-      if (header.length > 0) {
-        payload = new char[header.length];
-        bytesRead = recv(clientSocket, payload, header.length, 0);
+      handleMessage(header, payload.data(), tag);
+    }
+  }
 
-        if (bytesRead <= 0) {
-          delete[] payload;
-          break;
-        }
+  // After a dropped connection, reconnect and ask the server to resume the
+  // session. The answer arrives as MSG_RESUME_RESPONSE on the new socket.
+  bool reconnect() {
+    if (!connected || resumeToken == 0)
+      return false; // Quitting, or never logged in
+
+    std::cout << YELLOW << "\n[!] Connection lost, reconnecting..." << RESET
+              << std::endl;
+    close(clientSocket);
+    watchedGameId = 0; // Spectating does not survive the connection
+    for (int attempt = 0; attempt < RESUME_ATTEMPTS && connected; attempt++) {
+      if (attempt > 0) {
+        std::this_thread::sleep_for(
+            std::chrono::milliseconds(RESUME_RETRY_MS));
       }
+      std::shared_ptr<ShmChannel> channel;
+      int sock = openSocket(channel);
+      if (sock < 0)
+        continue;
+      {
+        std::lock_guard<std::mutex> lock(sendMutex);
+        clientSocket = sock;
+        ring = channel;
+      }
+      resuming = true;
+
+      ResumeRequest req;
+      req.userId = userId;
+      req.sessionId = sessionId;
+      req.resumeToken = resumeToken;
+      sendMessage(MSG_RESUME_SESSION, &req, sizeof(req));
+      return true;
+    }
+    return false;
+  }
 
-      handleMessage(header, payload);
-      if (payload)
-        delete[] payload;
+  // Rebuild the game from a snapshot sent after a resume or a new login
+  void restoreGame(const BoardSnapshot &snapshot, const uint8_t *cells) {
+    inGame = true;
+    currentGameId = snapshot.gameId;
+    currentBoardSize = snapshot.boardSize;
+    isPlayer1 = (snapshot.player1Id == userId);
+    opponentId = isPlayer1 ? snapshot.player2Id : snapshot.player1Id;
+    opponentName = std::string(
+        isPlayer1 ? snapshot.player2Name : snapshot.player1Name,
+        strnlen(isPlayer1 ? snapshot.player2Name : snapshot.player1Name, 32));
+    isMyTurn = (snapshot.currentTurn == userId);
+
+    int totalCells = currentBoardSize * currentBoardSize;
+    if (gameBoard)
+      delete[] gameBoard;
+    gameBoard = new uint8_t[totalCells];
+    unpackBoard(cells, totalCells, gameBoard);
+
+    clearScreen();
+    printHeader();
+    std::cout << GREEN << "\n✓ Rejoined game #" << currentGameId << " after "
+              << snapshot.moveCount << " moves" << RESET << std::endl;
+    if (snapshot.timeLimit > 0) {
+      uint16_t mine = isPlayer1 ? snapshot.player1Time : snapshot.player2Time;
+      uint16_t theirs =
+          isPlayer1 ? snapshot.player2Time : snapshot.player1Time;
+      std::cout << "Time left: you " << mine << "s, opponent " << theirs
+                << "s" << std::endl;
+    }
+    if (snapshot.drawOfferedBy != 0 && snapshot.drawOfferedBy != userId) {
+      std::cout << YELLOW << "Your opponent has offered a draw (option 3/4)"
+                << RESET << std::endl;
     }
+    displayBoard();
   }
 
-  void handleMessage(MessageHeader &header, char *payload) {
+  void handleMessage(MessageHeader &header, char *payload, uint32_t tag) {
     switch (header.type) {
+    case MSG_RESUME_RESPONSE: {
+      ResumeResponseView resp =
+          ResumeResponseView::bind(payload, header.length);
+      if (!resp)
+        break;
+      if (!resp.success()) {
+        resuming = false;
+        std::cout << RED << "\n✗ Session expired, please login again"
+                  << RESET << std::endl;
+        userId = 0;
+        sessionId = 0;
+        resumeToken = 0;
+        inGame = false;
+        isMyTurn = false;
+        break;
+      }
+      // Also sent after a login while a game is in progress, which has
+      // already subscribed
+      if (resuming) {
+        resuming = false;
+        std::cout << GREEN << "\n✓ Session resumed" << RESET << std::endl;
+        sendMessage(MSG_SUBSCRIBE_PRESENCE, nullptr, 0);
+      }
+
+      if (resp.gameId() == 0) {
+        if (inGame) {
+          std::cout << YELLOW << "[*] Your game ended while you were away"
+                    << RESET << std::endl;
+        }
+        inGame = false;
+        isMyTurn = false;
+        break;
+      }
+      const size_t fixed = ResumeResponseView::SIZE + BoardSnapshotView::SIZE;
+      BoardSnapshotView snapshot = BoardSnapshotView::bind(
+          payload, header.length, ResumeResponseView::SIZE);
+      if (!snapshot ||
+          header.length < fixed + boardCells(snapshot.boardSize()))
+        break;
+      restoreGame(snapshot.value(), (const uint8_t *)payload + fixed);
+      break;
+    }
+
     case MSG_LOGIN_RESPONSE: {
-      LoginResponse *resp = (LoginResponse *)payload;
-      if (resp->success) {
-        userId = resp->userId;
-        sessionId = resp->sessionId;
-        eloRating = resp->eloRating;
-        wins = resp->wins;
-        losses = resp->losses;
-        draws = resp->draws;
+      LoginResponseView resp = LoginResponseView::bind(payload, header.length);
+      if (!resp)
+        break;
+      if (resp.success()) {
+        userId = resp.userId();
+        sessionId = resp.sessionId();
+        resumeToken = resp.resumeToken();
+        eloRating = resp.eloRating();
+        wins = resp.wins();
+        losses = resp.losses();
+        draws = resp.draws();
 
         std::cout << std::endl;
         std::cout << GREEN << "╔═══════════════════════════════════════╗"
@@ -430,69 +1019,72 @@ public:
                   << draws << "D            ║" << std::endl;
         std::cout << "╚═══════════════════════════════════════╝" << RESET
                   << std::endl;
+
+        sendMessage(MSG_SUBSCRIBE_PRESENCE, nullptr, 0);
       } else {
-        std::cout << RED << "\n✗ Login failed: " << resp->message << RESET
+        std::cout << RED << "\n✗ Login failed: " << resp.message() << RESET
                   << std::endl;
       }
       break;
     }
 
     case MSG_REGISTER_RESPONSE: {
-      LoginResponse *resp = (LoginResponse *)payload;
-      if (resp->success) {
+      LoginResponseView resp = LoginResponseView::bind(payload, header.length);
+      if (!resp)
+        break;
+      if (resp.success()) {
         std::cout << GREEN << "\n✓ Registration successful! Please login."
                   << RESET << std::endl;
       } else {
-        std::cout << RED << "\n✗ Registration failed: " << resp->message
+        std::cout << RED << "\n✗ Registration failed: " << resp.message()
                   << RESET << std::endl;
       }
       break;
     }
 
     case MSG_ONLINE_PLAYERS_LIST: {
-      uint32_t count = *(uint32_t *)payload;
+      uint32_t count;
+      if (!Le::read(payload, header.length, count))
+        break;
+      auto infos = ListView<PlayerInfoView>::bind(payload, header.length,
+                                                  sizeof(count), count);
+      if (!infos)
+        break;
 
-      std::cout << std::endl;
-      std::cout << CYAN
-                << "╔═══════════════════════════════════════════════════════╗"
-                << std::endl;
-      std::cout << "║              ONLINE PLAYERS (" << count
-                << ")                        ║" << std::endl;
-      std::cout << "╠═══════════════════════════════════════════════════════╣"
-                << std::endl;
-      std::cout << "║  ID   │ Username          │  ELO  │ W/L/D   │ Status ║"
-                << std::endl;
-      std::cout << "╠═══════════════════════════════════════════════════════╣"
-                << RESET << std::endl;
+      std::vector<PlayerInfo> players;
+      players.reserve(infos.size());
+      for (size_t i = 0; i < infos.size(); i++) {
+        players.push_back(infos[i].value());
+      }
+      printPlayers(players);
+      break;
+    }
 
-      for (uint32_t i = 0; i < count; i++) {
-        PlayerInfo info;
-        recv(clientSocket, &info, sizeof(info), 0);
+    case MSG_PRESENCE_DELTA:
+      applyPresenceDelta(payload, header.length);
+      break;
 
-        std::cout << CYAN << "║ " << RESET;
-        std::cout << std::setw(5) << info.userId << " │ ";
-        std::cout << std::setw(17) << std::left << info.username << std::right
-                  << " │ ";
-        std::cout << std::setw(5) << info.eloRating << " │ ";
-        std::cout << std::setw(2) << info.wins << "/" << std::setw(2)
-                  << info.losses << "/" << std::setw(2) << info.draws << " │ ";
-
-        if (info.inGame) {
-          std::cout << YELLOW << "In Game" << RESET;
-        } else {
-          std::cout << GREEN << " Ready " << RESET;
-        }
-        std::cout << CYAN << " ║" << RESET << std::endl;
+    case MSG_QUEUE_STATUS: {
+      QueueStatusView status = QueueStatusView::bind(payload, header.length);
+      if (!status)
+        break;
+      if (status.inQueue()) {
+        std::cout << YELLOW << "\n[*] Searching for an opponent ("
+                  << (int)status.boardSize() << "x" << (int)status.boardSize()
+                  << ", " << status.waiting() << " waiting)..." << RESET
+                  << std::endl;
+      } else if (status.boardSize() == 0) {
+        std::cout << YELLOW << "\n[*] Left the matchmaking queue" << RESET
+                  << std::endl;
       }
-
-      std::cout << CYAN
-                << "╚═══════════════════════════════════════════════════════╝"
-                << RESET << std::endl;
       break;
     }
 
     case MSG_CHALLENGE_RECEIVED: {
-      ChallengeResponse *resp = (ChallengeResponse *)payload;
+      ChallengeResponseView resp =
+          ChallengeResponseView::bind(payload, header.length);
+      if (!resp)
+        break;
 
       std::cout << std::endl;
       std::cout << YELLOW << BOLD << "╔═══════════════════════════════════════╗"
@@ -500,13 +1092,14 @@ public:
       std::cout << "║       ⚔️  CHALLENGE RECEIVED!  ⚔️       ║" << std::endl;
       std::cout << "╠═══════════════════════════════════════╣" << RESET
                 << YELLOW << std::endl;
-      std::cout << "║  From: " << resp->challengerName << std::endl;
-      std::cout << "║  Challenge ID: " << resp->challengeId << std::endl;
-      std::cout << "║  Board: " << (int)resp->boardSize << "x"
-                << (int)resp->boardSize << std::endl;
+      std::cout << "║  From: " << resp.challengerName() << std::endl;
+      std::cout << "║  Challenge ID: " << resp.challengeId() << std::endl;
+      std::cout << "║  Board: " << (int)resp.boardSize() << "x"
+                << (int)resp.boardSize() << std::endl;
       std::cout << "║  Time: "
-                << (resp->timeLimit > 0 ? std::to_string(resp->timeLimit) + "s"
-                                        : "Unlimited")
+                << (resp.timeLimit() > 0
+                        ? std::to_string(resp.timeLimit()) + "s"
+                        : "Unlimited")
                 << std::endl;
       std::cout << "╠═══════════════════════════════════════╣" << std::endl;
       std::cout << "║  Use option 5 to Accept               ║" << std::endl;
@@ -517,30 +1110,37 @@ public:
     }
 
     case MSG_CHALLENGE_DECLINED: {
-      ChallengeDeclinedResponse *resp = (ChallengeDeclinedResponse *)payload;
+      ChallengeDeclinedResponseView resp =
+          ChallengeDeclinedResponseView::bind(payload, header.length);
+      if (!resp)
+        break;
       std::cout << std::endl;
-      std::cout << RED << "[!] Challenge declined by " << resp->declinerName
+      std::cout << RED << "[!] Challenge declined by " << resp.declinerName()
                 << RESET << std::endl;
       break;
     }
 
     case MSG_CHALLENGE_RESPONSE: {
-      uint32_t challengeId = *(uint32_t *)payload;
+      uint32_t challengeId;
+      if (!Le::read(payload, header.length, challengeId))
+        break;
       std::cout << GREEN << "\n✓ Challenge sent! (ID: " << challengeId
                 << ") Waiting for response..." << RESET << std::endl;
       break;
     }
 
     case MSG_GAME_START: {
-      GameStart *start = (GameStart *)payload;
+      GameStartView start = GameStartView::bind(payload, header.length);
+      if (!start)
+        break;
 
       inGame = true;
-      currentGameId = start->gameId;
-      currentBoardSize = start->boardSize;
-      isPlayer1 = (start->player1Id == userId);
-      opponentId = isPlayer1 ? start->player2Id : start->player1Id;
-      opponentName = isPlayer1 ? start->player2Name : start->player1Name;
-      isMyTurn = (start->currentTurn == userId);
+      currentGameId = start.gameId();
+      currentBoardSize = start.boardSize();
+      isPlayer1 = (start.player1Id() == userId);
+      opponentId = isPlayer1 ? start.player2Id() : start.player1Id();
+      opponentName = isPlayer1 ? start.player2Name() : start.player1Name();
+      isMyTurn = (start.currentTurn() == userId);
 
       // Initialize board
       if (gameBoard)
@@ -566,19 +1166,22 @@ public:
 
     case MSG_MOVE_RESPONSE:
     case MSG_OPPONENT_MOVE: {
-      MoveResponse *resp = (MoveResponse *)payload;
+      MoveResponseView resp = MoveResponseView::bind(payload, header.length);
+      if (!resp)
+        break;
 
-      if (gameBoard) {
-        gameBoard[resp->y * currentBoardSize + resp->x] = resp->player;
+      if (gameBoard && resp.x() < currentBoardSize &&
+          resp.y() < currentBoardSize) {
+        gameBoard[resp.y() * currentBoardSize + resp.x()] = resp.player();
       }
-      isMyTurn = (resp->nextTurn == userId);
+      isMyTurn = (resp.nextTurn() == userId);
 
       clearScreen();
       printHeader();
 
-      std::cout << MAGENTA << "\n[Move #" << resp->moveNumber << "] Player "
-                << (resp->player == 1 ? "X" : "O") << " placed at ("
-                << (int)resp->x << ", " << (int)resp->y << ")" << RESET
+      std::cout << MAGENTA << "\n[Move #" << resp.moveNumber() << "] Player "
+                << (resp.player() == 1 ? "X" : "O") << " placed at ("
+                << (int)resp.x() << ", " << (int)resp.y() << ")" << RESET
                 << std::endl;
 
       displayBoard();
@@ -607,8 +1210,10 @@ public:
     }
 
     case MSG_REMATCH_RECEIVED: {
-      RematchRequest *req = (RematchRequest *)payload;
-      currentGameId = req->lastGameId;
+      RematchRequestView req = RematchRequestView::bind(payload, header.length);
+      if (!req)
+        break;
+      currentGameId = req.lastGameId();
 
       std::cout << std::endl;
       std::cout << YELLOW << BOLD << "╔═══════════════════════════════════════╗"
@@ -631,8 +1236,87 @@ public:
       break;
     }
 
+    case MSG_WATCH_RESPONSE: {
+      const size_t fixed = WatchResponseView::SIZE + BoardSnapshotView::SIZE;
+      WatchResponseView resp = WatchResponseView::bind(payload, header.length);
+      BoardSnapshotView snapshot = BoardSnapshotView::bind(
+          payload, header.length, WatchResponseView::SIZE);
+      if (!resp || !snapshot ||
+          header.length < fixed + boardCells(snapshot.boardSize()))
+        break;
+      int totalCells = snapshot.boardSize() * snapshot.boardSize();
+
+      watchedGameId = snapshot.gameId();
+      watchedBoardSize = snapshot.boardSize();
+      watchedBoard.assign(totalCells, 0);
+      unpackBoard((const uint8_t *)payload + fixed, totalCells,
+                  watchedBoard.data());
+      watchedNames[0] = snapshot.player1Name();
+      watchedNames[1] = snapshot.player2Name();
+      watchedTimes[0] = snapshot.player1Time();
+      watchedTimes[1] = snapshot.player2Time();
+      watchedTimeLimit = snapshot.timeLimit();
+
+      std::cout << GREEN << "\n✓ Now watching game #" << watchedGameId
+                << " (" << snapshot.moveCount() << " moves so far)" << RESET
+                << std::endl;
+      if (resp.delaySeconds() > 0) {
+        std::cout << YELLOW << "Broadcast delayed by " << resp.delaySeconds()
+                  << "s; " << resp.tailMoves() << " moves to catch up"
+                  << RESET << std::endl;
+      }
+      displayWatchedBoard();
+      break;
+    }
+
+    case MSG_SPECTATOR_MOVE: {
+      SpectatorMoveView spectated =
+          SpectatorMoveView::bind(payload, header.length);
+      if (!spectated)
+        break;
+      MoveResponseView move = spectated.move();
+      if (spectated.gameId() != watchedGameId ||
+          move.x() >= watchedBoardSize || move.y() >= watchedBoardSize)
+        break;
+
+      watchedBoard[move.y() * watchedBoardSize + move.x()] = move.player();
+      watchedTimes[0] = move.player1Time();
+      watchedTimes[1] = move.player2Time();
+      std::cout << MAGENTA << "\n[Game #" << spectated.gameId() << ", move #"
+                << move.moveNumber() << "] "
+                << watchedNames[move.player() == 1 ? 0 : 1] << " ("
+                << (move.player() == 1 ? "X" : "O") << ") placed at ("
+                << (int)move.x() << ", " << (int)move.y() << ")" << RESET
+                << std::endl;
+      displayWatchedBoard();
+      break;
+    }
+
+    case MSG_TIME_UPDATE: {
+      TimeUpdateView update = TimeUpdateView::bind(payload, header.length);
+      if (update && update.gameId() == watchedGameId) {
+        watchedTimes[0] = update.player1Time();
+        watchedTimes[1] = update.player2Time();
+      }
+      break;
+    }
+
     case MSG_GAME_OVER: {
-      GameOver *gameOver = (GameOver *)payload;
+      GameOverView gameOver = GameOverView::bind(payload, header.length);
+      if (!gameOver)
+        break;
+
+      if (gameOver.gameId() == watchedGameId &&
+          !(inGame && gameOver.gameId() == currentGameId)) {
+        watchedGameId = 0;
+        std::cout << YELLOW << BOLD << "\n👁  Game #" << gameOver.gameId()
+                  << " is over: "
+                  << (gameOver.reason() == 3 ? "draw"
+                                             : gameOver.winnerName() + " wins")
+                  << " after " << gameOver.totalMoves() << " moves" << RESET
+                  << std::endl;
+        break;
+      }
 
       inGame = false;
       isMyTurn = false;
@@ -642,21 +1326,21 @@ public:
       displayBoard();
 
       std::cout << std::endl;
-      if (gameOver->reason == 3) { // Draw
+      if (gameOver.reason() == 3) { // Draw
         std::cout << YELLOW << BOLD
                   << "╔═══════════════════════════════════════╗" << std::endl;
         std::cout << "║            🤝 GAME DRAW! 🤝           ║" << std::endl;
         std::cout << "╚═══════════════════════════════════════╝" << RESET
                   << std::endl;
         draws++;
-      } else if (gameOver->winnerId == userId) {
+      } else if (gameOver.winnerId() == userId) {
         std::cout << GREEN << BOLD
                   << "╔═══════════════════════════════════════╗" << std::endl;
         std::cout << "║        🏆 YOU WIN! 🏆                 ║" << std::endl;
         std::cout << "╠═══════════════════════════════════════╣" << RESET
                   << GREEN << std::endl;
-        std::cout << "║  ELO Change: +" << gameOver->eloChange << std::endl;
-        eloRating += gameOver->eloChange;
+        std::cout << "║  ELO Change: +" << gameOver.eloChange() << std::endl;
+        eloRating += gameOver.eloChange();
         wins++;
       } else {
         std::cout << RED << BOLD << "╔═══════════════════════════════════════╗"
@@ -664,23 +1348,169 @@ public:
         std::cout << "║        😢 YOU LOSE! 😢                ║" << std::endl;
         std::cout << "╠═══════════════════════════════════════╣" << RESET << RED
                   << std::endl;
-        std::cout << "║  ELO Change: -" << gameOver->eloChange << std::endl;
-        eloRating -= gameOver->eloChange;
+        std::cout << "║  ELO Change: -" << gameOver.eloChange() << std::endl;
+        eloRating -= gameOver.eloChange();
         losses++;
       }
 
       const char *reasonStr[] = {"Five in a row", "Resignation", "Timeout",
                                  "Draw agreed"};
-      std::cout << "║  Reason: " << reasonStr[gameOver->reason] << std::endl;
-      std::cout << "║  Total Moves: " << gameOver->totalMoves << std::endl;
+      std::cout << "║  Reason: "
+                << reasonStr[std::min<uint8_t>(gameOver.reason(), 3)]
+                << std::endl;
+      std::cout << "║  Total Moves: " << gameOver.totalMoves() << std::endl;
       std::cout << "╚═══════════════════════════════════════╝" << RESET
                 << std::endl;
       std::cout << std::endl << "Use option 11 to request rematch" << std::endl;
       break;
     }
 
+    case MSG_TOURNAMENT_STATUS: {
+      if (auto status = TournamentStatusView::bind(payload, header.length)) {
+        printTournamentStatus(status.value());
+      }
+      break;
+    }
+
+    case MSG_STANDINGS_RESPONSE: {
+      TournamentStatusView status =
+          TournamentStatusView::bind(payload, header.length);
+      uint16_t count;
+      if (!status || !Le::read(payload, header.length, count,
+                               TournamentStatusView::SIZE))
+        break;
+      auto entries = ListView<StandingEntryView>::bind(
+          payload, header.length, TournamentStatusView::SIZE + sizeof(count),
+          count);
+      if (!entries)
+        break;
+
+      printTournamentStatus(status.value());
+      std::cout << CYAN
+                << "╔═══════════════════════════════════════════════════════╗"
+                << std::endl;
+      std::cout << "║ Rank  │ Username          │ Points │ W/D/L            ║"
+                << std::endl;
+      std::cout << "╠═══════════════════════════════════════════════════════╣"
+                << RESET << std::endl;
+      for (uint16_t i = 0; i < count; i++) {
+        StandingEntryView entry = entries[i];
+        std::cout << CYAN << "║ " << RESET;
+        std::cout << std::setw(5) << entry.rank() << " │ ";
+        std::cout << std::setw(17) << std::left << entry.username()
+                  << std::right << " │ ";
+        std::cout << std::setw(4) << entry.points() / 2
+                  << (entry.points() % 2 ? ".5" : "  ") << " │ ";
+        std::cout << std::setw(4) << entry.wins() << "/" << std::setw(4)
+                  << entry.draws() << "/" << std::setw(4) << entry.losses()
+                  << "   ";
+        std::cout << CYAN << " ║" << RESET << std::endl;
+      }
+      std::cout << CYAN
+                << "╚═══════════════════════════════════════════════════════╝"
+                << RESET << std::endl;
+      break;
+    }
+
+    case MSG_RATING_HISTORY_RESPONSE: {
+      RatingHistoryHeaderView rh =
+          RatingHistoryHeaderView::bind(payload, header.length);
+      if (!rh)
+        break;
+      auto points = ListView<RatingPointView>::bind(
+          payload, header.length, RatingHistoryHeaderView::SIZE,
+          rh.sampleCount());
+      if (!points)
+        break;
+
+      std::cout << std::endl;
+      std::cout << CYAN
+                << "╔═══════════════════════════════════════════════════════╗"
+                << std::endl;
+      std::cout << "║  RATING HISTORY  User #" << std::setw(6) << std::left
+                << rh.userId() << std::right << "  Current ELO: "
+                << std::setw(5) << rh.currentRating() << "       ║"
+                << std::endl;
+      std::cout << "╚═══════════════════════════════════════════════════════╝"
+                << RESET << std::endl;
+
+      if (rh.count() == 0) {
+        std::cout << "No rated games in this period." << std::endl;
+        break;
+      }
+      int change = (int)rh.currentRating() - rh.startRating();
+      std::cout << "Points: " << rh.count() << "  Start: "
+                << rh.startRating() << "  Change: "
+                << (change >= 0 ? GREEN : RED) << (change >= 0 ? "+" : "")
+                << change << RESET << std::endl;
+      std::cout << "Min: " << rh.minRating() << "  Max: " << rh.maxRating()
+                << "  P10/P50/P90: " << rh.p10Rating() << "/" << rh.p50Rating()
+                << "/" << rh.p90Rating() << std::endl;
+
+      for (size_t i = 0; i < points.size(); i++) {
+        time_t t = points[i].time();
+        struct tm *tm_info = localtime(&t);
+        char dateStr[17];
+        strftime(dateStr, sizeof(dateStr), "%Y-%m-%d %H:%M", tm_info);
+        std::cout << "  " << dateStr << "  " << std::setw(5)
+                  << points[i].rating() << std::endl;
+      }
+      break;
+    }
+
+    case MSG_LEADERBOARD_RESPONSE: {
+      LeaderboardHeaderView lb =
+          LeaderboardHeaderView::bind(payload, header.length);
+      if (!lb)
+        break;
+      auto entries = ListView<LeaderboardEntryView>::bind(
+          payload, header.length, LeaderboardHeaderView::SIZE, lb.count());
+      if (!entries)
+        break;
+
+      std::cout << std::endl;
+      std::cout << CYAN
+                << "╔═══════════════════════════════════════════════════════╗"
+                << std::endl;
+      std::cout << "║  LEADERBOARD  Your rank: " << std::setw(6)
+                << lb.myRank()
+                << " of " << std::setw(6) << lb.totalPlayers()
+                << "            ║" << std::endl;
+      std::cout << "╠═══════════════════════════════════════════════════════╣"
+                << std::endl;
+      std::cout << "║ Rank  │ Username          │  ELO  │ W/L/D            ║"
+                << std::endl;
+      std::cout << "╠═══════════════════════════════════════════════════════╣"
+                << RESET << std::endl;
+
+      for (size_t i = 0; i < entries.size(); i++) {
+        LeaderboardEntryView entry = entries[i];
+        bool me = entry.userId() == userId;
+        std::cout << CYAN << "║ " << RESET << (me ? YELLOW : "");
+        std::cout << std::setw(5) << entry.rank() << " │ ";
+        std::cout << std::setw(17) << std::left << entry.username()
+                  << std::right << " │ ";
+        std::cout << std::setw(5) << entry.eloRating() << " │ ";
+        std::cout << std::setw(4) << entry.wins() << "/" << std::setw(4)
+                  << entry.losses() << "/" << std::setw(4) << entry.draws()
+                  << "   " << RESET;
+        std::cout << CYAN << " ║" << RESET << std::endl;
+      }
+
+      std::cout << CYAN
+                << "╚═══════════════════════════════════════════════════════╝"
+                << RESET << std::endl;
+      break;
+    }
+
     case MSG_GAME_HISTORY_RESPONSE: {
-      uint32_t count = *(uint32_t *)payload;
+      uint32_t count;
+      if (!Le::read(payload, header.length, count))
+        break;
+      count = std::min<size_t>(count, (header.length - sizeof(count)) /
+                                          GameHistoryEntryView::SIZE);
+      auto entries = ListView<GameHistoryEntryView>::bind(
+          payload, header.length, sizeof(count), count);
 
       std::cout << std::endl;
       std::cout << CYAN
@@ -696,31 +1526,31 @@ public:
                 << RESET << std::endl;
 
       for (uint32_t i = 0; i < count; i++) {
-        GameHistoryEntry entry;
-        recv(clientSocket, &entry, sizeof(entry), 0);
+        GameHistoryEntryView entry = entries[i];
 
         std::cout << CYAN << "║ " << RESET;
-        std::cout << std::setw(5) << entry.gameId << " │ ";
-        std::cout << std::setw(17) << std::left << entry.opponentName
+        std::cout << std::setw(5) << entry.gameId() << " │ ";
+        std::cout << std::setw(17) << std::left << entry.opponentName()
                   << std::right << " │ ";
 
-        if (entry.result == 0) {
+        if (entry.result() == 0) {
           std::cout << GREEN << " WIN  " << RESET;
-        } else if (entry.result == 1) {
+        } else if (entry.result() == 1) {
           std::cout << RED << " LOSS " << RESET;
         } else {
           std::cout << YELLOW << " DRAW " << RESET;
         }
 
         std::cout << " │ ";
-        if (entry.eloChange >= 0) {
-          std::cout << GREEN << "+" << std::setw(4) << entry.eloChange << RESET;
+        if (entry.eloChange() >= 0) {
+          std::cout << GREEN << "+" << std::setw(4) << entry.eloChange()
+                    << RESET;
         } else {
-          std::cout << RED << std::setw(5) << entry.eloChange << RESET;
+          std::cout << RED << std::setw(5) << entry.eloChange() << RESET;
         }
 
         // Format timestamp
-        time_t t = entry.timestamp;
+        time_t t = entry.timestamp();
         struct tm *tm_info = localtime(&t);
         char dateStr[11];
         strftime(dateStr, 11, "%Y-%m-%d", tm_info);
@@ -735,22 +1565,25 @@ public:
     }
 
     case MSG_GAME_LOG_RESPONSE: {
-      GameLogHeader *logHeader = (GameLogHeader *)payload;
+      GameLogHeaderView logHeader =
+          GameLogHeaderView::bind(payload, header.length);
+      if (!logHeader)
+        break;
 
       std::cout << std::endl;
       std::cout << CYAN
                 << "╔═══════════════════════════════════════════════════════╗"
                 << std::endl;
-      std::cout << "║              GAME LOG #" << logHeader->gameId
+      std::cout << "║              GAME LOG #" << logHeader.gameId()
                 << std::endl;
       std::cout << "╠═══════════════════════════════════════════════════════╣"
                 << std::endl;
-      std::cout << "║  " << logHeader->player1Name << " (X) vs "
-                << logHeader->player2Name << " (O)" << std::endl;
-      std::cout << "║  Board: " << (int)logHeader->boardSize << "x"
-                << (int)logHeader->boardSize
-                << " │ Moves: " << logHeader->totalMoves
-                << " │ Duration: " << logHeader->gameDuration << "s"
+      std::cout << "║  " << logHeader.player1Name() << " (X) vs "
+                << logHeader.player2Name() << " (O)" << std::endl;
+      std::cout << "║  Board: " << (int)logHeader.boardSize() << "x"
+                << (int)logHeader.boardSize()
+                << " │ Moves: " << logHeader.totalMoves()
+                << " │ Duration: " << logHeader.gameDuration() << "s"
                 << std::endl;
       std::cout << "╠═══════════════════════════════════════════════════════╣"
                 << std::endl;
@@ -758,18 +1591,24 @@ public:
       std::cout << "╠═══════════════════════════════════════════════════════╣"
                 << RESET << std::endl;
 
-      for (uint32_t i = 0; i < logHeader->totalMoves; i++) {
-        MoveLogEntry entry;
-        recv(clientSocket, &entry, sizeof(entry), 0);
-
-        std::cout << CYAN << "║ " << RESET;
-        std::cout << std::setw(4) << entry.moveNumber << " │ ";
-        std::cout << std::setw(6) << entry.playerId << " │ ";
-        std::cout << "(" << std::setw(2) << (int)entry.x << "," << std::setw(2)
-                  << (int)entry.y << ")    │ ";
-        std::cout << std::setw(8) << entry.timestamp;
-        std::cout << CYAN << " ║" << RESET << std::endl;
-      }
+      // Packed moves follow the header; player and number are implied
+      const uint8_t *packed =
+          (const uint8_t *)payload + GameLogHeaderView::SIZE;
+      size_t packedLen = header.length - GameLogHeaderView::SIZE;
+      uint32_t player1Id = logHeader.player1Id();
+      uint32_t player2Id = logHeader.player2Id();
+      MoveCodec::decode(
+          logHeader.boardSize(), packed, packedLen,
+          [&](uint32_t i, uint8_t x, uint8_t y, uint32_t timestamp) {
+            std::cout << CYAN << "║ " << RESET;
+            std::cout << std::setw(4) << i + 1 << " │ ";
+            std::cout << std::setw(6) << (i % 2 == 0 ? player1Id : player2Id)
+                      << " │ ";
+            std::cout << "(" << std::setw(2) << (int)x << "," << std::setw(2)
+                      << (int)y << ")    │ ";
+            std::cout << std::setw(8) << timestamp;
+            std::cout << CYAN << " ║" << RESET << std::endl;
+          });
 
       std::cout << CYAN
                 << "╚═══════════════════════════════════════════════════════╝"
@@ -777,9 +1616,71 @@ public:
       break;
     }
 
+    case MSG_REPLAY_DATA: {
+      ReplayDataView data = ReplayDataView::bind(payload, header.length);
+      if (!data)
+        break;
+      size_t offset = ReplayDataView::SIZE;
+
+      // A seek's reply carries the game and starts the replay over
+      if (data.flags() & REPLAY_SEEKED) {
+        GameLogHeaderView logHeader =
+            GameLogHeaderView::bind(payload, header.length, offset);
+        if (!logHeader)
+          break;
+        offset += GameLogHeaderView::SIZE;
+        replayGameId = logHeader.gameId();
+        replayBoardSize = logHeader.boardSize();
+        replayTotalMoves = logHeader.totalMoves();
+        replayNames[0] = logHeader.player1Name();
+        replayNames[1] = logHeader.player2Name();
+      }
+      if (data.gameId() != replayGameId ||
+          header.length < offset + boardCells(replayBoardSize))
+        break;
+
+      // Every chunk starts from its keyframe
+      int totalCells = replayBoardSize * replayBoardSize;
+      replayBoard.assign(totalCells, 0);
+      unpackBoard((const uint8_t *)payload + offset, totalCells,
+                  replayBoard.data());
+      offset += boardCells(replayBoardSize);
+      if (data.flags() & REPLAY_SEEKED) {
+        displayReplayBoard(data.firstMove());
+      }
+
+      MoveCodec::decode(
+          replayBoardSize, (const uint8_t *)payload + offset,
+          header.length - offset,
+          [&](uint32_t i, uint8_t x, uint8_t y, uint32_t timestamp) {
+            uint32_t number = data.firstMove() + i + 1;
+            int player = (number % 2 == 1) ? 0 : 1;
+            if (x < replayBoardSize && y < replayBoardSize)
+              replayBoard[y * replayBoardSize + x] = player + 1;
+            std::cout << MAGENTA << "[Replay #" << replayGameId << ", move #"
+                      << number << " at " << timestamp << "s] "
+                      << replayNames[player] << " ("
+                      << (player == 0 ? "X" : "O") << ") placed at ("
+                      << (int)x << ", " << (int)y << ")" << RESET
+                      << std::endl;
+          });
+
+      if (data.flags() & REPLAY_LAST) {
+        if (data.moveCount() > 0)
+          displayReplayBoard(data.firstMove() + data.moveCount());
+        std::cout << GREEN << "✓ End of replay" << RESET << std::endl;
+      } else {
+        grantReplayCredit(replayGameId, 1);
+      }
+      break;
+    }
+
     case MSG_ERROR: {
       std::cout << std::endl;
-      std::cout << RED << "[Error] " << payload << RESET << std::endl;
+      std::cout << RED << "[Error] " << payload;
+      if (tag != 0)
+        std::cout << " (request #" << tag << ")";
+      std::cout << RESET << std::endl;
       break;
     }
 
@@ -844,6 +1745,12 @@ public:
       std::cout << CYAN << "║" << RESET
                 << "  6. Decline Challenge                " << CYAN << "║"
                 << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << "  7. Quick Match (queue)              " << CYAN << "║"
+                << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << "  8. Leave Queue                      " << CYAN << "║"
+                << RESET << std::endl;
       std::cout << CYAN << "╠═══════════════════════════════════════╣" << RESET
                 << std::endl;
       std::cout << CYAN << "║" << RESET
@@ -861,6 +1768,24 @@ public:
       std::cout << CYAN << "║" << RESET
                 << " 14. View Game Log                    " << CYAN << "║"
                 << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << " 15. View Leaderboard                 " << CYAN << "║"
+                << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << " 16. Tournaments                      " << CYAN << "║"
+                << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << " 17. Rating History                   " << CYAN << "║"
+                << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << " 18. Watch a Game                     " << CYAN << "║"
+                << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << " 19. Stop Watching                    " << CYAN << "║"
+                << RESET << std::endl;
+      std::cout << CYAN << "║" << RESET
+                << " 20. Replay a Game                    " << CYAN << "║"
+                << RESET << std::endl;
       std::cout << CYAN << "╠═══════════════════════════════════════╣" << RESET
                 << std::endl;
       std::cout << CYAN << "║" << RESET
@@ -934,6 +1859,12 @@ public:
           tempId = getIntInput();
           declineChallenge(tempId);
           break;
+        case 7:
+          joinQueue();
+          break;
+        case 8:
+          leaveQueue();
+          break;
         case 10:
           getGameHistory();
           break;
@@ -953,7 +1884,27 @@ public:
         case 14:
           getGameLog();
           break;
+        case 15:
+          getLeaderboard();
+          break;
+        case 16:
+          tournamentMenu();
+          break;
+        case 17:
+          getRatingHistory();
+          break;
+        case 18:
+          watchGame();
+          break;
+        case 19:
+          stopWatching();
+          break;
+        case 20:
+          replayGame();
+          break;
         case 0:
+          if (userId > 0)
+            sendMessage(MSG_LOGOUT, nullptr, 0);
           connected = false;
           std::cout << YELLOW << "Goodbye!" << RESET << std::endl;
           break;
@@ -976,21 +1927,41 @@ public:
 int main(int argc, char *argv[]) {
   const char *host = "127.0.0.1";
   int port = 8888;
-
-  if (argc > 1) {
-    host = argv[1];
-  }
-  if (argc > 2) {
-    port = std::atoi(argv[2]);
+  uint8_t wireVersion = WIRE_VERSION_MAX; // --wire=VERSION
+  bool compression = true;                // --no-compress
+  const char *unixPath = "";              // --unix=PATH
+  bool sharedMemory = false;              // --shm, with --unix
+
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--wire=", 7) == 0) {
+      wireVersion = std::atoi(argv[i] + 7);
+    } else if (strcmp(argv[i], "--no-compress") == 0) {
+      compression = false;
+    } else if (strncmp(argv[i], "--unix=", 7) == 0) {
+      unixPath = argv[i] + 7;
+    } else if (strcmp(argv[i], "--shm") == 0) {
+      sharedMemory = true;
+    } else if (positional++ == 0) {
+      host = argv[i];
+    } else {
+      port = std::atoi(argv[i]);
+    }
   }
 
   GomokuClient client;
+  client.setWireVersion(wireVersion);
+  client.setCompression(compression);
+  client.setUnixSocket(unixPath);
+  client.setSharedMemory(sharedMemory);
 
   client.clearScreen();
   client.printHeader();
 
-  std::cout << CYAN << "Connecting to " << host << ":" << port << "..." << RESET
-            << std::endl;
+  std::cout << CYAN << "Connecting to "
+            << (*unixPath ? std::string(unixPath)
+                          : std::string(host) + ":" + std::to_string(port))
+            << "..." << RESET << std::endl;
 
   if (client.connectToServer(host, port)) {
     client.run();
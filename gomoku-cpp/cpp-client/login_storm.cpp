@@ -0,0 +1,320 @@
+// Login storm against a running server.
+//
+// Opens N connections at once, each registering and logging in a fresh
+// account, while a game in progress measures how long the server takes to
+// answer a move. Password hashing runs on the server's auth workers, so
+// the move round trip should stay near its idle baseline however many
+// logins are queued behind it.
+//
+// The probe is a move on an occupied cell, which the server rejects with
+// MSG_ERROR without changing the game. Reported are the probe round trip
+// before and during the storm, the rate of password hashes (two per
+// connection) and the register+login latency per connection.
+//
+//   login_storm [--host HOST] [--port PORT] [--clients N] [--probes N]
+
+#include "../cpp-server/protocol.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 8888;
+  size_t clients = 64;
+  size_t probes = 200; // Baseline probes before the storm
+};
+
+// One v1 connection
+class Connection {
+public:
+  Connection() : sock(-1), userId(0), sessionId(0) {}
+  ~Connection() {
+    if (sock >= 0)
+      close(sock);
+  }
+
+  bool open(const Options &opt) {
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+      return false;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+      return false;
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return true;
+  }
+
+  bool login(const std::string &username, const std::string &password) {
+    RegisterRequest reg;
+    memset(&reg, 0, sizeof(reg));
+    username.copy(reg.username, sizeof(reg.username) - 1);
+    password.copy(reg.password, sizeof(reg.password) - 1);
+    strcpy(reg.email, "storm@localhost");
+    std::vector<char> payload;
+    if (!send(MSG_REGISTER, &reg, sizeof(reg)) ||
+        !await(MSG_REGISTER_RESPONSE, payload))
+      return false;
+
+    LoginRequest req;
+    memset(&req, 0, sizeof(req));
+    username.copy(req.username, sizeof(req.username) - 1);
+    password.copy(req.password, sizeof(req.password) - 1);
+    LoginResponse response;
+    if (!send(MSG_LOGIN, &req, sizeof(req)) ||
+        !await(MSG_LOGIN_RESPONSE, payload) ||
+        payload.size() < sizeof(response))
+      return false;
+    memcpy(&response, payload.data(), sizeof(response));
+    if (!response.success)
+      return false;
+    userId = response.userId;
+    sessionId = response.sessionId;
+    return true;
+  }
+
+  bool send(uint16_t type, const void *payload = nullptr,
+            uint32_t length = 0) {
+    MessageHeader header;
+    header.type = type;
+    header.length = length;
+    header.userId = userId;
+    header.sessionId = sessionId;
+    std::vector<char> frame((const char *)&header,
+                            (const char *)&header + sizeof(header));
+    frame.insert(frame.end(), (const char *)payload,
+                 (const char *)payload + length);
+    size_t sent = 0;
+    while (sent < frame.size()) {
+      ssize_t n = ::send(sock, frame.data() + sent, frame.size() - sent, 0);
+      if (n <= 0)
+        return false;
+      sent += n;
+    }
+    return true;
+  }
+
+  // Skips frames of other types; v1 history entries never reach here
+  bool await(uint16_t type, std::vector<char> &payload) {
+    MessageHeader header;
+    do {
+      if (!recvAll(&header, sizeof(header)))
+        return false;
+      payload.resize(header.length);
+      if (header.length > 0 && !recvAll(payload.data(), header.length))
+        return false;
+    } while (header.type != type);
+    return true;
+  }
+
+  uint32_t id() const { return userId; }
+
+private:
+  int sock;
+  uint32_t userId;
+  uint32_t sessionId;
+
+  bool recvAll(void *buffer, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+      ssize_t n = recv(sock, (char *)buffer + total, length - total, 0);
+      if (n <= 0)
+        return false;
+      total += n;
+    }
+    return true;
+  }
+};
+
+// A game between two fresh accounts, with one move on the board
+struct Probe {
+  Connection first;
+  Connection second;
+  MoveRequest occupied;
+
+  bool setUp(const Options &opt, const std::string &prefix) {
+    std::vector<char> payload;
+    if (!first.open(opt) || !second.open(opt) ||
+        !first.login(prefix + "a", "storm") ||
+        !second.login(prefix + "b", "storm"))
+      return false;
+
+    ChallengeRequest challenge;
+    challenge.targetUserId = second.id();
+    challenge.boardSize = 15;
+    challenge.timeLimit = 0;
+    uint32_t challengeId;
+    if (!first.send(MSG_SEND_CHALLENGE, &challenge, sizeof(challenge)) ||
+        !second.await(MSG_CHALLENGE_RECEIVED, payload) ||
+        payload.size() < sizeof(challengeId))
+      return false;
+    memcpy(&challengeId, payload.data(), sizeof(challengeId));
+    GameStart start;
+    if (!second.send(MSG_ACCEPT_CHALLENGE, &challengeId,
+                     sizeof(challengeId)) ||
+        !first.await(MSG_GAME_START, payload) ||
+        payload.size() < sizeof(start))
+      return false;
+    memcpy(&start, payload.data(), sizeof(start));
+
+    occupied.gameId = start.gameId;
+    occupied.x = 7;
+    occupied.y = 7;
+    return first.send(MSG_MAKE_MOVE, &occupied, sizeof(occupied)) &&
+           first.await(MSG_MOVE_RESPONSE, payload);
+  }
+
+  // Round trip of one rejected move, in milliseconds
+  bool once(double &ms) {
+    std::vector<char> payload;
+    Clock::time_point sent = Clock::now();
+    if (!second.send(MSG_MAKE_MOVE, &occupied, sizeof(occupied)) ||
+        !second.await(MSG_ERROR, payload))
+      return false;
+    ms = std::chrono::duration<double, std::milli>(Clock::now() - sent)
+             .count();
+    return true;
+  }
+
+  void tearDown() {
+    second.send(MSG_RESIGN, &occupied.gameId, sizeof(occupied.gameId));
+    first.send(MSG_LOGOUT);
+    second.send(MSG_LOGOUT);
+  }
+};
+
+static double percentile(std::vector<double> values, double p) {
+  if (values.empty())
+    return 0.0;
+  std::sort(values.begin(), values.end());
+  return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+}
+
+static bool parseOptions(int argc, char *argv[], Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    if (arg == "--host") {
+      opt.host = argv[++i];
+    } else if (arg == "--port") {
+      opt.port = std::atoi(argv[++i]);
+    } else if (arg == "--clients") {
+      opt.clients = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--probes") {
+      opt.probes = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return opt.clients > 0 && opt.probes > 0;
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--host HOST] [--port PORT] [--clients N] [--probes N]"
+              << std::endl;
+    return 1;
+  }
+
+  std::string prefix = "storm" + std::to_string(getpid()) + "_";
+  Probe probe;
+  if (!probe.setUp(opt, prefix)) {
+    std::cerr << "Cannot start a probe game on " << opt.host << ":"
+              << opt.port << std::endl;
+    return 1;
+  }
+
+  std::vector<double> baseline;
+  for (size_t i = 0; i < opt.probes; i++) {
+    double ms;
+    if (!probe.once(ms)) {
+      std::cerr << "Probe connection lost" << std::endl;
+      return 1;
+    }
+    baseline.push_back(ms);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+
+  std::mutex latencyMutex;
+  std::vector<double> loginMs;
+  std::atomic<size_t> finished(0);
+  std::atomic<size_t> failed(0);
+  std::vector<std::thread> storm;
+  Clock::time_point started = Clock::now();
+  for (size_t i = 0; i < opt.clients; i++) {
+    storm.emplace_back([&, i]() {
+      Connection conn;
+      Clock::time_point begin = Clock::now();
+      if (conn.open(opt) && conn.login(prefix + std::to_string(i), "storm")) {
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() -
+                                                              begin)
+                        .count();
+        std::lock_guard<std::mutex> lock(latencyMutex);
+        loginMs.push_back(ms);
+        conn.send(MSG_LOGOUT);
+      } else {
+        failed++;
+      }
+      finished++;
+    });
+  }
+
+  std::vector<double> during;
+  while (finished < opt.clients) {
+    double ms;
+    if (!probe.once(ms)) {
+      std::cerr << "Probe connection lost" << std::endl;
+      return 1;
+    }
+    during.push_back(ms);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  double seconds =
+      std::chrono::duration<double>(Clock::now() - started).count();
+  for (auto &t : storm) {
+    t.join();
+  }
+  probe.tearDown();
+
+  std::cout << std::fixed << std::setprecision(2)
+            << "move round trip idle:   p50 " << percentile(baseline, 0.5)
+            << " ms, p99 " << percentile(baseline, 0.99) << " ms ("
+            << baseline.size() << " probes)" << std::endl
+            << "move round trip storm:  p50 " << percentile(during, 0.5)
+            << " ms, p99 " << percentile(during, 0.99) << " ms, max "
+            << percentile(during, 1.0) << " ms (" << during.size()
+            << " probes)" << std::endl
+            << std::setprecision(1) << loginMs.size()
+            << " register+login pairs in " << seconds << " s ("
+            << 2 * loginMs.size() / seconds << " hashes/s), latency p50 "
+            << std::setprecision(0) << percentile(loginMs, 0.5)
+            << " ms, p99 " << percentile(loginMs, 0.99) << " ms";
+  if (failed > 0)
+    std::cout << ", " << failed << " failed";
+  std::cout << std::endl;
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,364 @@
+// Pipelined request throughput against a running server.
+//
+// Logs in a throwaway account and sends a fixed mix of lookups (game
+// history, player list, a leaderboard page and a game log), first one at a
+// time as the interactive client does, then with a window of requests in
+// flight. On v1 the answers can only be matched to requests by arrival
+// order. On v3 they are matched by tag, and the server is free to complete
+// them out of order on its query workers.
+//
+// With --compress every connection asks for compressed payloads, so runs
+// with and without it compare bytes on the wire against request rate. An
+// existing account (--user, --password) brings its game history along.
+//
+//   pipeline_bench [--host HOST] [--port PORT] [--requests N] [--window W]
+//                  [--compress] [--user NAME --password PASSWORD]
+
+#include "../cpp-server/protocol.h"
+#include "../cpp-server/wire.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 8888;
+  size_t requests = 20000;
+  size_t window = 32;
+  bool compress = false;
+  std::string user;
+  std::string password = "bench";
+};
+
+// One logged-in connection in a fixed wire version
+class Connection {
+public:
+  Connection()
+      : sock(-1), version(WIRE_V1), userId(0), sessionId(0), bytesIn(0) {}
+  ~Connection() {
+    if (sock >= 0)
+      close(sock);
+  }
+
+  bool open(const Options &opt, uint8_t wanted) {
+    sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock < 0)
+      return false;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(opt.port);
+    inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+      return false;
+
+    uint8_t features = opt.compress ? WIRE_COMPRESS : 0;
+    if (wanted == WIRE_V1 && features == 0)
+      return true;
+    Hello hello;
+    hello.version = wanted;
+    hello.features = features;
+    if (!send(MSG_HELLO, &hello, sizeof(hello), 0))
+      return false;
+    MessageHeader header;
+    std::vector<char> payload;
+    uint32_t tag;
+    if (!read(header, payload, tag) || header.type != MSG_HELLO_RESPONSE ||
+        payload.size() < sizeof(Hello) || (uint8_t)payload[0] != wanted ||
+        (uint8_t)payload[1] != features)
+      return false;
+    version = wanted;
+    return true;
+  }
+
+  // Registration fails harmlessly if the account already exists
+  bool login(const std::string &username, const std::string &password) {
+    RegisterRequest reg;
+    memset(&reg, 0, sizeof(reg));
+    username.copy(reg.username, sizeof(reg.username) - 1);
+    password.copy(reg.password, sizeof(reg.password) - 1);
+    strcpy(reg.email, "bench@localhost");
+    LoginResponse response;
+    if (!send(MSG_REGISTER, &reg, sizeof(reg), 0) ||
+        !await(MSG_REGISTER_RESPONSE, response))
+      return false;
+
+    LoginRequest req;
+    memset(&req, 0, sizeof(req));
+    username.copy(req.username, sizeof(req.username) - 1);
+    password.copy(req.password, sizeof(req.password) - 1);
+    if (!send(MSG_LOGIN, &req, sizeof(req), 0) ||
+        !await(MSG_LOGIN_RESPONSE, response) || !response.success)
+      return false;
+    userId = response.userId;
+    sessionId = response.sessionId;
+    return true;
+  }
+
+  void logout() { send(MSG_LOGOUT, nullptr, 0, 0); }
+
+  bool send(uint16_t type, const void *payload, uint32_t length,
+            uint32_t tag) {
+    std::vector<char> frame = WireCodec::frame(version, type, userId,
+                                               sessionId, payload, length, tag);
+    size_t sent = 0;
+    while (sent < frame.size()) {
+      ssize_t n = ::send(sock, frame.data() + sent, frame.size() - sent, 0);
+      if (n <= 0)
+        return false;
+      sent += n;
+    }
+    return true;
+  }
+
+  // v1 history entries follow an uncompressed frame; they are read into
+  // the payload
+  bool read(MessageHeader &header, std::vector<char> &payload,
+            uint32_t &tag) {
+    auto fill = [this](void *buffer, size_t length) {
+      return recvAll(buffer, length);
+    };
+    size_t wireBytes;
+    if (!WireCodec::readFrame(version, fill, header, payload, wireBytes, tag))
+      return false;
+    bytesIn += wireBytes;
+    if (version == WIRE_V1 && header.type == MSG_GAME_HISTORY_RESPONSE &&
+        payload.size() == sizeof(uint32_t)) {
+      uint32_t count;
+      memcpy(&count, payload.data(), sizeof(count));
+      size_t entries = (size_t)count * sizeof(GameHistoryEntry);
+      payload.resize(sizeof(count) + entries);
+      if (entries > 0 && !fill(payload.data() + sizeof(count), entries))
+        return false;
+      bytesIn += entries;
+    }
+    return true;
+  }
+
+  uint8_t wireVersion() const { return version; }
+  uint64_t received() const { return bytesIn; }
+
+private:
+  int sock;
+  uint8_t version;
+  uint32_t userId;
+  uint32_t sessionId;
+  uint64_t bytesIn;
+
+  bool recvAll(void *buffer, size_t length) {
+    size_t total = 0;
+    while (total < length) {
+      ssize_t n = recv(sock, (char *)buffer + total, length - total, 0);
+      if (n <= 0)
+        return false;
+      total += n;
+    }
+    return true;
+  }
+
+  bool await(uint16_t type, LoginResponse &response) {
+    MessageHeader header;
+    std::vector<char> payload;
+    uint32_t tag;
+    while (read(header, payload, tag)) {
+      if (header.type != type)
+        continue;
+      memset(&response, 0, sizeof(response));
+      memcpy(&response, payload.data(),
+             std::min(payload.size(), sizeof(response)));
+      return true;
+    }
+    return false;
+  }
+};
+
+// Request i of the mix. Game logs of ids 1-8 are asked for; one that does
+// not exist is answered with MSG_ERROR, which still completes the request.
+static bool sendRequest(Connection &conn, size_t i, uint32_t tag) {
+  switch (i % 4) {
+  case 0:
+    return conn.send(MSG_GET_GAME_HISTORY, nullptr, 0, tag);
+  case 1:
+    return conn.send(MSG_GET_ONLINE_PLAYERS, nullptr, 0, tag);
+  case 2: {
+    LeaderboardRequest req;
+    req.mode = LEADERBOARD_TOP;
+    req.offset = 0;
+    req.limit = LEADERBOARD_PAGE_MAX;
+    return conn.send(MSG_GET_LEADERBOARD, &req, sizeof(req), tag);
+  }
+  default: {
+    uint32_t gameId = (i / 4) % 8 + 1;
+    return conn.send(MSG_GET_GAME_LOG, &gameId, sizeof(gameId), tag);
+  }
+  }
+}
+
+static bool isAnswer(uint16_t type) {
+  return type == MSG_GAME_HISTORY_RESPONSE || type == MSG_ONLINE_PLAYERS_LIST ||
+         type == MSG_LEADERBOARD_RESPONSE || type == MSG_GAME_LOG_RESPONSE ||
+         type == MSG_ERROR;
+}
+
+struct Result {
+  double seconds;
+  uint64_t bytesIn;
+  std::vector<double> latencyUs; // Sorted
+};
+
+// Keep up to `window` requests in flight until `requests` are answered.
+// v1 answers are taken in order; tagged ones are looked up by tag, and
+// frames with tag 0 answer nothing.
+static bool run(Connection &conn, size_t requests, size_t window,
+                Result &result) {
+  bool tagged = conn.wireVersion() >= WIRE_V3;
+  std::deque<Clock::time_point> inOrder;
+  std::unordered_map<uint32_t, Clock::time_point> byTag;
+  result.latencyUs.clear();
+  result.latencyUs.reserve(requests);
+
+  size_t sent = 0;
+  uint64_t received = conn.received();
+  Clock::time_point start = Clock::now();
+  while (result.latencyUs.size() < requests) {
+    while (sent < requests && sent - result.latencyUs.size() < window) {
+      uint32_t tag = sent + 1;
+      if (!sendRequest(conn, sent, tag))
+        return false;
+      if (tagged) {
+        byTag[tag] = Clock::now();
+      } else {
+        inOrder.push_back(Clock::now());
+      }
+      sent++;
+    }
+
+    MessageHeader header;
+    std::vector<char> payload;
+    uint32_t tag;
+    if (!conn.read(header, payload, tag))
+      return false;
+    Clock::time_point sentAt;
+    if (tagged) {
+      auto it = byTag.find(tag);
+      if (it == byTag.end())
+        continue;
+      sentAt = it->second;
+      byTag.erase(it);
+    } else {
+      if (!isAnswer(header.type) || inOrder.empty())
+        continue;
+      sentAt = inOrder.front();
+      inOrder.pop_front();
+    }
+    result.latencyUs.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - sentAt)
+            .count());
+  }
+  result.seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  result.bytesIn = conn.received() - received;
+  std::sort(result.latencyUs.begin(), result.latencyUs.end());
+  return true;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+  return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+static bool parseOptions(int argc, char *argv[], Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--compress") {
+      opt.compress = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return false;
+    if (arg == "--host") {
+      opt.host = argv[++i];
+    } else if (arg == "--port") {
+      opt.port = std::atoi(argv[++i]);
+    } else if (arg == "--user") {
+      opt.user = argv[++i];
+    } else if (arg == "--password") {
+      opt.password = argv[++i];
+    } else if (arg == "--requests") {
+      opt.requests = std::strtoul(argv[++i], nullptr, 10);
+    } else if (arg == "--window") {
+      opt.window = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return opt.requests > 0 && opt.window > 0;
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--host HOST] [--port PORT] [--requests N] [--window W]"
+                 " [--compress] [--user NAME --password PASSWORD]"
+              << std::endl;
+    return 1;
+  }
+
+  std::string username =
+      opt.user.empty() ? "bench" + std::to_string(getpid()) : opt.user;
+  struct Mode {
+    const char *name;
+    uint8_t version;
+    size_t window;
+  };
+  const Mode modes[] = {
+      {"v1 one at a time", WIRE_V1, 1},
+      {"v1 pipelined", WIRE_V1, opt.window},
+      {"v3 one at a time", WIRE_V3, 1},
+      {"v3 pipelined", WIRE_V3, opt.window},
+  };
+
+  std::cout << opt.requests << " requests per run, window " << opt.window
+            << (opt.compress ? ", compressed" : "") << std::endl;
+  for (const Mode &mode : modes) {
+    Connection conn;
+    if (!conn.open(opt, mode.version) ||
+        !conn.login(username, opt.password)) {
+      std::cerr << "Cannot log in to " << opt.host << ":" << opt.port
+                << " with wire v" << (int)mode.version << std::endl;
+      return 1;
+    }
+    Result result;
+    if (!run(conn, opt.requests, mode.window, result)) {
+      std::cerr << "Connection lost during " << mode.name << std::endl;
+      return 1;
+    }
+    conn.logout();
+
+    std::cout << std::left << std::setw(18) << mode.name << std::right
+              << std::fixed << std::setprecision(0) << std::setw(9)
+              << opt.requests / result.seconds << " req/s, latency p50 "
+              << std::setprecision(1) << percentile(result.latencyUs, 0.5)
+              << " us, p99 " << percentile(result.latencyUs, 0.99) << " us, "
+              << std::setprecision(0)
+              << (double)result.bytesIn / opt.requests << " B/request"
+              << std::endl;
+  }
+  return 0;
+}
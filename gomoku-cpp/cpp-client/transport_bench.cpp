@@ -0,0 +1,311 @@
+// Round-trip latency to a server on the same host, per transport.
+//
+// Logs in a throwaway account over loopback TCP, over the server's Unix
+// domain socket, and over the Unix socket with the frames moved to shared
+// memory, and times the same small request on each: leaving the match
+// queue, which the server answers with an empty MSG_QUEUE_STATUS on the
+// connection's own thread. Requests go one at a time on wire v2, so each
+// sample is a full round trip with nothing queued behind it. The server
+// must have been started with --unix=PATH for the local transports.
+//
+//   transport_bench [--host HOST] [--port PORT] [--unix PATH]
+//                   [--round-trips N]
+
+#include "../cpp-server/protocol.h"
+#include "../cpp-server/shm_ring.h"
+#include "../cpp-server/wire.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Options {
+  std::string host = "127.0.0.1";
+  int port = 8888;
+  std::string unixPath;
+  size_t roundTrips = 50000;
+};
+
+enum Transport { TRANSPORT_TCP, TRANSPORT_UNIX, TRANSPORT_SHM };
+
+// One logged-in v2 connection over a given transport
+class Connection {
+public:
+  Connection() : sock(-1), userId(0), sessionId(0) {}
+  ~Connection() {
+    ring.reset();
+    if (sock >= 0)
+      close(sock);
+  }
+
+  bool open(const Options &opt, Transport transport) {
+    if (transport == TRANSPORT_TCP) {
+      sock = socket(AF_INET, SOCK_STREAM, 0);
+      if (sock < 0)
+        return false;
+      struct sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family = AF_INET;
+      addr.sin_port = htons(opt.port);
+      inet_pton(AF_INET, opt.host.c_str(), &addr.sin_addr);
+      if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return false;
+      int one = 1;
+      setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    } else {
+      sock = socket(AF_UNIX, SOCK_STREAM, 0);
+      if (sock < 0)
+        return false;
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      opt.unixPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+      if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        return false;
+    }
+
+    uint8_t features = transport == TRANSPORT_SHM ? WIRE_SHM : 0;
+    Hello hello;
+    hello.version = WIRE_V2;
+    hello.features = features;
+    std::vector<char> frame =
+        WireCodec::frame(WIRE_V1, MSG_HELLO, 0, 0, &hello, sizeof(hello));
+    if (!sendBytes(frame))
+      return false;
+
+    MessageHeader header;
+    std::vector<char> payload;
+    size_t wireBytes;
+    uint32_t tag;
+    int fd = -1;
+    auto fill = [this, &fd](void *buffer, size_t length) {
+      int received;
+      if (!ShmChannel::recvWithFd(sock, buffer, length, received))
+        return false;
+      if (received >= 0) {
+        if (fd >= 0)
+          close(fd);
+        fd = received;
+      }
+      return true;
+    };
+    if (!WireCodec::readFrame(WIRE_V1, fill, header, payload, wireBytes,
+                              tag) ||
+        header.type != MSG_HELLO_RESPONSE || payload.size() < sizeof(Hello) ||
+        (uint8_t)payload[0] != WIRE_V2 || (uint8_t)payload[1] != features) {
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+    if (transport == TRANSPORT_SHM) {
+      if (fd < 0)
+        return false;
+      ring = ShmChannel::attach(fd, sock);
+      if (!ring)
+        return false;
+    } else if (fd >= 0) {
+      close(fd);
+    }
+    return true;
+  }
+
+  // Registration fails harmlessly if the account already exists
+  bool login(const std::string &username) {
+    RegisterRequest reg;
+    memset(&reg, 0, sizeof(reg));
+    username.copy(reg.username, sizeof(reg.username) - 1);
+    strcpy(reg.password, "bench");
+    strcpy(reg.email, "bench@localhost");
+    LoginResponse response;
+    if (!send(MSG_REGISTER, &reg, sizeof(reg)) ||
+        !await(MSG_REGISTER_RESPONSE, &response, sizeof(response)))
+      return false;
+
+    LoginRequest req;
+    memset(&req, 0, sizeof(req));
+    username.copy(req.username, sizeof(req.username) - 1);
+    strcpy(req.password, "bench");
+    if (!send(MSG_LOGIN, &req, sizeof(req)) ||
+        !await(MSG_LOGIN_RESPONSE, &response, sizeof(response)) ||
+        !response.success)
+      return false;
+    userId = response.userId;
+    sessionId = response.sessionId;
+    return true;
+  }
+
+  void logout() { send(MSG_LOGOUT, nullptr, 0); }
+
+  bool send(uint16_t type, const void *payload, uint32_t length) {
+    return sendBytes(WireCodec::frame(WIRE_V2, type, userId, sessionId,
+                                      payload, length, 0));
+  }
+
+  // Skips anything else the server pushes meanwhile
+  bool await(uint16_t type, void *out, size_t size) {
+    auto fill = [this](void *buffer, size_t length) {
+      return recvAll(buffer, length);
+    };
+    MessageHeader header;
+    std::vector<char> payload;
+    size_t wireBytes;
+    uint32_t tag;
+    while (WireCodec::readFrame(WIRE_V2, fill, header, payload, wireBytes,
+                                tag)) {
+      if (header.type != type)
+        continue;
+      memset(out, 0, size);
+      memcpy(out, payload.data(), std::min(payload.size(), size));
+      return true;
+    }
+    return false;
+  }
+
+private:
+  int sock;
+  std::shared_ptr<ShmChannel> ring;
+  uint32_t userId;
+  uint32_t sessionId;
+
+  bool sendBytes(const std::vector<char> &frame) {
+    if (ring)
+      return ring->write(frame.data(), frame.size());
+    size_t sent = 0;
+    while (sent < frame.size()) {
+      ssize_t n = ::send(sock, frame.data() + sent, frame.size() - sent,
+                         MSG_NOSIGNAL);
+      if (n <= 0)
+        return false;
+      sent += n;
+    }
+    return true;
+  }
+
+  bool recvAll(void *buffer, size_t length) {
+    if (ring)
+      return ring->read(buffer, length);
+    size_t total = 0;
+    while (total < length) {
+      ssize_t n = recv(sock, (char *)buffer + total, length - total, 0);
+      if (n <= 0)
+        return false;
+      total += n;
+    }
+    return true;
+  }
+};
+
+// Microseconds per round trip, sorted
+static bool run(Connection &conn, size_t roundTrips,
+                std::vector<double> &latencyUs) {
+  latencyUs.clear();
+  latencyUs.reserve(roundTrips);
+  QueueStatus status;
+  for (size_t i = 0; i < roundTrips; i++) {
+    Clock::time_point sentAt = Clock::now();
+    if (!conn.send(MSG_LEAVE_QUEUE, nullptr, 0) ||
+        !conn.await(MSG_QUEUE_STATUS, &status, sizeof(status)))
+      return false;
+    latencyUs.push_back(
+        std::chrono::duration<double, std::micro>(Clock::now() - sentAt)
+            .count());
+  }
+  std::sort(latencyUs.begin(), latencyUs.end());
+  return true;
+}
+
+static double percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty())
+    return 0.0;
+  return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+static bool parseOptions(int argc, char *argv[], Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc)
+      return false;
+    if (arg == "--host") {
+      opt.host = argv[++i];
+    } else if (arg == "--port") {
+      opt.port = std::atoi(argv[++i]);
+    } else if (arg == "--unix") {
+      opt.unixPath = argv[++i];
+    } else if (arg == "--round-trips") {
+      opt.roundTrips = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      return false;
+    }
+  }
+  return opt.roundTrips > 0;
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--host HOST] [--port PORT] [--unix PATH]"
+                 " [--round-trips N]"
+              << std::endl;
+    return 1;
+  }
+
+  std::string username = "bench" + std::to_string(getpid());
+  struct Mode {
+    const char *name;
+    Transport transport;
+  };
+  const Mode modes[] = {
+      {"loopback TCP", TRANSPORT_TCP},
+      {"Unix socket", TRANSPORT_UNIX},
+      {"shared memory", TRANSPORT_SHM},
+  };
+
+  std::cout << opt.roundTrips << " round trips per transport" << std::endl;
+  for (const Mode &mode : modes) {
+    if (mode.transport != TRANSPORT_TCP && opt.unixPath.empty()) {
+      std::cout << std::left << std::setw(15) << mode.name
+                << "skipped, no --unix" << std::endl;
+      continue;
+    }
+    Connection conn;
+    if (!conn.open(opt, mode.transport) || !conn.login(username)) {
+      std::cerr << "Cannot log in over " << mode.name << std::endl;
+      return 1;
+    }
+    // An untimed tenth of the run warms both ends up
+    std::vector<double> latencyUs;
+    if (!run(conn, opt.roundTrips / 10 + 1, latencyUs) ||
+        !run(conn, opt.roundTrips, latencyUs)) {
+      std::cerr << "Connection lost over " << mode.name << std::endl;
+      return 1;
+    }
+    conn.logout();
+
+    double total = 0;
+    for (double us : latencyUs) {
+      total += us;
+    }
+    std::cout << std::left << std::setw(15) << mode.name << std::right
+              << std::fixed << std::setprecision(1) << "p50 " << std::setw(6)
+              << percentile(latencyUs, 0.5) << " us, p99 " << std::setw(6)
+              << percentile(latencyUs, 0.99) << " us, " << std::setprecision(0)
+              << std::setw(7) << opt.roundTrips / (total / 1e6)
+              << " round trips/s" << std::endl;
+  }
+  return 0;
+}
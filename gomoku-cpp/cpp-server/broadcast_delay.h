@@ -0,0 +1,356 @@
+#ifndef BROADCAST_DELAY_H
+#define BROADCAST_DELAY_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+#include "spectators.h"
+
+// Spectator feeds held back by a fixed delay, for tournaments and to keep
+// live play from being relayed to a player.
+//
+// Each game has a ring of its encoded events. An event is released to the
+// game's watchers `delay` seconds after it happened, by a single timer
+// thread that sleeps until the earliest due game; no thread waits per
+// game. The feed keeps the board as of its released events, so a watcher
+// joining late gets that position, or an earlier one if it asks to rewind,
+// followed by the released moves since.
+class BroadcastDelay {
+public:
+  typedef std::chrono::steady_clock Clock;
+  // Serializes a message into a frame per wire version, with a
+  // correlation tag
+  typedef std::function<SharedFrames(uint16_t, const void *, uint32_t,
+                                     uint32_t)>
+      Framer;
+
+  // Events kept per game, released or not. Older released ones are
+  // overwritten; rewinding further than they reach starts at the oldest.
+  static const size_t RING_EVENTS = 1024;
+
+  BroadcastDelay(SpectatorHub &hub, uint32_t delaySeconds, Framer framer)
+      : hub(hub), delay(std::chrono::seconds(delaySeconds)),
+        delaySeconds(delaySeconds), framer(std::move(framer)),
+        stopping(false) {
+    if (delaySeconds > 0) {
+      timer = std::thread(&BroadcastDelay::run, this);
+    }
+  }
+
+  ~BroadcastDelay() {
+    if (!timer.joinable())
+      return;
+    {
+      std::lock_guard<std::mutex> lock(timerMutex);
+      stopping = true;
+    }
+    timerCv.notify_all();
+    timer.join();
+  }
+
+  bool enabled() const { return delaySeconds > 0; }
+
+private:
+  enum EventKind { EVENT_MOVE, EVENT_CLOCK, EVENT_OVER };
+
+  // What a snapshot needs besides the board, as of some event
+  struct State {
+    uint32_t currentTurn;
+    uint32_t moveCount;
+    uint16_t player1Time;
+    uint16_t player2Time;
+  };
+
+  struct Event {
+    Clock::time_point time;
+    SharedFrames frames;
+    uint8_t kind;
+    uint8_t x, y, player; // Moves only
+    State after;
+  };
+
+  struct Feed {
+    std::mutex mutex;
+    BoardSnapshot start; // Players, names and settings
+    std::vector<Event> ring;
+    size_t head = 0;     // Oldest event
+    size_t count = 0;    // Events in the ring
+    size_t released = 0; // The oldest `released` events have been sent
+    State base;          // State before the oldest event
+    State latest;        // State after the newest event
+    std::vector<uint8_t> board; // Position after the released events
+    bool over = false;          // Game over has been released
+
+    Event &at(size_t i) { return ring[(head + i) % ring.size()]; }
+  };
+  typedef std::shared_ptr<Feed> FeedPtr;
+
+  struct Timer {
+    Clock::time_point due;
+    uint32_t gameId;
+    bool operator>(const Timer &other) const { return due > other.due; }
+  };
+
+  SpectatorHub &hub;
+  Clock::duration delay;
+  uint32_t delaySeconds;
+  Framer framer;
+
+  std::shared_mutex feedsMutex;
+  std::unordered_map<uint32_t, FeedPtr> feeds;
+
+  std::mutex timerMutex;
+  std::condition_variable timerCv;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+  bool stopping;
+  std::thread timer;
+
+  FeedPtr find(uint32_t gameId) {
+    std::shared_lock<std::shared_mutex> lock(feedsMutex);
+    auto it = feeds.find(gameId);
+    return it == feeds.end() ? nullptr : it->second;
+  }
+
+  void schedule(uint32_t gameId, Clock::time_point due) {
+    {
+      std::lock_guard<std::mutex> lock(timerMutex);
+      timers.push(Timer{due, gameId});
+    }
+    timerCv.notify_one();
+  }
+
+  void run() {
+    std::unique_lock<std::mutex> lock(timerMutex);
+    while (!stopping) {
+      if (timers.empty()) {
+        timerCv.wait(lock);
+        continue;
+      }
+      Timer next = timers.top();
+      if (next.due > Clock::now()) {
+        timerCv.wait_until(lock, next.due);
+        continue;
+      }
+      timers.pop();
+      lock.unlock();
+      release(next.gameId);
+      lock.lock();
+    }
+  }
+
+  // Send the oldest unreleased event; the caller holds feed.mutex
+  void releaseOneLocked(uint32_t gameId, Feed &feed) {
+    Event &event = feed.at(feed.released++);
+    if (event.kind == EVENT_MOVE) {
+      feed.board[event.y * feed.start.boardSize + event.x] = event.player;
+    }
+    hub.publish(gameId, event.frames);
+  }
+
+  // Send every event whose delay has passed
+  void release(uint32_t gameId) {
+    FeedPtr feed = find(gameId);
+    if (!feed)
+      return;
+
+    bool over = false;
+    {
+      std::lock_guard<std::mutex> lock(feed->mutex);
+      Clock::time_point now = Clock::now();
+      while (feed->released < feed->count &&
+             feed->at(feed->released).time + delay <= now) {
+        over = feed->at(feed->released).kind == EVENT_OVER;
+        releaseOneLocked(gameId, *feed);
+      }
+      if (over) {
+        feed->over = true;
+        hub.endGame(gameId);
+      } else if (feed->released < feed->count) {
+        schedule(gameId, feed->at(feed->released).time + delay);
+      }
+    }
+
+    if (over) {
+      std::unique_lock<std::shared_mutex> lock(feedsMutex);
+      feeds.erase(gameId);
+    }
+  }
+
+  // A clock update takes the turn and move count from the latest state,
+  // and the game's end keeps it whole
+  void record(uint32_t gameId, uint8_t kind, const void *payload,
+              uint32_t length, uint16_t type, const State &after,
+              uint8_t x = 0, uint8_t y = 0, uint8_t player = 0) {
+    FeedPtr feed = find(gameId);
+    if (!feed)
+      return;
+
+    Event event;
+    event.time = Clock::now();
+    event.frames = framer(type, payload, length, 0);
+    event.kind = kind;
+    event.x = x;
+    event.y = y;
+    event.player = player;
+    event.after = after;
+
+    std::lock_guard<std::mutex> lock(feed->mutex);
+    if (kind != EVENT_MOVE) {
+      event.after = feed->latest;
+      if (kind == EVENT_CLOCK) {
+        event.after.player1Time = after.player1Time;
+        event.after.player2Time = after.player2Time;
+      }
+    }
+    if (feed->count == feed->ring.size()) {
+      // Full: the oldest event makes room. Only a delay longer than the
+      // ring can hold leaves it unreleased; it is then sent early.
+      if (feed->released == 0) {
+        releaseOneLocked(gameId, *feed);
+      }
+      feed->base = feed->at(0).after;
+      feed->head = (feed->head + 1) % feed->ring.size();
+      feed->count--;
+      feed->released--;
+    }
+    feed->at(feed->count++) = std::move(event);
+    feed->latest = feed->at(feed->count - 1).after;
+    if (feed->released == feed->count - 1) {
+      schedule(gameId, feed->at(feed->released).time + delay);
+    }
+  }
+
+public:
+  // Start a game's feed from its opening position
+  void open(const GameStart &start) {
+    auto feed = std::make_shared<Feed>();
+    memset(&feed->start, 0, sizeof(feed->start));
+    feed->start.gameId = start.gameId;
+    feed->start.player1Id = start.player1Id;
+    feed->start.player2Id = start.player2Id;
+    memcpy(feed->start.player1Name, start.player1Name,
+           sizeof(feed->start.player1Name));
+    memcpy(feed->start.player2Name, start.player2Name,
+           sizeof(feed->start.player2Name));
+    feed->start.boardSize = start.boardSize;
+    feed->start.timeLimit = start.timeLimit;
+    feed->ring.resize(RING_EVENTS);
+    feed->base =
+        State{start.currentTurn, 0, start.player1Time, start.player2Time};
+    feed->latest = feed->base;
+    feed->board.assign((size_t)start.boardSize * start.boardSize, 0);
+
+    std::unique_lock<std::shared_mutex> lock(feedsMutex);
+    feeds[start.gameId] = feed;
+  }
+
+  void recordMove(const SpectatorMove &spectated) {
+    const MoveResponse &move = spectated.move;
+    record(spectated.gameId, EVENT_MOVE, &spectated, sizeof(spectated),
+           MSG_SPECTATOR_MOVE,
+           State{move.nextTurn, move.moveNumber, move.player1Time,
+                 move.player2Time},
+           move.x, move.y, move.player);
+  }
+
+  void recordClock(const TimeUpdate &update) {
+    record(update.gameId, EVENT_CLOCK, &update, sizeof(update),
+           MSG_TIME_UPDATE,
+           State{0, 0, update.player1Time, update.player2Time});
+  }
+
+  // The game's last event; its feed closes once this is released
+  void recordGameOver(const GameOver &gameOver) {
+    record(gameOver.gameId, EVENT_OVER, &gameOver, sizeof(gameOver),
+           MSG_GAME_OVER, State{0, 0, 0, 0});
+  }
+
+  enum WatchResult { WATCH_OK, WATCH_NO_GAME, WATCH_PLAYER };
+
+  // Add a watcher. It is sent the released position as of `rewindSeconds`
+  // before the delayed present, tagged as the answer to its request, then
+  // the released moves since, then the feed as it is released.
+  WatchResult watch(uint32_t gameId, int socket, uint8_t version,
+                    uint32_t tag, uint32_t userId, uint16_t rewindSeconds) {
+    FeedPtr feed = find(gameId);
+    if (!feed)
+      return WATCH_NO_GAME;
+
+    std::lock_guard<std::mutex> lock(feed->mutex);
+    if (feed->over)
+      return WATCH_NO_GAME;
+    if (feed->start.player1Id == userId || feed->start.player2Id == userId)
+      return WATCH_PLAYER;
+
+    // First released event after the seek point; times only increase
+    Clock::time_point seek =
+        Clock::now() - delay - std::chrono::seconds(rewindSeconds);
+    size_t first = feed->released;
+    while (first > 0 && feed->at(first - 1).time > seek) {
+      first--;
+    }
+
+    // Undo the moves after the seek point; they are sent as the tail
+    std::vector<uint8_t> board = feed->board;
+    uint16_t tailMoves = 0;
+    for (size_t i = first; i < feed->released; i++) {
+      const Event &event = feed->at(i);
+      if (event.kind == EVENT_MOVE) {
+        board[event.y * feed->start.boardSize + event.x] = 0;
+        tailMoves++;
+      }
+    }
+    const State &state = first == 0 ? feed->base : feed->at(first - 1).after;
+
+    WatchResponse response;
+    response.gameId = gameId;
+    response.delaySeconds = (uint16_t)delaySeconds;
+    response.tailMoves = tailMoves;
+
+    BoardSnapshot snapshot = feed->start;
+    snapshot.currentTurn = state.currentTurn;
+    snapshot.moveCount = state.moveCount;
+    snapshot.player1Time = state.player1Time;
+    snapshot.player2Time = state.player2Time;
+
+    std::vector<char> payload;
+    payload.insert(payload.end(), (const char *)&response,
+                   (const char *)&response + sizeof(response));
+    payload.insert(payload.end(), (const char *)&snapshot,
+                   (const char *)&snapshot + sizeof(snapshot));
+    size_t offset = payload.size();
+    payload.resize(offset + boardCells(snapshot.boardSize));
+    int totalCells = snapshot.boardSize * snapshot.boardSize;
+    for (int i = 0; i < totalCells; i++) {
+      payload[offset + i / 4] |= (char)((board[i] & 3) << (2 * (i % 4)));
+    }
+
+    // Snapshot and tail go out as one buffer, ahead of the next release
+    SharedFrame head = framer(MSG_WATCH_RESPONSE, payload.data(),
+                              payload.size(), tag)[version - 1];
+    std::vector<char> frames(head->begin(), head->end());
+    for (size_t i = first; i < feed->released; i++) {
+      const Event &event = feed->at(i);
+      if (event.kind == EVENT_MOVE) {
+        const SharedFrame &frame = event.frames[version - 1];
+        frames.insert(frames.end(), frame->begin(), frame->end());
+      }
+    }
+    hub.watch(gameId, socket, version,
+              std::make_shared<const std::vector<char>>(std::move(frames)));
+    return WATCH_OK;
+  }
+};
+
+#endif
@@ -0,0 +1,214 @@
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mux.h"
+#include "protocol.h"
+#include "records.h"
+#include "shared_key.h"
+
+// Clustered mode: several server processes, each owning a range of the
+// hash space of user ids, usernames and game ids.
+//
+// An account lives on the node that owns its username, and that node only
+// hands out user ids it owns, so the name and the id agree on the node. A
+// user logs in at that node, their home. Games are created by the node of
+// the player who accepted, with a game id it owns, and are played there.
+//
+// Every node keeps a peer link to every other node: a TCP connection to
+// its client port that starts with a PeerHello handshake. Records on it
+// have the mux.h layout, with a user id as the connection:
+//
+//   MUX_OPEN            home -> owner: the user starts a session on the
+//                       owner; data is the user's PresenceDelta as JOINED
+//                       with its name, then their ClusterRating. The owner
+//                       answers CLUSTER_SEAT if the user is seated in one
+//                       of its games.
+//   MUX_DATA            home -> owner: one v3 frame from the user, which
+//                       the owner handles as if the user were connected to
+//                       it. owner -> home: v3 frames for the user, which
+//                       the home relays on the user's own connection.
+//   MUX_CLOSE           home -> owner: the user left; their session there
+//                       is suspended, as a dropped connection's would be.
+//                       owner -> home: drop the session; the home answers
+//                       with its own MUX_CLOSE.
+//   CLUSTER_PRESENCE    the sender's own users' presence changes, in the
+//                       MSG_PRESENCE_DELTA layout; a full batch first.
+//   CLUSTER_GAME_START  owner -> home: the user was seated in a game;
+//                       data is the game id.
+//   CLUSTER_GAME_OVER   owner -> home: the user's game ended; data is a
+//                       ClusterGameResult, which the home rates and keeps
+//                       for the user's history.
+//   CLUSTER_SEAT        owner -> home: a BoardSnapshot and board of the
+//                       user's game, to resume them in it.
+//   CLUSTER_RATING      home -> owner: the user's ClusterRating after a
+//                       rating period, for a user with a session there.
+//
+// Each node sends on its own link to a peer, and answers on the link the
+// peer opened to it. If a link fails, the sessions on it are suspended and
+// the presence of the peer's users is dropped until it is back.
+//
+// The handshake proves to each side that the other holds the key all
+// nodes share (--cluster-key), in three MSG_PEER_HELLO frames in v1
+// framing (see shared_key.h), with node indexes as ids. A node that is not
+// clustered, or gets a bad index or proof, closes the connection.
+enum ClusterKind {
+  CLUSTER_PRESENCE = 4,
+  CLUSTER_GAME_START = 5,
+  CLUSTER_GAME_OVER = 6,
+  CLUSTER_SEAT = 7,
+  CLUSTER_RATING = 8
+};
+
+// A Glicko-2 rating, as the player's home node holds it. Rating periods
+// rate local players against the remote opponent's.
+struct ClusterRating {
+  double rating;
+  double deviation;
+  double volatility;
+  uint32_t period;
+} __attribute__((packed));
+
+inline ClusterRating toClusterRating(const GlickoRating &glicko) {
+  ClusterRating out;
+  out.rating = glicko.rating;
+  out.deviation = glicko.deviation;
+  out.volatility = glicko.volatility;
+  out.period = glicko.period;
+  return out;
+}
+
+inline GlickoRating fromClusterRating(const ClusterRating &rating) {
+  GlickoRating out;
+  out.rating = rating.rating;
+  out.deviation = rating.deviation;
+  out.volatility = rating.volatility;
+  out.period = rating.period;
+  return out;
+}
+
+// Header of a finished game, as the owner recorded it, with both players'
+// ratings as the owner knew them
+struct ClusterGameResult {
+  uint32_t gameId;
+  uint32_t player1Id;
+  uint32_t player2Id;
+  char player1Name[32];
+  char player2Name[32];
+  uint8_t boardSize;
+  uint32_t winnerId;
+  uint8_t result; // 0 = player1 win, 1 = player2 win, 2 = draw
+  uint32_t totalMoves;
+  uint64_t startTime;
+  uint32_t duration;
+  int16_t eloChange;
+  ClusterRating player1Rating;
+  ClusterRating player2Rating;
+} __attribute__((packed));
+
+typedef KeyHello PeerHello;
+
+// Membership and ownership. Ids and names hash to 32 bits, and node i of
+// n owns the hashes in [i * 2^32 / n, (i + 1) * 2^32 / n).
+class Cluster {
+public:
+  struct Node {
+    std::string host;
+    int port;
+  };
+
+  Cluster() : self(0), key('P') {}
+
+  // "HOST:PORT,HOST:PORT,..." lists every node's client port, in node
+  // order; `index` is this node's position in it
+  bool configure(const std::string &spec, int index) {
+    nodes.clear();
+    size_t start = 0;
+    while (start <= spec.size()) {
+      size_t end = spec.find(',', start);
+      if (end == std::string::npos)
+        end = spec.size();
+      std::string entry = spec.substr(start, end - start);
+      size_t colon = entry.rfind(':');
+      if (colon == std::string::npos || colon == 0)
+        return false;
+      Node node;
+      node.host = entry.substr(0, colon);
+      node.port = std::atoi(entry.c_str() + colon + 1);
+      if (node.port <= 0)
+        return false;
+      nodes.push_back(node);
+      start = end + 1;
+    }
+    self = index;
+    return index >= 0 && (size_t)index < nodes.size();
+  }
+
+  // A single server is a cluster of one, which owns everything
+  bool enabled() const { return nodes.size() > 1; }
+  size_t size() const { return nodes.size(); }
+  int selfIndex() const { return self; }
+  const Node &node(int index) const { return nodes[index]; }
+
+  int ownerOf(uint32_t id) const { return ownerOfHash(mix(id)); }
+
+  int ownerOfName(const std::string &name) const {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (unsigned char c : name) {
+      h = (h ^ c) * 16777619u;
+    }
+    return ownerOfHash(mix(h));
+  }
+
+  bool owns(uint32_t id) const { return ownerOf(id) == self; }
+
+  // The shared key is the file's contents without trailing line breaks
+  bool loadKey(const std::string &path) { return key.load(path); }
+
+  // A hello from this node, with no proof yet
+  PeerHello hello() const { return key.hello(self); }
+
+  // Sign this node's hello to the peer that sent `theirs`
+  void prove(bool accepting, const PeerHello &theirs, PeerHello &ours) const {
+    key.prove(accepting, theirs, ours);
+  }
+
+  // Whether the peer's hello answers this node's with a valid proof;
+  // `accepting` is this node's role, as in prove()
+  bool verify(bool accepting, const PeerHello &ours,
+              const PeerHello &theirs) const {
+    return key.verify(accepting, ours, theirs);
+  }
+
+  // First hash this node owns, and the first it does not
+  uint64_t rangeBegin() const { return ((uint64_t)self << 32) / size(); }
+  uint64_t rangeEnd() const { return ((uint64_t)(self + 1) << 32) / size(); }
+
+private:
+  std::vector<Node> nodes;
+  int self;
+  SharedKey key;
+
+  // Sequential ids spread evenly over the ranges
+  static uint32_t mix(uint32_t h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+  }
+
+  int ownerOfHash(uint32_t h) const {
+    if (nodes.size() <= 1)
+      return self;
+    return (int)(((uint64_t)h * nodes.size()) >> 32);
+  }
+};
+
+#endif
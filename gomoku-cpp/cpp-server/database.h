@@ -2,166 +2,335 @@
 #define DATABASE_H
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <iterator>
 #include <map>
-#include <sstream>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
 #include <string>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 
-struct User {
-  uint32_t userId;
-  std::string username;
-  std::string email;
-  std::string passwordHash; // Store hashed password
-  uint16_t eloRating;
-  uint16_t wins;
-  uint16_t losses;
-  uint16_t draws;
-  bool isOnline;
-  bool inGame;
-};
+#include "elo.h"
+#include "glicko2.h"
+#include "leaderboard.h"
+#include "legacy_loader.h"
+#include "move_cache.h"
+#include "move_codec.h"
+#include "password_hash.h"
+#include "presence.h"
+#include "rating_history.h"
+#include "records.h"
+
+typedef MoveListCache<uint8_t>::ListPtr PackedMovesPtr;
+
+// Database is safe for concurrent use by the per-client handler threads.
+//
+// Users and game records are split into shards, each guarded by its own
+// reader/writer lock, so lookups on different users or games never contend
+// and readers of the same shard proceed in parallel. Files are written by
+// a background flusher from short per-shard snapshots instead of inline
+// under the caller's lock.
+//
+// Lock order: usernameMutex -> user shards (ascending) -> game shard ->
+// remoteMutex -> cacheMutex / presence / leaderboard / rating history.
+// The *FileMutex locks are taken before any shard lock.
+class Database {
+private:
+  static const size_t USER_SHARDS = 16;
+  static const size_t GAME_SHARDS = 16;
 
-struct Challenge {
-  uint32_t challengeId;
-  uint32_t challengerId;
-  uint32_t challengedId;
-  uint8_t boardSize;
-  uint16_t timeLimit;
-  bool pending;
-};
+  struct UserShard {
+    mutable std::shared_mutex mutex;
+    std::map<uint32_t, User> users;
+    std::map<uint32_t, std::vector<uint32_t>> games; // userId -> gameIds
+  };
 
-struct MoveLog {
-  uint32_t moveNumber;
-  uint32_t playerId;
-  uint8_t x;
-  uint8_t y;
-  uint32_t timestamp; // Seconds since game start
-};
+  struct GameShard {
+    mutable std::shared_mutex mutex;
+    std::map<uint32_t, GameRecord> records;
+    std::map<uint32_t, MoveIndexEntry> moveIndex; // gameId -> stored moves
+  };
 
-struct GameRecord {
-  uint32_t gameId;
-  uint32_t player1Id;
-  uint32_t player2Id;
-  std::string player1Name;
-  std::string player2Name;
-  uint8_t boardSize;
-  uint32_t winnerId;
-  uint8_t result; // 0 = player1 win, 1 = player2 win, 2 = draw
-  std::vector<MoveLog> moves;
-  uint64_t startTime;
-  uint32_t duration; // In seconds
-  int16_t eloChange;
-};
+  UserShard userShards[USER_SHARDS];
+  GameShard gameShards[GAME_SHARDS];
 
-class Database {
-private:
-  std::map<uint32_t, User> users;
+  std::shared_mutex usernameMutex;
   std::map<std::string, uint32_t> usernameToId; // username -> userId mapping
+
+  std::mutex challengeMutex;
   std::map<uint32_t, Challenge> challenges;
-  std::map<uint32_t, GameRecord> gameRecords;
-  uint32_t userIdCounter;
-  uint32_t challengeIdCounter;
-  uint32_t gameIdCounter;
 
-  const std::string DATA_DIR = "./data/";
+  PresenceSet presence; // Online users, kept in sync with the shards
+
+  // Users homed on other nodes of a cluster, as last replicated. Records
+  // are never erased, so presence entries may keep viewing their names.
+  std::shared_mutex remoteMutex;
+  std::map<uint32_t, User> remoteUsers;
+  // Their Glicko-2 rating before the last period it was rated in, for a
+  // node still closing that period; under remoteMutex
+  std::map<uint32_t, GlickoRating> remotePriorGlicko;
+  Leaderboard leaderboard; // Rank index over all users' ratings
+  RatingHistory ratingHistory; // Elo time series per user
+
+  std::mutex cacheMutex;
+  MoveListCache<uint8_t> moveCache; // Packed (MoveCodec) lists
+
+  std::atomic<uint32_t> userIdCounter;
+  std::atomic<uint32_t> challengeIdCounter;
+  std::atomic<uint32_t> gameIdCounter;
+  // In a cluster, only ids this node owns are handed out
+  std::function<bool(uint32_t)> ownsId;
+  // Told of each local user's new rating when a period closes
+  std::function<void(uint32_t, const GlickoRating &)> ratedHook;
+
+  // Serialize writers of each data file
+  std::mutex usersFileMutex;
+  std::mutex gamesFileMutex;
+  std::mutex movesFileMutex;
+  std::mutex ratingsFileMutex;
+
+  // Background persistence
+  std::thread flusher;
+  std::mutex flushMutex;
+  std::condition_variable flushCv;
+  bool usersDirty;
+  bool gamesDirty;
+  bool stopping;
+
+  // Optional Glicko-2 rating periods; Elo stays the live estimate
+  RatingPeriod ratingPeriod;
+  std::thread ratingThread;
+  std::atomic<uint32_t> ratingPeriodSeconds; // 0 = Glicko-2 disabled
+
+  const std::string DATA_DIR;
   const std::string USERS_FILE = "users.dat";
   const std::string GAMES_FILE = "games.dat";
+  const std::string MOVES_FILE = "moves.dat";
+  const std::string RATINGS_FILE = "ratings.dat";
+
+  // Upper bound for move lists of completed games kept in memory
+  static const size_t MOVE_CACHE_LIMIT = 16 * 1024 * 1024;
+
+  // How often dirty users/games are written back
+  static const int FLUSH_INTERVAL_MS = 500;
+
+  UserShard &userShard(uint32_t userId) {
+    return userShards[userId % USER_SHARDS];
+  }
+
+  GameShard &gameShard(uint32_t gameId) {
+    return gameShards[gameId % GAME_SHARDS];
+  }
+
+  uint32_t nextId(std::atomic<uint32_t> &counter) {
+    uint32_t id;
+    do {
+      id = counter++;
+    } while (ownsId && !ownsId(id));
+    return id;
+  }
 
 public:
-  Database() : userIdCounter(1), challengeIdCounter(1), gameIdCounter(1) {
-    // Create data directory if not exists
-    mkdir(DATA_DIR.c_str(), 0755);
+  explicit Database(const std::string &dataDir = "./data/")
+      : moveCache(MOVE_CACHE_LIMIT), userIdCounter(1), challengeIdCounter(1),
+        gameIdCounter(1), usersDirty(false), gamesDirty(false),
+        stopping(false), ratingPeriodSeconds(0), DATA_DIR(dataDir) {
+    // Create data directory if not exists, with its parents
+    for (size_t slash = DATA_DIR.find('/', 1); slash != std::string::npos;
+         slash = DATA_DIR.find('/', slash + 1)) {
+      mkdir(DATA_DIR.substr(0, slash).c_str(), 0755);
+    }
 
     // Load existing data
-    loadUsers();
-    loadGames();
+    size_t userCount = loadUsers();
+    size_t gameCount = loadGames();
+    loadRatingHistory();
 
-    std::cout << "Database initialized. Users: " << users.size()
-              << ", Games: " << gameRecords.size() << std::endl;
+    std::cout << "Database initialized. Users: " << userCount
+              << ", Games: " << gameCount << std::endl;
+
+    flusher = std::thread(&Database::flushLoop, this);
   }
 
   // ==================== USER MANAGEMENT ====================
 
+  // Password hashing is deliberately slow (see PasswordHash); createUser
+  // and authenticateUser run it without holding any lock and are meant to
+  // be called from a worker pool rather than a connection thread.
+
   bool createUser(const char *username, const char *email,
                   const char *password) {
+    {
+      // Refuse a taken name before paying for the hash
+      std::shared_lock<std::shared_mutex> nameLock(usernameMutex);
+      if (usernameToId.find(username) != usernameToId.end()) {
+        return false;
+      }
+    }
+    std::string passwordHash = PasswordHash::hash(password);
+
+    std::unique_lock<std::shared_mutex> nameLock(usernameMutex);
     // Check if username exists
     if (usernameToId.find(username) != usernameToId.end()) {
       return false;
     }
 
     User user;
-    user.userId = userIdCounter++;
+    user.userId = nextId(userIdCounter);
     user.username = username;
     user.email = email;
-    user.passwordHash = hashPassword(password); // Simple hash
-    user.eloRating = 1000;
+    user.passwordHash = passwordHash;
+    user.eloRating = Elo::INITIAL_RATING;
     user.wins = 0;
     user.losses = 0;
     user.draws = 0;
     user.isOnline = false;
     user.inGame = false;
 
-    users[user.userId] = user;
     usernameToId[username] = user.userId;
+    {
+      UserShard &shard = userShard(user.userId);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      shard.users[user.userId] = user;
+      leaderboard.set(user.userId, user.eloRating);
+    }
+    nameLock.unlock();
 
-    saveUsers();
+    markDirty(true, false);
     return true;
   }
 
   bool authenticateUser(const char *username, const char *password,
                         User &user) {
-    auto it = usernameToId.find(username);
-    if (it == usernameToId.end()) {
+    uint32_t userId;
+    {
+      std::shared_lock<std::shared_mutex> nameLock(usernameMutex);
+      auto it = usernameToId.find(username);
+      if (it == usernameToId.end()) {
+        return false;
+      }
+      userId = it->second;
+    }
+
+    UserShard &shard = userShard(userId);
+    std::string stored;
+    {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.users.find(userId);
+      if (it == shard.users.end()) {
+        return false;
+      }
+      stored = it->second.passwordHash;
+    }
+
+    if (!PasswordHash::verify(password, stored)) {
       return false;
     }
 
-    User &storedUser = users[it->second];
-    if (storedUser.passwordHash == hashPassword(password)) {
-      user = storedUser;
-      return true;
+    // Accounts still on the old string hash are upgraded on login
+    std::string upgraded;
+    if (PasswordHash::needsRehash(stored)) {
+      upgraded = PasswordHash::hash(password);
     }
-    return false;
+
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it == shard.users.end()) {
+      return false;
+    }
+    bool rehashed = !upgraded.empty() && it->second.passwordHash == stored;
+    if (rehashed) {
+      it->second.passwordHash = upgraded;
+    }
+    user = it->second;
+    lock.unlock();
+
+    if (rehashed) {
+      markDirty(true, false);
+    }
+    return true;
   }
 
   User getUser(uint32_t userId) {
-    auto it = users.find(userId);
-    if (it != users.end()) {
+    UserShard &shard = userShard(userId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it != shard.users.end()) {
       return it->second;
     }
+    lock.unlock();
+
+    std::shared_lock<std::shared_mutex> remoteLock(remoteMutex);
+    auto remote = remoteUsers.find(userId);
+    if (remote != remoteUsers.end()) {
+      return remote->second;
+    }
     return User();
   }
 
-  std::vector<User> getOnlineUsers() {
-    std::vector<User> onlineUsers;
-    for (const auto &pair : users) {
-      if (pair.second.isOnline) {
-        onlineUsers.push_back(pair.second);
-      }
-    }
-    return onlineUsers;
+  // Snapshot of the online users in O(online), without copying names
+  std::vector<PresenceEntry> getOnlineUsers() { return presence.snapshot(); }
+
+  // Presence changes since the previous call, one merged entry per user
+  std::vector<PresenceChange> takePresenceChanges() {
+    return presence.takeChanges();
   }
 
   void setUserOnline(uint32_t userId, bool online) {
-    auto it = users.find(userId);
-    if (it != users.end()) {
-      it->second.isOnline = online;
+    UserShard &shard = userShard(userId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it != shard.users.end()) {
+      User &u = it->second;
+      u.isOnline = online;
       if (!online) {
-        it->second.inGame = false;
+        u.inGame = false;
+        presence.remove(userId);
+      } else {
+        PresenceEntry entry;
+        entry.userId = u.userId;
+        entry.username = u.username;
+        entry.eloRating = u.eloRating;
+        entry.wins = u.wins;
+        entry.losses = u.losses;
+        entry.draws = u.draws;
+        entry.inGame = u.inGame;
+        presence.add(entry);
       }
     }
   }
 
   void setUserInGame(uint32_t userId, bool inGame) {
-    auto it = users.find(userId);
-    if (it != users.end()) {
+    UserShard &shard = userShard(userId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it != shard.users.end()) {
       it->second.inGame = inGame;
+      presence.setInGame(userId, inGame);
+      return;
+    }
+    lock.unlock();
+
+    std::unique_lock<std::shared_mutex> remoteLock(remoteMutex);
+    auto remote = remoteUsers.find(userId);
+    if (remote != remoteUsers.end()) {
+      remote->second.inGame = inGame;
+      presence.setInGame(userId, inGame);
     }
   }
 
@@ -177,11 +346,13 @@ public:
     challenge.timeLimit = timeLimit;
     challenge.pending = true;
 
+    std::lock_guard<std::mutex> lock(challengeMutex);
     challenges[challenge.challengeId] = challenge;
     return challenge.challengeId;
   }
 
   Challenge getChallenge(uint32_t challengeId) {
+    std::lock_guard<std::mutex> lock(challengeMutex);
     auto it = challenges.find(challengeId);
     if (it != challenges.end()) {
       return it->second;
@@ -189,7 +360,25 @@ public:
     return Challenge();
   }
 
-  void removeChallenge(uint32_t challengeId) { challenges.erase(challengeId); }
+  void removeChallenge(uint32_t challengeId) {
+    std::lock_guard<std::mutex> lock(challengeMutex);
+    challenges.erase(challengeId);
+  }
+
+  // Remove a challenge sent to `challengedId` and report whether this
+  // caller was the one to do it, so two threads cannot both act on the
+  // same challenge. Challenges sent to anyone else are left alone.
+  bool takeChallenge(uint32_t challengeId, uint32_t challengedId,
+                     Challenge &challenge) {
+    std::lock_guard<std::mutex> lock(challengeMutex);
+    auto it = challenges.find(challengeId);
+    if (it == challenges.end() || it->second.challengedId != challengedId) {
+      return false;
+    }
+    challenge = it->second;
+    challenges.erase(it);
+    return true;
+  }
 
   // ==================== GAME MANAGEMENT ====================
 
@@ -197,7 +386,7 @@ public:
                       uint16_t timeLimit) {
     (void)timeLimit; // Stored in GameState, not in record
     GameRecord record;
-    record.gameId = gameIdCounter++;
+    record.gameId = nextId(gameIdCounter);
     record.player1Id = player1Id;
     record.player2Id = player2Id;
     record.player1Name = getUser(player1Id).username;
@@ -205,11 +394,19 @@ public:
     record.boardSize = boardSize;
     record.winnerId = 0;
     record.result = 255; // Game in progress
+    record.totalMoves = 0;
     record.startTime = std::time(nullptr);
     record.duration = 0;
     record.eloChange = 0;
 
-    gameRecords[record.gameId] = record;
+    {
+      GameShard &shard = gameShard(record.gameId);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      shard.records[record.gameId] = record;
+    }
+
+    addUserGame(player1Id, record.gameId);
+    addUserGame(player2Id, record.gameId);
 
     // Mark players as in game
     setUserInGame(player1Id, true);
@@ -220,8 +417,10 @@ public:
 
   void logMove(uint32_t gameId, uint32_t playerId, uint32_t moveNumber,
                uint8_t x, uint8_t y) {
-    auto it = gameRecords.find(gameId);
-    if (it != gameRecords.end()) {
+    GameShard &shard = gameShard(gameId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(gameId);
+    if (it != shard.records.end()) {
       MoveLog log;
       log.moveNumber = moveNumber;
       log.playerId = playerId;
@@ -230,6 +429,8 @@ public:
       log.timestamp = std::time(nullptr) - it->second.startTime;
 
       it->second.moves.push_back(log);
+      it->second.totalMoves = it->second.moves.size();
+      lock.unlock();
 
       std::cout << "Move logged: Game " << gameId << ", Player " << playerId
                 << ", Move " << moveNumber << " at (" << (int)x << "," << (int)y
@@ -237,41 +438,126 @@ public:
     }
   }
 
-  void updateGameResult(uint32_t gameId, uint32_t winnerId, uint8_t result) {
-    auto it = gameRecords.find(gameId);
-    if (it != gameRecords.end()) {
-      it->second.winnerId = winnerId;
-      it->second.result = result;
-      it->second.duration = std::time(nullptr) - it->second.startTime;
+  void updateGameResult(uint32_t gameId, uint32_t winnerId, uint8_t result,
+                        int16_t eloChange = 0) {
+    uint32_t player1Id, player2Id;
+    PackedMovesPtr packed;
+    {
+      GameShard &shard = gameShard(gameId);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.records.find(gameId);
+      if (it == shard.records.end()) {
+        return;
+      }
+      GameRecord &g = it->second;
+      g.winnerId = winnerId;
+      g.result = result;
+      g.eloChange = eloChange;
+      g.duration = std::time(nullptr) - g.startTime;
+      player1Id = g.player1Id;
+      player2Id = g.player2Id;
+
+      // The record keeps only the header from now on; the moves stay
+      // reachable through the cache until they are on disk
+      packed = packMoves(g);
+      g.moves = std::vector<MoveLog>();
+      std::lock_guard<std::mutex> cacheLock(cacheMutex);
+      moveCache.put(gameId, packed);
+    }
 
-      // Mark players as not in game
-      setUserInGame(it->second.player1Id, false);
-      setUserInGame(it->second.player2Id, false);
+    // Mark players as not in game
+    setUserInGame(player1Id, false);
+    setUserInGame(player2Id, false);
 
-      saveGames();
+    archiveMoves(gameId, *packed);
+    markDirty(false, true);
 
-      std::cout << "Game " << gameId << " completed. Winner: " << winnerId
-                << ", Result: " << (int)result << std::endl;
-    }
+    std::cout << "Game " << gameId << " completed. Winner: " << winnerId
+              << ", Result: " << (int)result << std::endl;
   }
 
   GameRecord getGameRecord(uint32_t gameId) {
-    auto it = gameRecords.find(gameId);
-    if (it != gameRecords.end()) {
+    GameShard &shard = gameShard(gameId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(gameId);
+    if (it != shard.records.end()) {
       return it->second;
     }
     return GameRecord();
   }
 
+  // Packed move list of a game (see MoveCodec). Completed games are read
+  // from disk on first access and kept in the bounded move cache.
+  PackedMovesPtr getPackedMoves(uint32_t gameId) {
+    GameShard &shard = gameShard(gameId);
+    uint8_t boardSize;
+    {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.records.find(gameId);
+      if (it == shard.records.end()) {
+        return std::make_shared<const std::vector<uint8_t>>();
+      }
+      const GameRecord &g = it->second;
+      if (g.result == 255) {
+        return packMoves(g);
+      }
+      boardSize = g.boardSize;
+
+      std::lock_guard<std::mutex> cacheLock(cacheMutex);
+      PackedMovesPtr cached = moveCache.get(gameId);
+      if (cached) {
+        return cached;
+      }
+    }
+
+    // Disk reads happen without holding the shard lock
+    PackedMovesPtr loaded = std::make_shared<const std::vector<uint8_t>>(
+        readPackedMoves(gameId, boardSize));
+    std::lock_guard<std::mutex> cacheLock(cacheMutex);
+    moveCache.put(gameId, loaded);
+    return loaded;
+  }
+
+  std::vector<MoveLog> getGameMoves(uint32_t gameId) {
+    std::vector<MoveLog> moves;
+    GameRecord g = getGameHeader(gameId);
+    if (g.gameId == 0) {
+      return moves;
+    }
+    PackedMovesPtr packed = getPackedMoves(gameId);
+    MoveCodec::decode(g.boardSize, packed->data(), packed->size(),
+                      [&](uint32_t i, uint8_t x, uint8_t y, uint32_t t) {
+                        MoveLog m;
+                        m.moveNumber = i + 1;
+                        m.playerId = (i % 2 == 0) ? g.player1Id : g.player2Id;
+                        m.x = x;
+                        m.y = y;
+                        m.timestamp = t;
+                        moves.push_back(m);
+                      });
+    return moves;
+  }
+
   std::vector<GameRecord> getUserGameHistory(uint32_t userId,
                                              uint32_t limit = 20) {
-    std::vector<GameRecord> history;
+    std::vector<uint32_t> gameIds;
+    {
+      UserShard &shard = userShard(userId);
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.games.find(userId);
+      if (it != shard.games.end()) {
+        gameIds = it->second;
+      }
+    }
 
-    for (const auto &pair : gameRecords) {
-      if (pair.second.result != 255 && // Only completed games
-          (pair.second.player1Id == userId ||
-           pair.second.player2Id == userId)) {
-        history.push_back(pair.second);
+    // Game IDs grow with start time, so walk from the newest one and stop
+    // once enough completed games were found
+    std::vector<GameRecord> history;
+    for (auto it = gameIds.rbegin();
+         it != gameIds.rend() && history.size() < limit; ++it) {
+      GameRecord g = getGameHeader(*it);
+      if (g.gameId != 0 && g.result != 255) { // Only completed games
+        history.push_back(std::move(g));
       }
     }
 
@@ -281,32 +567,41 @@ public:
                 return a.startTime > b.startTime;
               });
 
-    // Limit results
-    if (history.size() > limit) {
-      history.resize(limit);
-    }
-
     return history;
   }
 
   // ==================== ELO RATING ====================
 
   int16_t updateEloRating(uint32_t winnerId, uint32_t loserId) {
-    auto winnerIt = users.find(winnerId);
-    auto loserIt = users.find(loserId);
+    UserShard &winnerShard = userShard(winnerId);
+    UserShard &loserShard = userShard(loserId);
+    std::unique_lock<std::shared_mutex> winnerLock(winnerShard.mutex,
+                                                   std::defer_lock);
+    std::unique_lock<std::shared_mutex> loserLock(loserShard.mutex,
+                                                  std::defer_lock);
+    if (&winnerShard == &loserShard) {
+      winnerLock.lock();
+    } else {
+      std::lock(winnerLock, loserLock);
+    }
 
-    if (winnerIt == users.end() || loserIt == users.end()) {
-      return 0;
+    auto winnerIt = winnerShard.users.find(winnerId);
+    auto loserIt = loserShard.users.find(loserId);
+
+    if (winnerIt == winnerShard.users.end() ||
+        loserIt == loserShard.users.end()) {
+      winnerLock.unlock();
+      if (loserLock.owns_lock()) {
+        loserLock.unlock();
+      }
+      return updateRemoteEloRating(winnerId, loserId);
     }
 
     int winnerElo = winnerIt->second.eloRating;
     int loserElo = loserIt->second.eloRating;
 
     // Calculate ELO change using standard formula
-    const int K = 32;
-    double expectedWinner =
-        1.0 / (1.0 + pow(10.0, (loserElo - winnerElo) / 400.0));
-    int16_t eloChange = (int16_t)(K * (1.0 - expectedWinner));
+    int16_t eloChange = Elo::change(winnerElo, loserElo);
 
     // Update ratings
     winnerIt->second.eloRating += eloChange;
@@ -316,226 +611,759 @@ public:
     winnerIt->second.wins++;
     loserIt->second.losses++;
 
-    saveUsers();
+    publishStats(winnerIt->second);
+    publishStats(loserIt->second);
+
+    uint32_t now = std::time(nullptr);
+    ratingHistory.append(winnerId, now, winnerElo, winnerIt->second.eloRating);
+    ratingHistory.append(loserId, now, loserElo, loserIt->second.eloRating);
+
+    if (ratingPeriodSeconds) {
+      ratingPeriod.record(winnerId, loserId, 1.0);
+    }
+
+    winnerLock.unlock();
+    if (loserLock.owns_lock()) {
+      loserLock.unlock();
+    }
+    markDirty(true, false);
 
     return eloChange;
   }
 
   void updateDrawStats(uint32_t player1Id, uint32_t player2Id) {
-    auto p1It = users.find(player1Id);
-    auto p2It = users.find(player2Id);
+    for (uint32_t userId : {player1Id, player2Id}) {
+      UserShard &shard = userShard(userId);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.users.find(userId);
+      if (it != shard.users.end()) {
+        it->second.draws++;
+        publishStats(it->second);
+        uint16_t elo = it->second.eloRating;
+        ratingHistory.append(userId, std::time(nullptr), elo, elo);
+      }
+    }
+
+    if (ratingPeriodSeconds) {
+      ratingPeriod.record(player1Id, player2Id, 0.5);
+    }
+
+    markDirty(true, false);
+  }
 
-    if (p1It != users.end()) {
-      p1It->second.draws++;
+  // A game between a local user and one homed on another cluster node.
+  // Only the local side is rated here; the other node applies the same
+  // change when it is told the result (see recordRemoteGame).
+  int16_t updateRemoteEloRating(uint32_t winnerId, uint32_t loserId) {
+    User winner = getUser(winnerId);
+    User loser = getUser(loserId);
+    if (winner.userId == 0 || loser.userId == 0) {
+      return 0;
     }
-    if (p2It != users.end()) {
-      p2It->second.draws++;
+
+    int16_t eloChange = Elo::change(winner.eloRating, loser.eloRating);
+    applyResult(winnerId, eloChange, 1.0);
+    applyResult(loserId, -eloChange, 0.0);
+
+    if (ratingPeriodSeconds) {
+      ratingPeriod.record(winnerId, loserId, 1.0);
     }
+    markDirty(true, false);
+    return eloChange;
+  }
 
-    saveUsers();
+  // ==================== CLUSTER ====================
+
+  // Hand out only user and game ids for which `owns` holds. Set before
+  // any are created.
+  void restrictIds(std::function<bool(uint32_t)> owns) {
+    ownsId = std::move(owns);
+  }
+
+  // Call `rated` with each local user's rating once a rating period is
+  // closed, outside any lock. Set before enableGlicko.
+  void onRated(std::function<void(uint32_t, const GlickoRating &)> rated) {
+    ratedHook = std::move(rated);
+  }
+
+  // Apply a presence change replicated from the user's home node. The
+  // name is only read for PRESENCE_JOINED.
+  void applyRemotePresence(uint8_t kind, uint32_t userId,
+                           const std::string &username, uint16_t eloRating,
+                           uint16_t wins, uint16_t losses, uint16_t draws,
+                           bool inGame) {
+    std::unique_lock<std::shared_mutex> lock(remoteMutex);
+    if (kind & PRESENCE_LEFT) {
+      auto it = remoteUsers.find(userId);
+      if (it != remoteUsers.end()) {
+        it->second.isOnline = false;
+        it->second.inGame = false;
+        presence.remove(userId);
+      }
+      return;
+    }
+
+    auto it = remoteUsers.find(userId);
+    if (it == remoteUsers.end()) {
+      if (!(kind & PRESENCE_JOINED))
+        return; // Joined before this node was listening
+      User user = User();
+      user.userId = userId;
+      user.username = username;
+      it = remoteUsers.emplace(userId, std::move(user)).first;
+    }
+    User &u = it->second;
+    u.eloRating = eloRating;
+    u.wins = wins;
+    u.losses = losses;
+    u.draws = draws;
+    u.isOnline = true;
+    u.inGame = inGame;
+
+    if (kind & PRESENCE_JOINED) {
+      PresenceEntry entry;
+      entry.userId = u.userId;
+      entry.username = u.username;
+      entry.eloRating = u.eloRating;
+      entry.wins = u.wins;
+      entry.losses = u.losses;
+      entry.draws = u.draws;
+      entry.inGame = u.inGame;
+      presence.add(entry);
+    } else {
+      presence.setInGame(userId, inGame);
+      presence.updateStats(userId, eloRating, wins, losses, draws);
+    }
+  }
+
+  // Glicko-2 rating of a user homed on another node, as their home or the
+  // owner of their game reported it. Kept even while they are offline; a
+  // report older than the one held is ignored.
+  void setRemoteGlicko(uint32_t userId, const std::string &username,
+                       const GlickoRating &glicko) {
+    std::unique_lock<std::shared_mutex> lock(remoteMutex);
+    auto it = remoteUsers.find(userId);
+    if (it == remoteUsers.end()) {
+      User user = User();
+      user.userId = userId;
+      user.username = username;
+      it = remoteUsers.emplace(userId, std::move(user)).first;
+    }
+    GlickoRating &held = it->second.glicko;
+    if (glicko.period < held.period)
+      return;
+    if (glicko.period > held.period) {
+      remotePriorGlicko[userId] = held;
+    }
+    held = glicko;
+  }
+
+  // Take the remote users for which `pred` holds offline, when the link
+  // to their home node is lost
+  void dropRemotePresence(const std::function<bool(uint32_t)> &pred) {
+    std::unique_lock<std::shared_mutex> lock(remoteMutex);
+    for (auto &pair : remoteUsers) {
+      if (pair.second.isOnline && pred(pair.first)) {
+        pair.second.isOnline = false;
+        pair.second.inGame = false;
+        presence.remove(pair.first);
+      }
+    }
+  }
+
+  // A local user's game that was played on another node: keep its header
+  // for the user's history and apply the result to the user
+  void recordRemoteGame(uint32_t userId, const GameRecord &record) {
+    {
+      GameShard &shard = gameShard(record.gameId);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      if (!shard.records.emplace(record.gameId, record).second)
+        return; // Already recorded
+    }
+    addUserGame(userId, record.gameId);
+
+    double score1 = record.result == 2 ? 0.5 : record.result == 0 ? 1.0 : 0.0;
+    if (record.result == 2) {
+      applyResult(userId, 0, 0.5);
+    } else if (record.winnerId == userId) {
+      applyResult(userId, record.eloChange, 1.0);
+    } else {
+      applyResult(userId, -record.eloChange, 0.0);
+    }
+    if (ratingPeriodSeconds) {
+      ratingPeriod.record(record.player1Id, record.player2Id, score1);
+    }
+
+    setUserInGame(userId, false);
+    markDirty(true, true);
+  }
+
+  // ==================== GLICKO-2 ====================
+
+  // Collect results into rating periods of the given length and rate them
+  // in a background batch at the end of each period
+  void enableGlicko(uint32_t periodSeconds) {
+    if (periodSeconds == 0 || ratingPeriodSeconds.exchange(periodSeconds))
+      return;
+    ratingThread = std::thread(&Database::ratingPeriodLoop, this);
+    std::cout << "Glicko-2 rating periods enabled: " << periodSeconds << " s"
+              << std::endl;
+  }
+
+  // Rate all games of the period that just ended. Every affected player's
+  // update reads only the ratings from before the period, so players are
+  // split across threads and computed independently.
+  void closeRatingPeriod() {
+    std::vector<RatingPeriod::Game> games = ratingPeriod.take();
+    if (games.empty())
+      return;
+
+    auto started = std::chrono::steady_clock::now();
+    uint32_t period = currentRatingPeriod();
+
+    // Snapshot of every involved player's rating before the period
+    std::map<uint32_t, GlickoRating> before;
+    for (const auto &g : games) {
+      before.emplace(g.player1Id, GlickoRating());
+      before.emplace(g.player2Id, GlickoRating());
+    }
+    for (auto &pair : before) {
+      if (!localGlicko(pair.first, pair.second)) {
+        remoteGlicko(pair.first, period, pair.second);
+      }
+      // Deviation grows over the periods the player sat out
+      if (pair.second.period != 0 && period > pair.second.period + 1) {
+        pair.second.deviation =
+            Glicko2::inflate(pair.second, period - pair.second.period - 1);
+      }
+    }
+
+    // Workers only touch their own jobs, which carry the prior rating
+    struct Job {
+      uint32_t userId;
+      GlickoRating prior;
+      std::vector<Glicko2::Result> results;
+      GlickoRating rating;
+    };
+    std::vector<Job> jobs;
+    std::map<uint32_t, size_t> jobIndex;
+    for (const auto &pair : before) {
+      jobIndex[pair.first] = jobs.size();
+      jobs.push_back(Job{pair.first, pair.second, {}, GlickoRating()});
+    }
+    for (const auto &g : games) {
+      const GlickoRating &r1 = before.at(g.player1Id);
+      const GlickoRating &r2 = before.at(g.player2Id);
+      jobs[jobIndex.at(g.player1Id)].results.push_back(
+          Glicko2::Result{r2.rating, r2.deviation, g.score1});
+      jobs[jobIndex.at(g.player2Id)].results.push_back(
+          Glicko2::Result{r1.rating, r1.deviation, 1.0 - g.score1});
+    }
+
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, jobs.size());
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < workers; w++) {
+      threads.emplace_back([&, w]() {
+        for (size_t i = w; i < jobs.size(); i += workers) {
+          jobs[i].rating = Glicko2::update(jobs[i].prior, jobs[i].results);
+          jobs[i].rating.period = period;
+        }
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+
+    std::vector<const Job *> local;
+    for (const Job &job : jobs) {
+      UserShard &shard = userShard(job.userId);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.users.find(job.userId);
+      if (it != shard.users.end()) {
+        it->second.glicko = job.rating;
+        local.push_back(&job);
+      }
+    }
+    markDirty(true, false);
+    if (ratedHook) {
+      for (const Job *job : local) {
+        ratedHook(job->userId, job->rating);
+      }
+    }
+
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - started)
+                    .count();
+    std::cout << "Rating period " << period << ": " << games.size()
+              << " games, " << jobs.size() << " players rated in " << ms
+              << " ms using " << workers << " thread(s)" << std::endl;
+  }
+
+  // ==================== LEADERBOARD ====================
+
+  // 1-based rank by rating, 0 for unknown users
+  uint32_t getRank(uint32_t userId) const { return leaderboard.rank(userId); }
+
+  size_t getRankedCount() const { return leaderboard.size(); }
+
+  // One page of the leaderboard starting at 1-based rank `start`
+  std::vector<User> getLeaderboard(uint32_t start, size_t limit) {
+    std::vector<User> page;
+    for (uint32_t userId : leaderboard.range(start, limit)) {
+      page.push_back(getUser(userId));
+    }
+    return page;
+  }
+
+  // ==================== RATING HISTORY ====================
+
+  // Elo series of a user over [from, to] (Unix seconds)
+  bool getRatingHistory(uint32_t userId, uint32_t from, uint32_t to,
+                        size_t maxSamples, RatingHistory::Summary &out) {
+    return ratingHistory.query(userId, from, to, maxSamples, out);
   }
 
   // ==================== PERSISTENCE ====================
 
 private:
-  std::string hashPassword(const char *password) {
-    // Simple hash for demo - in production use bcrypt or similar
-    std::string pwd(password);
-    uint32_t hash = 0;
-    for (char c : pwd) {
-      hash = hash * 31 + c;
+  // Rating of a user held by this node; false for other users
+  bool localGlicko(uint32_t userId, GlickoRating &out) {
+    UserShard &shard = userShard(userId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it == shard.users.end())
+      return false;
+    out = it->second.glicko;
+    return true;
+  }
+
+  // Rating of a user homed on another node from before `period`. Their
+  // home may have closed it already and reported the result.
+  void remoteGlicko(uint32_t userId, uint32_t period, GlickoRating &out) {
+    std::shared_lock<std::shared_mutex> lock(remoteMutex);
+    auto it = remoteUsers.find(userId);
+    if (it == remoteUsers.end())
+      return;
+    out = it->second.glicko;
+    if (out.period != 0 && out.period >= period) {
+      auto prior = remotePriorGlicko.find(userId);
+      out = prior != remotePriorGlicko.end() ? prior->second : GlickoRating();
     }
-    return std::to_string(hash);
   }
 
-  void saveUsers() {
-    std::ofstream file(DATA_DIR + USERS_FILE);
-    if (!file)
+  // Header of a game record without copying in-progress moves
+  GameRecord getGameHeader(uint32_t gameId) {
+    GameShard &shard = gameShard(gameId);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.records.find(gameId);
+    if (it == shard.records.end()) {
+      return GameRecord();
+    }
+    const GameRecord &src = it->second;
+    GameRecord g;
+    g.gameId = src.gameId;
+    g.player1Id = src.player1Id;
+    g.player2Id = src.player2Id;
+    g.player1Name = src.player1Name;
+    g.player2Name = src.player2Name;
+    g.boardSize = src.boardSize;
+    g.winnerId = src.winnerId;
+    g.result = src.result;
+    g.totalMoves = src.totalMoves;
+    g.startTime = src.startTime;
+    g.duration = src.duration;
+    g.eloChange = src.eloChange;
+    return g;
+  }
+
+  // Caller holds the user's shard lock
+  void publishStats(const User &u) {
+    presence.updateStats(u.userId, u.eloRating, u.wins, u.losses, u.draws);
+    leaderboard.set(u.userId, u.eloRating);
+  }
+
+  // One game's outcome for a local user; score is 1 for a win, 0.5 for a
+  // draw and 0 for a loss. Users not stored here are left alone.
+  void applyResult(uint32_t userId, int eloDelta, double score) {
+    UserShard &shard = userShard(userId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.users.find(userId);
+    if (it == shard.users.end()) {
       return;
+    }
+    User &u = it->second;
+    uint16_t before = u.eloRating;
+    u.eloRating += eloDelta;
+    if (score == 1.0) {
+      u.wins++;
+    } else if (score == 0.0) {
+      u.losses++;
+    } else {
+      u.draws++;
+    }
+    publishStats(u);
+    ratingHistory.append(userId, std::time(nullptr), before, u.eloRating);
+  }
+
+  void addUserGame(uint32_t userId, uint32_t gameId) {
+    UserShard &shard = userShard(userId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.games[userId].push_back(gameId);
+  }
 
-    file << userIdCounter << "\n";
-    file << users.size() << "\n";
+  uint32_t currentRatingPeriod() const {
+    return std::time(nullptr) / std::max(1u, ratingPeriodSeconds.load());
+  }
 
-    for (const auto &pair : users) {
-      const User &u = pair.second;
-      file << u.userId << "|" << u.username << "|" << u.email << "|"
-           << u.passwordHash << "|" << u.eloRating << "|" << u.wins << "|"
-           << u.losses << "|" << u.draws << "\n";
+  void ratingPeriodLoop() {
+    std::unique_lock<std::mutex> lock(flushMutex);
+    uint32_t period = currentRatingPeriod();
+    while (!stopping) {
+      flushCv.wait_for(lock, std::chrono::seconds(1));
+      uint32_t now = currentRatingPeriod();
+      if (now == period)
+        continue;
+      period = now;
+      lock.unlock();
+      closeRatingPeriod();
+      lock.lock();
     }
+  }
 
-    file.close();
+  void markDirty(bool users, bool games) {
+    std::lock_guard<std::mutex> lock(flushMutex);
+    usersDirty = usersDirty || users;
+    gamesDirty = gamesDirty || games;
   }
 
-  void loadUsers() {
-    std::ifstream file(DATA_DIR + USERS_FILE);
+  void flushLoop() {
+    std::unique_lock<std::mutex> lock(flushMutex);
+    while (!stopping) {
+      flushCv.wait_for(lock, std::chrono::milliseconds(FLUSH_INTERVAL_MS));
+      bool saveU = usersDirty;
+      bool saveG = gamesDirty;
+      usersDirty = false;
+      gamesDirty = false;
+      lock.unlock();
+
+      if (saveU)
+        saveUsers();
+      if (saveG)
+        saveGames();
+      appendRatingHistory();
+
+      lock.lock();
+    }
+  }
+
+  void saveUsers() {
+    std::lock_guard<std::mutex> fileLock(usersFileMutex);
+
+    // Format each shard under its read lock, write without any lock held
+    std::string body;
+    size_t count = 0;
+    for (UserShard &shard : userShards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (const auto &pair : shard.users) {
+        LegacyLoader::formatUser(pair.second, body);
+        count++;
+      }
+    }
+
+    std::string path = DATA_DIR + USERS_FILE;
+    std::string tmpPath = path + ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary);
     if (!file)
       return;
 
-    std::string line;
+    file << userIdCounter.load() << "\n";
+    file << count << "\n";
+    file << body;
 
-    // Read counter
-    std::getline(file, line);
-    userIdCounter = std::stoul(line);
+    file.close();
+    if (file)
+      std::rename(tmpPath.c_str(), path.c_str());
+  }
 
-    // Read user count
-    std::getline(file, line);
-    size_t count = std::stoul(line);
+  size_t loadUsers() {
+    LegacyLoader::UserData data;
+    if (!LegacyLoader::loadUsers(DATA_DIR + USERS_FILE, data))
+      return 0;
 
-    for (size_t i = 0; i < count; i++) {
-      std::getline(file, line);
-      std::istringstream iss(line);
-      std::string token;
-      User u;
-
-      std::getline(iss, token, '|');
-      u.userId = std::stoul(token);
-      std::getline(iss, u.username, '|');
-      std::getline(iss, u.email, '|');
-      std::getline(iss, u.passwordHash, '|');
-      std::getline(iss, token, '|');
-      u.eloRating = std::stoi(token);
-      std::getline(iss, token, '|');
-      u.wins = std::stoi(token);
-      std::getline(iss, token, '|');
-      u.losses = std::stoi(token);
-      std::getline(iss, token, '|');
-      u.draws = std::stoi(token);
-
-      u.isOnline = false;
-      u.inGame = false;
-
-      users[u.userId] = u;
+    userIdCounter = data.idCounter;
+    for (User &u : data.users) {
       usernameToId[u.username] = u.userId;
+      leaderboard.set(u.userId, u.eloRating);
+      uint32_t id = u.userId;
+      userShard(id).users.emplace(id, std::move(u));
     }
-
-    file.close();
+    return data.users.size();
   }
 
+  struct SavedGame {
+    std::string header;
+    uint32_t gameId;
+    MoveIndexEntry moves;
+  };
+
   void saveGames() {
-    std::ofstream file(DATA_DIR + GAMES_FILE);
+    std::lock_guard<std::mutex> fileLock(gamesFileMutex);
+
+    std::string path = DATA_DIR + GAMES_FILE;
+    std::string tmpPath = path + ".tmp";
+    std::ofstream file(tmpPath, std::ios::binary);
     if (!file)
       return;
 
-    file << gameIdCounter << "\n";
+    // Legacy move lines are copied from the current file, so saving never
+    // has to materialize them
+    std::ifstream oldFile(path, std::ios::binary);
+    std::vector<std::pair<uint32_t, MoveIndexEntry>> textLines;
+
+    file << gameIdCounter.load() << "\n";
+
+    // The count is patched in once all shards are written
+    std::streampos countPos = file.tellp();
+    file << "0000000000\n";
 
     // Only save completed games
     uint32_t completedCount = 0;
-    for (const auto &pair : gameRecords) {
-      if (pair.second.result != 255)
+    std::string raw;
+    std::vector<SavedGame> batch;
+    for (GameShard &shard : gameShards) {
+      batch.clear();
+      {
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        for (const auto &pair : shard.records) {
+          const GameRecord &g = pair.second;
+          if (g.result == 255)
+            continue; // Skip ongoing games
+
+          SavedGame saved;
+          saved.gameId = g.gameId;
+          saved.header =
+              std::to_string(g.gameId) + "|" + std::to_string(g.player1Id) +
+              "|" + std::to_string(g.player2Id) + "|" + g.player1Name + "|" +
+              g.player2Name + "|" + std::to_string((int)g.boardSize) + "|" +
+              std::to_string(g.winnerId) + "|" + std::to_string((int)g.result) +
+              "|" + std::to_string(g.startTime) + "|" +
+              std::to_string(g.duration) + "|" + std::to_string(g.eloChange) +
+              "|" + std::to_string(g.totalMoves) + "\n";
+          auto idx = shard.moveIndex.find(g.gameId);
+          if (idx != shard.moveIndex.end()) {
+            saved.moves = idx->second;
+          } else {
+            saved.moves.offset = 0;
+            saved.moves.length = 0;
+            saved.moves.format = MOVES_TEXT;
+          }
+          batch.push_back(std::move(saved));
+        }
+      }
+
+      for (const SavedGame &saved : batch) {
+        file << saved.header;
+        if (saved.moves.format == MOVES_PACKED) {
+          file << "@" << saved.moves.offset << "," << saved.moves.length;
+        } else {
+          MoveIndexEntry entry;
+          entry.offset = (uint64_t)file.tellp();
+          entry.length = 0;
+          entry.format = MOVES_TEXT;
+          if (saved.moves.length > 0 && oldFile) {
+            raw.resize(saved.moves.length);
+            oldFile.seekg(saved.moves.offset);
+            oldFile.read(&raw[0], saved.moves.length);
+            file << raw;
+            entry.length = saved.moves.length;
+          }
+          textLines.push_back(std::make_pair(saved.gameId, entry));
+        }
+        file << "\n";
         completedCount++;
+      }
     }
-    file << completedCount << "\n";
 
-    for (const auto &pair : gameRecords) {
-      const GameRecord &g = pair.second;
-      if (g.result == 255)
-        continue; // Skip ongoing games
+    char countField[16];
+    snprintf(countField, sizeof(countField), "%010u", completedCount);
+    file.seekp(countPos);
+    file.write(countField, 10);
 
-      file << g.gameId << "|" << g.player1Id << "|" << g.player2Id << "|"
-           << g.player1Name << "|" << g.player2Name << "|" << (int)g.boardSize
-           << "|" << g.winnerId << "|" << (int)g.result << "|" << g.startTime
-           << "|" << g.duration << "|" << g.eloChange << "|" << g.moves.size()
-           << "\n";
+    file.close();
+    oldFile.close();
+    if (!file || std::rename(tmpPath.c_str(), path.c_str()) != 0)
+      return;
 
-      // Save moves
-      for (const auto &m : g.moves) {
-        file << m.moveNumber << "," << m.playerId << "," << (int)m.x << ","
-             << (int)m.y << "," << m.timestamp << ";";
+    // Legacy lines moved within games.dat
+    for (const auto &line : textLines) {
+      GameShard &shard = gameShard(line.first);
+      std::unique_lock<std::shared_mutex> lock(shard.mutex);
+      auto idx = shard.moveIndex.find(line.first);
+      if (idx == shard.moveIndex.end() || idx->second.format == MOVES_TEXT) {
+        shard.moveIndex[line.first] = line.second;
       }
-      file << "\n";
     }
-
-    file.close();
   }
 
-  void loadGames() {
-    std::ifstream file(DATA_DIR + GAMES_FILE);
-    if (!file)
+  // ratings.dat is append-only: new points are written by the flusher
+  void appendRatingHistory() {
+    std::lock_guard<std::mutex> fileLock(ratingsFileMutex);
+    std::vector<RatingHistory::Record> records = ratingHistory.takeAppended();
+    if (records.empty())
       return;
 
-    std::string line;
+    std::string body;
+    for (const RatingHistory::Record &r : records) {
+      RatingHistory::formatRecord(r, body);
+    }
+    std::ofstream file(DATA_DIR + RATINGS_FILE,
+                       std::ios::binary | std::ios::app);
+    if (file) {
+      file.write(body.data(), body.size());
+    }
+  }
 
-    // Read counter
-    std::getline(file, line);
-    if (line.empty())
+  void loadRatingHistory() {
+    std::ifstream file(DATA_DIR + RATINGS_FILE, std::ios::binary);
+    if (!file)
       return;
-    gameIdCounter = std::stoul(line);
+    std::string raw((std::istreambuf_iterator<char>(file)),
+                    std::istreambuf_iterator<char>());
+    // Drop a torn record at the end so later appends stay aligned
+    size_t count = raw.size() / RatingHistory::RECORD_SIZE;
+    if (raw.size() % RatingHistory::RECORD_SIZE != 0) {
+      file.close();
+      if (truncate((DATA_DIR + RATINGS_FILE).c_str(),
+                   count * RatingHistory::RECORD_SIZE) != 0)
+        std::cerr << "Cannot truncate " << RATINGS_FILE << std::endl;
+    }
+    for (size_t i = 0; i < count; i++) {
+      RatingHistory::Record r = RatingHistory::parseRecord(
+          (const uint8_t *)raw.data() + i * RatingHistory::RECORD_SIZE);
+      ratingHistory.load(r.userId, r.point);
+    }
+  }
 
-    // Read game count
-    std::getline(file, line);
-    if (line.empty())
-      return;
-    size_t count = std::stoul(line);
+  PackedMovesPtr packMoves(const GameRecord &g) {
+    auto packed = std::make_shared<std::vector<uint8_t>>();
+    MoveCodec::encode(g.boardSize, g.moves.data(), g.moves.size(), *packed);
+    return packed;
+  }
 
-    for (size_t i = 0; i < count; i++) {
-      std::getline(file, line);
-      if (line.empty())
-        continue;
+  // Append the packed moves of a finished game to moves.dat
+  void archiveMoves(uint32_t gameId, const std::vector<uint8_t> &packed) {
+    MoveIndexEntry entry;
+    {
+      std::lock_guard<std::mutex> fileLock(movesFileMutex);
+      std::ofstream file(DATA_DIR + MOVES_FILE,
+                         std::ios::binary | std::ios::app);
+      if (!file)
+        return;
+      file.seekp(0, std::ios::end);
+
+      entry.offset = (uint64_t)file.tellp();
+      entry.length = packed.size();
+      entry.format = MOVES_PACKED;
+      file.write((const char *)packed.data(), packed.size());
+      file.close();
+      if (!file)
+        return;
+    }
 
-      std::istringstream iss(line);
-      std::string token;
-      GameRecord g;
-
-      std::getline(iss, token, '|');
-      g.gameId = std::stoul(token);
-      std::getline(iss, token, '|');
-      g.player1Id = std::stoul(token);
-      std::getline(iss, token, '|');
-      g.player2Id = std::stoul(token);
-      std::getline(iss, g.player1Name, '|');
-      std::getline(iss, g.player2Name, '|');
-      std::getline(iss, token, '|');
-      g.boardSize = std::stoi(token);
-      std::getline(iss, token, '|');
-      g.winnerId = std::stoul(token);
-      std::getline(iss, token, '|');
-      g.result = std::stoi(token);
-      std::getline(iss, token, '|');
-      g.startTime = std::stoull(token);
-      std::getline(iss, token, '|');
-      g.duration = std::stoul(token);
-      std::getline(iss, token, '|');
-      g.eloChange = std::stoi(token);
-      std::getline(iss, token, '|');
-      size_t moveCount = std::stoul(token);
-
-      // Load moves
-      std::getline(file, line);
-      if (!line.empty() && moveCount > 0) {
-        std::istringstream movesStream(line);
-        std::string moveStr;
-        while (std::getline(movesStream, moveStr, ';')) {
-          if (moveStr.empty())
-            continue;
-          std::istringstream moveIss(moveStr);
-          std::string mToken;
-          MoveLog m;
-
-          std::getline(moveIss, mToken, ',');
-          m.moveNumber = std::stoul(mToken);
-          std::getline(moveIss, mToken, ',');
-          m.playerId = std::stoul(mToken);
-          std::getline(moveIss, mToken, ',');
-          m.x = std::stoi(mToken);
-          std::getline(moveIss, mToken, ',');
-          m.y = std::stoi(mToken);
-          std::getline(moveIss, mToken, ',');
-          m.timestamp = std::stoul(mToken);
-
-          g.moves.push_back(m);
-        }
+    GameShard &shard = gameShard(gameId);
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    shard.moveIndex[gameId] = entry;
+  }
+
+  std::vector<uint8_t> readPackedMoves(uint32_t gameId, uint8_t boardSize) {
+    std::vector<uint8_t> packed;
+
+    // games.dat may be rewritten concurrently, which moves legacy lines;
+    // hold its lock while looking up and reading a text line
+    std::unique_lock<std::mutex> gamesFileLock(gamesFileMutex);
+    MoveIndexEntry entry;
+    {
+      GameShard &shard = gameShard(gameId);
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto idx = shard.moveIndex.find(gameId);
+      if (idx == shard.moveIndex.end() || idx->second.length == 0) {
+        MoveCodec::putVarint(packed, 0);
+        return packed;
       }
+      entry = idx->second;
+    }
 
-      gameRecords[g.gameId] = g;
+    bool isPacked = entry.format == MOVES_PACKED;
+    if (isPacked) {
+      gamesFileLock.unlock(); // moves.dat is append-only
     }
 
-    file.close();
+    std::ifstream file(DATA_DIR + (isPacked ? MOVES_FILE : GAMES_FILE),
+                       std::ios::binary);
+    std::string raw(entry.length, '\0');
+    if (file) {
+      file.seekg(entry.offset);
+      file.read(&raw[0], entry.length);
+    }
+    if (!file) {
+      MoveCodec::putVarint(packed, 0);
+      return packed;
+    }
+
+    if (isPacked) {
+      packed.assign(raw.begin(), raw.end());
+    } else {
+      std::vector<MoveLog> moves;
+      LegacyLoader::parseMoveLine(raw.data(), raw.data() + raw.size(), moves);
+      MoveCodec::encode(boardSize, moves.data(), moves.size(), packed);
+    }
+    return packed;
+  }
+
+  size_t loadGames() {
+    LegacyLoader::GameData data;
+    if (!LegacyLoader::loadGames(DATA_DIR + GAMES_FILE, data))
+      return 0;
+
+    gameIdCounter = data.idCounter;
+    for (size_t i = 0; i < data.games.size(); i++) {
+      GameRecord &g = data.games[i];
+      GameShard &shard = gameShard(g.gameId);
+      userShard(g.player1Id).games[g.player1Id].push_back(g.gameId);
+      userShard(g.player2Id).games[g.player2Id].push_back(g.gameId);
+      // Only remember where the moves are; they are parsed on demand
+      shard.moveIndex.emplace(g.gameId, data.moveLines[i]);
+      uint32_t id = g.gameId;
+      shard.records.emplace(id, std::move(g));
+    }
+
+    // History walks each user's games from the newest one
+    for (UserShard &shard : userShards) {
+      for (auto &pair : shard.games) {
+        std::sort(pair.second.begin(), pair.second.end());
+      }
+    }
+    return data.games.size();
   }
 
 public:
   ~Database() {
+    {
+      std::lock_guard<std::mutex> lock(flushMutex);
+      stopping = true;
+    }
+    flushCv.notify_all();
+    flusher.join();
+    if (ratingThread.joinable()) {
+      ratingThread.join();
+      ratedHook = nullptr; // Its owner may be gone
+      closeRatingPeriod();
+    }
+
     saveUsers();
     saveGames();
+    appendRatingHistory();
     std::cout << "Database saved and closed" << std::endl;
   }
 };
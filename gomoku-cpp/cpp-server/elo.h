@@ -0,0 +1,21 @@
+#ifndef ELO_H
+#define ELO_H
+
+#include <cmath>
+#include <cstdint>
+
+// Elo rating math shared by the live server and the rating rebuild tool
+class Elo {
+public:
+  static const int DEFAULT_K = 32;
+  static const uint16_t INITIAL_RATING = 1000;
+
+  // Points the winner takes from the loser
+  static int16_t change(int winnerElo, int loserElo, int k = DEFAULT_K) {
+    double expectedWinner =
+        1.0 / (1.0 + std::pow(10.0, (loserElo - winnerElo) / 400.0));
+    return (int16_t)(k * (1.0 - expectedWinner));
+  }
+};
+
+#endif
@@ -5,9 +5,13 @@
 #include <chrono>
 #include <cstdint>
 #include <functional>
+#include <mutex>
 #include <thread>
 
 struct GameState {
+  std::mutex mutex; // Serializes moves, draw offers and the game's end
+  bool finished;    // Set once by whoever ends the game
+
   uint32_t gameId;
   uint32_t player1Id;
   uint32_t player2Id;
@@ -31,7 +35,7 @@ struct GameState {
   uint32_t lastGameWinner;
 
   GameState()
-      : board(nullptr), moveCount(0), timeLimit(0), player1TimeLeft(0),
+      : finished(false), board(nullptr), moveCount(0), timeLimit(0), player1TimeLeft(0),
         player2TimeLeft(0), timerActive(false), drawOffered(false),
         drawOfferedBy(0), lastGameWinner(0) {}
 
@@ -181,6 +185,23 @@ public:
     }
   }
 
+  // Pack a board at 2 bits per cell, four cells per byte from the low
+  // bits; `out` must hold (boardSize * boardSize + 3) / 4 bytes
+  static void packBoard(const uint8_t *board, uint8_t boardSize,
+                        uint8_t *out) {
+    int totalCells = boardSize * boardSize;
+    for (int i = 0; i < (totalCells + 3) / 4; i++) {
+      out[i] = 0;
+    }
+    for (int i = 0; i < totalCells; i++) {
+      out[i / 4] |= (board[i] & 3) << (2 * (i % 4));
+    }
+  }
+
+  static void packBoard(GameState *game, uint8_t *out) {
+    packBoard(game->board, game->boardSize, out);
+  }
+
   // Create a string representation of the board
   static std::string boardToString(GameState *game) {
     std::string result;
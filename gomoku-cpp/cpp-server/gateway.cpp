@@ -0,0 +1,553 @@
+// Connection gateway: terminates client connections and forwards their
+// frames to the server over a few multiplexed upstreams (see mux.h).
+//
+// Clients connect to the gateway as they would to the server; it passes
+// their bytes through untouched, so every wire version and feature except
+// shared memory works as before. The server keeps one thread per upstream
+// rather than one per client, and never sees clients come and go at the
+// socket level. A client that stops reading is dropped here once
+// CLIENT_BUFFER_LIMIT bytes are waiting for it, without ever holding up
+// the server's writes. A client whose upstream is backed up is not read
+// from until the upstream drains.
+//
+// Everything runs on one epoll loop. Upstreams that fail are reopened
+// every RECONNECT_MS; their clients are dropped, and reconnect and resume
+// their sessions as they would after losing the server.
+//
+// The server only accepts upstreams from gateways holding the key it was
+// given with --gateway-key, and the gateway needs the same file.
+//
+//   gomoku_gateway --gateway-key=PATH [--upstreams=N] [--server=HOST:PORT]
+//                  [PORT]
+
+#include "mux.h"
+#include "protocol.h"
+#include "shared_key.h"
+#include "wire.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+class Gateway {
+public:
+  // Bytes a client may fall behind before it is dropped, bytes queued for
+  // an upstream before its clients stop being read, and how much is read
+  // from a socket per event
+  static const size_t CLIENT_BUFFER_LIMIT = 1 << 20;
+  static const size_t UPSTREAM_BUFFER_LIMIT = 4 << 20;
+  static const size_t READ_CHUNK = 64 << 10;
+
+  // How often failed upstreams are reopened, how long opening one may
+  // take, and how often traffic is logged while there is any
+  static const int RECONNECT_MS = 1000;
+  static const int HANDSHAKE_TIMEOUT_SEC = 2;
+  static const int REPORT_SEC = 60;
+
+  Gateway(int port, const std::string &serverHost, int serverPort,
+          size_t upstreamCount, const SharedKey &key)
+      : serverHost(serverHost), serverPort(serverPort), key(key), nextId(1),
+        upstreams(upstreamCount), forwarded(0), delivered(0), dropped(0) {
+    epoll = epoll_create1(EPOLL_CLOEXEC);
+    listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (epoll < 0 || listener < 0) {
+      std::cerr << "Error creating socket" << std::endl;
+      exit(1);
+    }
+    int opt = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &opt, sizeof(opt));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = INADDR_ANY;
+    addr.sin_port = htons(port);
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      std::cerr << "Error binding socket" << std::endl;
+      exit(1);
+    }
+    if (listen(listener, 1024) < 0) {
+      std::cerr << "Error listening" << std::endl;
+      exit(1);
+    }
+    watch(listener, EPOLLIN, LISTENER, 0);
+
+    for (size_t i = 0; i < upstreams.size(); i++) {
+      openUpstream(i);
+    }
+    std::cout << "Gateway on port " << port << ", " << connectedUpstreams()
+              << "/" << upstreams.size() << " upstreams to " << serverHost
+              << ":" << serverPort << std::endl;
+  }
+
+  void run() {
+    auto lastReconnect = std::chrono::steady_clock::now();
+    auto lastReport = lastReconnect;
+    struct epoll_event events[256];
+    while (true) {
+      int n = epoll_wait(epoll, events, 256, RECONNECT_MS);
+      if (n < 0 && errno != EINTR) {
+        std::cerr << "epoll_wait failed" << std::endl;
+        return;
+      }
+      for (int i = 0; i < n; i++) {
+        uint64_t key = events[i].data.u64;
+        uint32_t kind = key >> 32;
+        uint32_t value = (uint32_t)key;
+        if (kind == LISTENER) {
+          acceptClients();
+        } else if (kind == UPSTREAM) {
+          upstreamEvent(value, events[i].events);
+        } else {
+          clientEvent(value, events[i].events);
+        }
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      if (now - lastReconnect >= std::chrono::milliseconds(RECONNECT_MS)) {
+        for (size_t i = 0; i < upstreams.size(); i++) {
+          if (upstreams[i].socket < 0)
+            openUpstream(i);
+        }
+        lastReconnect = now;
+      }
+      if (now - lastReport >= std::chrono::seconds(REPORT_SEC)) {
+        if (forwarded + delivered > 0) {
+          std::cout << "[*] Gateway: " << clients.size() << " clients, "
+                    << connectedUpstreams() << "/" << upstreams.size()
+                    << " upstreams, " << forwarded << " B up, " << delivered
+                    << " B down, " << dropped << " slow clients dropped"
+                    << std::endl;
+        }
+        forwarded = delivered = dropped = 0;
+        lastReport = now;
+      }
+    }
+  }
+
+private:
+  // What an epoll event is for, in the top half of its key
+  enum Kind { LISTENER, UPSTREAM, CLIENT };
+
+  // Bytes waiting to be written to a socket
+  struct Outbox {
+    std::vector<char> data;
+    size_t sent = 0;
+    size_t size() const { return data.size() - sent; }
+  };
+
+  struct Upstream {
+    int socket = -1;
+    std::vector<char> in; // Start of a record not yet complete
+    Outbox out;
+    std::vector<uint32_t> paused; // Clients not read while out is full
+    size_t clients = 0;
+  };
+
+  struct Client {
+    int socket;
+    size_t upstream;
+    Outbox out;
+    bool paused = false;  // Not read until its upstream drains
+    bool closing = false; // Dropped by the server; closed once flushed
+  };
+
+  std::string serverHost;
+  int serverPort;
+  SharedKey key; // Proves this gateway to the server
+  int epoll;
+  int listener;
+  uint32_t nextId; // Client ids are never reused
+  std::vector<Upstream> upstreams;
+  std::unordered_map<uint32_t, Client> clients;
+  uint64_t forwarded; // Client bytes sent upstream since the last report
+  uint64_t delivered; // Server bytes sent to clients
+  size_t dropped;     // Clients that fell too far behind
+
+  void watch(int socket, uint32_t events, Kind kind, uint32_t value,
+             int op = EPOLL_CTL_ADD) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.u64 = ((uint64_t)kind << 32) | value;
+    epoll_ctl(epoll, op, socket, &ev);
+  }
+
+  size_t connectedUpstreams() const {
+    size_t n = 0;
+    for (const Upstream &u : upstreams) {
+      n += u.socket >= 0;
+    }
+    return n;
+  }
+
+  // Write what the socket takes; false if it failed
+  static bool flush(int socket, Outbox &box) {
+    while (box.size() > 0) {
+      ssize_t n = send(socket, box.data.data() + box.sent, box.size(),
+                       MSG_NOSIGNAL);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        break;
+      if (n <= 0)
+        return false;
+      box.sent += n;
+    }
+    if (box.sent > box.data.size() / 2) {
+      box.data.erase(box.data.begin(), box.data.begin() + box.sent);
+      box.sent = 0;
+    }
+    return true;
+  }
+
+  // ==================== UPSTREAMS ====================
+
+  // Connect and trade MSG_GATEWAY_HELLO frames with the server, proving
+  // the key both hold (see shared_key.h), blocking for at most
+  // HANDSHAKE_TIMEOUT_SEC per step, then hand the socket to the loop
+  void openUpstream(size_t index) {
+    int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+      return;
+    struct timeval timeout;
+    timeout.tv_sec = HANDSHAKE_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(serverPort);
+    inet_pton(AF_INET, serverHost.c_str(), &addr.sin_addr);
+    KeyHello ours = key.hello(index);
+    KeyHello theirs;
+    if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        !sendHello(sock, ours) || !recvHello(sock, theirs) ||
+        !key.verify(false, ours, theirs)) {
+      close(sock);
+      return;
+    }
+    key.prove(false, theirs, ours);
+    if (!sendHello(sock, ours)) {
+      close(sock);
+      return;
+    }
+
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL) | O_NONBLOCK);
+    upstreams[index] = Upstream();
+    upstreams[index].socket = sock;
+    watch(sock, EPOLLIN, UPSTREAM, index);
+    std::cout << "[+] Upstream " << index << " connected" << std::endl;
+  }
+
+  static bool sendHello(int sock, const KeyHello &hello) {
+    std::vector<char> frame = WireCodec::frame(WIRE_V1, MSG_GATEWAY_HELLO, 0,
+                                               0, &hello, sizeof(hello));
+    return send(sock, frame.data(), frame.size(), MSG_NOSIGNAL) ==
+           (ssize_t)frame.size();
+  }
+
+  // The server's answer, or an error frame if it refused the gateway
+  static bool recvHello(int sock, KeyHello &hello) {
+    MessageHeader header;
+    if (recv(sock, &header, sizeof(header), MSG_WAITALL) != sizeof(header) ||
+        header.type != MSG_GATEWAY_HELLO || header.length != sizeof(hello))
+      return false;
+    return recv(sock, &hello, sizeof(hello), MSG_WAITALL) == sizeof(hello);
+  }
+
+  // Its clients are dropped without telling the server, which drops them
+  // too when it sees the upstream close
+  void closeUpstream(size_t index) {
+    Upstream &u = upstreams[index];
+    std::vector<uint32_t> ids;
+    for (auto &pair : clients) {
+      if (pair.second.upstream == index)
+        ids.push_back(pair.first);
+    }
+    for (uint32_t id : ids) {
+      close(clients[id].socket);
+      clients.erase(id);
+    }
+    close(u.socket);
+    u = Upstream();
+    std::cout << "[-] Upstream " << index << " lost (" << ids.size()
+              << " clients dropped)" << std::endl;
+  }
+
+  // Closes the upstream, and so drops its clients, if the write fails
+  void queue(size_t index, uint32_t id, uint8_t kind,
+             const void *data = nullptr, uint32_t length = 0) {
+    Upstream &u = upstreams[index];
+    if (u.socket < 0)
+      return;
+    bool idle = u.out.size() == 0;
+    appendMuxRecord(u.out.data, id, kind, data, length);
+    if (idle) {
+      if (!flush(u.socket, u.out)) {
+        closeUpstream(index);
+        return;
+      }
+      if (u.out.size() > 0)
+        watch(u.socket, EPOLLIN | EPOLLOUT, UPSTREAM, index, EPOLL_CTL_MOD);
+    }
+  }
+
+  void upstreamEvent(size_t index, uint32_t events) {
+    Upstream &u = upstreams[index];
+    if (u.socket < 0)
+      return;
+    if (events & EPOLLOUT) {
+      if (!flush(u.socket, u.out)) {
+        closeUpstream(index);
+        return;
+      }
+      if (u.out.size() == 0)
+        watch(u.socket, EPOLLIN, UPSTREAM, index, EPOLL_CTL_MOD);
+      if (u.out.size() < UPSTREAM_BUFFER_LIMIT / 2)
+        resumeClients(index);
+    }
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+      size_t have = u.in.size();
+      u.in.resize(have + READ_CHUNK);
+      ssize_t n = recv(u.socket, u.in.data() + have, READ_CHUNK, 0);
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        u.in.resize(have);
+        return;
+      }
+      if (n <= 0) {
+        closeUpstream(index);
+        return;
+      }
+      u.in.resize(have + n);
+      if (!handleRecords(index))
+        closeUpstream(index);
+    }
+  }
+
+  // Every whole record in the upstream's input; false if one is malformed.
+  // Answering may close the upstream, which ends the walk.
+  bool handleRecords(size_t index) {
+    Upstream &u = upstreams[index];
+    size_t used = 0;
+    while (u.socket >= 0 && u.in.size() - used >= sizeof(MuxHeader)) {
+      MuxHeader header;
+      memcpy(&header, u.in.data() + used, sizeof(header));
+      if (header.length > MUX_RECORD_MAX)
+        return false;
+      if (u.in.size() - used - sizeof(header) < header.length)
+        break;
+      const char *data = u.in.data() + used + sizeof(header);
+      used += sizeof(header) + header.length;
+
+      auto it = clients.find(header.connection);
+      if (it == clients.end() || it->second.upstream != index)
+        continue; // Already closed
+      if (header.kind == MUX_DATA) {
+        deliver(header.connection, data, header.length);
+      } else if (header.kind == MUX_CLOSE) {
+        it->second.closing = true;
+        if (it->second.out.size() == 0) {
+          dropClient(header.connection, false);
+        } else {
+          watch(it->second.socket, EPOLLOUT, CLIENT, header.connection,
+                EPOLL_CTL_MOD);
+        }
+        queue(index, header.connection, MUX_CLOSE);
+      }
+    }
+    if (u.socket >= 0)
+      u.in.erase(u.in.begin(), u.in.begin() + used);
+    return true;
+  }
+
+  void resumeClients(size_t index) {
+    Upstream &u = upstreams[index];
+    for (uint32_t id : u.paused) {
+      auto it = clients.find(id);
+      if (it == clients.end() || it->second.closing)
+        continue;
+      it->second.paused = false;
+      uint32_t events = EPOLLIN | EPOLLRDHUP;
+      if (it->second.out.size() > 0)
+        events |= EPOLLOUT;
+      watch(it->second.socket, events, CLIENT, id, EPOLL_CTL_MOD);
+    }
+    u.paused.clear();
+  }
+
+  // ==================== CLIENTS ====================
+
+  // New clients go to the connected upstream with the fewest
+  void acceptClients() {
+    while (true) {
+      int sock = accept4(listener, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+      if (sock < 0)
+        return;
+      size_t best = upstreams.size();
+      for (size_t i = 0; i < upstreams.size(); i++) {
+        if (upstreams[i].socket >= 0 &&
+            (best == upstreams.size() ||
+             upstreams[i].clients < upstreams[best].clients))
+          best = i;
+      }
+      if (best == upstreams.size()) {
+        close(sock); // No server to forward to
+        continue;
+      }
+
+      int one = 1;
+      setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      uint32_t id = nextId++;
+      if (nextId == 0)
+        nextId = 1;
+      Client client;
+      client.socket = sock;
+      client.upstream = best;
+      clients[id] = client;
+      upstreams[best].clients++;
+      watch(sock, EPOLLIN | EPOLLRDHUP, CLIENT, id);
+      queue(best, id, MUX_OPEN);
+    }
+  }
+
+  // Close a client; the server is told unless it asked for it
+  void dropClient(uint32_t id, bool tellServer) {
+    auto it = clients.find(id);
+    if (it == clients.end())
+      return;
+    size_t index = it->second.upstream;
+    close(it->second.socket);
+    clients.erase(it);
+    upstreams[index].clients--;
+    if (tellServer)
+      queue(index, id, MUX_CLOSE);
+  }
+
+  void clientEvent(uint32_t id, uint32_t events) {
+    auto it = clients.find(id);
+    if (it == clients.end())
+      return;
+    Client &client = it->second;
+    if ((events & EPOLLERR) ||
+        ((events & EPOLLHUP) && (client.paused || client.closing))) {
+      dropClient(id, !client.closing);
+      return;
+    }
+    if (events & EPOLLOUT) {
+      if (!flush(client.socket, client.out)) {
+        dropClient(id, !client.closing);
+        return;
+      }
+      if (client.out.size() == 0) {
+        if (client.closing) {
+          dropClient(id, false);
+          return;
+        }
+        watch(client.socket, client.paused ? 0 : EPOLLIN | EPOLLRDHUP, CLIENT,
+              id, EPOLL_CTL_MOD);
+      }
+    }
+    if (client.closing || client.paused ||
+        !(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)))
+      return;
+
+    char buffer[READ_CHUNK];
+    ssize_t n = recv(client.socket, buffer, sizeof(buffer), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      return;
+    if (n <= 0) {
+      dropClient(id, true);
+      return;
+    }
+    forwarded += n;
+    size_t index = client.upstream;
+    queue(index, id, MUX_DATA, buffer, n);
+    Upstream &u = upstreams[index];
+    if (u.socket < 0)
+      return; // Lost, with the client
+    if (u.out.size() > UPSTREAM_BUFFER_LIMIT) {
+      client.paused = true;
+      u.paused.push_back(id);
+      watch(client.socket, client.out.size() > 0 ? (uint32_t)EPOLLOUT : 0,
+            CLIENT, id, EPOLL_CTL_MOD);
+    }
+  }
+
+  // A frame from the server; a client too far behind is dropped
+  void deliver(uint32_t id, const char *data, size_t length) {
+    Client &client = clients[id];
+    if (client.closing)
+      return;
+    bool idle = client.out.size() == 0;
+    client.out.data.insert(client.out.data.end(), data, data + length);
+    delivered += length;
+    if (idle && !flush(client.socket, client.out)) {
+      dropClient(id, true);
+      return;
+    }
+    if (client.out.size() > CLIENT_BUFFER_LIMIT) {
+      dropped++;
+      dropClient(id, true);
+    } else if (idle && client.out.size() > 0) {
+      watch(client.socket,
+            (client.paused ? 0 : EPOLLIN | EPOLLRDHUP) | EPOLLOUT, CLIENT, id,
+            EPOLL_CTL_MOD);
+    }
+  }
+};
+
+int main(int argc, char *argv[]) {
+  int port = 9888;
+  std::string serverHost = "127.0.0.1";
+  int serverPort = 8888;
+  size_t upstreamCount = 4; // --upstreams=N
+  SharedKey key('G');        // --gateway-key=PATH
+  bool keyed = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--gateway-key=", 14) == 0) {
+      keyed = key.load(argv[i] + 14);
+    } else if (strncmp(argv[i], "--upstreams=", 12) == 0) {
+      upstreamCount = std::max(1, std::atoi(argv[i] + 12));
+    } else if (strncmp(argv[i], "--server=", 9) == 0) {
+      std::string server = argv[i] + 9;
+      size_t colon = server.rfind(':');
+      if (colon != std::string::npos) {
+        serverPort = std::atoi(server.c_str() + colon + 1);
+        server.resize(colon);
+      }
+      serverHost = server;
+    } else {
+      port = std::atoi(argv[i]);
+    }
+  }
+
+  if (!keyed) {
+    std::cerr << "The gateway needs --gateway-key=PATH, the server's key "
+                 "file of at least 16 bytes"
+              << std::endl;
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  Gateway gateway(port, serverHost, serverPort, upstreamCount, key);
+  gateway.run();
+  return 0;
+}
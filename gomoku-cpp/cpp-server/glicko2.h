@@ -0,0 +1,136 @@
+#ifndef GLICKO2_H
+#define GLICKO2_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "records.h"
+
+// Glicko-2 rating update (Glickman, "Example of the Glicko-2 system").
+// Ratings are stored on the Glicko scale (1500 / 350) and converted to the
+// internal Glicko-2 scale for the computation.
+class Glicko2 {
+public:
+  struct Result {
+    double opponentRating;
+    double opponentDeviation;
+    double score; // 1 = win, 0.5 = draw, 0 = loss
+  };
+
+  // System constant: how much volatility may change per period
+  static constexpr double TAU = 0.5;
+  static constexpr double MAX_DEVIATION = 350.0;
+
+  // Deviation after `periods` rating periods without games
+  static double inflate(const GlickoRating &r, uint32_t periods) {
+    double phi = r.deviation / SCALE;
+    phi = std::sqrt(phi * phi + periods * r.volatility * r.volatility);
+    return std::min(MAX_DEVIATION, phi * SCALE);
+  }
+
+  // Rating after one period with the given results. `r.deviation` must
+  // already include any inflation for inactive periods before this one.
+  static GlickoRating update(const GlickoRating &r,
+                             const std::vector<Result> &results) {
+    double mu = (r.rating - 1500.0) / SCALE;
+    double phi = r.deviation / SCALE;
+    double sigma = r.volatility;
+
+    if (results.empty()) {
+      GlickoRating out = r;
+      out.deviation = inflate(r, 1);
+      return out;
+    }
+
+    // Estimated variance and improvement from the period's games
+    double vInv = 0, deltaSum = 0;
+    for (const Result &res : results) {
+      double muJ = (res.opponentRating - 1500.0) / SCALE;
+      double phiJ = res.opponentDeviation / SCALE;
+      double g = 1.0 / std::sqrt(1.0 + 3.0 * phiJ * phiJ / (M_PI * M_PI));
+      double e = 1.0 / (1.0 + std::exp(-g * (mu - muJ)));
+      vInv += g * g * e * (1.0 - e);
+      deltaSum += g * (res.score - e);
+    }
+    double v = 1.0 / vInv;
+    double delta = v * deltaSum;
+
+    // New volatility: solve f(x) = 0 with the Illinois method
+    double a = std::log(sigma * sigma);
+    auto f = [&](double x) {
+      double ex = std::exp(x);
+      double d = phi * phi + v + ex;
+      return ex * (delta * delta - phi * phi - v - ex) / (2.0 * d * d) -
+             (x - a) / (TAU * TAU);
+    };
+    double A = a, B;
+    if (delta * delta > phi * phi + v) {
+      B = std::log(delta * delta - phi * phi - v);
+    } else {
+      int k = 1;
+      while (f(a - k * TAU) < 0)
+        k++;
+      B = a - k * TAU;
+    }
+    double fA = f(A), fB = f(B);
+    for (int i = 0; i < 100 && std::fabs(B - A) > EPSILON; i++) {
+      double C = A + (A - B) * fA / (fB - fA);
+      double fC = f(C);
+      if (fC * fB <= 0) {
+        A = B;
+        fA = fB;
+      } else {
+        fA /= 2.0;
+      }
+      B = C;
+      fB = fC;
+    }
+    double newSigma = std::exp(A / 2.0);
+
+    double phiStar = std::sqrt(phi * phi + newSigma * newSigma);
+    double newPhi = 1.0 / std::sqrt(1.0 / (phiStar * phiStar) + 1.0 / v);
+    double newMu = mu + newPhi * newPhi * deltaSum;
+
+    GlickoRating out;
+    out.rating = newMu * SCALE + 1500.0;
+    out.deviation = std::min(MAX_DEVIATION, newPhi * SCALE);
+    out.volatility = newSigma;
+    out.period = r.period;
+    return out;
+  }
+
+private:
+  static constexpr double SCALE = 173.7178;
+  static constexpr double EPSILON = 0.000001;
+};
+
+// Results collected during the current rating period
+class RatingPeriod {
+public:
+  struct Game {
+    uint32_t player1Id;
+    uint32_t player2Id;
+    double score1; // Player 1's score
+  };
+
+  void record(uint32_t player1Id, uint32_t player2Id, double score1) {
+    std::lock_guard<std::mutex> lock(mutex);
+    games.push_back(Game{player1Id, player2Id, score1});
+  }
+
+  std::vector<Game> take() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Game> out;
+    out.swap(games);
+    return out;
+  }
+
+private:
+  std::mutex mutex;
+  std::vector<Game> games;
+};
+
+#endif
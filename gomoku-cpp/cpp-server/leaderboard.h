@@ -0,0 +1,202 @@
+#ifndef LEADERBOARD_H
+#define LEADERBOARD_H
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+// Rank index over player ratings. Players are ordered by rating (highest
+// first) and then by userId. They are kept in a treap keyed on that order
+// whose nodes count their subtree, so a rating change, a rank lookup and
+// a "k-th player" search each cost O(log n) expected, however many
+// players share a rating. Listing a page walks the tree in order from the
+// first player on it.
+class Leaderboard {
+private:
+  struct Node {
+    uint32_t userId;
+    uint16_t rating;
+    uint32_t priority; // Max-heap order keeps the tree balanced
+    uint32_t size;     // Nodes in this subtree
+    uint32_t left;     // Indexes into nodes; NONE if absent
+    uint32_t right;
+  };
+  static const uint32_t NONE = 0;
+
+  mutable std::shared_mutex mutex;
+  std::vector<Node> nodes; // nodes[NONE] is an empty sentinel of size 0
+  std::vector<uint32_t> freeNodes;
+  uint32_t root;
+  uint32_t seed; // xorshift state for priorities
+  std::unordered_map<uint32_t, uint16_t> ratings; // userId -> rating
+
+  // Whether (rating, userId) a is ranked before b
+  static bool before(uint16_t ra, uint32_t ua, uint16_t rb, uint32_t ub) {
+    return ra != rb ? ra > rb : ua < ub;
+  }
+
+  bool before(uint32_t node, uint16_t rating, uint32_t userId) const {
+    return before(nodes[node].rating, nodes[node].userId, rating, userId);
+  }
+
+  void update(uint32_t node) {
+    Node &n = nodes[node];
+    n.size = 1 + nodes[n.left].size + nodes[n.right].size;
+  }
+
+  // Split a subtree into the nodes ranked before the key and the rest
+  void split(uint32_t node, uint16_t rating, uint32_t userId, uint32_t &left,
+             uint32_t &right) {
+    if (node == NONE) {
+      left = right = NONE;
+      return;
+    }
+    if (before(node, rating, userId)) {
+      split(nodes[node].right, rating, userId, nodes[node].right, right);
+      left = node;
+    } else {
+      split(nodes[node].left, rating, userId, left, nodes[node].left);
+      right = node;
+    }
+    update(node);
+  }
+
+  // Join two subtrees whose nodes are all ranked left before right
+  uint32_t merge(uint32_t left, uint32_t right) {
+    if (left == NONE || right == NONE)
+      return left != NONE ? left : right;
+    if (nodes[left].priority > nodes[right].priority) {
+      nodes[left].right = merge(nodes[left].right, right);
+      update(left);
+      return left;
+    }
+    nodes[right].left = merge(left, nodes[right].left);
+    update(right);
+    return right;
+  }
+
+  void insert(uint32_t userId, uint16_t rating) {
+    uint32_t node;
+    if (!freeNodes.empty()) {
+      node = freeNodes.back();
+      freeNodes.pop_back();
+    } else {
+      node = nodes.size();
+      nodes.emplace_back();
+    }
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    nodes[node] = Node{userId, rating, seed, 1, NONE, NONE};
+
+    uint32_t left, right;
+    split(root, rating, userId, left, right);
+    root = merge(merge(left, node), right);
+  }
+
+  // Remove the player's node from a subtree, returning its new root
+  uint32_t erase(uint32_t node, uint32_t userId, uint16_t rating) {
+    if (node == NONE)
+      return NONE;
+    Node &n = nodes[node];
+    if (n.userId == userId && n.rating == rating) {
+      freeNodes.push_back(node);
+      return merge(n.left, n.right);
+    }
+    if (before(node, rating, userId))
+      n.right = erase(n.right, userId, rating);
+    else
+      n.left = erase(n.left, userId, rating);
+    update(node);
+    return node;
+  }
+
+public:
+  Leaderboard() : nodes(1, Node{0, 0, 0, 0, NONE, NONE}), root(NONE),
+                  seed(2463534242u) {}
+
+  // Add a player or move them to a new rating
+  void set(uint32_t userId, uint16_t rating) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = ratings.find(userId);
+    if (it != ratings.end()) {
+      if (it->second == rating)
+        return;
+      root = erase(root, userId, it->second);
+      it->second = rating;
+    } else {
+      ratings.emplace(userId, rating);
+    }
+    insert(userId, rating);
+  }
+
+  // 1-based rank of the player, 0 if unknown
+  uint32_t rank(uint32_t userId) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = ratings.find(userId);
+    if (it == ratings.end())
+      return 0;
+    uint16_t rating = it->second;
+    uint32_t ahead = 0;
+    uint32_t node = root;
+    while (node != NONE) {
+      const Node &n = nodes[node];
+      if (n.userId == userId && n.rating == rating)
+        return ahead + nodes[n.left].size + 1;
+      if (before(node, rating, userId)) {
+        ahead += nodes[n.left].size + 1;
+        node = n.right;
+      } else {
+        node = n.left;
+      }
+    }
+    return 0;
+  }
+
+  // Up to `limit` userIds starting at 1-based rank `start`
+  std::vector<uint32_t> range(uint32_t start, size_t limit) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    std::vector<uint32_t> ids;
+    if (start == 0 || start > ratings.size() || limit == 0)
+      return ids;
+
+    // Descend to the start-th player, keeping the nodes ranked after the
+    // path on a stack, as an in-order walk from there would
+    std::vector<uint32_t> after;
+    uint32_t node = root;
+    uint32_t k = start - 1; // Players to skip within `node`
+    while (node != NONE) {
+      const Node &n = nodes[node];
+      uint32_t leftSize = nodes[n.left].size;
+      if (k < leftSize) {
+        after.push_back(node);
+        node = n.left;
+      } else if (k == leftSize) {
+        after.push_back(node);
+        break;
+      } else {
+        k -= leftSize + 1;
+        node = n.right;
+      }
+    }
+
+    while (!after.empty() && ids.size() < limit) {
+      uint32_t next = after.back();
+      after.pop_back();
+      ids.push_back(nodes[next].userId);
+      for (uint32_t n = nodes[next].right; n != NONE; n = nodes[n].left) {
+        after.push_back(n);
+      }
+    }
+    return ids;
+  }
+
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return ratings.size();
+  }
+};
+
+#endif
@@ -0,0 +1,351 @@
+#ifndef LEGACY_LOADER_H
+#define LEGACY_LOADER_H
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "records.h"
+
+// Parallel loader for the pipe/semicolon text format of users.dat and
+// games.dat. The file is memory-mapped, split into chunks at record
+// boundaries and every chunk is parsed by its own thread with
+// std::from_chars. Move lines are not parsed here; only their location is
+// recorded so the Database can load them on demand. A move line is either
+// the legacy text list or an "@offset,length" reference into moves.dat.
+class LegacyLoader {
+public:
+  struct UserData {
+    uint32_t idCounter = 1;
+    std::vector<User> users;
+  };
+
+  struct GameData {
+    uint32_t idCounter = 1;
+    std::vector<GameRecord> games;
+    std::vector<MoveIndexEntry> moveLines; // Parallel to games
+  };
+
+  static bool loadUsers(const std::string &path, UserData &out) {
+    MappedFile file(path);
+    if (!file.data)
+      return false;
+
+    auto started = std::chrono::steady_clock::now();
+    const char *p = file.data;
+    const char *end = file.data + file.size;
+
+    uint64_t counter = 0, count = 0;
+    if (!parseLineNumber(p, end, counter) || !parseLineNumber(p, end, count))
+      return false;
+    out.idCounter = (uint32_t)counter;
+
+    std::vector<Chunk> chunks = split(p, end, false);
+    std::vector<std::vector<User>> parts(chunks.size());
+    runParallel(chunks.size(), [&](size_t i) {
+      parseUsers(chunks[i].begin, chunks[i].end, parts[i]);
+    });
+
+    out.users.clear();
+    out.users.reserve(count);
+    for (auto &part : parts) {
+      std::move(part.begin(), part.end(), std::back_inserter(out.users));
+    }
+
+    report("users", out.users.size(), count, file.size, chunks.size(),
+           started);
+    return true;
+  }
+
+  static bool loadGames(const std::string &path, GameData &out) {
+    MappedFile file(path);
+    if (!file.data)
+      return false;
+
+    auto started = std::chrono::steady_clock::now();
+    const char *p = file.data;
+    const char *end = file.data + file.size;
+
+    uint64_t counter = 0, count = 0;
+    if (!parseLineNumber(p, end, counter) || !parseLineNumber(p, end, count))
+      return false;
+    out.idCounter = (uint32_t)counter;
+
+    std::vector<Chunk> chunks = split(p, end, true);
+    std::vector<GameData> parts(chunks.size());
+    runParallel(chunks.size(), [&](size_t i) {
+      parseGames(file.data, chunks[i].begin, chunks[i].end, parts[i]);
+    });
+
+    out.games.clear();
+    out.moveLines.clear();
+    out.games.reserve(count);
+    out.moveLines.reserve(count);
+    for (auto &part : parts) {
+      std::move(part.games.begin(), part.games.end(),
+                std::back_inserter(out.games));
+      out.moveLines.insert(out.moveLines.end(), part.moveLines.begin(),
+                           part.moveLines.end());
+    }
+
+    report("games", out.games.size(), count, file.size, chunks.size(),
+           started);
+    return true;
+  }
+
+  // Append one users.dat line
+  static void formatUser(const User &u, std::string &out) {
+    out += std::to_string(u.userId) + "|" + u.username + "|" + u.email + "|" +
+           u.passwordHash + "|" + std::to_string(u.eloRating) + "|" +
+           std::to_string(u.wins) + "|" + std::to_string(u.losses) + "|" +
+           std::to_string(u.draws) + "|" + std::to_string(u.glicko.rating) +
+           "|" + std::to_string(u.glicko.deviation) + "|" +
+           std::to_string(u.glicko.volatility) + "|" +
+           std::to_string(u.glicko.period) + "\n";
+  }
+
+  // Parse a "n,p,x,y,t;n,p,x,y,t;..." move line
+  static void parseMoveLine(const char *p, const char *end,
+                            std::vector<MoveLog> &moves) {
+    while (p < end) {
+      const char *next = std::find(p, end, ';');
+      Fields f(p, next);
+      MoveLog m;
+      uint32_t x = 0, y = 0;
+      if (f.number(m.moveNumber, ',') && f.number(m.playerId, ',') &&
+          f.number(x, ',') && f.number(y, ',') && f.number(m.timestamp, ',')) {
+        m.x = (uint8_t)x;
+        m.y = (uint8_t)y;
+        moves.push_back(m);
+      }
+      p = next + (next < end ? 1 : 0);
+    }
+  }
+
+private:
+  // Below this size a file is parsed by a single thread
+  static const size_t MIN_CHUNK_BYTES = 256 * 1024;
+
+  struct MappedFile {
+    const char *data;
+    size_t size;
+
+    explicit MappedFile(const std::string &path) : data(nullptr), size(0) {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+        return;
+      struct stat st;
+      if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void *mem = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mem != MAP_FAILED) {
+          madvise(mem, st.st_size, MADV_SEQUENTIAL);
+          data = (const char *)mem;
+          size = st.st_size;
+        }
+      }
+      close(fd);
+    }
+
+    ~MappedFile() {
+      if (data)
+        munmap((void *)data, size);
+    }
+  };
+
+  struct Chunk {
+    const char *begin;
+    const char *end;
+  };
+
+  // Sequential reader over the separator-delimited fields of one line
+  struct Fields {
+    const char *p;
+    const char *end;
+
+    Fields(const char *p, const char *end) : p(p), end(end) {}
+
+    bool text(std::string &out, char sep) {
+      if (p > end)
+        return false;
+      const char *stop = std::find(p, end, sep);
+      out.assign(p, stop);
+      p = stop + 1;
+      return true;
+    }
+
+    template <typename T> bool number(T &out, char sep) {
+      if (p > end)
+        return false;
+      const char *stop = std::find(p, end, sep);
+      auto res = std::from_chars(p, stop, out);
+      p = stop + 1;
+      return res.ec == std::errc() && res.ptr == stop;
+    }
+  };
+
+  static const char *lineEnd(const char *p, const char *end) {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return nl ? nl : end;
+  }
+
+  static bool parseLineNumber(const char *&p, const char *end,
+                              uint64_t &out) {
+    if (p >= end)
+      return false;
+    const char *stop = lineEnd(p, end);
+    auto res = std::from_chars(p, stop, out);
+    p = stop < end ? stop + 1 : end;
+    return res.ec == std::errc();
+  }
+
+  // Game records span a header line and a move line. Move lines never
+  // contain '|', so a record starts at the first line that does.
+  static bool isGameHeader(const char *line, const char *end) {
+    return memchr(line, '|', lineEnd(line, end) - line) != nullptr;
+  }
+
+  static std::vector<Chunk> split(const char *begin, const char *end,
+                                  bool games) {
+    size_t bytes = end - begin;
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::max<size_t>(1, std::min(workers, bytes / MIN_CHUNK_BYTES));
+
+    std::vector<Chunk> chunks;
+    const char *start = begin;
+    for (size_t i = 1; i <= workers && start < end; i++) {
+      const char *stop = (i == workers) ? end : begin + bytes * i / workers;
+      if (stop < start)
+        stop = start;
+      // Move the cut forward to the start of the next record
+      while (stop < end) {
+        stop = lineEnd(stop, end);
+        if (stop < end)
+          stop++;
+        if (!games || stop >= end || isGameHeader(stop, end))
+          break;
+      }
+      chunks.push_back({start, stop});
+      start = stop;
+    }
+    return chunks;
+  }
+
+  template <typename Fn> static void runParallel(size_t n, Fn fn) {
+    if (n <= 1) {
+      if (n == 1)
+        fn(0);
+      return;
+    }
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < n; i++) {
+      threads.emplace_back(fn, i);
+    }
+    fn(0);
+    for (auto &t : threads) {
+      t.join();
+    }
+  }
+
+  static void parseUsers(const char *p, const char *end,
+                         std::vector<User> &out) {
+    while (p < end) {
+      const char *stop = lineEnd(p, end);
+      Fields f(p, stop);
+      User u;
+      if (f.number(u.userId, '|') && f.text(u.username, '|') &&
+          f.text(u.email, '|') && f.text(u.passwordHash, '|') &&
+          f.number(u.eloRating, '|') && f.number(u.wins, '|') &&
+          f.number(u.losses, '|') && f.number(u.draws, '|')) {
+        // Optional Glicko-2 fields, absent in older files
+        if (f.p < stop) {
+          GlickoRating &g = u.glicko;
+          if (!(f.number(g.rating, '|') && f.number(g.deviation, '|') &&
+                f.number(g.volatility, '|') && f.number(g.period, '|')))
+            g = GlickoRating();
+        }
+        u.isOnline = false;
+        u.inGame = false;
+        out.push_back(std::move(u));
+      }
+      p = stop < end ? stop + 1 : end;
+    }
+  }
+
+  static void parseGames(const char *base, const char *p, const char *end,
+                         GameData &out) {
+    while (p < end) {
+      const char *stop = lineEnd(p, end);
+      if (stop == p) { // Stray empty line
+        p = stop + 1;
+        continue;
+      }
+
+      Fields f(p, stop);
+      GameRecord g;
+      uint32_t boardSize = 0, result = 0;
+      bool ok = f.number(g.gameId, '|') && f.number(g.player1Id, '|') &&
+                f.number(g.player2Id, '|') && f.text(g.player1Name, '|') &&
+                f.text(g.player2Name, '|') && f.number(boardSize, '|') &&
+                f.number(g.winnerId, '|') && f.number(result, '|') &&
+                f.number(g.startTime, '|') && f.number(g.duration, '|') &&
+                f.number(g.eloChange, '|') && f.number(g.totalMoves, '|');
+      g.boardSize = (uint8_t)boardSize;
+      g.result = (uint8_t)result;
+
+      // The move line follows the header
+      p = stop < end ? stop + 1 : end;
+      MoveIndexEntry entry;
+      entry.offset = p - base;
+      entry.length = 0;
+      entry.format = MOVES_TEXT;
+      if (p < end && !isGameHeader(p, end)) {
+        const char *movesEnd = lineEnd(p, end);
+        entry.length = (uint32_t)(movesEnd - p);
+        if (*p == '@') {
+          Fields ref(p + 1, movesEnd);
+          entry.format = MOVES_PACKED;
+          ok = ok && ref.number(entry.offset, ',') &&
+               ref.number(entry.length, ',');
+        }
+        p = movesEnd < end ? movesEnd + 1 : end;
+      }
+
+      if (ok) {
+        out.games.push_back(std::move(g));
+        out.moveLines.push_back(entry);
+      }
+    }
+  }
+
+  static void report(const char *what, size_t loaded, size_t expected,
+                     size_t bytes, size_t chunks,
+                     std::chrono::steady_clock::time_point started) {
+    double secs = std::chrono::duration<double>(
+                      std::chrono::steady_clock::now() - started)
+                      .count();
+    double mb = bytes / (1024.0 * 1024.0);
+    std::cout << "Loaded " << loaded << " " << what << " (" << mb << " MB) in "
+              << secs * 1000.0 << " ms using " << chunks << " thread(s)";
+    if (secs > 0) {
+      std::cout << " - " << (size_t)(loaded / secs) << " records/s, "
+                << mb / secs << " MB/s";
+    }
+    std::cout << std::endl;
+    if (loaded != expected) {
+      std::cerr << "Warning: " << what << " file declares " << expected
+                << " records but " << loaded << " were parsed" << std::endl;
+    }
+  }
+};
+
+#endif
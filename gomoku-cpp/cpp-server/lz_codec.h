@@ -0,0 +1,154 @@
+#ifndef LZ_CODEC_H
+#define LZ_CODEC_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Fast LZ77 block compression in the LZ4 block format, for large message
+// payloads.
+//
+// A block is a run of sequences, each
+//
+//   uint8   token: literal count (high nibble), match length - 4 (low)
+//   bytes   more literal count if its nibble is 15, 255 per byte until one
+//           below 255
+//   bytes   the literals
+//   uint16  match offset back into the output, little-endian
+//   bytes   more match length, as for the literal count
+//
+// and the last sequence stops after its literals. Matches are found with a
+// single hash table of 4-byte prefixes and no chain, so compression is one
+// pass over the input; it favours speed over ratio, which suits payloads of
+// zero-padded names and repeated records.
+class LzCodec {
+public:
+  static const size_t MIN_MATCH = 4;
+  static const size_t MAX_OFFSET = 65535;
+
+  // Append the compressed form of src to out
+  static void compress(const uint8_t *src, size_t length,
+                       std::vector<char> &out) {
+    uint32_t table[1 << HASH_BITS]; // Position + 1 of a prefix; 0 if none
+    memset(table, 0, sizeof(table));
+
+    size_t anchor = 0; // First byte not yet emitted
+    size_t i = 0;
+    while (i + MIN_MATCH <= length) {
+      uint32_t prefix = read32(src + i);
+      uint32_t &slot = table[hash(prefix)];
+      size_t candidate = slot;
+      slot = (uint32_t)(i + 1);
+      if (candidate == 0 || i - (candidate - 1) > MAX_OFFSET ||
+          read32(src + candidate - 1) != prefix) {
+        i++;
+        continue;
+      }
+
+      size_t ref = candidate - 1;
+      size_t match = MIN_MATCH;
+      while (i + match < length && src[ref + match] == src[i + match]) {
+        match++;
+      }
+      sequence(out, src + anchor, i - anchor, i - ref, match);
+      i += match;
+      anchor = i;
+    }
+    sequence(out, src + anchor, length - anchor, 0, 0);
+  }
+
+  // Expand a block that must come to exactly `rawLength` bytes; false if
+  // it is malformed or does not
+  static bool decompress(const uint8_t *src, size_t length, size_t rawLength,
+                         std::vector<char> &out) {
+    out.resize(rawLength);
+    char *dst = out.data();
+    size_t pos = 0;
+    const uint8_t *p = src;
+    const uint8_t *end = src + length;
+
+    while (p < end) {
+      uint8_t token = *p++;
+      size_t literals = token >> 4;
+      if (literals == 15 && !moreLength(p, end, literals))
+        return false;
+      if (literals > (size_t)(end - p) || literals > rawLength - pos)
+        return false;
+      memcpy(dst + pos, p, literals);
+      p += literals;
+      pos += literals;
+      if (p == end)
+        break; // Last sequence
+
+      if (end - p < 2)
+        return false;
+      size_t offset = p[0] | (p[1] << 8);
+      p += 2;
+      size_t match = token & 15;
+      if (match == 15 && !moreLength(p, end, match))
+        return false;
+      match += MIN_MATCH;
+      if (offset == 0 || offset > pos || match > rawLength - pos)
+        return false;
+      // Byte by byte: a match may overlap the bytes it produces
+      for (size_t k = 0; k < match; k++, pos++) {
+        dst[pos] = dst[pos - offset];
+      }
+    }
+    return pos == rawLength;
+  }
+
+private:
+  static const int HASH_BITS = 12;
+
+  static uint32_t read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  static uint32_t hash(uint32_t prefix) {
+    return (prefix * 2654435761u) >> (32 - HASH_BITS);
+  }
+
+  static void putLength(std::vector<char> &out, size_t n) {
+    while (n >= 255) {
+      out.push_back((char)255);
+      n -= 255;
+    }
+    out.push_back((char)n);
+  }
+
+  static bool moreLength(const uint8_t *&p, const uint8_t *end,
+                         size_t &length) {
+    uint8_t byte;
+    do {
+      if (p >= end)
+        return false;
+      byte = *p++;
+      length += byte;
+    } while (byte == 255);
+    return true;
+  }
+
+  // `match` is 0 for the last sequence, which has no match part
+  static void sequence(std::vector<char> &out, const uint8_t *literals,
+                       size_t count, size_t offset, size_t match) {
+    size_t extra = match ? match - MIN_MATCH : 0;
+    uint8_t token = (uint8_t)((count < 15 ? count : 15) << 4);
+    if (match)
+      token |= (uint8_t)(extra < 15 ? extra : 15);
+    out.push_back((char)token);
+    if (count >= 15)
+      putLength(out, count - 15);
+    out.insert(out.end(), literals, literals + count);
+    if (!match)
+      return;
+    out.push_back((char)(offset & 0xFF));
+    out.push_back((char)(offset >> 8));
+    if (extra >= 15)
+      putLength(out, extra - 15);
+  }
+};
+
+#endif
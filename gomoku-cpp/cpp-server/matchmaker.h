@@ -0,0 +1,235 @@
+#ifndef MATCHMAKER_H
+#define MATCHMAKER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Automatic pairing of players who asked for a game with the same board
+// size and time limit. Each (boardSize, timeLimit) pool is ordered by Elo,
+// so a newcomer is checked against its nearest neighbours in O(log n).
+// The acceptable rating gap grows the longer a player waits; a periodic
+// sweep pairs adjacent players whose widened windows now overlap.
+class Matchmaker {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Match {
+    uint32_t player1Id; // Waited longest, moves first
+    uint32_t player2Id;
+    uint8_t boardSize;
+    uint16_t timeLimit;
+  };
+
+  struct WaitStats {
+    size_t samples;
+    uint32_t p50Ms;
+    uint32_t p90Ms;
+    uint32_t p99Ms;
+  };
+
+private:
+  // Rating window: BASE at enqueue, +GROWTH per second waited, up to MAX
+  static const int WINDOW_BASE = 50;
+  static const int WINDOW_GROWTH_PER_SEC = 10;
+  static const int WINDOW_MAX = 500;
+
+  // Most recent time-to-match samples kept for percentiles
+  static const size_t WAIT_SAMPLES = 4096;
+
+  struct Ticket {
+    uint32_t userId;
+    Clock::time_point queuedAt;
+  };
+
+  typedef uint32_t PoolKey; // boardSize << 16 | timeLimit
+  typedef std::multimap<uint16_t, Ticket> Pool; // elo -> ticket
+
+  struct Location {
+    PoolKey key;
+    Pool::iterator it;
+  };
+
+  std::mutex mutex;
+  std::map<PoolKey, Pool> pools;
+  std::unordered_map<uint32_t, Location> queued; // userId -> pool entry
+
+  std::vector<uint32_t> waits; // Ring of time-to-match samples in ms
+  size_t nextWait;
+  size_t matchedTotal;
+
+  static PoolKey poolKey(uint8_t boardSize, uint16_t timeLimit) {
+    return (PoolKey)boardSize << 16 | timeLimit;
+  }
+
+  static int window(const Ticket &t, Clock::time_point now) {
+    auto waited =
+        std::chrono::duration_cast<std::chrono::seconds>(now - t.queuedAt);
+    return std::min<int>(WINDOW_MAX,
+                         WINDOW_BASE + waited.count() * WINDOW_GROWTH_PER_SEC);
+  }
+
+  static bool compatible(Pool::iterator a, Pool::iterator b,
+                         Clock::time_point now) {
+    int gap = std::abs((int)a->first - (int)b->first);
+    return gap <= window(a->second, now) && gap <= window(b->second, now);
+  }
+
+  // Caller holds the mutex. Removes both tickets and records the match.
+  Match pair(PoolKey key, Pool &pool, Pool::iterator a, Pool::iterator b,
+             Clock::time_point now) {
+    if (b->second.queuedAt < a->second.queuedAt)
+      std::swap(a, b);
+
+    Match m;
+    m.player1Id = a->second.userId;
+    m.player2Id = b->second.userId;
+    m.boardSize = key >> 16;
+    m.timeLimit = key & 0xFFFF;
+
+    for (Pool::iterator it : {a, b}) {
+      recordWait(now - it->second.queuedAt);
+      queued.erase(it->second.userId);
+      pool.erase(it);
+    }
+    return m;
+  }
+
+  void recordWait(Clock::duration waited) {
+    uint32_t ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(waited).count();
+    if (waits.size() < WAIT_SAMPLES) {
+      waits.push_back(ms);
+    } else {
+      waits[nextWait] = ms;
+    }
+    nextWait = (nextWait + 1) % WAIT_SAMPLES;
+    matchedTotal++;
+  }
+
+  bool removeLocked(uint32_t userId) {
+    auto it = queued.find(userId);
+    if (it == queued.end())
+      return false;
+    auto poolIt = pools.find(it->second.key);
+    poolIt->second.erase(it->second.it);
+    if (poolIt->second.empty())
+      pools.erase(poolIt);
+    queued.erase(it);
+    return true;
+  }
+
+public:
+  Matchmaker() : nextWait(0), matchedTotal(0) {}
+
+  // Queue a player, replacing any earlier ticket. If a compatible player is
+  // already waiting, both are dequeued and the match is returned.
+  bool enqueue(uint32_t userId, uint16_t elo, uint8_t boardSize,
+               uint16_t timeLimit, Match &match) {
+    std::lock_guard<std::mutex> lock(mutex);
+    removeLocked(userId);
+
+    Clock::time_point now = Clock::now();
+    PoolKey key = poolKey(boardSize, timeLimit);
+    Pool &pool = pools[key];
+    Pool::iterator self = pool.emplace(elo, Ticket{userId, now});
+    queued[userId] = Location{key, self};
+
+    // Nearest neighbours by rating on either side
+    Pool::iterator best = pool.end();
+    int bestGap = 0;
+    if (self != pool.begin()) {
+      Pool::iterator below = std::prev(self);
+      best = below;
+      bestGap = elo - below->first;
+    }
+    Pool::iterator above = std::next(self);
+    if (above != pool.end() &&
+        (best == pool.end() || above->first - elo < bestGap)) {
+      best = above;
+    }
+
+    if (best != pool.end() && compatible(self, best, now)) {
+      match = pair(key, pool, self, best, now);
+      if (pool.empty())
+        pools.erase(key);
+      return true;
+    }
+    return false;
+  }
+
+  bool remove(uint32_t userId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return removeLocked(userId);
+  }
+
+  // Pair every adjacent couple whose windows have widened enough
+  std::vector<Match> sweep() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Match> matches;
+    Clock::time_point now = Clock::now();
+
+    for (auto poolIt = pools.begin(); poolIt != pools.end();) {
+      Pool &pool = poolIt->second;
+      Pool::iterator it = pool.begin();
+      while (it != pool.end()) {
+        Pool::iterator next = std::next(it);
+        if (next == pool.end())
+          break;
+        if (compatible(it, next, now)) {
+          Pool::iterator after = std::next(next);
+          matches.push_back(pair(poolIt->first, pool, it, next, now));
+          it = after;
+        } else {
+          it = next;
+        }
+      }
+      poolIt = pool.empty() ? pools.erase(poolIt) : std::next(poolIt);
+    }
+    return matches;
+  }
+
+  // Players waiting in the pool a queued player belongs to (0 if none)
+  size_t poolSize(uint8_t boardSize, uint16_t timeLimit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = pools.find(poolKey(boardSize, timeLimit));
+    return it == pools.end() ? 0 : it->second.size();
+  }
+
+  size_t size() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return queued.size();
+  }
+
+  size_t matched() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return matchedTotal;
+  }
+
+  // Time-to-match percentiles over the most recent samples
+  WaitStats waitStats() {
+    std::vector<uint32_t> sorted;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      sorted = waits;
+    }
+    WaitStats stats = {sorted.size(), 0, 0, 0};
+    if (sorted.empty())
+      return stats;
+    std::sort(sorted.begin(), sorted.end());
+    auto at = [&](double q) {
+      return sorted[std::min(sorted.size() - 1, (size_t)(q * sorted.size()))];
+    };
+    stats.p50Ms = at(0.50);
+    stats.p90Ms = at(0.90);
+    stats.p99Ms = at(0.99);
+    return stats;
+  }
+};
+
+#endif
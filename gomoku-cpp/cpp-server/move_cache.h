@@ -0,0 +1,89 @@
+#ifndef MOVE_CACHE_H
+#define MOVE_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// LRU cache for move lists of completed games that were loaded on demand.
+// Memory is bounded by an approximate byte budget; entries handed out to
+// callers stay alive through the shared_ptr even after they are evicted.
+template <typename T> class MoveListCache {
+public:
+  typedef std::shared_ptr<const std::vector<T>> ListPtr;
+
+private:
+  struct Entry {
+    uint32_t gameId;
+    ListPtr moves;
+    size_t bytes;
+  };
+
+  std::list<Entry> lru; // front = most recently used
+  std::unordered_map<uint32_t, typename std::list<Entry>::iterator> index;
+  size_t capacityBytes;
+  size_t usedBytes;
+
+  static size_t entryBytes(const std::vector<T> &moves) {
+    return sizeof(Entry) + moves.capacity() * sizeof(T);
+  }
+
+  void evict() {
+    while (usedBytes > capacityBytes && !lru.empty()) {
+      Entry &victim = lru.back();
+      usedBytes -= victim.bytes;
+      index.erase(victim.gameId);
+      lru.pop_back();
+    }
+  }
+
+public:
+  explicit MoveListCache(size_t capacityBytes)
+      : capacityBytes(capacityBytes), usedBytes(0) {}
+
+  ListPtr get(uint32_t gameId) {
+    auto it = index.find(gameId);
+    if (it == index.end()) {
+      return nullptr;
+    }
+    lru.splice(lru.begin(), lru, it->second);
+    return it->second->moves;
+  }
+
+  void put(uint32_t gameId, ListPtr moves) {
+    erase(gameId);
+
+    Entry entry;
+    entry.gameId = gameId;
+    entry.bytes = entryBytes(*moves);
+    entry.moves = std::move(moves);
+
+    // A single list larger than the whole budget is served but not kept
+    if (entry.bytes > capacityBytes) {
+      return;
+    }
+
+    usedBytes += entry.bytes;
+    lru.push_front(std::move(entry));
+    index[gameId] = lru.begin();
+    evict();
+  }
+
+  void erase(uint32_t gameId) {
+    auto it = index.find(gameId);
+    if (it != index.end()) {
+      usedBytes -= it->second->bytes;
+      lru.erase(it->second);
+      index.erase(it);
+    }
+  }
+
+  size_t size() const { return lru.size(); }
+  size_t bytesUsed() const { return usedBytes; }
+  size_t capacity() const { return capacityBytes; }
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef MOVE_CODEC_H
+#define MOVE_CODEC_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Packed move list shared by the game store and MSG_GAME_LOG_RESPONSE.
+//
+//   varint  moveCount
+//   per move:
+//     cell     1 byte (x << 4 | y) on boards up to 16x16, else 2 bytes (x, y)
+//     varint   zigzag(timestamp - previous timestamp)
+//
+// Move numbers and players are implied by order: move i (0-based) is move
+// number i + 1 and belongs to player 1 when i is even, player 2 otherwise.
+class MoveCodec {
+public:
+  static bool compactCells(uint8_t boardSize) { return boardSize <= 16; }
+
+  // Appends to any byte container
+  template <typename Bytes> static void putVarint(Bytes &out, uint64_t value) {
+    while (value >= 0x80) {
+      out.push_back((typename Bytes::value_type)(value | 0x80));
+      value >>= 7;
+    }
+    out.push_back((typename Bytes::value_type)value);
+  }
+
+  static bool getVarint(const uint8_t *&p, const uint8_t *end,
+                        uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+      uint8_t byte = *p++;
+      value |= (uint64_t)(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  // Encode any sequence of moves exposing x, y and timestamp members
+  template <typename Move>
+  static void encode(uint8_t boardSize, const Move *moves, size_t count,
+                     std::vector<uint8_t> &out) {
+    bool compact = compactCells(boardSize);
+    out.reserve(out.size() + 2 + count * (compact ? 2 : 3));
+    putVarint(out, count);
+
+    int64_t prev = 0;
+    for (size_t i = 0; i < count; i++) {
+      const Move &m = moves[i];
+      if (compact) {
+        out.push_back((uint8_t)((m.x << 4) | (m.y & 0x0F)));
+      } else {
+        out.push_back(m.x);
+        out.push_back(m.y);
+      }
+      int64_t delta = (int64_t)m.timestamp - prev;
+      putVarint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+      prev = m.timestamp;
+    }
+  }
+
+  // Decode a packed list, calling fn(index, x, y, timestamp) per move.
+  // Returns false on truncated or malformed input.
+  template <typename Fn>
+  static bool decode(uint8_t boardSize, const uint8_t *p, size_t length,
+                     Fn fn) {
+    const uint8_t *end = p + length;
+    bool compact = compactCells(boardSize);
+
+    uint64_t count;
+    if (!getVarint(p, end, count))
+      return false;
+
+    int64_t timestamp = 0;
+    for (uint64_t i = 0; i < count; i++) {
+      uint8_t x, y;
+      if (compact) {
+        if (p >= end)
+          return false;
+        x = *p >> 4;
+        y = *p & 0x0F;
+        p++;
+      } else {
+        if (end - p < 2)
+          return false;
+        x = p[0];
+        y = p[1];
+        p += 2;
+      }
+
+      uint64_t zz;
+      if (!getVarint(p, end, zz))
+        return false;
+      timestamp += (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+      fn((uint32_t)i, x, y, (uint32_t)timestamp);
+    }
+    return true;
+  }
+
+  // Number of moves in a packed list without decoding it
+  static uint32_t count(const uint8_t *p, size_t length) {
+    uint64_t n = 0;
+    getVarint(p, p + length, n);
+    return (uint32_t)n;
+  }
+};
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef MUX_H
+#define MUX_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "protocol.h"
+
+// Upstream between a connection gateway (gateway.cpp) and the server.
+//
+// A gateway opens a few connections to the server's TCP port, and starts
+// each with a handshake of MSG_GATEWAY_HELLO frames in v1 framing, which
+// proves it holds the server's gateway key (see shared_key.h). From then
+// on the connection carries only mux records in both directions:
+//
+//   MuxHeader  the client's id on the gateway, the kind, the data length
+//   bytes      data
+//
+// MUX_OPEN announces a new client. MUX_DATA carries its bytes: from the
+// gateway, whatever the client sent, in any split; from the server, whole
+// frames in the wire version the client negotiated. The server reads each
+// client's frames as it would from a socket of its own.
+//
+// MUX_CLOSE from the gateway means the client is gone, and its id is
+// never used again. MUX_CLOSE from the server asks the gateway to drop the
+// client once what was sent to it is flushed; the gateway answers with its
+// own MUX_CLOSE. Records for an id that is closed are ignored. If the
+// upstream itself fails, all of its clients are gone.
+enum MuxKind {
+  MUX_OPEN = 1,
+  MUX_DATA = 2,
+  MUX_CLOSE = 3
+};
+
+struct MuxHeader {
+  uint32_t connection; // Client id, chosen by the gateway; never 0
+  uint8_t kind;        // MuxKind
+  uint32_t length;     // Bytes of data that follow
+} __attribute__((packed));
+
+// Largest record either side accepts
+const uint32_t MUX_RECORD_MAX = 32 << 20;
+
+// Append a record to an upstream's output
+inline void appendMuxRecord(std::vector<char> &out, uint32_t connection,
+                            uint8_t kind, const void *data = nullptr,
+                            uint32_t length = 0) {
+  MuxHeader header;
+  header.connection = connection;
+  header.kind = kind;
+  header.length = length;
+  const char *h = (const char *)&header;
+  out.insert(out.end(), h, h + sizeof(header));
+  if (length > 0)
+    out.insert(out.end(), (const char *)data, (const char *)data + length);
+}
+
+#endif
@@ -0,0 +1,385 @@
+#ifndef PASSWORD_HASH_H
+#define PASSWORD_HASH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+// SHA-256 (FIPS 180-4), only what PBKDF2-HMAC-SHA256 needs
+class Sha256 {
+public:
+  static const size_t DIGEST_SIZE = 32;
+  static const size_t BLOCK_SIZE = 64;
+
+  Sha256() { reset(); }
+
+  void reset() {
+    static const uint32_t init[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372,
+                                     0xa54ff53a, 0x510e527f, 0x9b05688c,
+                                     0x1f83d9ab, 0x5be0cd19};
+    memcpy(state, init, sizeof(state));
+    bufferLen = 0;
+    totalLen = 0;
+  }
+
+  void update(const uint8_t *data, size_t len) {
+    totalLen += len;
+    while (len > 0) {
+      size_t n = std::min(len, BLOCK_SIZE - bufferLen);
+      memcpy(buffer + bufferLen, data, n);
+      bufferLen += n;
+      data += n;
+      len -= n;
+      if (bufferLen == BLOCK_SIZE) {
+        compress(buffer);
+        bufferLen = 0;
+      }
+    }
+  }
+
+  void finish(uint8_t out[DIGEST_SIZE]) {
+    uint64_t bits = totalLen * 8;
+    uint8_t pad = 0x80;
+    update(&pad, 1);
+    pad = 0;
+    while (bufferLen != BLOCK_SIZE - 8) {
+      update(&pad, 1);
+    }
+    uint8_t length[8];
+    for (int i = 0; i < 8; i++) {
+      length[i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+    update(length, 8);
+    for (int i = 0; i < 8; i++) {
+      for (int j = 0; j < 4; j++) {
+        out[4 * i + j] = (uint8_t)(state[i] >> (24 - 8 * j));
+      }
+    }
+  }
+
+private:
+  uint32_t state[8];
+  uint8_t buffer[BLOCK_SIZE];
+  size_t bufferLen;
+  uint64_t totalLen;
+
+  static uint32_t rotr(uint32_t x, int n) { return (x >> n) | (x << (32 - n)); }
+
+  void compress(const uint8_t *block) {
+    static const uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+        0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+        0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+        0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+        0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+        0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+        0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+        0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+        0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+             (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+    }
+    for (int i = 16; i < 64; i++) {
+      uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+    uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; i++) {
+      uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+      uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+      uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+};
+
+// scrypt (RFC 7914) on top of PBKDF2-HMAC-SHA256
+class Scrypt {
+public:
+  static void pbkdf2(const uint8_t *password, size_t passwordLen,
+                     const uint8_t *salt, size_t saltLen, uint32_t iterations,
+                     uint8_t *out, size_t outLen) {
+    // HMAC key block, hashed first if longer than a block
+    uint8_t key[Sha256::BLOCK_SIZE] = {0};
+    if (passwordLen > Sha256::BLOCK_SIZE) {
+      Sha256 h;
+      h.update(password, passwordLen);
+      h.finish(key);
+    } else {
+      memcpy(key, password, passwordLen);
+    }
+    uint8_t ipad[Sha256::BLOCK_SIZE], opad[Sha256::BLOCK_SIZE];
+    for (size_t i = 0; i < Sha256::BLOCK_SIZE; i++) {
+      ipad[i] = key[i] ^ 0x36;
+      opad[i] = key[i] ^ 0x5c;
+    }
+    auto hmac = [&](const uint8_t *a, size_t aLen, const uint8_t *b,
+                    size_t bLen, uint8_t mac[Sha256::DIGEST_SIZE]) {
+      Sha256 inner;
+      inner.update(ipad, sizeof(ipad));
+      inner.update(a, aLen);
+      inner.update(b, bLen);
+      inner.finish(mac);
+      Sha256 outer;
+      outer.update(opad, sizeof(opad));
+      outer.update(mac, Sha256::DIGEST_SIZE);
+      outer.finish(mac);
+    };
+
+    for (uint32_t blockIndex = 1; outLen > 0; blockIndex++) {
+      uint8_t counter[4] = {(uint8_t)(blockIndex >> 24),
+                            (uint8_t)(blockIndex >> 16),
+                            (uint8_t)(blockIndex >> 8), (uint8_t)blockIndex};
+      uint8_t u[Sha256::DIGEST_SIZE], t[Sha256::DIGEST_SIZE];
+      hmac(salt, saltLen, counter, 4, u);
+      memcpy(t, u, sizeof(t));
+      for (uint32_t i = 1; i < iterations; i++) {
+        hmac(u, sizeof(u), nullptr, 0, u);
+        for (size_t j = 0; j < sizeof(t); j++) {
+          t[j] ^= u[j];
+        }
+      }
+      size_t n = std::min(outLen, sizeof(t));
+      memcpy(out, t, n);
+      out += n;
+      outLen -= n;
+    }
+  }
+
+  // Uses 128 * r * n bytes of memory; n must be a power of two
+  static void derive(const uint8_t *password, size_t passwordLen,
+                     const uint8_t *salt, size_t saltLen, uint64_t n,
+                     uint32_t r, uint32_t p, uint8_t *out, size_t outLen) {
+    size_t blockWords = 32 * r; // 128 * r bytes
+    std::vector<uint8_t> b(p * blockWords * 4);
+    pbkdf2(password, passwordLen, salt, saltLen, 1, b.data(), b.size());
+
+    std::vector<uint32_t> x(blockWords), y(blockWords), v(n * blockWords);
+    for (uint32_t i = 0; i < p; i++) {
+      uint8_t *chunk = b.data() + i * blockWords * 4;
+      for (size_t k = 0; k < blockWords; k++) {
+        x[k] = (uint32_t)chunk[4 * k] | (uint32_t)chunk[4 * k + 1] << 8 |
+               (uint32_t)chunk[4 * k + 2] << 16 |
+               (uint32_t)chunk[4 * k + 3] << 24;
+      }
+      roMix(x.data(), y.data(), v.data(), n, r);
+      for (size_t k = 0; k < blockWords; k++) {
+        for (int j = 0; j < 4; j++) {
+          chunk[4 * k + j] = (uint8_t)(x[k] >> (8 * j));
+        }
+      }
+    }
+    pbkdf2(password, passwordLen, b.data(), b.size(), 1, out, outLen);
+  }
+
+private:
+  static uint32_t rotl(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+  static void salsa208(uint32_t b[16]) {
+    uint32_t x[16];
+    memcpy(x, b, sizeof(x));
+    for (int i = 0; i < 8; i += 2) {
+      x[4] ^= rotl(x[0] + x[12], 7);
+      x[8] ^= rotl(x[4] + x[0], 9);
+      x[12] ^= rotl(x[8] + x[4], 13);
+      x[0] ^= rotl(x[12] + x[8], 18);
+      x[9] ^= rotl(x[5] + x[1], 7);
+      x[13] ^= rotl(x[9] + x[5], 9);
+      x[1] ^= rotl(x[13] + x[9], 13);
+      x[5] ^= rotl(x[1] + x[13], 18);
+      x[14] ^= rotl(x[10] + x[6], 7);
+      x[2] ^= rotl(x[14] + x[10], 9);
+      x[6] ^= rotl(x[2] + x[14], 13);
+      x[10] ^= rotl(x[6] + x[2], 18);
+      x[3] ^= rotl(x[15] + x[11], 7);
+      x[7] ^= rotl(x[3] + x[15], 9);
+      x[11] ^= rotl(x[7] + x[3], 13);
+      x[15] ^= rotl(x[11] + x[7], 18);
+      x[1] ^= rotl(x[0] + x[3], 7);
+      x[2] ^= rotl(x[1] + x[0], 9);
+      x[3] ^= rotl(x[2] + x[1], 13);
+      x[0] ^= rotl(x[3] + x[2], 18);
+      x[6] ^= rotl(x[5] + x[4], 7);
+      x[7] ^= rotl(x[6] + x[5], 9);
+      x[4] ^= rotl(x[7] + x[6], 13);
+      x[5] ^= rotl(x[4] + x[7], 18);
+      x[11] ^= rotl(x[10] + x[9], 7);
+      x[8] ^= rotl(x[11] + x[10], 9);
+      x[9] ^= rotl(x[8] + x[11], 13);
+      x[10] ^= rotl(x[9] + x[8], 18);
+      x[12] ^= rotl(x[15] + x[14], 7);
+      x[13] ^= rotl(x[12] + x[15], 9);
+      x[14] ^= rotl(x[13] + x[12], 13);
+      x[15] ^= rotl(x[14] + x[13], 18);
+    }
+    for (int i = 0; i < 16; i++) {
+      b[i] += x[i];
+    }
+  }
+
+  // in and out are 2 * r 64-byte blocks
+  static void blockMix(const uint32_t *in, uint32_t *out, uint32_t r) {
+    uint32_t x[16];
+    memcpy(x, in + (2 * r - 1) * 16, sizeof(x));
+    for (uint32_t i = 0; i < 2 * r; i++) {
+      for (int k = 0; k < 16; k++) {
+        x[k] ^= in[i * 16 + k];
+      }
+      salsa208(x);
+      // Even blocks go to the first half, odd blocks to the second
+      memcpy(out + ((i & 1) * r + i / 2) * 16, x, sizeof(x));
+    }
+  }
+
+  static void roMix(uint32_t *x, uint32_t *y, uint32_t *v, uint64_t n,
+                    uint32_t r) {
+    size_t words = 32 * r;
+    for (uint64_t i = 0; i < n; i++) {
+      memcpy(v + i * words, x, words * 4);
+      blockMix(x, y, r);
+      memcpy(x, y, words * 4);
+    }
+    for (uint64_t i = 0; i < n; i++) {
+      uint64_t j = x[(2 * r - 1) * 16] & (n - 1);
+      for (size_t k = 0; k < words; k++) {
+        x[k] ^= v[j * words + k];
+      }
+      blockMix(x, y, r);
+      memcpy(x, y, words * 4);
+    }
+  }
+};
+
+// Stored password hashes: "scrypt$<log2 N>$<r>$<p>$<salt hex>$<key hex>".
+// Accounts created before this format keep a decimal string hash until
+// their next successful login rehashes them.
+class PasswordHash {
+public:
+  // 16 MiB and a few tens of milliseconds per hash
+  static const uint32_t LOG_N = 14;
+  static const uint32_t R = 8;
+  static const uint32_t P = 1;
+  static const size_t SALT_SIZE = 16;
+  static const size_t KEY_SIZE = 32;
+
+  static std::string hash(const std::string &password) {
+    uint8_t salt[SALT_SIZE];
+    std::random_device rd;
+    for (size_t i = 0; i < SALT_SIZE; i += 4) {
+      uint32_t word = rd();
+      memcpy(salt + i, &word, 4);
+    }
+    uint8_t key[KEY_SIZE];
+    Scrypt::derive((const uint8_t *)password.data(), password.size(), salt,
+                   SALT_SIZE, 1ull << LOG_N, R, P, key, KEY_SIZE);
+    return parameterPrefix() + toHex(salt, SALT_SIZE) + "$" +
+           toHex(key, KEY_SIZE);
+  }
+
+  // Check a password against a stored hash of either format
+  static bool verify(const std::string &password, const std::string &stored) {
+    if (isLegacy(stored))
+      return legacyHash(password) == stored;
+
+    unsigned logN, r, p;
+    char saltHex[2 * 64 + 1], keyHex[2 * 64 + 1];
+    if (sscanf(stored.c_str(), "scrypt$%u$%u$%u$%128[0-9a-f]$%128[0-9a-f]",
+               &logN, &r, &p, saltHex, keyHex) != 5)
+      return false;
+    if (logN == 0 || logN > 20 || r == 0 || r > 32 || p == 0 || p > 16)
+      return false;
+    std::vector<uint8_t> salt = fromHex(saltHex);
+    std::vector<uint8_t> expected = fromHex(keyHex);
+    if (expected.empty())
+      return false;
+
+    std::vector<uint8_t> key(expected.size());
+    Scrypt::derive((const uint8_t *)password.data(), password.size(),
+                   salt.data(), salt.size(), 1ull << logN, r, p, key.data(),
+                   key.size());
+    uint8_t diff = 0;
+    for (size_t i = 0; i < key.size(); i++) {
+      diff |= key[i] ^ expected[i];
+    }
+    return diff == 0;
+  }
+
+  // Stored with the old string hash or other scrypt parameters
+  static bool needsRehash(const std::string &stored) {
+    std::string prefix = parameterPrefix();
+    return stored.compare(0, prefix.size(), prefix) != 0;
+  }
+
+private:
+  static std::string parameterPrefix() {
+    return "scrypt$" + std::to_string(LOG_N) + "$" + std::to_string(R) + "$" +
+           std::to_string(P) + "$";
+  }
+
+  static bool isLegacy(const std::string &stored) {
+    return stored.compare(0, 7, "scrypt$") != 0;
+  }
+
+  // The original 31-multiplier string hash
+  static std::string legacyHash(const std::string &password) {
+    uint32_t hash = 0;
+    for (char c : password) {
+      hash = hash * 31 + c;
+    }
+    return std::to_string(hash);
+  }
+
+  static std::string toHex(const uint8_t *data, size_t len) {
+    static const char digits[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(2 * len);
+    for (size_t i = 0; i < len; i++) {
+      out += digits[data[i] >> 4];
+      out += digits[data[i] & 0x0F];
+    }
+    return out;
+  }
+
+  static std::vector<uint8_t> fromHex(const char *hex) {
+    std::vector<uint8_t> out;
+    size_t len = strlen(hex);
+    if (len % 2 != 0)
+      return out;
+    for (size_t i = 0; i < len; i += 2) {
+      char byte[3] = {hex[i], hex[i + 1], 0};
+      out.push_back((uint8_t)strtoul(byte, nullptr, 16));
+    }
+    return out;
+  }
+};
+
+#endif
@@ -0,0 +1,164 @@
+#ifndef PRESENCE_H
+#define PRESENCE_H
+
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+
+// Hot lobby data for one online user. The name is a view into the user's
+// record inside Database, which is never moved or renamed once created.
+struct PresenceEntry {
+  uint32_t userId;
+  std::string_view username;
+  uint16_t eloRating;
+  uint16_t wins;
+  uint16_t losses;
+  uint16_t draws;
+  bool inGame;
+};
+
+// Coalesced change for one user since the last takeChanges() call.
+// kind is a combination of PresenceChangeKind flags.
+struct PresenceChange {
+  uint8_t kind;
+  PresenceEntry entry; // Current state; only userId is valid for LEFT
+};
+
+// Set of online users, maintained incrementally on login, logout and game
+// state changes. Entries are kept densely packed so a lobby listing costs
+// O(online users) regardless of how many accounts exist.
+//
+// Every change is also noted in a pending journal keyed by user, so the
+// lobby feed can publish one merged delta per changed user per interval.
+class PresenceSet {
+private:
+  struct Pending {
+    uint8_t kind;
+    bool wasOnline; // Online when the current interval started
+  };
+
+  mutable std::shared_mutex mutex;
+  std::vector<PresenceEntry> entries;
+  std::unordered_map<uint32_t, size_t> slots; // userId -> index in entries
+  std::unordered_map<uint32_t, Pending> pending;
+
+  // Caller holds the unique lock
+  void note(uint32_t userId, uint8_t kind, bool wasOnline) {
+    auto ins = pending.emplace(userId, Pending{0, wasOnline});
+    ins.first->second.kind |= kind;
+  }
+
+public:
+  void add(const PresenceEntry &entry) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = slots.find(entry.userId);
+    if (it != slots.end()) {
+      entries[it->second] = entry;
+      note(entry.userId, PRESENCE_JOINED, true);
+      return;
+    }
+    slots[entry.userId] = entries.size();
+    entries.push_back(entry);
+    note(entry.userId, PRESENCE_JOINED, false);
+  }
+
+  void remove(uint32_t userId) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = slots.find(userId);
+    if (it == slots.end()) {
+      return;
+    }
+
+    // Swap with the last entry to keep the array dense
+    size_t slot = it->second;
+    slots.erase(it);
+    if (slot != entries.size() - 1) {
+      entries[slot] = entries.back();
+      slots[entries[slot].userId] = slot;
+    }
+    entries.pop_back();
+    note(userId, PRESENCE_LEFT, true);
+  }
+
+  void setInGame(uint32_t userId, bool inGame) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = slots.find(userId);
+    if (it != slots.end() && entries[it->second].inGame != inGame) {
+      entries[it->second].inGame = inGame;
+      note(userId, PRESENCE_GAME, true);
+    }
+  }
+
+  void updateStats(uint32_t userId, uint16_t eloRating, uint16_t wins,
+                   uint16_t losses, uint16_t draws) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = slots.find(userId);
+    if (it != slots.end()) {
+      PresenceEntry &e = entries[it->second];
+      e.eloRating = eloRating;
+      e.wins = wins;
+      e.losses = losses;
+      e.draws = draws;
+      note(userId, PRESENCE_RATING, true);
+    }
+  }
+
+  bool contains(uint32_t userId) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return slots.count(userId) > 0;
+  }
+
+  // Copy of the current online set; names are not copied
+  std::vector<PresenceEntry> snapshot() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return entries;
+  }
+
+  // Drain the journal into one change per user. A user who came online
+  // and left again within the interval produces nothing; a user who went
+  // offline and came back is reported as JOINED so receivers upsert.
+  std::vector<PresenceChange> takeChanges() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    std::vector<PresenceChange> changes;
+    changes.reserve(pending.size());
+
+    for (const auto &pair : pending) {
+      uint32_t userId = pair.first;
+      const Pending &p = pair.second;
+      auto it = slots.find(userId);
+      bool online = it != slots.end();
+
+      PresenceChange change;
+      if (!online) {
+        if (!p.wasOnline)
+          continue;
+        change.kind = PRESENCE_LEFT;
+        change.entry = PresenceEntry();
+        change.entry.userId = userId;
+      } else {
+        change.entry = entries[it->second];
+        if (!p.wasOnline || (p.kind & PRESENCE_JOINED)) {
+          change.kind = PRESENCE_JOINED;
+        } else {
+          change.kind = p.kind & (PRESENCE_GAME | PRESENCE_RATING);
+        }
+      }
+      changes.push_back(change);
+    }
+
+    pending.clear();
+    return changes;
+  }
+
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return entries.size();
+  }
+};
+
+#endif
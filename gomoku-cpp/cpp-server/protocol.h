@@ -12,10 +12,17 @@ enum MessageType {
     MSG_LOGIN = 3,
     MSG_LOGIN_RESPONSE = 4,
     MSG_LOGOUT = 5,
+    MSG_RESUME_SESSION = 6,    // Reattach a dropped session on a new connection
+    MSG_RESUME_RESPONSE = 7,
+    MSG_HELLO = 8,             // Negotiate the wire version (see wire.h)
+    MSG_HELLO_RESPONSE = 9,
     
     // Player List (2 points)
     MSG_GET_ONLINE_PLAYERS = 10,
     MSG_ONLINE_PLAYERS_LIST = 11,
+    MSG_SUBSCRIBE_PRESENCE = 12,    // Receive lobby changes as pushed deltas
+    MSG_UNSUBSCRIBE_PRESENCE = 13,
+    MSG_PRESENCE_DELTA = 14,
     
     // Challenge System (3 points - now complete with decline)
     MSG_SEND_CHALLENGE = 20,
@@ -24,6 +31,9 @@ enum MessageType {
     MSG_DECLINE_CHALLENGE = 23,
     MSG_CHALLENGE_RESPONSE = 24,
     MSG_CHALLENGE_DECLINED = 25,  // Notify challenger that challenge was declined
+    MSG_JOIN_QUEUE = 26,          // Automatic matchmaking
+    MSG_LEAVE_QUEUE = 27,
+    MSG_QUEUE_STATUS = 28,
     
     // Game Play (10 points)
     MSG_GAME_START = 30,
@@ -31,6 +41,10 @@ enum MessageType {
     MSG_MOVE_RESPONSE = 32,
     MSG_OPPONENT_MOVE = 33,
     MSG_GAME_OVER = 34,
+    MSG_WATCH_GAME = 35,
+    MSG_UNWATCH_GAME = 36,    // Payload: uint32_t gameId
+    MSG_WATCH_RESPONSE = 37,
+    MSG_SPECTATOR_MOVE = 38,
     
     // Resignation/Draw (1 point)
     MSG_RESIGN = 40,
@@ -55,10 +69,28 @@ enum MessageType {
     MSG_REPLAY_GAME = 64,
     MSG_REPLAY_DATA = 65,
     
+    // Leaderboard
+    MSG_GET_LEADERBOARD = 66,
+    MSG_LEADERBOARD_RESPONSE = 67,
+    MSG_GET_RATING_HISTORY = 68,
+    MSG_RATING_HISTORY_RESPONSE = 69,
+    
+    // Tournaments
+    MSG_TOURNAMENT_CREATE = 80,
+    MSG_TOURNAMENT_JOIN = 81,    // Payload: uint32_t tournamentId
+    MSG_TOURNAMENT_START = 82,   // Payload: uint32_t tournamentId
+    MSG_TOURNAMENT_STATUS = 83,
+    MSG_GET_STANDINGS = 84,
+    MSG_STANDINGS_RESPONSE = 85,
+    
     // Time management
     MSG_TIME_UPDATE = 70,
     MSG_TIME_OUT = 71,
     
+    // Gateways and cluster peers
+    MSG_GATEWAY_HELLO = 90,    // Makes the connection a gateway upstream
+    MSG_PEER_HELLO = 91,       // Makes it a cluster peer link (cluster.h)
+    
     // Error
     MSG_ERROR = 99
 };
@@ -71,6 +103,37 @@ struct MessageHeader {
     uint32_t sessionId;     // Session ID
 } __attribute__((packed));
 
+// Wire protocol versions; framing of each is described in wire.h
+enum WireVersion {
+    WIRE_V1 = 1,  // MessageHeader and fixed-size payloads
+    WIRE_V2 = 2,  // Varint length, 1-byte type, compact payloads
+    WIRE_V3 = 3   // v2 with a correlation tag on every frame
+};
+
+const uint8_t WIRE_VERSION_MAX = WIRE_V3;
+
+// Optional wire features, asked for and granted in Hello
+enum WireFeature {
+    WIRE_COMPRESS = 1, // Large payloads may be LZ compressed (see wire.h)
+    WIRE_SHM = 2       // Frames move to shared memory (see shm_ring.h)
+};
+
+const uint8_t WIRE_FEATURES = WIRE_COMPRESS | WIRE_SHM;  // Known to this build
+
+// Hello
+// A client that speaks a later version sends MSG_HELLO, in v1 framing, as
+// the first frame of a connection, with the highest version it speaks, and
+// waits for MSG_HELLO_RESPONSE (also v1) with the version chosen. Every
+// later frame in both directions uses that version. A client that never
+// sends it stays on v1; a server that does not know it answers MSG_ERROR.
+// Features are granted only if both sides know them; a Hello without the
+// features byte asks for none. WIRE_SHM is only granted on the server's
+// Unix domain socket.
+struct Hello {
+    uint8_t version;
+    uint8_t features;  // WireFeature bits
+} __attribute__((packed));
+
 // Login Request
 struct LoginRequest {
     char username[32];
@@ -87,8 +150,51 @@ struct LoginResponse {
     uint16_t losses;
     uint16_t draws;
     char message[128];
+    uint64_t resumeToken;  // Presented with MSG_RESUME_SESSION after a drop
+} __attribute__((packed));
+
+// Resume Request
+// Sent on a fresh connection, before any login, within the grace period
+// after the previous connection dropped
+struct ResumeRequest {
+    uint32_t userId;
+    uint32_t sessionId;
+    uint64_t resumeToken;
+} __attribute__((packed));
+
+// Resume Response
+// On success the session's ids are unchanged. If the user is in a game,
+// a BoardSnapshot follows.
+struct ResumeResponse {
+    uint8_t success;
+    uint32_t userId;
+    uint32_t sessionId;
+    uint32_t gameId;  // 0 = not in a game
+} __attribute__((packed));
+
+// Board Snapshot
+// Followed by boardCells(boardSize) bytes: 2 bits per cell (0 = empty,
+// 1 = player 1, 2 = player 2), row-major, four cells per byte starting
+// at the low bits. A 15x15 board is 57 bytes.
+struct BoardSnapshot {
+    uint32_t gameId;
+    uint32_t player1Id;
+    uint32_t player2Id;
+    char player1Name[32];
+    char player2Name[32];
+    uint8_t boardSize;
+    uint32_t currentTurn;
+    uint32_t moveCount;
+    uint16_t timeLimit;
+    uint16_t player1Time;    // Remaining time, as of the snapshot
+    uint16_t player2Time;
+    uint32_t drawOfferedBy;  // 0 = no pending offer
 } __attribute__((packed));
 
+inline size_t boardCells(uint8_t boardSize) {
+    return ((size_t)boardSize * boardSize + 3) / 4;
+}
+
 // Register Request
 struct RegisterRequest {
     char username[32];
@@ -112,6 +218,21 @@ struct ChallengeResponse {
     uint16_t timeLimit;
 } __attribute__((packed));
 
+// Matchmaking Queue Request
+struct QueueRequest {
+    uint8_t boardSize;
+    uint16_t timeLimit;  // Time limit per player in seconds (0 = unlimited)
+} __attribute__((packed));
+
+// Matchmaking Queue Status (reply to join/leave; MSG_GAME_START follows
+// when a match is found)
+struct QueueStatus {
+    uint8_t inQueue;
+    uint8_t boardSize;
+    uint16_t timeLimit;
+    uint32_t waiting;  // Players waiting in the same pool
+} __attribute__((packed));
+
 // Challenge Declined Response
 struct ChallengeDeclinedResponse {
     uint32_t challengeId;
@@ -152,6 +273,34 @@ struct MoveResponse {
     uint32_t moveNumber;     // Move number in the game
 } __attribute__((packed));
 
+// Watch Request
+// A server started with a spectator delay shows games that many seconds
+// late. rewindSeconds starts the feed further back, as far as the game's
+// retained history reaches; it may be omitted (4-byte payload).
+struct WatchRequest {
+    uint32_t gameId;
+    uint16_t rewindSeconds;
+} __attribute__((packed));
+
+// Watch Response
+// MSG_WATCH_RESPONSE carries this header, a BoardSnapshot of the position
+// being shown and its packed board. `tailMoves` MSG_SPECTATOR_MOVE frames
+// follow, bringing a rewound watcher up to the (delayed) present.
+struct WatchResponse {
+    uint32_t gameId;
+    uint16_t delaySeconds;
+    uint16_t tailMoves;
+} __attribute__((packed));
+
+// Spectator Move
+// Watchers of a game receive MSG_WATCH_RESPONSE, then a SpectatorMove per
+// move, a TimeUpdate (MSG_TIME_UPDATE) every second while a clock runs,
+// and the game's MSG_GAME_OVER
+struct SpectatorMove {
+    uint32_t gameId;
+    MoveResponse move;
+} __attribute__((packed));
+
 // Game Over
 struct GameOver {
     uint32_t gameId;
@@ -163,6 +312,8 @@ struct GameOver {
 } __attribute__((packed));
 
 // Player Info
+// MSG_ONLINE_PLAYERS_LIST is a single message: uint32_t count followed by
+// `count` PlayerInfo records.
 struct PlayerInfo {
     uint32_t userId;
     char username[32];
@@ -174,6 +325,34 @@ struct PlayerInfo {
     uint8_t inGame;
 } __attribute__((packed));
 
+// Presence delta kinds (bit flags, combined when coalesced)
+enum PresenceChangeKind {
+    PRESENCE_JOINED = 1,   // Came online; record is followed by the username
+    PRESENCE_LEFT = 2,     // Went offline; only userId is meaningful
+    PRESENCE_GAME = 4,     // Entered or left a game
+    PRESENCE_RATING = 8    // Rating or W/L/D changed
+};
+
+// Presence Delta Batch
+// MSG_PRESENCE_DELTA carries this header followed by `count` records. Each
+// record is a PresenceDelta, plus a char[32] username when the kind
+// includes PRESENCE_JOINED. A batch with `full` set is a complete snapshot
+// that replaces the subscriber's list.
+struct PresenceDeltaHeader {
+    uint32_t count;
+    uint8_t full;
+} __attribute__((packed));
+
+struct PresenceDelta {
+    uint8_t kind;
+    uint32_t userId;
+    uint16_t eloRating;
+    uint16_t wins;
+    uint16_t losses;
+    uint16_t draws;
+    uint8_t inGame;
+} __attribute__((packed));
+
 // Draw Request/Response
 struct DrawRequest {
     uint32_t gameId;
@@ -185,16 +364,9 @@ struct RematchRequest {
     uint32_t opponentId;
 } __attribute__((packed));
 
-// Move Log Entry
-struct MoveLogEntry {
-    uint32_t moveNumber;
-    uint32_t playerId;
-    uint8_t x;
-    uint8_t y;
-    uint32_t timestamp;  // Time when move was made (seconds since game start)
-} __attribute__((packed));
-
 // Game Log Response Header
+// MSG_GAME_LOG_RESPONSE carries this header followed by the packed move
+// list described in move_codec.h
 struct GameLogHeader {
     uint32_t gameId;
     uint32_t player1Id;
@@ -209,7 +381,48 @@ struct GameLogHeader {
     uint64_t timestamp;     // Game start timestamp
 } __attribute__((packed));
 
+// Replay Request
+// A seek opens a replay of a finished game at a position; the reply
+// starts there, so any position is one round trip away. Chunks are sent
+// only against credit the client has granted and are topped up as it
+// consumes them.
+enum ReplayOp {
+    REPLAY_SEEK = 0,    // Start at `moveNumber` moves played
+    REPLAY_CREDIT = 1,  // Allow `credit` more chunks
+    REPLAY_STOP = 2
+};
+
+struct ReplayRequest {
+    uint8_t op;
+    uint32_t gameId;
+    uint32_t moveNumber;  // Seek only
+    uint16_t credit;      // Chunks the client can take; a seek's reply
+                          // always goes out and counts against it
+} __attribute__((packed));
+
+// Replay Data
+// MSG_REPLAY_DATA carries this header, then a GameLogHeader on the reply
+// to a seek, then the packed board (see BoardSnapshot) after `firstMove`
+// moves, then the chunk's moves packed as in move_codec.h. Chunks after
+// the first start on multiples of REPLAY_CHUNK_MOVES.
+const uint32_t REPLAY_CHUNK_MOVES = 32;
+
+enum ReplayFlags {
+    REPLAY_SEEKED = 1,  // Reply to a seek; a GameLogHeader follows
+    REPLAY_LAST = 2     // No moves after this chunk
+};
+
+struct ReplayData {
+    uint32_t gameId;
+    uint32_t firstMove;  // Moves played before this chunk
+    uint16_t moveCount;
+    uint8_t flags;
+} __attribute__((packed));
+
 // Game History Entry (simplified for list)
+// MSG_GAME_HISTORY_RESPONSE carries uint32_t count and `count` entries. In
+// v1 framing the header's length covers only the count and the entries
+// follow the frame.
 struct GameHistoryEntry {
     uint32_t gameId;
     uint32_t opponentId;
@@ -219,6 +432,122 @@ struct GameHistoryEntry {
     uint64_t timestamp;
 } __attribute__((packed));
 
+// Leaderboard Request
+enum LeaderboardMode {
+    LEADERBOARD_TOP = 0,        // Page starting at rank `offset + 1`
+    LEADERBOARD_AROUND_ME = 1,  // Page centered on the requester
+    LEADERBOARD_MY_RANK = 2     // Header only
+};
+
+struct LeaderboardRequest {
+    uint8_t mode;
+    uint32_t offset;
+    uint16_t limit;  // Clamped to LEADERBOARD_PAGE_MAX
+} __attribute__((packed));
+
+const uint16_t LEADERBOARD_PAGE_MAX = 50;
+
+// Leaderboard Response
+// MSG_LEADERBOARD_RESPONSE carries this header followed by `count`
+// LeaderboardEntry records in rank order
+struct LeaderboardHeader {
+    uint32_t totalPlayers;
+    uint32_t myRank;     // 0 if the requester is not ranked
+    uint32_t startRank;  // Rank of the first entry
+    uint16_t count;
+} __attribute__((packed));
+
+struct LeaderboardEntry {
+    uint32_t rank;
+    uint32_t userId;
+    char username[32];
+    uint16_t eloRating;
+    uint16_t wins;
+    uint16_t losses;
+    uint16_t draws;
+} __attribute__((packed));
+
+// Rating History Request
+struct RatingHistoryRequest {
+    uint32_t userId;     // 0 = the requester
+    uint16_t days;       // Only the last `days` days; 0 = all time
+    uint16_t maxPoints;  // Clamped to RATING_HISTORY_POINTS_MAX
+} __attribute__((packed));
+
+const uint16_t RATING_HISTORY_POINTS_MAX = 200;
+
+// Rating History Response
+// MSG_RATING_HISTORY_RESPONSE carries this header followed by `sampleCount`
+// RatingPoint records, oldest first. When the range holds more points than
+// requested, evenly spaced points are sent, always including the first and
+// last one; the statistics cover every point in the range.
+struct RatingHistoryHeader {
+    uint32_t userId;
+    uint32_t fromTime;     // Unix seconds, inclusive
+    uint32_t toTime;
+    uint32_t count;        // Points in the range (0 = no rated games)
+    uint16_t currentRating;
+    uint16_t startRating;  // First point in the range
+    uint16_t minRating;
+    uint16_t maxRating;
+    uint16_t p10Rating;
+    uint16_t p50Rating;
+    uint16_t p90Rating;
+    uint16_t sampleCount;
+} __attribute__((packed));
+
+struct RatingPoint {
+    uint32_t time;
+    uint16_t rating;  // After the game
+} __attribute__((packed));
+
+// Tournament Create Request
+enum TournamentFormat {
+    TOURNAMENT_SWISS = 0,
+    TOURNAMENT_ARENA = 1
+};
+
+struct TournamentCreate {
+    char name[32];
+    uint8_t format;
+    uint8_t boardSize;
+    uint16_t timeLimit;  // Per game, seconds per player (0 = unlimited)
+    uint16_t rounds;     // Swiss: number of rounds; arena: duration in minutes
+} __attribute__((packed));
+
+// Tournament Status (reply to create/join/start, and pushed to every
+// participant when a round starts or the tournament finishes)
+struct TournamentStatus {
+    uint32_t tournamentId;
+    char name[32];
+    uint8_t format;
+    uint8_t state;  // 0 = open, 1 = running, 2 = finished
+    uint16_t round;
+    uint16_t rounds;
+    uint32_t players;
+    uint32_t gamesInProgress;
+} __attribute__((packed));
+
+// Standings Request
+struct StandingsRequest {
+    uint32_t tournamentId;
+    uint32_t offset;
+    uint16_t limit;  // Clamped to LEADERBOARD_PAGE_MAX
+} __attribute__((packed));
+
+// Standings Response
+// MSG_STANDINGS_RESPONSE carries a TournamentStatus followed by uint16_t
+// count and `count` StandingEntry records in standings order
+struct StandingEntry {
+    uint32_t rank;
+    uint32_t userId;
+    char username[32];
+    uint16_t points;  // Half points: win = 2, draw = 1
+    uint16_t wins;
+    uint16_t draws;
+    uint16_t losses;
+} __attribute__((packed));
+
 // Time Update
 struct TimeUpdate {
     uint32_t gameId;
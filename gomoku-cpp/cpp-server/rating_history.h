@@ -0,0 +1,220 @@
+#ifndef RATING_HISTORY_H
+#define RATING_HISTORY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "move_codec.h"
+
+// Per-user Elo time series. Each rated result appends one point
+// (time, rating after the game); a user's first point is preceded by their
+// rating before it, so the series starts where they started.
+//
+// Points are stored as zigzag varints relative to the previous point,
+// usually 2-3 bytes each. Every BLOCK_POINTS points a block starts with
+// an absolute point, so a time range is found by binary search over the
+// blocks and only the blocks it overlaps are decoded.
+class RatingHistory {
+public:
+  struct Point {
+    uint32_t time; // Unix seconds
+    uint16_t rating;
+  };
+
+  // Appended point, kept until the next takeAppended() for persistence
+  struct Record {
+    uint32_t userId;
+    Point point;
+  };
+
+  // ratings.dat record: uint32 userId, uint32 time, uint16 rating (LE)
+  static const size_t RECORD_SIZE = 10;
+
+  struct Summary {
+    uint32_t count; // Points in the range
+    Point first;
+    Point last;
+    uint16_t minRating;
+    uint16_t maxRating;
+    uint16_t p10;
+    uint16_t p50;
+    uint16_t p90;
+    std::vector<Point> samples; // At most maxSamples, evenly spaced
+  };
+
+private:
+  static const uint32_t BLOCK_POINTS = 64;
+
+  struct Block {
+    Point start;     // Absolute first point of the block
+    uint32_t offset; // Encoded deltas of the remaining points
+  };
+
+  struct Series {
+    std::vector<uint8_t> deltas;
+    std::vector<Block> blocks;
+    uint32_t count = 0;
+    Point last = {0, 0};
+  };
+
+  mutable std::shared_mutex mutex;
+  std::unordered_map<uint32_t, Series> series;
+  std::vector<Record> appended;
+
+  static void putSigned(std::vector<uint8_t> &out, int64_t value) {
+    MoveCodec::putVarint(out, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+  }
+
+  static int64_t getSigned(const uint8_t *&p, const uint8_t *end) {
+    uint64_t zz = 0;
+    MoveCodec::getVarint(p, end, zz);
+    return (int64_t)(zz >> 1) ^ -(int64_t)(zz & 1);
+  }
+
+  static void push(Series &s, Point point) {
+    if (s.count % BLOCK_POINTS == 0) {
+      s.blocks.push_back(Block{point, (uint32_t)s.deltas.size()});
+    } else {
+      putSigned(s.deltas, (int64_t)point.time - s.last.time);
+      putSigned(s.deltas, (int)point.rating - s.last.rating);
+    }
+    s.last = point;
+    s.count++;
+  }
+
+  // Calls fn(point) for every point with from <= time <= to, oldest first
+  template <typename Fn>
+  static void visit(const Series &s, uint32_t from, uint32_t to, Fn fn) {
+    // Last block starting before `from`; earlier ones end before it
+    auto it = std::lower_bound(
+        s.blocks.begin(), s.blocks.end(), from,
+        [](const Block &b, uint32_t t) { return b.start.time < t; });
+    size_t b = it == s.blocks.begin() ? 0 : (it - s.blocks.begin()) - 1;
+
+    for (; b < s.blocks.size(); b++) {
+      const Block &block = s.blocks[b];
+      if (block.start.time > to)
+        return;
+      uint32_t points =
+          std::min(BLOCK_POINTS, s.count - (uint32_t)b * BLOCK_POINTS);
+      const uint8_t *p = s.deltas.data() + block.offset;
+      const uint8_t *end = s.deltas.data() + s.deltas.size();
+      Point point = block.start;
+      for (uint32_t i = 0; i < points; i++) {
+        if (i > 0) {
+          point.time = (uint32_t)(point.time + getSigned(p, end));
+          point.rating = (uint16_t)(point.rating + getSigned(p, end));
+        }
+        if (point.time > to)
+          return;
+        if (point.time >= from)
+          fn(point);
+      }
+    }
+  }
+
+public:
+  // Record a rated result. `before` seeds an empty series.
+  void append(uint32_t userId, uint32_t time, uint16_t before,
+              uint16_t after) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    Series &s = series[userId];
+    if (s.count == 0) {
+      push(s, Point{time, before});
+      appended.push_back(Record{userId, Point{time, before}});
+    }
+    push(s, Point{time, after});
+    appended.push_back(Record{userId, Point{time, after}});
+  }
+
+  // Add a stored point while loading, without journaling it
+  void load(uint32_t userId, Point point) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    push(series[userId], point);
+  }
+
+  // Points appended since the previous call
+  std::vector<Record> takeAppended() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    std::vector<Record> out;
+    out.swap(appended);
+    return out;
+  }
+
+  static void formatRecord(const Record &r, std::string &out) {
+    uint8_t buf[RECORD_SIZE];
+    for (int i = 0; i < 4; i++) {
+      buf[i] = (uint8_t)(r.userId >> (8 * i));
+      buf[4 + i] = (uint8_t)(r.point.time >> (8 * i));
+    }
+    buf[8] = (uint8_t)r.point.rating;
+    buf[9] = (uint8_t)(r.point.rating >> 8);
+    out.append((const char *)buf, RECORD_SIZE);
+  }
+
+  static Record parseRecord(const uint8_t *p) {
+    Record r = {0, {0, 0}};
+    for (int i = 0; i < 4; i++) {
+      r.userId |= (uint32_t)p[i] << (8 * i);
+      r.point.time |= (uint32_t)p[4 + i] << (8 * i);
+    }
+    r.point.rating = (uint16_t)(p[8] | p[9] << 8);
+    return r;
+  }
+
+  // Statistics over [from, to]. Returns false if the user has no points
+  // in the range.
+  bool query(uint32_t userId, uint32_t from, uint32_t to, size_t maxSamples,
+             Summary &out) const {
+    std::vector<Point> points;
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      auto it = series.find(userId);
+      if (it == series.end())
+        return false;
+      visit(it->second, from, to, [&](Point p) { points.push_back(p); });
+    }
+    if (points.empty())
+      return false;
+
+    out.count = points.size();
+    out.first = points.front();
+    out.last = points.back();
+
+    std::vector<uint16_t> ratings;
+    ratings.reserve(points.size());
+    for (const Point &p : points) {
+      ratings.push_back(p.rating);
+    }
+    std::sort(ratings.begin(), ratings.end());
+    auto at = [&](double q) {
+      return ratings[std::min(ratings.size() - 1, (size_t)(q * ratings.size()))];
+    };
+    out.minRating = ratings.front();
+    out.maxRating = ratings.back();
+    out.p10 = at(0.10);
+    out.p50 = at(0.50);
+    out.p90 = at(0.90);
+
+    // Evenly spaced samples that always keep the first and last point
+    out.samples.clear();
+    if (points.size() <= maxSamples) {
+      out.samples = std::move(points);
+    } else if (maxSamples == 1) {
+      out.samples.push_back(points.back());
+    } else if (maxSamples > 1) {
+      for (size_t i = 0; i < maxSamples; i++) {
+        out.samples.push_back(
+            points[i * (points.size() - 1) / (maxSamples - 1)]);
+      }
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,332 @@
+// Offline rating rebuild. Replays every finished game from games.dat in
+// start-time order with the server's Elo update and writes a new
+// users.dat, so rating parameters can be changed after the fact.
+//
+// Players who never met, even indirectly, cannot influence each other's
+// ratings. The player graph is split into connected components and the
+// components are replayed in parallel; within a component games keep
+// their global order, so the result does not depend on the thread count.
+//
+// The Elo series in ratings.dat is regenerated from the same replay, one
+// point per game at its end time.
+//
+// Stop the server before running this tool: it rewrites users.dat and
+// ratings.dat.
+//
+//   rating_rebuild [--data DIR] [--k K] [--initial RATING] [--threads N]
+//                  [--dry-run]
+
+#include "elo.h"
+#include "legacy_loader.h"
+#include "rating_history.h"
+#include "records.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Options {
+  std::string dataDir = "./data/";
+  int k = Elo::DEFAULT_K;
+  int initial = Elo::INITIAL_RATING;
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+  bool dryRun = false;
+};
+
+// Finished game reduced to what the replay needs
+struct RatedGame {
+  uint64_t startTime;
+  uint32_t endTime;
+  uint32_t gameId;
+  uint32_t player1; // Dense player indices
+  uint32_t player2;
+  uint8_t result; // 0 = player1 win, 1 = player2 win, 2 = draw
+};
+
+struct Standing {
+  int rating;
+  uint16_t wins;
+  uint16_t losses;
+  uint16_t draws;
+};
+
+class DisjointSet {
+public:
+  explicit DisjointSet(size_t n) : parent(n), size(n, 1) {
+    std::iota(parent.begin(), parent.end(), 0);
+  }
+
+  uint32_t find(uint32_t x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]];
+      x = parent[x];
+    }
+    return x;
+  }
+
+  void unite(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a == b)
+      return;
+    if (size[a] < size[b])
+      std::swap(a, b);
+    parent[b] = a;
+    size[a] += size[b];
+  }
+
+private:
+  std::vector<uint32_t> parent;
+  std::vector<uint32_t> size;
+};
+
+static bool parseOptions(int argc, char *argv[], Options &opt) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--data" && hasValue) {
+      opt.dataDir = argv[++i];
+      if (opt.dataDir.back() != '/')
+        opt.dataDir += '/';
+    } else if (arg == "--k" && hasValue) {
+      opt.k = std::atoi(argv[++i]);
+    } else if (arg == "--initial" && hasValue) {
+      opt.initial = std::atoi(argv[++i]);
+    } else if (arg == "--threads" && hasValue) {
+      opt.threads = std::max(1, std::atoi(argv[++i]));
+    } else if (arg == "--dry-run") {
+      opt.dryRun = true;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+static uint16_t clampRating(int rating) {
+  return (uint16_t)std::min(65535, std::max(0, rating));
+}
+
+// Series points for one player's result, in ratings.dat order: a first
+// game also records the rating before it
+static void addPoints(std::vector<RatingHistory::Record> &history,
+                      uint32_t userId, uint32_t time, const Standing &s,
+                      int before) {
+  if (s.wins + s.losses + s.draws == 1) {
+    history.push_back(
+        RatingHistory::Record{userId, {time, clampRating(before)}});
+  }
+  history.push_back(
+      RatingHistory::Record{userId, {time, clampRating(s.rating)}});
+}
+
+static void replay(const std::vector<RatedGame> &games,
+                   const std::vector<uint32_t> &order,
+                   const std::vector<User> &users, const Options &opt,
+                   std::vector<Standing> &standings,
+                   std::vector<RatingHistory::Record> &history) {
+  for (uint32_t index : order) {
+    const RatedGame &g = games[index];
+    Standing &p1 = standings[g.player1];
+    Standing &p2 = standings[g.player2];
+    int before1 = p1.rating;
+    int before2 = p2.rating;
+    if (g.result == 2) {
+      p1.draws++;
+      p2.draws++;
+    } else {
+      Standing &winner = g.result == 0 ? p1 : p2;
+      Standing &loser = g.result == 0 ? p2 : p1;
+      int16_t change = Elo::change(winner.rating, loser.rating, opt.k);
+      winner.rating += change;
+      loser.rating -= change;
+      winner.wins++;
+      loser.losses++;
+    }
+    addPoints(history, users[g.player1].userId, g.endTime, p1, before1);
+    addPoints(history, users[g.player2].userId, g.endTime, p2, before2);
+  }
+}
+
+// Write a complete file next to the old one, then swap it in
+static bool replaceFile(const std::string &path, const std::string &body) {
+  std::string tmpPath = path + ".rebuild";
+  std::ofstream file(tmpPath, std::ios::binary);
+  if (!file)
+    return false;
+  file << body;
+  file.close();
+  if (!file)
+    return false;
+  return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+static bool writeUsers(const std::string &path, uint32_t idCounter,
+                       const std::vector<User> &users) {
+  std::string body =
+      std::to_string(idCounter) + "\n" + std::to_string(users.size()) + "\n";
+  for (const User &u : users) {
+    LegacyLoader::formatUser(u, body);
+  }
+  return replaceFile(path, body);
+}
+
+// Components touch disjoint players, so writing them one after another
+// keeps every player's points in order
+static bool writeHistory(
+    const std::string &path,
+    const std::vector<std::vector<RatingHistory::Record>> &histories) {
+  std::string body;
+  for (const auto &history : histories) {
+    for (const RatingHistory::Record &r : history) {
+      RatingHistory::formatRecord(r, body);
+    }
+  }
+  return replaceFile(path, body);
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+  if (!parseOptions(argc, argv, opt)) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--data DIR] [--k K] [--initial RATING] [--threads N]"
+                 " [--dry-run]"
+              << std::endl;
+    return 1;
+  }
+
+  auto started = std::chrono::steady_clock::now();
+
+  LegacyLoader::UserData userData;
+  LegacyLoader::GameData gameData;
+  if (!LegacyLoader::loadUsers(opt.dataDir + "users.dat", userData)) {
+    std::cerr << "Cannot read " << opt.dataDir << "users.dat" << std::endl;
+    return 1;
+  }
+  if (!LegacyLoader::loadGames(opt.dataDir + "games.dat", gameData)) {
+    std::cerr << "Cannot read " << opt.dataDir << "games.dat" << std::endl;
+    return 1;
+  }
+
+  std::vector<User> &users = userData.users;
+  std::sort(users.begin(), users.end(), [](const User &a, const User &b) {
+    return a.userId < b.userId;
+  });
+  std::unordered_map<uint32_t, uint32_t> dense; // userId -> index in users
+  dense.reserve(users.size());
+  for (size_t i = 0; i < users.size(); i++) {
+    dense[users[i].userId] = i;
+  }
+
+  // Finished games between known players, in start-time order
+  std::vector<RatedGame> games;
+  games.reserve(gameData.games.size());
+  for (const GameRecord &g : gameData.games) {
+    auto p1 = dense.find(g.player1Id);
+    auto p2 = dense.find(g.player2Id);
+    if (g.result > 2 || p1 == dense.end() || p2 == dense.end() ||
+        g.player1Id == g.player2Id)
+      continue;
+    games.push_back(
+        RatedGame{g.startTime, (uint32_t)(g.startTime + g.duration), g.gameId,
+                  p1->second, p2->second, g.result});
+  }
+  gameData = LegacyLoader::GameData();
+  std::sort(games.begin(), games.end(),
+            [](const RatedGame &a, const RatedGame &b) {
+              return a.startTime != b.startTime ? a.startTime < b.startTime
+                                                : a.gameId < b.gameId;
+            });
+
+  // Connected components of the "played against" graph
+  DisjointSet components(users.size());
+  for (const RatedGame &g : games) {
+    components.unite(g.player1, g.player2);
+  }
+  std::unordered_map<uint32_t, std::vector<uint32_t>> byRoot;
+  for (uint32_t i = 0; i < games.size(); i++) {
+    byRoot[components.find(games[i].player1)].push_back(i);
+  }
+  std::vector<std::vector<uint32_t>> work;
+  work.reserve(byRoot.size());
+  for (auto &pair : byRoot) {
+    work.push_back(std::move(pair.second));
+  }
+  byRoot.clear();
+  // Largest first so one big component does not finish last
+  std::sort(work.begin(), work.end(),
+            [](const std::vector<uint32_t> &a, const std::vector<uint32_t> &b) {
+              return a.size() > b.size();
+            });
+
+  auto replayStarted = std::chrono::steady_clock::now();
+  std::vector<Standing> standings(users.size(),
+                                  Standing{opt.initial, 0, 0, 0});
+  std::vector<std::vector<RatingHistory::Record>> histories(work.size());
+  std::atomic<size_t> next(0);
+  size_t workers = std::min(opt.threads, std::max<size_t>(1, work.size()));
+  std::vector<std::thread> threads;
+  for (size_t w = 0; w < workers; w++) {
+    threads.emplace_back([&]() {
+      for (size_t i = next++; i < work.size(); i = next++) {
+        replay(games, work[i], users, opt, standings, histories[i]);
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  double replayMs = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - replayStarted)
+                        .count();
+
+  size_t changed = 0;
+  for (size_t i = 0; i < users.size(); i++) {
+    uint16_t rating = clampRating(standings[i].rating);
+    if (rating != users[i].eloRating || standings[i].wins != users[i].wins ||
+        standings[i].losses != users[i].losses ||
+        standings[i].draws != users[i].draws)
+      changed++;
+    users[i].eloRating = rating;
+    users[i].wins = standings[i].wins;
+    users[i].losses = standings[i].losses;
+    users[i].draws = standings[i].draws;
+  }
+
+  double totalSecs = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - started)
+                         .count();
+  std::cout << "Replayed " << games.size() << " games for " << users.size()
+            << " users in " << work.size() << " components (largest "
+            << (work.empty() ? 0 : work[0].size()) << " games) using "
+            << workers << " thread(s): replay " << replayMs << " ms, total "
+            << totalSecs * 1000.0 << " ms" << std::endl;
+  std::cout << changed << " user(s) changed (K=" << opt.k
+            << ", initial rating " << opt.initial << ")" << std::endl;
+
+  if (opt.dryRun)
+    return 0;
+  if (!writeUsers(opt.dataDir + "users.dat", userData.idCounter, users)) {
+    std::cerr << "Failed to write " << opt.dataDir << "users.dat"
+              << std::endl;
+    return 1;
+  }
+  if (!writeHistory(opt.dataDir + "ratings.dat", histories)) {
+    std::cerr << "Failed to write " << opt.dataDir << "ratings.dat"
+              << std::endl;
+    return 1;
+  }
+  std::cout << "Wrote " << opt.dataDir << "users.dat and ratings.dat"
+            << std::endl;
+  return 0;
+}
@@ -0,0 +1,75 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Glicko-2 rating, recomputed once per rating period (see glicko2.h)
+struct GlickoRating {
+  double rating = 1500.0;
+  double deviation = 350.0;
+  double volatility = 0.06;
+  uint32_t period = 0; // Last rating period the user was rated in
+};
+
+struct User {
+  uint32_t userId;
+  std::string username;
+  std::string email;
+  std::string passwordHash; // Store hashed password
+  uint16_t eloRating;
+  uint16_t wins;
+  uint16_t losses;
+  uint16_t draws;
+  bool isOnline;
+  bool inGame;
+  GlickoRating glicko;
+};
+
+struct Challenge {
+  uint32_t challengeId;
+  uint32_t challengerId;
+  uint32_t challengedId;
+  uint8_t boardSize;
+  uint16_t timeLimit;
+  bool pending;
+};
+
+struct MoveLog {
+  uint32_t moveNumber;
+  uint32_t playerId;
+  uint8_t x;
+  uint8_t y;
+  uint32_t timestamp; // Seconds since game start
+};
+
+struct GameRecord {
+  uint32_t gameId;
+  uint32_t player1Id;
+  uint32_t player2Id;
+  std::string player1Name;
+  std::string player2Name;
+  uint8_t boardSize;
+  uint32_t winnerId;
+  uint8_t result; // 0 = player1 win, 1 = player2 win, 2 = draw
+  std::vector<MoveLog> moves; // Only populated while the game is in progress
+  uint32_t totalMoves;
+  uint64_t startTime;
+  uint32_t duration; // In seconds
+  int16_t eloChange;
+};
+
+// Where the moves of a completed game are stored
+enum MoveStorage : uint8_t {
+  MOVES_TEXT = 0,  // Legacy "n,p,x,y,t;" line inside games.dat
+  MOVES_PACKED = 1 // MoveCodec blob inside moves.dat
+};
+
+struct MoveIndexEntry {
+  uint64_t offset;
+  uint32_t length;
+  uint8_t format; // MoveStorage
+};
+
+#endif
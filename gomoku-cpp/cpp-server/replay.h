@@ -0,0 +1,158 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "game_logic.h"
+#include "move_codec.h"
+#include "protocol.h"
+#include "records.h"
+
+// One connection's replay of a finished game, streamed in chunks of
+// REPLAY_CHUNK_MOVES moves.
+//
+// The move list is decoded once when the replay opens, and the packed
+// board is kept every REPLAY_CHUNK_MOVES moves along the way. A seek
+// starts from the keyframe at or before the target and plays at most one
+// chunk's worth of moves, so jumping around a long game never replays it
+// from the start, and each chunk is sent with its keyframe so the client
+// can step back without asking again.
+class ReplayStream {
+public:
+  ReplayStream(const GameRecord &record, const std::vector<uint8_t> &packed)
+      : boardSize(record.boardSize), position(0), credit(0), seeked(false) {
+    memset(&header, 0, sizeof(header));
+    header.gameId = record.gameId;
+    header.player1Id = record.player1Id;
+    header.player2Id = record.player2Id;
+    record.player1Name.copy(header.player1Name,
+                            sizeof(header.player1Name) - 1);
+    record.player2Name.copy(header.player2Name,
+                            sizeof(header.player2Name) - 1);
+    header.boardSize = record.boardSize;
+    header.winnerId = record.winnerId;
+    header.result = record.result;
+    header.gameDuration = record.duration;
+    header.timestamp = record.startTime;
+
+    size_t cells = (size_t)boardSize * boardSize;
+    board.assign(cells, 0);
+    MoveCodec::decode(boardSize, packed.data(), packed.size(),
+                      [this](uint32_t i, uint8_t x, uint8_t y, uint32_t ts) {
+                        if (i % REPLAY_CHUNK_MOVES == 0)
+                          keyframe();
+                        moves.push_back(Move{x, y, ts});
+                        place(i);
+                      });
+    header.totalMoves = moves.size();
+    if (moves.size() % REPLAY_CHUNK_MOVES == 0)
+      keyframe();
+    seek(0);
+  }
+
+  uint32_t gameId() const { return header.gameId; }
+  bool done() const { return position >= moves.size() && !seeked; }
+
+  // Credit is capped so a client cannot queue up an unbounded burst
+  void grant(uint16_t chunks, uint32_t limit) {
+    credit = std::min<uint32_t>(credit + chunks, limit);
+  }
+
+  // Restart at `moveNumber` moves played, clamped to the game's length
+  void seek(uint32_t moveNumber) {
+    position = std::min<uint32_t>(moveNumber, moves.size());
+    uint32_t key = position / REPLAY_CHUNK_MOVES;
+    const std::vector<uint8_t> &frame = keyframes[key];
+    for (size_t i = 0; i < board.size(); i++) {
+      board[i] = (frame[i / 4] >> (2 * (i % 4))) & 3;
+    }
+    for (uint32_t i = key * REPLAY_CHUNK_MOVES; i < position; i++) {
+      place(i);
+    }
+    seeked = true;
+  }
+
+  // Build the next MSG_REPLAY_DATA payload if the client has credit for
+  // it; the reply to a seek is sent regardless
+  bool nextChunk(std::vector<char> &payload) {
+    if (done() || (credit == 0 && !seeked))
+      return false;
+    if (credit > 0)
+      credit--;
+
+    uint32_t end = std::min<uint32_t>(
+        (position / REPLAY_CHUNK_MOVES + 1) * REPLAY_CHUNK_MOVES,
+        moves.size());
+    ReplayData data;
+    data.gameId = header.gameId;
+    data.firstMove = position;
+    data.moveCount = end - position;
+    data.flags = (seeked ? REPLAY_SEEKED : 0) |
+                 (end == moves.size() ? REPLAY_LAST : 0);
+
+    payload.clear();
+    append(payload, &data, sizeof(data));
+    if (seeked)
+      append(payload, &header, sizeof(header));
+    if (position % REPLAY_CHUNK_MOVES == 0) {
+      const std::vector<uint8_t> &frame =
+          keyframes[position / REPLAY_CHUNK_MOVES];
+      append(payload, frame.data(), frame.size());
+    } else {
+      size_t offset = payload.size();
+      payload.resize(offset + boardCells(boardSize));
+      GameLogic::packBoard(board.data(), boardSize,
+                           (uint8_t *)payload.data() + offset);
+    }
+
+    std::vector<uint8_t> packed;
+    MoveCodec::encode(boardSize, moves.data() + position, end - position,
+                      packed);
+    append(payload, packed.data(), packed.size());
+
+    for (uint32_t i = position; i < end; i++) {
+      place(i);
+    }
+    position = end;
+    seeked = false;
+    return true;
+  }
+
+private:
+  struct Move {
+    uint8_t x, y;
+    uint32_t timestamp;
+  };
+
+  uint8_t boardSize;
+  GameLogHeader header;
+  std::vector<Move> moves;
+  std::vector<std::vector<uint8_t>> keyframes; // Every REPLAY_CHUNK_MOVES
+  std::vector<uint8_t> board;                  // After `position` moves
+  uint32_t position;
+  uint32_t credit;
+  bool seeked; // The seek's reply has not been sent yet
+
+  // Move i is player 1's when i is even
+  void place(uint32_t i) {
+    const Move &m = moves[i];
+    if (m.x < boardSize && m.y < boardSize)
+      board[m.y * boardSize + m.x] = (i % 2 == 0) ? 1 : 2;
+  }
+
+  void keyframe() {
+    keyframes.emplace_back(boardCells(boardSize));
+    GameLogic::packBoard(board.data(), boardSize, keyframes.back().data());
+  }
+
+  static void append(std::vector<char> &buffer, const void *data,
+                     size_t length) {
+    const char *bytes = (const char *)data;
+    buffer.insert(buffer.end(), bytes, bytes + length);
+  }
+};
+
+#endif
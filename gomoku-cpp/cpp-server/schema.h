@@ -0,0 +1,332 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+
+#include "protocol.h"
+
+// Message schemas and bounds-checked views of received payloads.
+//
+// Every payload struct in protocol.h is described once here, as the list
+// of its fields in order:
+//
+//   F(kind, field)    an integer; kind is its compact form in wire.h: u8,
+//                     var, or sig for a signed one
+//   T(field)          a char array holding a NUL-padded name
+//   R(field, Type)    a nested struct that has its own schema
+//
+// SCHEMA_VIEW makes a view class of a list. A view points into a received
+// payload and has an accessor per field, which loads it from the field's
+// offset in the packed struct, little-endian whatever the host. Views are
+// made by bind(), which checks that the struct fits in what arrived and
+// returns an empty view if not; fields are read in place, and nothing is
+// copied until they are. wire.h builds its compact forms from the same
+// lists. A struct whose list misses a field fails to build.
+//
+// Payloads are still built as host-order structs; every supported host is
+// little-endian.
+
+// ==================== SCHEMAS ====================
+
+#define HELLO_SCHEMA(F, T, R) F(u8, version) F(u8, features)
+
+#define LOGIN_REQUEST_SCHEMA(F, T, R) T(username) T(password)
+
+#define LOGIN_RESPONSE_SCHEMA(F, T, R)                                         \
+  F(u8, success) F(var, userId) F(var, sessionId) F(var, eloRating)           \
+  F(var, wins) F(var, losses) F(var, draws) T(message) F(var, resumeToken)
+
+#define RESUME_REQUEST_SCHEMA(F, T, R)                                         \
+  F(var, userId) F(var, sessionId) F(var, resumeToken)
+
+#define RESUME_RESPONSE_SCHEMA(F, T, R)                                        \
+  F(u8, success) F(var, userId) F(var, sessionId) F(var, gameId)
+
+#define BOARD_SNAPSHOT_SCHEMA(F, T, R)                                         \
+  F(var, gameId) F(var, player1Id) F(var, player2Id) T(player1Name)           \
+  T(player2Name) F(u8, boardSize) F(var, currentTurn) F(var, moveCount)       \
+  F(var, timeLimit) F(var, player1Time) F(var, player2Time)                   \
+  F(var, drawOfferedBy)
+
+#define REGISTER_REQUEST_SCHEMA(F, T, R) T(username) T(email) T(password)
+
+#define CHALLENGE_REQUEST_SCHEMA(F, T, R)                                      \
+  F(var, targetUserId) F(u8, boardSize) F(var, timeLimit)
+
+#define CHALLENGE_RESPONSE_SCHEMA(F, T, R)                                     \
+  F(var, challengeId) F(var, challengerId) T(challengerName)                  \
+  F(u8, boardSize) F(var, timeLimit)
+
+#define QUEUE_REQUEST_SCHEMA(F, T, R) F(u8, boardSize) F(var, timeLimit)
+
+#define QUEUE_STATUS_SCHEMA(F, T, R)                                           \
+  F(u8, inQueue) F(u8, boardSize) F(var, timeLimit) F(var, waiting)
+
+#define CHALLENGE_DECLINED_RESPONSE_SCHEMA(F, T, R)                            \
+  F(var, challengeId) F(var, declinerId) T(declinerName)
+
+#define GAME_START_SCHEMA(F, T, R)                                             \
+  F(var, gameId) F(var, player1Id) F(var, player2Id) T(player1Name)           \
+  T(player2Name) F(u8, boardSize) F(var, currentTurn) F(var, timeLimit)       \
+  F(var, player1Time) F(var, player2Time)
+
+#define MOVE_REQUEST_SCHEMA(F, T, R) F(var, gameId) F(u8, x) F(u8, y)
+
+#define MOVE_RESPONSE_SCHEMA(F, T, R)                                          \
+  F(u8, success) F(u8, x) F(u8, y) F(u8, player) F(var, nextTurn)             \
+  F(var, player1Time) F(var, player2Time) F(var, moveNumber)
+
+#define WATCH_REQUEST_SCHEMA(F, T, R) F(var, gameId) F(var, rewindSeconds)
+
+#define WATCH_RESPONSE_SCHEMA(F, T, R)                                         \
+  F(var, gameId) F(var, delaySeconds) F(var, tailMoves)
+
+#define SPECTATOR_MOVE_SCHEMA(F, T, R) F(var, gameId) R(move, MoveResponse)
+
+#define GAME_OVER_SCHEMA(F, T, R)                                              \
+  F(var, gameId) F(var, winnerId) T(winnerName) F(sig, eloChange)             \
+  F(u8, reason) F(var, totalMoves)
+
+#define PLAYER_INFO_SCHEMA(F, T, R)                                            \
+  F(var, userId) T(username) F(var, eloRating) F(var, wins) F(var, losses)    \
+  F(var, draws) F(u8, isOnline) F(u8, inGame)
+
+#define PRESENCE_DELTA_HEADER_SCHEMA(F, T, R) F(var, count) F(u8, full)
+
+#define PRESENCE_DELTA_SCHEMA(F, T, R)                                         \
+  F(u8, kind) F(var, userId) F(var, eloRating) F(var, wins) F(var, losses)    \
+  F(var, draws) F(u8, inGame)
+
+#define DRAW_REQUEST_SCHEMA(F, T, R) F(var, gameId)
+
+#define REMATCH_REQUEST_SCHEMA(F, T, R) F(var, lastGameId) F(var, opponentId)
+
+#define GAME_LOG_HEADER_SCHEMA(F, T, R)                                        \
+  F(var, gameId) F(var, player1Id) F(var, player2Id) T(player1Name)           \
+  T(player2Name) F(u8, boardSize) F(var, winnerId) F(u8, result)              \
+  F(var, totalMoves) F(var, gameDuration) F(var, timestamp)
+
+#define REPLAY_REQUEST_SCHEMA(F, T, R)                                         \
+  F(u8, op) F(var, gameId) F(var, moveNumber) F(var, credit)
+
+#define REPLAY_DATA_SCHEMA(F, T, R)                                            \
+  F(var, gameId) F(var, firstMove) F(var, moveCount) F(u8, flags)
+
+#define GAME_HISTORY_ENTRY_SCHEMA(F, T, R)                                     \
+  F(var, gameId) F(var, opponentId) T(opponentName) F(u8, result)             \
+  F(sig, eloChange) F(var, timestamp)
+
+#define LEADERBOARD_REQUEST_SCHEMA(F, T, R)                                    \
+  F(u8, mode) F(var, offset) F(var, limit)
+
+#define LEADERBOARD_HEADER_SCHEMA(F, T, R)                                     \
+  F(var, totalPlayers) F(var, myRank) F(var, startRank) F(var, count)
+
+#define LEADERBOARD_ENTRY_SCHEMA(F, T, R)                                      \
+  F(var, rank) F(var, userId) T(username) F(var, eloRating) F(var, wins)      \
+  F(var, losses) F(var, draws)
+
+#define RATING_HISTORY_REQUEST_SCHEMA(F, T, R)                                 \
+  F(var, userId) F(var, days) F(var, maxPoints)
+
+#define RATING_HISTORY_HEADER_SCHEMA(F, T, R)                                  \
+  F(var, userId) F(var, fromTime) F(var, toTime) F(var, count)                \
+  F(var, currentRating) F(var, startRating) F(var, minRating)                 \
+  F(var, maxRating) F(var, p10Rating) F(var, p50Rating) F(var, p90Rating)     \
+  F(var, sampleCount)
+
+#define RATING_POINT_SCHEMA(F, T, R) F(var, time) F(var, rating)
+
+#define TOURNAMENT_CREATE_SCHEMA(F, T, R)                                      \
+  T(name) F(u8, format) F(u8, boardSize) F(var, timeLimit) F(var, rounds)
+
+#define TOURNAMENT_STATUS_SCHEMA(F, T, R)                                      \
+  F(var, tournamentId) T(name) F(u8, format) F(u8, state) F(var, round)       \
+  F(var, rounds) F(var, players) F(var, gamesInProgress)
+
+#define STANDINGS_REQUEST_SCHEMA(F, T, R)                                      \
+  F(var, tournamentId) F(var, offset) F(var, limit)
+
+#define STANDING_ENTRY_SCHEMA(F, T, R)                                         \
+  F(var, rank) F(var, userId) T(username) F(var, points) F(var, wins)         \
+  F(var, draws) F(var, losses)
+
+#define TIME_UPDATE_SCHEMA(F, T, R)                                            \
+  F(var, gameId) F(var, player1Time) F(var, player2Time)
+
+#define RESIGN_REQUEST_SCHEMA(F, T, R) F(var, gameId)
+
+// ==================== LITTLE-ENDIAN LOADS ====================
+
+struct Le {
+  template <typename T> static T load(const char *p) {
+    T value;
+    memcpy(&value, p, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    char *bytes = (char *)&value;
+    for (size_t i = 0; i < sizeof(value) / 2; i++) {
+      std::swap(bytes[i], bytes[sizeof(value) - 1 - i]);
+    }
+#endif
+    return value;
+  }
+
+  // Read an integer at `offset` of a payload; false if it does not fit
+  template <typename T>
+  static bool read(const char *payload, size_t length, T &value,
+                   size_t offset = 0) {
+    if (offset > length || length - offset < sizeof(T))
+      return false;
+    value = load<T>(payload + offset);
+    return true;
+  }
+};
+
+// ==================== VIEWS ====================
+
+#define SCHEMA_SCALAR(kind, field)                                             \
+  decltype(Layout::field) field() const {                                      \
+    return Le::load<decltype(Layout::field)>(p + offsetof(Layout, field));    \
+  }
+#define SCHEMA_TEXT(field)                                                     \
+  std::string field() const {                                                  \
+    const char *text = p + offsetof(Layout, field);                            \
+    return std::string(text, strnlen(text, sizeof(Layout::field)));            \
+  }
+#define SCHEMA_RECORD(field, Type)                                             \
+  Type##View field() const { return Type##View(p + offsetof(Layout, field)); }
+
+#define SCHEMA_COPY_SCALAR(kind, field) s.field = field();
+#define SCHEMA_COPY_TEXT(field)                                                \
+  memcpy(s.field, p + offsetof(Layout, field), sizeof(s.field));
+#define SCHEMA_COPY_RECORD(field, Type) s.field = field().value();
+
+#define SCHEMA_SIZE_SCALAR(kind, field) +sizeof(Layout::field)
+#define SCHEMA_SIZE_TEXT(field) +sizeof(Layout::field)
+#define SCHEMA_SIZE_RECORD(field, Type) +Type##View::SIZE
+
+// The size check catches a field left out of a list. The constructor does
+// no checking; it is for a record already inside a bound view.
+#define SCHEMA_VIEW(Struct, LIST)                                              \
+  class Struct##View {                                                         \
+  public:                                                                      \
+    typedef Struct Layout;                                                     \
+    static constexpr size_t SIZE = sizeof(Struct);                             \
+    static_assert(0 LIST(SCHEMA_SIZE_SCALAR, SCHEMA_SIZE_TEXT,                 \
+                         SCHEMA_SIZE_RECORD) == SIZE,                          \
+                  "schema of " #Struct " does not cover its fields");          \
+                                                                               \
+    Struct##View() : p(nullptr) {}                                             \
+    explicit Struct##View(const char *p) : p(p) {}                             \
+                                                                               \
+    static Struct##View bind(const char *payload, size_t length,               \
+                             size_t offset = 0) {                              \
+      if (length < SIZE || offset > length - SIZE)                             \
+        return Struct##View();                                                 \
+      /* Never null here; said so the caller's test of it folds away */        \
+      if (!payload)                                                            \
+        __builtin_unreachable();                                               \
+      return Struct##View(payload + offset);                                   \
+    }                                                                          \
+                                                                               \
+    explicit operator bool() const { return p != nullptr; }                    \
+    const char *data() const { return p; }                                     \
+                                                                               \
+    LIST(SCHEMA_SCALAR, SCHEMA_TEXT, SCHEMA_RECORD)                            \
+                                                                               \
+    /* A host-order copy */                                                    \
+    Struct value() const {                                                     \
+      Struct s;                                                                \
+      LIST(SCHEMA_COPY_SCALAR, SCHEMA_COPY_TEXT, SCHEMA_COPY_RECORD)           \
+      return s;                                                                \
+    }                                                                          \
+                                                                               \
+  private:                                                                     \
+    const char *p;                                                             \
+  }
+
+SCHEMA_VIEW(Hello, HELLO_SCHEMA);
+SCHEMA_VIEW(LoginRequest, LOGIN_REQUEST_SCHEMA);
+SCHEMA_VIEW(LoginResponse, LOGIN_RESPONSE_SCHEMA);
+SCHEMA_VIEW(ResumeRequest, RESUME_REQUEST_SCHEMA);
+SCHEMA_VIEW(ResumeResponse, RESUME_RESPONSE_SCHEMA);
+SCHEMA_VIEW(BoardSnapshot, BOARD_SNAPSHOT_SCHEMA);
+SCHEMA_VIEW(RegisterRequest, REGISTER_REQUEST_SCHEMA);
+SCHEMA_VIEW(ChallengeRequest, CHALLENGE_REQUEST_SCHEMA);
+SCHEMA_VIEW(ChallengeResponse, CHALLENGE_RESPONSE_SCHEMA);
+SCHEMA_VIEW(QueueRequest, QUEUE_REQUEST_SCHEMA);
+SCHEMA_VIEW(QueueStatus, QUEUE_STATUS_SCHEMA);
+SCHEMA_VIEW(ChallengeDeclinedResponse, CHALLENGE_DECLINED_RESPONSE_SCHEMA);
+SCHEMA_VIEW(GameStart, GAME_START_SCHEMA);
+SCHEMA_VIEW(MoveRequest, MOVE_REQUEST_SCHEMA);
+SCHEMA_VIEW(MoveResponse, MOVE_RESPONSE_SCHEMA);
+SCHEMA_VIEW(WatchRequest, WATCH_REQUEST_SCHEMA);
+SCHEMA_VIEW(WatchResponse, WATCH_RESPONSE_SCHEMA);
+SCHEMA_VIEW(SpectatorMove, SPECTATOR_MOVE_SCHEMA);
+SCHEMA_VIEW(GameOver, GAME_OVER_SCHEMA);
+SCHEMA_VIEW(PlayerInfo, PLAYER_INFO_SCHEMA);
+SCHEMA_VIEW(PresenceDeltaHeader, PRESENCE_DELTA_HEADER_SCHEMA);
+SCHEMA_VIEW(PresenceDelta, PRESENCE_DELTA_SCHEMA);
+SCHEMA_VIEW(DrawRequest, DRAW_REQUEST_SCHEMA);
+SCHEMA_VIEW(RematchRequest, REMATCH_REQUEST_SCHEMA);
+SCHEMA_VIEW(GameLogHeader, GAME_LOG_HEADER_SCHEMA);
+SCHEMA_VIEW(ReplayRequest, REPLAY_REQUEST_SCHEMA);
+SCHEMA_VIEW(ReplayData, REPLAY_DATA_SCHEMA);
+SCHEMA_VIEW(GameHistoryEntry, GAME_HISTORY_ENTRY_SCHEMA);
+SCHEMA_VIEW(LeaderboardRequest, LEADERBOARD_REQUEST_SCHEMA);
+SCHEMA_VIEW(LeaderboardHeader, LEADERBOARD_HEADER_SCHEMA);
+SCHEMA_VIEW(LeaderboardEntry, LEADERBOARD_ENTRY_SCHEMA);
+SCHEMA_VIEW(RatingHistoryRequest, RATING_HISTORY_REQUEST_SCHEMA);
+SCHEMA_VIEW(RatingHistoryHeader, RATING_HISTORY_HEADER_SCHEMA);
+SCHEMA_VIEW(RatingPoint, RATING_POINT_SCHEMA);
+SCHEMA_VIEW(TournamentCreate, TOURNAMENT_CREATE_SCHEMA);
+SCHEMA_VIEW(TournamentStatus, TOURNAMENT_STATUS_SCHEMA);
+SCHEMA_VIEW(StandingsRequest, STANDINGS_REQUEST_SCHEMA);
+SCHEMA_VIEW(StandingEntry, STANDING_ENTRY_SCHEMA);
+SCHEMA_VIEW(TimeUpdate, TIME_UPDATE_SCHEMA);
+SCHEMA_VIEW(ResignRequest, RESIGN_REQUEST_SCHEMA);
+
+#undef SCHEMA_VIEW
+#undef SCHEMA_SIZE_RECORD
+#undef SCHEMA_SIZE_TEXT
+#undef SCHEMA_SIZE_SCALAR
+#undef SCHEMA_COPY_RECORD
+#undef SCHEMA_COPY_TEXT
+#undef SCHEMA_COPY_SCALAR
+#undef SCHEMA_RECORD
+#undef SCHEMA_TEXT
+#undef SCHEMA_SCALAR
+
+// `count` records of a view's struct, back to back
+template <typename View> class ListView {
+public:
+  ListView() : p(nullptr), n(0), valid(false) {}
+
+  // Empty and false if the records do not all fit
+  static ListView bind(const char *payload, size_t length, size_t offset,
+                       size_t count) {
+    ListView list;
+    if (offset > length || count > (length - offset) / View::SIZE)
+      return list;
+    list.p = payload + offset;
+    list.n = count;
+    list.valid = true;
+    return list;
+  }
+
+  explicit operator bool() const { return valid; }
+  size_t size() const { return n; }
+  size_t bytes() const { return n * View::SIZE; }
+  View operator[](size_t i) const { return View(p + i * View::SIZE); }
+
+private:
+  const char *p;
+  size_t n;
+  bool valid;
+};
+
+#endif
@@ -0,0 +1,178 @@
+// Payload decode cost: the old raw casts against schema.h views.
+//
+// Decodes a buffer of move requests and a leaderboard page, as the server
+// and client handle them, once by casting the payload to the packed
+// struct after a length check and once through bind() and the view's
+// accessors. Both read every field they would use; the sums are printed
+// so that neither loop can be optimized away.
+//
+//   schema_bench [--iterations N]
+
+#include "schema.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static const size_t MOVES = 4096;
+
+// Each message is decoded from its own slot, as if it had just arrived
+struct Payloads {
+  std::vector<char> moves; // MOVES MoveRequests back to back
+  std::vector<char> page;  // LeaderboardHeader and a full page
+};
+
+static Payloads build() {
+  Payloads p;
+  for (size_t i = 0; i < MOVES; i++) {
+    MoveRequest req;
+    req.gameId = 1000 + i;
+    req.x = i % 15;
+    req.y = (i / 15) % 15;
+    p.moves.insert(p.moves.end(), (const char *)&req,
+                   (const char *)&req + sizeof(req));
+  }
+
+  LeaderboardHeader header;
+  header.totalPlayers = 20000;
+  header.myRank = 42;
+  header.startRank = 1;
+  header.count = LEADERBOARD_PAGE_MAX;
+  p.page.insert(p.page.end(), (const char *)&header,
+                (const char *)&header + sizeof(header));
+  for (uint16_t i = 0; i < LEADERBOARD_PAGE_MAX; i++) {
+    LeaderboardEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.rank = i + 1;
+    entry.userId = 7 * i + 1;
+    entry.eloRating = 2400 - i;
+    entry.wins = 100 + i;
+    entry.losses = 50;
+    entry.draws = i % 5;
+    p.page.insert(p.page.end(), (const char *)&entry,
+                  (const char *)&entry + sizeof(entry));
+  }
+  return p;
+}
+
+__attribute__((noinline)) static uint64_t rawMoves(const char *payload,
+                                                    uint32_t length) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < MOVES; i++) {
+    const char *p = payload + i * sizeof(MoveRequest);
+    if (length - i * sizeof(MoveRequest) >= sizeof(MoveRequest)) {
+      MoveRequest *req = (MoveRequest *)p;
+      sum += req->gameId + req->x + req->y;
+    }
+  }
+  return sum;
+}
+
+__attribute__((noinline)) static uint64_t viewMoves(const char *payload,
+                                                     uint32_t length) {
+  uint64_t sum = 0;
+  for (size_t i = 0; i < MOVES; i++) {
+    if (auto req =
+            MoveRequestView::bind(payload, length, i * MoveRequestView::SIZE)) {
+      sum += req.gameId() + req.x() + req.y();
+    }
+  }
+  return sum;
+}
+
+__attribute__((noinline)) static uint64_t rawPage(const char *payload,
+                                                   uint32_t length) {
+  if (length < sizeof(LeaderboardHeader))
+    return 0;
+  LeaderboardHeader *lb = (LeaderboardHeader *)payload;
+  if (lb->count >
+      (length - sizeof(LeaderboardHeader)) / sizeof(LeaderboardEntry))
+    return 0;
+  LeaderboardEntry *entries =
+      (LeaderboardEntry *)(payload + sizeof(LeaderboardHeader));
+  uint64_t sum = lb->myRank;
+  for (uint16_t i = 0; i < lb->count; i++) {
+    LeaderboardEntry &entry = entries[i];
+    sum += entry.rank + entry.userId + entry.eloRating + entry.wins +
+           entry.losses + entry.draws;
+  }
+  return sum;
+}
+
+__attribute__((noinline)) static uint64_t viewPage(const char *payload,
+                                                    uint32_t length) {
+  LeaderboardHeaderView lb = LeaderboardHeaderView::bind(payload, length);
+  if (!lb)
+    return 0;
+  auto entries = ListView<LeaderboardEntryView>::bind(
+      payload, length, LeaderboardHeaderView::SIZE, lb.count());
+  if (!entries)
+    return 0;
+  uint64_t sum = lb.myRank();
+  for (size_t i = 0; i < entries.size(); i++) {
+    LeaderboardEntryView entry = entries[i];
+    sum += entry.rank() + entry.userId() + entry.eloRating() + entry.wins() +
+           entry.losses() + entry.draws();
+  }
+  return sum;
+}
+
+// Nanoseconds per decoded record
+template <typename Decode>
+static double measure(Decode decode, const std::vector<char> &payload,
+                      size_t records, size_t iterations, uint64_t &sum) {
+  Clock::time_point start = Clock::now();
+  for (size_t i = 0; i < iterations; i++) {
+    sum += decode(payload.data(), payload.size());
+  }
+  double nanos =
+      std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  return nanos / (iterations * records);
+}
+
+int main(int argc, char *argv[]) {
+  size_t iterations = 20000;
+  for (int i = 1; i < argc; i++) {
+    if (std::string(argv[i]) == "--iterations" && i + 1 < argc) {
+      iterations = std::strtoul(argv[++i], nullptr, 10);
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--iterations N]" << std::endl;
+      return 1;
+    }
+  }
+
+  Payloads p = build();
+  struct Case {
+    const char *name;
+    uint64_t (*decode)(const char *, uint32_t);
+    const std::vector<char> &payload;
+    size_t records;
+  };
+  const Case cases[] = {
+      {"move, raw cast", rawMoves, p.moves, MOVES},
+      {"move, view", viewMoves, p.moves, MOVES},
+      {"leaderboard, raw cast", rawPage, p.page, LEADERBOARD_PAGE_MAX},
+      {"leaderboard, view", viewPage, p.page, LEADERBOARD_PAGE_MAX},
+  };
+
+  // One untimed pass each warms the caches
+  uint64_t sum = 0;
+  for (const Case &c : cases) {
+    measure(c.decode, c.payload, c.records, 1, sum);
+  }
+  for (const Case &c : cases) {
+    uint64_t check = 0;
+    double nanos =
+        measure(c.decode, c.payload, c.records, iterations, check);
+    std::cout << std::left << std::setw(22) << c.name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(8) << nanos
+              << " ns/record  (sum " << check << ")" << std::endl;
+  }
+  return 0;
+}
@@ -1,13 +1,34 @@
+#include "broadcast_delay.h"
+#include "cluster.h"
 #include "database.h"
 #include "game_logic.h"
+#include "matchmaker.h"
+#include "mux.h"
 #include "protocol.h"
+#include "replay.h"
+#include "schema.h"
+#include "session.h"
+#include "shared_key.h"
+#include "shm_ring.h"
+#include "spectators.h"
+#include "tournament.h"
+#include "wire.h"
+#include "worker_pool.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
 #include <chrono>
 #include <cstring>
 #include <iostream>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <set>
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <thread>
 #include <unistd.h>
 #include <vector>
@@ -15,19 +36,180 @@
 class GomokuServer {
 private:
   int serverSocket;
-  std::map<int, uint32_t> clientSockets; // socket -> userId
-  std::map<uint32_t, int> userSockets;   // userId -> socket
-  std::map<uint32_t, GameState *> activeGames;
+  int unixSocket;       // Local listener, -1 unless started with --unix
+  std::string unixPath; // Its filesystem path, removed on shutdown
+  SessionTable sessions; // Logged-in connections
+  // Games are shared so a handler can drop gameMutex after the lookup and
+  // work under the game's own lock; the state outlives its map entry
+  std::map<uint32_t, std::shared_ptr<GameState>> activeGames;
   std::map<uint32_t, uint32_t> userToGame; // userId -> gameId
   std::map<uint32_t, RematchRequest>
       pendingRematches; // gameId -> rematch request
-  std::mutex clientMutex;
-  std::mutex gameMutex;
+  Matchmaker matchmaker;
+  TournamentManager tournaments;
+  std::set<int> presenceSubscribers; // sockets receiving lobby deltas
+  // Upstream from a connection gateway (see mux.h). Records for all of its
+  // clients are written whole under its mutex.
+  struct GatewayLink {
+    int socket;
+    bool open = true; // Cleared before the socket is closed
+    std::mutex mutex;
+  };
+  // Frames to a socket are written whole under its writer's mutex, in the
+  // wire version and with the features the connection negotiated
+  struct SocketWriter {
+    std::mutex mutex;
+    uint8_t version = WIRE_V1; // Set once, by the connection's first frame
+    bool compress = false;     // Granted WIRE_COMPRESS, set with the version
+    // Granted WIRE_SHM: frames go through this channel, not the socket
+    std::shared_ptr<ShmChannel> ring;
+    // A gateway's client: frames go to its upstream, as records for muxId
+    std::shared_ptr<GatewayLink> gateway;
+    uint32_t muxId = 0;
+  };
+  std::map<int, std::shared_ptr<SocketWriter>> socketWriters;
+  // This node's link to a cluster peer (see cluster.h), and the users with
+  // a session open on the peer through it. Records are written under the
+  // mutex, which the link is only replaced under.
+  struct PeerLink {
+    std::mutex mutex;
+    std::shared_ptr<GatewayLink> link; // Null while disconnected
+    std::set<uint32_t> opened;
+  };
+  Cluster cluster;
+  SharedKey gatewayKey; // Gateways are refused unless one is loaded
+  std::vector<std::unique_ptr<PeerLink>> peers; // By node; none for self
+  // Local users seated in a game on a peer, and its node; under gameMutex
+  std::map<uint32_t, int> remoteSeats;
+  // Players of games being started, until registered; under gameMutex
+  std::set<uint32_t> seating;
+  std::map<int, uint64_t> connectionIds; // socket -> id of its connection
+  uint64_t nextConnectionId;
+  // Gateway clients have no descriptor; they are known by numbers from
+  // VIRTUAL_SOCKET_BASE up, which no real socket reaches
+  std::atomic<int> nextVirtualSocket;
+  std::mutex clientMutex; // connectionIds; held while a login opens a session
+  std::mutex gameMutex; // activeGames, userToGame, pendingRematches, seats
+  std::mutex subscriberMutex;
+  std::mutex socketWritersMutex;
+  // Open replay per socket. A stream is only used by its connection's
+  // handler thread; the lock covers the map.
+  std::map<int, std::shared_ptr<ReplayStream>> replays;
+  std::mutex replayMutex;
   Database db;
+  WireStats wireStats;
+  WorkerPool authPool;  // Password hashing for login and registration
+  WorkerPool queryPool; // Lookups answered out of order on v3 connections
+  WorkerPool gatewayPool; // Frames of gateway clients, one job per client
+  SpectatorHub spectators;
+  BroadcastDelay delayed; // Spectator feeds, when they run behind live play
   bool running;
 
+  // Logins and registrations waiting for a hashing worker before new ones
+  // are refused, and how much lower the workers' priority is
+  static const size_t AUTH_QUEUE_LIMIT = 256;
+  static const int AUTH_WORKER_NICENESS = 10;
+
+  // Lookups waiting for a query worker before new ones are answered on
+  // the connection's own thread
+  static const size_t QUERY_QUEUE_LIMIT = 1024;
+
+  // How long a dropped session, and any game it is playing, waits for the
+  // client to reconnect before the user is logged out
+  static const int RESUME_GRACE_SEC = 30;
+
+  // Frames a spectator may fall behind before it is dropped, connections
+  // with frames waiting to be written before new watchers are dropped,
+  // how long a write to a watcher may block before it is disconnected, and
+  // how much lower the writers' priority is than the players' threads
+  static const size_t SPECTATOR_QUEUE_LIMIT = 1024;
+  static const size_t SPECTATOR_OUTBOX_LIMIT = 65536;
+  static const int SPECTATOR_SEND_TIMEOUT_SEC = 5;
+  static const int SPECTATOR_WRITER_NICENESS = 5;
+
+  // How long a write to a gateway may block before its upstream, and every
+  // client on it, is dropped, how many bytes of a gateway client's frames
+  // are held before they are handled, how many clients one upstream may
+  // open, and how many clients may wait for a gateway worker
+  static const int GATEWAY_SEND_TIMEOUT_SEC = 5;
+  static const size_t GATEWAY_PENDING_LIMIT = 1 << 20;
+  static const size_t GATEWAY_CLIENTS_MAX = 10000;
+  static const size_t GATEWAY_QUEUE_LIMIT = 65536;
+  static const int VIRTUAL_SOCKET_BASE = 1 << 30;
+
+  // How long a node waits before connecting to a peer again
+  static const int PEER_RETRY_SEC = 1;
+
+  // Replay chunks a client may have granted and not yet received
+  static const uint32_t REPLAY_CREDIT_MAX = 64;
+
+  // How often coalesced presence deltas are pushed to subscribers
+  static const int PRESENCE_FLUSH_MS = 250;
+
+  // How often widened matchmaking windows are re-checked, and how often
+  // time-to-match percentiles are logged while players are being matched
+  static const int MATCHMAKING_SWEEP_MS = 1000;
+  static const int MATCHMAKING_REPORT_SEC = 60;
+
+  // The request being answered on this thread. Frames sent to its socket
+  // carry its tag. When it is answered off the connection's own thread,
+  // they are only written while that connection still holds the socket.
+  struct Reply {
+    int socket;
+    uint32_t tag;
+    uint64_t connection; // 0 on the connection's own thread
+  };
+  static inline thread_local Reply replyTo = {-1, 0, 0};
+
+  class ReplyScope {
+  public:
+    ReplyScope(int socket, uint32_t tag, uint64_t connection = 0)
+        : saved(replyTo) {
+      replyTo = Reply{socket, tag, connection};
+    }
+    ~ReplyScope() { replyTo = saved; }
+
+  private:
+    Reply saved;
+  };
+
 public:
-  GomokuServer(int port) : running(true) {
+  GomokuServer(int port, uint32_t ratingPeriodSeconds = 0,
+               uint32_t spectatorDelaySeconds = 0,
+               const std::string &unixPath = "",
+               const Cluster &cluster = Cluster(),
+               const SharedKey &gatewayKey = SharedKey('G'))
+      : unixSocket(-1), unixPath(unixPath),
+        tournaments([this](uint32_t userId) { return isSeated(userId); }),
+        cluster(cluster), gatewayKey(gatewayKey),
+        nextConnectionId(1), nextVirtualSocket(VIRTUAL_SOCKET_BASE),
+        db(dataDir(cluster)),
+        authPool(std::max(1u, std::thread::hardware_concurrency() / 2),
+                 AUTH_QUEUE_LIMIT, AUTH_WORKER_NICENESS),
+        queryPool(std::max(2u, std::thread::hardware_concurrency() / 2),
+                  QUERY_QUEUE_LIMIT),
+        gatewayPool(std::max(4u, std::thread::hardware_concurrency()),
+                    GATEWAY_QUEUE_LIMIT),
+        spectators(std::max(2u, std::thread::hardware_concurrency() / 2),
+                   SPECTATOR_QUEUE_LIMIT, SPECTATOR_OUTBOX_LIMIT,
+                   SPECTATOR_WRITER_NICENESS,
+                   [this](int socket, const std::vector<char> &frame) {
+                     return writeSpectatorFrame(socket, frame);
+                   }),
+        delayed(spectators, spectatorDelaySeconds,
+                [this](uint16_t type, const void *payload, uint32_t length,
+                       uint32_t tag) {
+                  return buildSharedFrames(type, payload, length, tag);
+                }),
+        running(true) {
+    if (cluster.enabled()) {
+      db.restrictIds([this](uint32_t id) { return this->cluster.owns(id); });
+      db.onRated([this](uint32_t userId, const GlickoRating &glicko) {
+        pushRating(userId, glicko);
+      });
+    }
+    db.enableGlicko(ratingPeriodSeconds);
+
     // Create socket
     serverSocket = socket(AF_INET, SOCK_STREAM, 0);
     if (serverSocket < 0) {
@@ -57,6 +239,10 @@ public:
       exit(1);
     }
 
+    if (!unixPath.empty()) {
+      openUnixListener();
+    }
+
     std::cout << "╔══════════════════════════════════════════╗" << std::endl;
     std::cout << "║     GOMOKU SERVER - LAN MULTIPLAYER      ║" << std::endl;
     std::cout << "╠══════════════════════════════════════════╣" << std::endl;
@@ -64,18 +250,85 @@ public:
               << std::endl;
     std::cout << "║  Waiting for connections...              ║" << std::endl;
     std::cout << "╚══════════════════════════════════════════╝" << std::endl;
+    if (unixSocket >= 0) {
+      std::cout << "Local clients: " << unixPath << std::endl;
+    }
+    if (cluster.enabled()) {
+      std::cout << "Cluster node " << cluster.selfIndex() << " of "
+                << cluster.size() << ", owning hashes [" << std::hex
+                << cluster.rangeBegin() << ", " << cluster.rangeEnd() << ")"
+                << std::dec << std::endl;
+      for (size_t node = 0; node < cluster.size(); node++) {
+        peers.emplace_back((int)node == cluster.selfIndex() ? nullptr
+                                                             : new PeerLink);
+      }
+      for (size_t node = 0; node < cluster.size(); node++) {
+        if (peers[node]) {
+          std::thread(&GomokuServer::peerLoop, this, (int)node).detach();
+        }
+      }
+    }
 
     // Start timeout checker thread
     std::thread(&GomokuServer::timeoutChecker, this).detach();
+
+    // Start lobby presence publisher thread
+    std::thread(&GomokuServer::presencePublisher, this).detach();
+
+    // Start matchmaking sweep thread
+    std::thread(&GomokuServer::matchmakingLoop, this).detach();
+  }
+
+  // Each node of a cluster keeps its own files
+  static std::string dataDir(const Cluster &cluster) {
+    if (!cluster.enabled())
+      return "./data/";
+    return "./data/node" + std::to_string(cluster.selfIndex()) + "/";
   }
 
   void start() {
+    if (unixSocket >= 0) {
+      std::thread(&GomokuServer::acceptLoop, this, unixSocket).detach();
+    }
+    acceptLoop(serverSocket);
+  }
+
+  // Local clients connect to a Unix domain socket at `unixPath`, which is
+  // replaced if a previous server left it behind. Only they may move their
+  // connection to shared memory (see shm_ring.h).
+  void openUnixListener() {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (unixPath.size() >= sizeof(addr.sun_path)) {
+      std::cerr << "Unix socket path too long: " << unixPath << std::endl;
+      exit(1);
+    }
+    unixPath.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    unixSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (unixSocket < 0) {
+      std::cerr << "Error creating Unix socket" << std::endl;
+      exit(1);
+    }
+    unlink(unixPath.c_str());
+    if (bind(unixSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      std::cerr << "Error binding Unix socket " << unixPath << std::endl;
+      exit(1);
+    }
+    if (listen(unixSocket, 10) < 0) {
+      std::cerr << "Error listening on " << unixPath << std::endl;
+      exit(1);
+    }
+  }
+
+  void acceptLoop(int listener) {
     while (running) {
-      struct sockaddr_in clientAddr;
+      struct sockaddr_storage clientAddr;
       socklen_t clientLen = sizeof(clientAddr);
 
       int clientSocket =
-          accept(serverSocket, (struct sockaddr *)&clientAddr, &clientLen);
+          accept(listener, (struct sockaddr *)&clientAddr, &clientLen);
       if (clientSocket < 0) {
         if (running) {
           std::cerr << "Error accepting connection" << std::endl;
@@ -94,118 +347,532 @@ public:
     while (running) {
       std::this_thread::sleep_for(std::chrono::seconds(1));
 
-      std::lock_guard<std::mutex> lock(gameMutex);
-      for (auto &pair : activeGames) {
-        GameState *game = pair.second;
-        if (game->timeLimit > 0 && GameLogic::checkTimeout(game)) {
+      for (const SessionPtr &session :
+           sessions.expire(SessionTable::Clock::now())) {
+        endSession(*session);
+      }
+
+      std::vector<std::shared_ptr<GameState>> games;
+      {
+        std::lock_guard<std::mutex> lock(gameMutex);
+        for (auto &pair : activeGames) {
+          if (pair.second->timeLimit > 0)
+            games.push_back(pair.second);
+        }
+      }
+
+      for (auto &game : games) {
+        std::lock_guard<std::mutex> lock(game->mutex);
+        if (game->finished)
+          continue;
+        if (GameLogic::checkTimeout(game.get())) {
           // Current player timed out
           uint32_t loserId = game->currentTurn;
           uint32_t winnerId =
               (game->player1Id == loserId) ? game->player2Id : game->player1Id;
 
-          handleGameOver(game, winnerId, 2); // 2 = timeout
+          handleGameOver(game.get(), winnerId, 2); // 2 = timeout
+        } else {
+          TimeUpdate update;
+          update.gameId = game->gameId;
+          update.player1Time =
+              GameLogic::getRemainingTime(game.get(), game->player1Id);
+          update.player2Time =
+              GameLogic::getRemainingTime(game.get(), game->player2Id);
+          publishClock(update);
+        }
+      }
+    }
+  }
+
+  // Read exactly len bytes; a single recv may return a partial payload
+  static int recvAll(int socket, void *buffer, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+      int n = recv(socket, (char *)buffer + total, len - total, 0);
+      if (n <= 0)
+        return n;
+      total += n;
+    }
+    return (int)total;
+  }
+
+  // Push the presence changes of the last interval to every subscriber.
+  // The batch is framed once per wire version and the same bytes go to
+  // every subscriber speaking it.
+  void presencePublisher() {
+    while (running) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(PRESENCE_FLUSH_MS));
+
+      std::vector<PresenceChange> changes = db.takePresenceChanges();
+      if (changes.empty())
+        continue;
+      if (cluster.enabled()) {
+        publishToPeers(changes);
+      }
+
+      std::vector<int> subscribers;
+      {
+        std::lock_guard<std::mutex> lock(subscriberMutex);
+        subscribers.assign(presenceSubscribers.begin(),
+                           presenceSubscribers.end());
+      }
+      if (subscribers.empty())
+        continue;
+
+      std::vector<char> batch;
+      PresenceDeltaHeader header;
+      header.count = changes.size();
+      header.full = 0;
+      appendBytes(batch, &header, sizeof(header));
+      for (const auto &change : changes) {
+        appendPresenceDelta(batch, change.kind, change.entry);
+      }
+
+      SharedFrames frames =
+          buildSharedFrames(MSG_PRESENCE_DELTA, batch.data(), batch.size());
+      for (int socket : subscribers) {
+        std::shared_ptr<SocketWriter> writer = socketWriter(socket);
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writeFrame(socket, *writer, *frames[writer->version - 1]);
+      }
+    }
+  }
+
+  // Pair queued players whose rating windows have widened enough, advance
+  // tournaments waiting on their players and close expired arenas, and
+  // periodically log how long players wait for a match and the traffic
+  // per wire version
+  void matchmakingLoop() {
+    auto lastReport = std::chrono::steady_clock::now();
+    size_t lastMatched = 0;
+
+    while (running) {
+      std::this_thread::sleep_for(
+          std::chrono::milliseconds(MATCHMAKING_SWEEP_MS));
+
+      std::vector<Matchmaker::Match> matches = matchmaker.sweep();
+      if (!matches.empty()) {
+        startMatchedGames(matches);
+      }
+
+      for (auto &update : tournaments.tick()) {
+        applyTournamentUpdate(update);
+      }
+
+      auto now = std::chrono::steady_clock::now();
+      if (now - lastReport >= std::chrono::seconds(MATCHMAKING_REPORT_SEC)) {
+        size_t matched = matchmaker.matched();
+        if (matched != lastMatched) {
+          Matchmaker::WaitStats stats = matchmaker.waitStats();
+          std::cout << "[*] Matchmaking: " << matched << " matched, "
+                    << matchmaker.size() << " queued, wait p50 "
+                    << stats.p50Ms << " ms, p90 " << stats.p90Ms
+                    << " ms, p99 " << stats.p99Ms << " ms (last "
+                    << stats.samples << ")" << std::endl;
+          lastMatched = matched;
+        }
+        std::string wire = wireStats.report();
+        if (!wire.empty()) {
+          std::cout << wire << std::endl;
         }
+        lastReport = now;
       }
     }
   }
 
   void handleClient(int clientSocket) {
+    {
+      std::lock_guard<std::mutex> lock(clientMutex);
+      connectionIds[clientSocket] = nextConnectionId++;
+    }
+
+    ClientState state;
+    auto read = [clientSocket, &state](void *buffer, size_t len) {
+      if (state.ring)
+        return state.ring->read(buffer, len);
+      return recvAll(clientSocket, buffer, len) > 0;
+    };
     while (running) {
       MessageHeader header;
-      int bytesRead = recv(clientSocket, &header, sizeof(header), 0);
-
-      if (bytesRead <= 0) {
-        std::cout << "[-] Client disconnected: " << clientSocket << std::endl;
-        removeClient(clientSocket);
-        close(clientSocket);
+      std::vector<char> payload;
+      size_t wireBytes = 0;
+      uint32_t tag = 0;
+      if (!WireCodec::readFrame(state.version, read, header, payload,
+                                wireBytes, tag))
+        break;
+      if (state.first && header.type == MSG_GATEWAY_HELLO) {
+        serveGateway(clientSocket, payload);
+        break;
+      }
+      if (state.first && header.type == MSG_PEER_HELLO) {
+        servePeer(clientSocket, payload);
         break;
       }
+      handleFrame(clientSocket, state, header, payload, wireBytes, tag);
+    }
 
-      // Read payload
-      char *payload = nullptr;
-      if (header.length > 0) {
-        payload = new char[header.length];
-        bytesRead = recv(clientSocket, payload, header.length, 0);
+    std::cout << "[-] Client disconnected: " << clientSocket << std::endl;
+    closeConnection(clientSocket);
+  }
 
-        if (bytesRead <= 0) {
-          delete[] payload;
-          break;
-        }
+  // What a connection has agreed on so far
+  struct ClientState {
+    uint8_t version = WIRE_V1;
+    bool first = true; // No frame handled yet
+    std::shared_ptr<ShmChannel> ring; // Set if the Hello granted WIRE_SHM
+  };
+
+  // A frame read from a client, on its socket or through a gateway
+  void handleFrame(int clientSocket, ClientState &state,
+                   MessageHeader &header, std::vector<char> &payload,
+                   size_t wireBytes, uint32_t tag) {
+    wireStats.read(state.version, wireBytes);
+
+    ReplyScope scope(clientSocket, tag);
+    if (header.type == MSG_HELLO) {
+      if (state.first) {
+        state.version = handleHello(clientSocket, header, payload);
+        state.ring = socketWriter(clientSocket)->ring;
+      } else {
+        sendError(clientSocket, "Wire version already chosen");
+      }
+    } else {
+      processMessage(clientSocket, state.version, header, payload.data());
+    }
+    state.first = false;
+  }
+
+  // The connection id goes first, so a login finishing on a worker can no
+  // longer bind to this socket. The descriptor is closed under its write
+  // lock, so a reply already being written completes before it is reused.
+  void closeConnection(int clientSocket) {
+    {
+      std::lock_guard<std::mutex> lock(clientMutex);
+      connectionIds.erase(clientSocket);
+    }
+    removeClient(clientSocket);
+    spectators.remove(clientSocket);
+    {
+      std::lock_guard<std::mutex> lock(replayMutex);
+      replays.erase(clientSocket);
+    }
+
+    std::shared_ptr<SocketWriter> writer = socketWriter(clientSocket);
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    {
+      std::lock_guard<std::mutex> writersLock(socketWritersMutex);
+      socketWriters.erase(clientSocket);
+    }
+    if (writer->ring) {
+      writer->ring->close();
+    }
+    if (!writer->gateway) {
+      close(clientSocket);
+    }
+  }
+
+  // Answer in v1 with the version both sides speak and the features both
+  // know; every frame after the reply uses them. Shared memory is only
+  // granted on the Unix socket, whose reply carries the channel's
+  // descriptor.
+  uint8_t handleHello(int clientSocket, const MessageHeader &header,
+                      const std::vector<char> &payload) {
+    Hello hello;
+    hello.version = WIRE_V1;
+    hello.features = 0;
+    if (header.length >= sizeof(hello.version)) {
+      hello.version = std::max<uint8_t>(
+          WIRE_V1, std::min<uint8_t>(payload[0], WIRE_VERSION_MAX));
+    }
+    if (header.length >= sizeof(Hello)) {
+      hello.features = payload[1] & WIRE_FEATURES;
+    }
+
+    std::shared_ptr<ShmChannel> ring;
+    if (hello.features & WIRE_SHM) {
+      struct sockaddr_storage local;
+      socklen_t localLen = sizeof(local);
+      if (getsockname(clientSocket, (struct sockaddr *)&local, &localLen) ==
+              0 &&
+          local.ss_family == AF_UNIX) {
+        ring = ShmChannel::create(clientSocket);
       }
+      if (!ring) {
+        hello.features &= ~WIRE_SHM;
+      }
+    }
 
-      // Process message
-      processMessage(clientSocket, header, payload);
-      if (payload)
-        delete[] payload;
+    std::shared_ptr<SocketWriter> writer = socketWriter(clientSocket);
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    std::vector<char> frame = buildFrame(WIRE_V1, MSG_HELLO_RESPONSE, 0, 0,
+                                         &hello, sizeof(hello));
+    if (ring) {
+      if (ShmChannel::sendWithFd(clientSocket, frame.data(), frame.size(),
+                                 ring->fd())) {
+        wireStats.wrote(WIRE_V1, frame.size());
+        writer->ring = ring;
+      } else {
+        // The reply granting shared memory may be partly sent, without
+        // the channel; the stream cannot be continued
+        shutdown(clientSocket, SHUT_RDWR);
+      }
+    } else {
+      writeFrame(clientSocket, *writer, frame);
     }
+    writer->version = hello.version;
+    writer->compress = hello.features & WIRE_COMPRESS;
+    return hello.version;
+  }
+
+  // Id of the connection currently using the socket, 0 if none
+  uint64_t connectionId(int clientSocket) {
+    std::lock_guard<std::mutex> lock(clientMutex);
+    auto it = connectionIds.find(clientSocket);
+    return it == connectionIds.end() ? 0 : it->second;
   }
 
-  void processMessage(int clientSocket, MessageHeader &header, char *payload) {
+  void processMessage(int clientSocket, uint8_t version, MessageHeader &header,
+                      char *payload) {
     switch (header.type) {
     case MSG_REGISTER:
-      handleRegister(clientSocket, (RegisterRequest *)payload);
-      break;
+      if (auto req = RegisterRequestView::bind(payload, header.length)) {
+        handleRegister(clientSocket, req);
+      }
+      return;
 
     case MSG_LOGIN:
-      handleLogin(clientSocket, (LoginRequest *)payload);
+      if (auto req = LoginRequestView::bind(payload, header.length)) {
+        handleLogin(clientSocket, req);
+      }
+      return;
+
+    case MSG_RESUME_SESSION:
+      if (auto req = ResumeRequestView::bind(payload, header.length)) {
+        handleResume(clientSocket, req);
+      }
+      return;
+    }
+
+    // Everything else needs the session of this socket; the ids in a v1
+    // header are checked, never trusted, and v2 frames carry none
+    SessionPtr session =
+        version == WIRE_V1
+            ? sessions.validate(clientSocket, header.sessionId, header.userId)
+            : sessions.find(clientSocket);
+    if (!session) {
+      sendError(clientSocket, "Not logged in");
+      return;
+    }
+    if (cluster.enabled()) {
+      int node = routeOf(header, payload);
+      if (node != cluster.selfIndex()) {
+        forwardToPeer(clientSocket, node, *session, header, payload);
+        return;
+      }
+    }
+    if (version >= WIRE_V3 && isQuery(header.type)) {
+      runQuery(clientSocket, session, header, payload);
+      return;
+    }
+    dispatch(clientSocket, *session, header, payload);
+  }
+
+  // Read-only lookups. On a v3 connection they run on queryPool, so a slow
+  // one does not hold up the requests behind it, and the tag tells the
+  // client which request each answer belongs to. Older clients could not
+  // tell, so theirs are answered in order on the connection's thread.
+  static bool isQuery(uint16_t type) {
+    switch (type) {
+    case MSG_GET_ONLINE_PLAYERS:
+    case MSG_GET_GAME_LOG:
+    case MSG_GET_GAME_HISTORY:
+    case MSG_GET_STANDINGS:
+    case MSG_GET_LEADERBOARD:
+    case MSG_GET_RATING_HISTORY:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  // With the queue full the lookup is answered here instead, which also
+  // slows down a client that floods it
+  void runQuery(int clientSocket, const SessionPtr &session,
+                MessageHeader &header, const char *payload) {
+    uint32_t tag = replyTo.tag;
+    uint64_t connection = connectionId(clientSocket);
+    std::vector<char> copy(payload, payload + header.length);
+    bool queued = queryPool.submit([=]() mutable {
+      ReplyScope scope(clientSocket, tag, connection);
+      dispatch(clientSocket, *session, header, copy.data());
+    });
+    if (!queued) {
+      dispatch(clientSocket, *session, header, copy.data());
+    }
+  }
+
+  void dispatch(int clientSocket, const Session &session,
+                MessageHeader &header, const char *payload) {
+    uint32_t userId = session.userId;
+    // Several requests carry only a uint32_t id
+    uint32_t id = 0;
+    bool hasId = Le::read(payload, header.length, id);
+    switch (header.type) {
+    case MSG_LOGOUT:
+      handleLogout(clientSocket);
       break;
 
     case MSG_GET_ONLINE_PLAYERS:
-      handleGetOnlinePlayers(clientSocket, header.userId);
+      handleGetOnlinePlayers(clientSocket, userId);
+      break;
+
+    case MSG_SUBSCRIBE_PRESENCE:
+      handleSubscribePresence(clientSocket, userId);
+      break;
+
+    case MSG_UNSUBSCRIBE_PRESENCE:
+      handleUnsubscribePresence(clientSocket);
       break;
 
     case MSG_SEND_CHALLENGE:
-      handleSendChallenge(clientSocket, header.userId,
-                          (ChallengeRequest *)payload);
+      if (auto req = ChallengeRequestView::bind(payload, header.length)) {
+        handleSendChallenge(clientSocket, session, req);
+      }
       break;
 
     case MSG_ACCEPT_CHALLENGE:
-      handleAcceptChallenge(clientSocket, header.userId, *(uint32_t *)payload);
+      if (hasId) {
+        handleAcceptChallenge(clientSocket, userId, id);
+      }
       break;
 
     case MSG_DECLINE_CHALLENGE:
-      handleDeclineChallenge(clientSocket, header.userId, *(uint32_t *)payload);
+      if (hasId) {
+        handleDeclineChallenge(clientSocket, session, id);
+      }
+      break;
+
+    case MSG_JOIN_QUEUE:
+      if (auto req = QueueRequestView::bind(payload, header.length)) {
+        handleJoinQueue(clientSocket, userId, req);
+      }
+      break;
+
+    case MSG_LEAVE_QUEUE:
+      handleLeaveQueue(clientSocket, userId);
       break;
 
     case MSG_MAKE_MOVE:
-      handleMakeMove(clientSocket, header.userId, (MoveRequest *)payload);
+      if (auto req = MoveRequestView::bind(payload, header.length)) {
+        handleMakeMove(clientSocket, userId, req);
+      }
+      break;
+
+    case MSG_WATCH_GAME:
+      if (hasId) {
+        // rewindSeconds may be left off
+        uint16_t rewindSeconds = 0;
+        Le::read(payload, header.length, rewindSeconds,
+                 offsetof(WatchRequest, rewindSeconds));
+        handleWatchGame(clientSocket, userId, id, rewindSeconds);
+      }
+      break;
+
+    case MSG_UNWATCH_GAME:
+      if (hasId) {
+        spectators.unwatch(id, clientSocket);
+      }
       break;
 
     case MSG_RESIGN:
-      handleResign(clientSocket, header.userId, (ResignRequest *)payload);
+      if (auto req = ResignRequestView::bind(payload, header.length)) {
+        handleResign(clientSocket, session, req);
+      }
       break;
 
     case MSG_OFFER_DRAW:
-      handleOfferDraw(clientSocket, header.userId, (DrawRequest *)payload);
+      if (auto req = DrawRequestView::bind(payload, header.length)) {
+        handleOfferDraw(clientSocket, session, req);
+      }
       break;
 
     case MSG_ACCEPT_DRAW:
-      handleAcceptDraw(clientSocket, header.userId, (DrawRequest *)payload);
+      if (auto req = DrawRequestView::bind(payload, header.length)) {
+        handleAcceptDraw(clientSocket, userId, req);
+      }
       break;
 
     case MSG_DECLINE_DRAW:
-      handleDeclineDraw(clientSocket, header.userId, (DrawRequest *)payload);
+      if (auto req = DrawRequestView::bind(payload, header.length)) {
+        handleDeclineDraw(clientSocket, userId, req);
+      }
       break;
 
     case MSG_REQUEST_REMATCH:
-      handleRequestRematch(clientSocket, header.userId,
-                           (RematchRequest *)payload);
+      if (auto req = RematchRequestView::bind(payload, header.length)) {
+        handleRequestRematch(clientSocket, session, req);
+      }
       break;
 
     case MSG_ACCEPT_REMATCH:
-      handleAcceptRematch(clientSocket, header.userId, *(uint32_t *)payload);
+      if (hasId) {
+        handleAcceptRematch(clientSocket, userId, id);
+      }
       break;
 
     case MSG_DECLINE_REMATCH:
-      handleDeclineRematch(clientSocket, header.userId, *(uint32_t *)payload);
+      if (hasId) {
+        handleDeclineRematch(clientSocket, userId, id);
+      }
       break;
 
     case MSG_GET_GAME_LOG:
-      handleGetGameLog(clientSocket, header.userId, *(uint32_t *)payload);
+      if (hasId) {
+        handleGetGameLog(clientSocket, userId, id);
+      }
       break;
 
     case MSG_GET_GAME_HISTORY:
-      handleGetGameHistory(clientSocket, header.userId);
+      handleGetGameHistory(clientSocket, userId);
+      break;
+
+    case MSG_REPLAY_GAME:
+      if (auto req = ReplayRequestView::bind(payload, header.length)) {
+        handleReplay(clientSocket, userId, req);
+      }
+      break;
+
+    case MSG_TOURNAMENT_CREATE:
+      if (auto req = TournamentCreateView::bind(payload, header.length)) {
+        handleCreateTournament(clientSocket, userId, req);
+      }
+      break;
+
+    case MSG_TOURNAMENT_JOIN:
+    case MSG_TOURNAMENT_START:
+      if (hasId) {
+        handleTournamentAction(clientSocket, userId, header.type, id);
+      }
+      break;
+
+    case MSG_GET_STANDINGS:
+      if (auto req = StandingsRequestView::bind(payload, header.length)) {
+        handleGetStandings(clientSocket, userId, req);
+      }
+      break;
+
+    case MSG_GET_LEADERBOARD:
+      if (auto req = LeaderboardRequestView::bind(payload, header.length)) {
+        handleGetLeaderboard(clientSocket, userId, req);
+      }
+      break;
+
+    case MSG_GET_RATING_HISTORY:
+      if (auto req = RatingHistoryRequestView::bind(payload, header.length)) {
+        handleGetRatingHistory(clientSocket, userId, req);
+      }
       break;
 
     default:
@@ -213,230 +880,1668 @@ public:
     }
   }
 
-  // ==================== AUTHENTICATION ====================
-
-  void handleRegister(int clientSocket, RegisterRequest *req) {
-    LoginResponse response;
-    memset(&response, 0, sizeof(response));
-
-    if (db.createUser(req->username, req->email, req->password)) {
-      response.success = 1;
-      strcpy(response.message, "Registration successful! Please login.");
-    } else {
-      response.success = 0;
-      strcpy(response.message, "Username already exists");
+  // ==================== GATEWAYS ====================
+
+  // A gateway's client. The upstream's reader queues its bytes, and one
+  // job at a time on gatewayPool handles them, so a slow handler holds up
+  // only its own client, and each client's frames stay in order.
+  struct GatewayClient {
+    int socket;
+    uint32_t muxId;
+    std::shared_ptr<GatewayLink> link;
+    ClientState state;         // Only used by the client's job
+    std::vector<char> pending; // Start of a frame not yet whole; the job's
+    std::mutex mutex;          // Guards the fields below
+    std::vector<char> inbox;   // Bytes the job has not taken yet
+    bool scheduled = false;    // A job is queued or running
+    bool closing = false;      // MUX_CLOSE sent; waiting for the gateway's
+    bool closed = false;       // Gone; the connection is closed once idle
+  };
+
+  // Serve a gateway's upstream on the thread that accepted it, until it
+  // closes. The gateway must prove it holds the key given with
+  // --gateway-key, in a handshake of MSG_GATEWAY_HELLO frames (see
+  // shared_key.h). At most GATEWAY_CLIENTS_MAX clients are open on it.
+  void serveGateway(int gatewaySocket, const std::vector<char> &hello) {
+    KeyHello theirs;
+    if (!gatewayKey.loaded() || hello.size() != sizeof(theirs)) {
+      sendError(gatewaySocket, "Gateways are not accepted");
+      return;
+    }
+    memcpy(&theirs, hello.data(), sizeof(theirs));
+    KeyHello ours = gatewayKey.hello(0);
+    gatewayKey.prove(true, theirs, ours);
+    KeyHello answer;
+    if (!writeKeyHello(gatewaySocket, MSG_GATEWAY_HELLO, ours) ||
+        !readKeyHello(gatewaySocket, MSG_GATEWAY_HELLO, answer) ||
+        answer.id != theirs.id ||
+        memcmp(answer.nonce, theirs.nonce, sizeof(answer.nonce)) != 0 ||
+        !gatewayKey.verify(true, ours, answer)) {
+      std::cout << "[!] Gateway failed the handshake: " << gatewaySocket
+                << std::endl;
+      return;
     }
 
-    sendMessage(clientSocket, MSG_REGISTER_RESPONSE, 0, 0, &response,
-                sizeof(response));
-  }
+    auto link = std::make_shared<GatewayLink>();
+    link->socket = gatewaySocket;
+    struct timeval timeout;
+    timeout.tv_sec = GATEWAY_SEND_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    setsockopt(gatewaySocket, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+    std::cout << "[+] Gateway connected: " << gatewaySocket << std::endl;
 
-  void handleLogin(int clientSocket, LoginRequest *req) {
-    LoginResponse response;
-    memset(&response, 0, sizeof(response));
+    std::map<uint32_t, std::shared_ptr<GatewayClient>> clients;
+    while (running) {
+      MuxHeader header;
+      if (recvAll(gatewaySocket, &header, sizeof(header)) <= 0 ||
+          header.length > GATEWAY_PENDING_LIMIT)
+        break;
+      std::vector<char> data(header.length);
+      if (header.length > 0 &&
+          recvAll(gatewaySocket, data.data(), header.length) <= 0)
+        break;
 
-    User user;
-    if (db.authenticateUser(req->username, req->password, user)) {
-      response.success = 1;
-      response.userId = user.userId;
-      response.sessionId = generateSessionId();
-      response.eloRating = user.eloRating;
-      response.wins = user.wins;
-      response.losses = user.losses;
-      response.draws = user.draws;
-      strcpy(response.message, "Login successful!");
-
-      // Store client mapping
-      std::lock_guard<std::mutex> lock(clientMutex);
-      clientSockets[clientSocket] = user.userId;
-      userSockets[user.userId] = clientSocket;
+      auto it = clients.find(header.connection);
+      if (header.kind == MUX_OPEN) {
+        if (it != clients.end() || header.connection == 0)
+          continue;
+        if (clients.size() >= GATEWAY_CLIENTS_MAX) {
+          closeGatewayClient(*link, header.connection);
+          continue;
+        }
+        auto client = std::make_shared<GatewayClient>();
+        client->socket = nextVirtualSocket++;
+        client->muxId = header.connection;
+        client->link = link;
+        clients[header.connection] = client;
+        {
+          std::lock_guard<std::mutex> lock(clientMutex);
+          connectionIds[client->socket] = nextConnectionId++;
+        }
+        std::shared_ptr<SocketWriter> writer = socketWriter(client->socket);
+        std::lock_guard<std::mutex> lock(writer->mutex);
+        writer->gateway = link;
+        writer->muxId = header.connection;
+      } else if (it == clients.end()) {
+        continue; // Already closed
+      } else if (header.kind == MUX_CLOSE) {
+        dropGatewayClient(it->second);
+        clients.erase(it);
+      } else if (header.kind == MUX_DATA) {
+        queueGatewayData(it->second, data);
+      }
+    }
 
-      db.setUserOnline(user.userId, true);
+    for (auto &pair : clients) {
+      dropGatewayClient(pair.second);
+    }
+    // Jobs still running must not write to the descriptor once it is
+    // closed and perhaps reused
+    {
+      std::lock_guard<std::mutex> lock(link->mutex);
+      link->open = false;
+    }
+    std::cout << "[-] Gateway disconnected: " << gatewaySocket << " ("
+              << clients.size() << " clients dropped)" << std::endl;
+  }
 
-      std::cout << "[*] User logged in: " << user.username
-                << " (ID: " << user.userId << ")" << std::endl;
-    } else {
-      response.success = 0;
-      strcpy(response.message, "Invalid username or password");
+  // Queue bytes from the gateway for the client's job. A client too far
+  // ahead of its job, or with no room for a job, is dropped.
+  void queueGatewayData(const std::shared_ptr<GatewayClient> &client,
+                        const std::vector<char> &data) {
+    {
+      std::lock_guard<std::mutex> lock(client->mutex);
+      if (client->closing || client->closed)
+        return;
+      if (client->inbox.size() + data.size() <= GATEWAY_PENDING_LIMIT) {
+        client->inbox.insert(client->inbox.end(), data.begin(), data.end());
+        if (!client->scheduled) {
+          client->scheduled = gatewayPool.submit(
+              [this, client]() { runGatewayClient(client); });
+        }
+        if (client->scheduled)
+          return;
+      }
+      client->closing = true;
+      client->inbox.clear();
     }
+    closeGatewayClient(*client->link, client->muxId);
+  }
 
-    sendMessage(clientSocket, MSG_LOGIN_RESPONSE, 0, 0, &response,
-                sizeof(response));
+  // A client's job: handle what the reader queued until nothing is left
+  void runGatewayClient(const std::shared_ptr<GatewayClient> &client) {
+    std::unique_lock<std::mutex> lock(client->mutex);
+    while (!client->closing && !client->closed && !client->inbox.empty()) {
+      std::vector<char> bytes;
+      bytes.swap(client->inbox);
+      lock.unlock();
+      client->pending.insert(client->pending.end(), bytes.begin(),
+                             bytes.end());
+      bool ok =
+          handleGatewayData(client->socket, client->state, client->pending);
+      lock.lock();
+      if (!ok && !client->closed) {
+        client->closing = true;
+        client->inbox.clear();
+        client->pending.clear();
+        lock.unlock();
+        closeGatewayClient(*client->link, client->muxId);
+        lock.lock();
+      }
+    }
+    client->scheduled = false;
+    if (client->closed) {
+      lock.unlock();
+      closeConnection(client->socket);
+    }
   }
 
-  // ==================== PLAYER LIST ====================
+  // The gateway dropped the client, or the upstream is gone. Its
+  // connection is closed now, or by its job once that ends.
+  void dropGatewayClient(const std::shared_ptr<GatewayClient> &client) {
+    {
+      std::lock_guard<std::mutex> lock(client->mutex);
+      client->closed = true;
+      client->inbox.clear();
+      if (client->scheduled)
+        return;
+    }
+    closeConnection(client->socket);
+  }
 
-  void handleGetOnlinePlayers(int clientSocket, uint32_t userId) {
-    std::vector<User> onlineUsers = db.getOnlineUsers();
+  // Handle every whole frame in `pending` and keep the rest. A frame is
+  // only decoded once all of it is held. False if a frame is malformed,
+  // declares more than GATEWAY_PENDING_LIMIT or too much is held without
+  // completing one.
+  bool handleGatewayData(int clientSocket, ClientState &state,
+                         std::vector<char> &pending) {
+    size_t used = 0;
+    while (running) {
+      size_t size;
+      if (!WireCodec::frameSize(state.version, pending.data() + used,
+                                pending.size() - used, size) ||
+          size > GATEWAY_PENDING_LIMIT)
+        return false;
+      if (size == 0 || pending.size() - used < size)
+        break;
 
-    // Count players excluding self
-    uint32_t count = 0;
-    for (const auto &user : onlineUsers) {
-      if (user.userId != userId)
-        count++;
+      size_t at = used;
+      auto read = [&](void *buffer, size_t len) {
+        if (used + size - at < len)
+          return false;
+        memcpy(buffer, pending.data() + at, len);
+        at += len;
+        return true;
+      };
+      MessageHeader header;
+      std::vector<char> payload;
+      size_t wireBytes = 0;
+      uint32_t tag = 0;
+      if (!WireCodec::readFrame(state.version, read, header, payload,
+                                wireBytes, tag) ||
+          at != used + size)
+        return false;
+      used = at;
+      handleFrame(clientSocket, state, header, payload, wireBytes, tag);
     }
+    pending.erase(pending.begin(), pending.begin() + used);
+    return pending.size() <= GATEWAY_PENDING_LIMIT;
+  }
 
-    sendMessage(clientSocket, MSG_ONLINE_PLAYERS_LIST, userId, 0, &count,
-                sizeof(count));
-
-    // Send each player info
-    for (const auto &user : onlineUsers) {
-      if (user.userId != userId) {
-        PlayerInfo info;
-        info.userId = user.userId;
-        strcpy(info.username, user.username.c_str());
-        info.eloRating = user.eloRating;
-        info.wins = user.wins;
-        info.losses = user.losses;
-        info.draws = user.draws;
-        info.isOnline = 1;
-        info.inGame = user.inGame ? 1 : 0;
+  // Ask the gateway to drop a client; it answers with MUX_CLOSE, and the
+  // client's connection is closed then
+  void closeGatewayClient(GatewayLink &link, uint32_t muxId) {
+    std::vector<char> record;
+    appendMuxRecord(record, muxId, MUX_CLOSE);
+    writeGateway(link, record);
+  }
 
-        send(clientSocket, &info, sizeof(info), 0);
+  // A write that times out or fails leaves a record half sent, so the
+  // upstream is shut down, and serveGateway() drops its clients
+  bool writeGateway(GatewayLink &link, const std::vector<char> &record) {
+    std::lock_guard<std::mutex> lock(link.mutex);
+    if (!link.open)
+      return false;
+    size_t sent = 0;
+    while (sent < record.size()) {
+      ssize_t n = send(link.socket, record.data() + sent,
+                       record.size() - sent, MSG_NOSIGNAL);
+      if (n <= 0) {
+        shutdown(link.socket, SHUT_RDWR);
+        return false;
       }
+      sent += n;
     }
+    return true;
   }
 
-  // ==================== CHALLENGE SYSTEM ====================
-
-  void handleSendChallenge(int clientSocket, uint32_t challengerId,
-                           ChallengeRequest *req) {
-    uint32_t challengeId = db.createChallenge(challengerId, req->targetUserId,
-                                              req->boardSize, req->timeLimit);
+  // ==================== CLUSTER ====================
 
-    // Send to target user
-    std::lock_guard<std::mutex> lock(clientMutex);
-    auto it = userSockets.find(req->targetUserId);
-    if (it != userSockets.end()) {
-      ChallengeResponse response;
-      response.challengeId = challengeId;
-      response.challengerId = challengerId;
-
-      User challenger = db.getUser(challengerId);
-      strcpy(response.challengerName, challenger.username.c_str());
-      response.boardSize = req->boardSize;
-      response.timeLimit = req->timeLimit;
-
-      sendMessage(it->second, MSG_CHALLENGE_RECEIVED, 0, 0, &response,
-                  sizeof(response));
+  // Node that owns what a request is about: the game it names, or the
+  // user a challenge or rating history is for. Everything else is served
+  // by the user's home, this node.
+  int routeOf(const MessageHeader &header, const char *payload) {
+    uint32_t id = 0;
+    switch (header.type) {
+    case MSG_SEND_CHALLENGE:
+      if (auto req = ChallengeRequestView::bind(payload, header.length)) {
+        return cluster.ownerOf(req.targetUserId());
+      }
+      break;
 
-      std::cout << "[*] Challenge sent: " << challenger.username << " -> User "
-                << req->targetUserId << std::endl;
-    }
+    case MSG_GET_RATING_HISTORY:
+      if (auto req = RatingHistoryRequestView::bind(payload, header.length)) {
+        if (req.userId() != 0)
+          return cluster.ownerOf(req.userId());
+      }
+      break;
 
-    // Confirm to sender
-    sendMessage(clientSocket, MSG_CHALLENGE_RESPONSE, challengerId, 0,
-                &challengeId, sizeof(challengeId));
-  }
+    case MSG_REPLAY_GAME:
+      if (auto req = ReplayRequestView::bind(payload, header.length)) {
+        return cluster.ownerOf(req.gameId());
+      }
+      break;
 
-  void handleAcceptChallenge(int clientSocket, uint32_t userId,
-                             uint32_t challengeId) {
-    Challenge challenge = db.getChallenge(challengeId);
-    if (challenge.challengeId == 0) {
-      sendError(clientSocket, "Challenge not found or expired");
+    // These start with the game id, or for a rematch the last game's
+    case MSG_MAKE_MOVE:
+    case MSG_WATCH_GAME:
+    case MSG_UNWATCH_GAME:
+    case MSG_RESIGN:
+    case MSG_OFFER_DRAW:
+    case MSG_ACCEPT_DRAW:
+    case MSG_DECLINE_DRAW:
+    case MSG_REQUEST_REMATCH:
+    case MSG_ACCEPT_REMATCH:
+    case MSG_DECLINE_REMATCH:
+    case MSG_GET_GAME_LOG:
+      if (Le::read(payload, header.length, id)) {
+        return cluster.ownerOf(id);
+      }
+      break;
+    }
+    return cluster.selfIndex();
+  }
+
+  // Send a user's request to the node that owns what it is about, in v3
+  // with the request's tag. Their session there is opened with the first
+  // one, and the answers come back through readPeerLink().
+  void forwardToPeer(int clientSocket, int node, const Session &session,
+                     const MessageHeader &header, const char *payload) {
+    std::vector<char> frame = WireCodec::frame(
+        WIRE_V3, header.type, 0, 0, payload, header.length, replyTo.tag);
+    bool sent = false;
+    {
+      PeerLink &peer = *peers[node];
+      std::lock_guard<std::mutex> lock(peer.mutex);
+      if (peer.link) {
+        std::vector<char> record;
+        if (peer.opened.insert(session.userId).second) {
+          appendPeerOpen(record, session.userId);
+        }
+        appendMuxRecord(record, session.userId, MUX_DATA, frame.data(),
+                        frame.size());
+        sent = writeGateway(*peer.link, record);
+      }
+    }
+    if (!sent) {
+      sendError(clientSocket, "Cluster node unavailable, try again later");
+    }
+  }
+
+  // MUX_OPEN for a local user, carrying their presence
+  void appendPeerOpen(std::vector<char> &record, uint32_t userId) {
+    User user = db.getUser(userId);
+    std::vector<char> data;
+    appendPresenceDelta(data, PRESENCE_JOINED, presenceOf(user));
+    ClusterRating rating = toClusterRating(user.glicko);
+    appendBytes(data, &rating, sizeof(rating));
+    appendMuxRecord(record, userId, MUX_OPEN, data.data(), data.size());
+  }
+
+  static PresenceEntry presenceOf(const User &user) {
+    PresenceEntry entry;
+    entry.userId = user.userId;
+    entry.username = user.username;
+    entry.eloRating = user.eloRating;
+    entry.wins = user.wins;
+    entry.losses = user.losses;
+    entry.draws = user.draws;
+    entry.inGame = user.inGame;
+    return entry;
+  }
+
+  // A local user left this node: suspend their sessions on the peers, or
+  // on logout log them out there too
+  void closePeerSessions(uint32_t userId, bool logout) {
+    if (!cluster.enabled())
+      return;
+    std::vector<char> bye =
+        WireCodec::frame(WIRE_V3, MSG_LOGOUT, 0, 0, nullptr, 0);
+    for (auto &peer : peers) {
+      if (!peer)
+        continue;
+      std::lock_guard<std::mutex> lock(peer->mutex);
+      if (!peer->link || peer->opened.erase(userId) == 0)
+        continue;
+      std::vector<char> record;
+      if (logout) {
+        appendMuxRecord(record, userId, MUX_DATA, bye.data(), bye.size());
+      }
+      appendMuxRecord(record, userId, MUX_CLOSE);
+      writeGateway(*peer->link, record);
+    }
+  }
+
+  // A local user back on this node whose game is played on a peer: open
+  // their session there, and the peer sends the game back (CLUSTER_SEAT)
+  void reseatRemote(uint32_t userId) {
+    int node;
+    {
+      std::lock_guard<std::mutex> lock(gameMutex);
+      auto it = remoteSeats.find(userId);
+      if (it == remoteSeats.end())
+        return;
+      node = it->second;
+    }
+    PeerLink &peer = *peers[node];
+    std::lock_guard<std::mutex> lock(peer.mutex);
+    if (!peer.link || !peer.opened.insert(userId).second)
+      return;
+    std::vector<char> record;
+    appendPeerOpen(record, userId);
+    writeGateway(*peer.link, record);
+  }
+
+  // Record for a peer on this node's link to it; false if not connected
+  bool writePeer(int node, const std::vector<char> &record) {
+    PeerLink &peer = *peers[node];
+    std::lock_guard<std::mutex> lock(peer.mutex);
+    return peer.link && writeGateway(*peer.link, record);
+  }
+
+  // A local user's new rating, for the peers they have a session on, which
+  // rate their opponents against it
+  void pushRating(uint32_t userId, const GlickoRating &glicko) {
+    ClusterRating rating = toClusterRating(glicko);
+    std::vector<char> record;
+    appendMuxRecord(record, userId, CLUSTER_RATING, &rating, sizeof(rating));
+    for (auto &peer : peers) {
+      if (!peer)
+        continue;
+      std::lock_guard<std::mutex> lock(peer->mutex);
+      if (peer->link && peer->opened.count(userId) > 0) {
+        writeGateway(*peer->link, record);
+      }
+    }
+  }
+
+  // Tell a remote player's home node about their game here
+  void notifyHome(uint32_t userId, uint8_t kind, const void *data,
+                  uint32_t length) {
+    std::vector<char> record;
+    appendMuxRecord(record, userId, kind, data, length);
+    writePeer(cluster.ownerOf(userId), record);
+  }
+
+  // Called once a game here has its result recorded; remote players are
+  // rated by their home from the header
+  void reportRemoteResult(const GameState *game) {
+    if (!cluster.enabled())
+      return;
+    GameRecord record = db.getGameRecord(game->gameId);
+    ClusterGameResult result;
+    memset(&result, 0, sizeof(result));
+    result.gameId = record.gameId;
+    result.player1Id = record.player1Id;
+    result.player2Id = record.player2Id;
+    record.player1Name.copy(result.player1Name,
+                            sizeof(result.player1Name) - 1);
+    record.player2Name.copy(result.player2Name,
+                            sizeof(result.player2Name) - 1);
+    result.boardSize = record.boardSize;
+    result.winnerId = record.winnerId;
+    result.result = record.result;
+    result.totalMoves = record.totalMoves;
+    result.startTime = record.startTime;
+    result.duration = record.duration;
+    result.eloChange = record.eloChange;
+    result.player1Rating = toClusterRating(db.getUser(record.player1Id).glicko);
+    result.player2Rating = toClusterRating(db.getUser(record.player2Id).glicko);
+    for (uint32_t playerId : {game->player1Id, game->player2Id}) {
+      if (!cluster.owns(playerId)) {
+        notifyHome(playerId, CLUSTER_GAME_OVER, &result, sizeof(result));
+      }
+    }
+  }
+
+  // Presence changes of this node's own users go to every peer
+  void publishToPeers(const std::vector<PresenceChange> &changes) {
+    std::vector<char> batch;
+    PresenceDeltaHeader header;
+    header.count = 0;
+    header.full = 0;
+    appendBytes(batch, &header, sizeof(header));
+    for (const auto &change : changes) {
+      if (cluster.owns(change.entry.userId)) {
+        appendPresenceDelta(batch, change.kind, change.entry);
+        header.count++;
+      }
+    }
+    if (header.count == 0)
+      return;
+    memcpy(batch.data(), &header, sizeof(header));
+
+    std::vector<char> record;
+    appendMuxRecord(record, 0, CLUSTER_PRESENCE, batch.data(), batch.size());
+    for (size_t node = 0; node < peers.size(); node++) {
+      if (peers[node]) {
+        writePeer(node, record);
+      }
+    }
+  }
+
+  // Apply a peer's presence batch; a full one replaces what was known of
+  // its users
+  void applyPeerPresence(int node, const std::vector<char> &data) {
+    PresenceDeltaHeader header;
+    if (data.size() < sizeof(header))
+      return;
+    memcpy(&header, data.data(), sizeof(header));
+    if (header.full) {
+      db.dropRemotePresence(
+          [&](uint32_t userId) { return cluster.ownerOf(userId) == node; });
+    }
+
+    size_t at = sizeof(header);
+    for (uint32_t i = 0; i < header.count; i++) {
+      PresenceDelta delta;
+      if (data.size() - at < sizeof(delta))
+        return;
+      memcpy(&delta, data.data() + at, sizeof(delta));
+      at += sizeof(delta);
+      std::string username;
+      if (delta.kind & PRESENCE_JOINED) {
+        const size_t nameSize = 32;
+        if (data.size() - at < nameSize)
+          return;
+        username.assign(data.data() + at, strnlen(data.data() + at, nameSize));
+        at += nameSize;
+      }
+      if (cluster.ownerOf(delta.userId) != node)
+        continue; // Only a user's home speaks for them
+      db.applyRemotePresence(delta.kind, delta.userId, username,
+                             delta.eloRating, delta.wins, delta.losses,
+                             delta.draws, delta.inGame != 0);
+    }
+  }
+
+  // Serve a peer's link to this node on the thread that accepted it. The
+  // peer's users get sessions here as a gateway's clients do, on virtual
+  // sockets, and the frames sent to them go back as records on the link.
+  void servePeer(int peerSocket, const std::vector<char> &hello) {
+    PeerHello theirs;
+    if (!cluster.enabled() || hello.size() != sizeof(theirs)) {
+      sendError(peerSocket, "Not a peer of this node");
+      return;
+    }
+    memcpy(&theirs, hello.data(), sizeof(theirs));
+    uint32_t node = theirs.id;
+    if (node >= cluster.size() || (int)node == cluster.selfIndex()) {
+      sendError(peerSocket, "Not a peer of this node");
+      return;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = GATEWAY_SEND_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    setsockopt(peerSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+    int one = 1;
+    setsockopt(peerSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // The peer proves it holds the cluster key after this node has
+    PeerHello ours = cluster.hello();
+    cluster.prove(true, theirs, ours);
+    sendMessage(peerSocket, MSG_PEER_HELLO, 0, 0, &ours, sizeof(ours));
+    PeerHello answer;
+    if (!readKeyHello(peerSocket, MSG_PEER_HELLO, answer) ||
+        answer.id != node ||
+        memcmp(answer.nonce, theirs.nonce, sizeof(answer.nonce)) != 0 ||
+        !cluster.verify(true, ours, answer)) {
+      std::cout << "[!] Peer hello as cluster node " << node
+                << " failed the handshake: " << peerSocket << std::endl;
+      return;
+    }
+
+    auto link = std::make_shared<GatewayLink>();
+    link->socket = peerSocket;
+    std::cout << "[+] Cluster node " << node << " connected: " << peerSocket
+              << std::endl;
+
+    struct PeerClient {
+      int socket;
+      ClientState state;
+      std::vector<char> pending;
+      bool closing; // MUX_CLOSE sent; waiting for the home's
+    };
+    std::map<uint32_t, PeerClient> clients; // By user id
+
+    while (running) {
+      MuxHeader header;
+      if (recvAll(peerSocket, &header, sizeof(header)) <= 0 ||
+          header.length > MUX_RECORD_MAX)
+        break;
+      std::vector<char> data(header.length);
+      if (header.length > 0 &&
+          recvAll(peerSocket, data.data(), header.length) <= 0)
+        break;
+
+      uint32_t userId = header.connection;
+      auto it = clients.find(userId);
+      switch (header.kind) {
+      case MUX_OPEN:
+        if (it == clients.end() && cluster.ownerOf(userId) == (int)node) {
+          PeerClient client{openPeerClient(link, userId, data), ClientState(),
+                            {}, false};
+          client.state.version = WIRE_V3;
+          client.state.first = false;
+          clients[userId] = std::move(client);
+          seatPeerClient(*link, userId);
+        }
+        break;
+
+      case MUX_DATA:
+        if (it != clients.end() && !it->second.closing) {
+          PeerClient &client = it->second;
+          client.pending.insert(client.pending.end(), data.begin(),
+                                data.end());
+          if (!handleGatewayData(client.socket, client.state,
+                                 client.pending)) {
+            client.closing = true;
+            client.pending.clear();
+            closeGatewayClient(*link, userId);
+          }
+        }
+        break;
+
+      case MUX_CLOSE:
+        if (it != clients.end()) {
+          closeConnection(it->second.socket);
+          clients.erase(it);
+        }
+        break;
+
+      case CLUSTER_PRESENCE:
+        applyPeerPresence(node, data);
+        break;
+
+      case CLUSTER_GAME_START:
+        if (cluster.owns(userId) && data.size() >= sizeof(uint32_t)) {
+          {
+            std::lock_guard<std::mutex> lock(gameMutex);
+            remoteSeats[userId] = node;
+          }
+          db.setUserInGame(userId, true);
+        }
+        break;
+
+      case CLUSTER_GAME_OVER:
+        if (cluster.owns(userId) && data.size() >= sizeof(ClusterGameResult)) {
+          recordPeerGame(userId, data);
+        }
+        break;
+
+      case CLUSTER_RATING:
+        if (cluster.ownerOf(userId) == (int)node &&
+            data.size() >= sizeof(ClusterRating)) {
+          ClusterRating rating;
+          memcpy(&rating, data.data(), sizeof(rating));
+          db.setRemoteGlicko(userId, db.getUser(userId).username,
+                             fromClusterRating(rating));
+        }
+        break;
+      }
+    }
+
+    for (auto &pair : clients) {
+      closeConnection(pair.second.socket);
+    }
+    // The node's users are offline until it is back, and games played
+    // there are lost
+    db.dropRemotePresence(
+        [&](uint32_t userId) { return cluster.ownerOf(userId) == (int)node; });
+    std::vector<uint32_t> unseated;
+    {
+      std::lock_guard<std::mutex> lock(gameMutex);
+      for (auto it = remoteSeats.begin(); it != remoteSeats.end();) {
+        if (it->second == (int)node) {
+          unseated.push_back(it->first);
+          it = remoteSeats.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    for (uint32_t userId : unseated) {
+      db.setUserInGame(userId, false);
+    }
+    std::cout << "[-] Cluster node " << node << " disconnected: "
+              << peerSocket << " (" << clients.size()
+              << " sessions suspended)" << std::endl;
+  }
+
+  // Session for a peer's user, who is known here from the OPEN's presence;
+  // returns its virtual socket
+  int openPeerClient(const std::shared_ptr<GatewayLink> &link,
+                     uint32_t userId, const std::vector<char> &data) {
+    PresenceDelta delta;
+    memset(&delta, 0, sizeof(delta));
+    std::string username;
+    const size_t nameSize = 32;
+    if (data.size() >= sizeof(delta) + nameSize) {
+      memcpy(&delta, data.data(), sizeof(delta));
+      username.assign(data.data() + sizeof(delta),
+                      strnlen(data.data() + sizeof(delta), nameSize));
+      db.applyRemotePresence(PRESENCE_JOINED, userId, username,
+                             delta.eloRating, delta.wins, delta.losses,
+                             delta.draws, delta.inGame != 0);
+    }
+    ClusterRating rating;
+    if (data.size() >= sizeof(delta) + nameSize + sizeof(rating)) {
+      memcpy(&rating, data.data() + sizeof(delta) + nameSize, sizeof(rating));
+      db.setRemoteGlicko(userId, username, fromClusterRating(rating));
+    }
+
+    int socket = nextVirtualSocket++;
+    {
+      std::lock_guard<std::mutex> lock(clientMutex);
+      connectionIds[socket] = nextConnectionId++;
+    }
+    {
+      std::shared_ptr<SocketWriter> writer = socketWriter(socket);
+      std::lock_guard<std::mutex> lock(writer->mutex);
+      writer->gateway = link;
+      writer->muxId = userId;
+      writer->version = WIRE_V3;
+    }
+    sessions.open(socket, userId, username);
+    return socket;
+  }
+
+  // A peer's user opening a session while seated in a game here gets the
+  // game sent to their home, to be resumed in it. The game's lock is held
+  // until it is written, so the game's next frames follow it.
+  void seatPeerClient(GatewayLink &link, uint32_t userId) {
+    std::shared_ptr<GameState> game = gameOf(userId);
+    if (!game)
+      return;
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->finished)
+      return;
+    std::vector<char> snapshot;
+    appendSnapshot(snapshot, game.get());
+    std::vector<char> record;
+    appendMuxRecord(record, userId, CLUSTER_SEAT, snapshot.data(),
+                    snapshot.size());
+    writeGateway(link, record);
+  }
+
+  // A local user's game on a peer has ended
+  void recordPeerGame(uint32_t userId, const std::vector<char> &data) {
+    ClusterGameResult result;
+    memcpy(&result, data.data(), sizeof(result));
+    GameRecord record;
+    record.gameId = result.gameId;
+    record.player1Id = result.player1Id;
+    record.player2Id = result.player2Id;
+    record.player1Name.assign(
+        result.player1Name,
+        strnlen(result.player1Name, sizeof(result.player1Name)));
+    record.player2Name.assign(
+        result.player2Name,
+        strnlen(result.player2Name, sizeof(result.player2Name)));
+    record.boardSize = result.boardSize;
+    record.winnerId = result.winnerId;
+    record.result = result.result;
+    record.totalMoves = result.totalMoves;
+    record.startTime = result.startTime;
+    record.duration = result.duration;
+    record.eloChange = result.eloChange;
+    // The opponent is rated against here as the owner knew them
+    bool first = result.player1Id == userId;
+    uint32_t opponentId = first ? record.player2Id : record.player1Id;
+    if (!cluster.owns(opponentId)) {
+      db.setRemoteGlicko(opponentId,
+                         first ? record.player2Name : record.player1Name,
+                         fromClusterRating(first ? result.player2Rating
+                                                 : result.player1Rating));
+    }
+    {
+      std::lock_guard<std::mutex> lock(gameMutex);
+      remoteSeats.erase(userId);
+    }
+    db.recordRemoteGame(userId, record);
+  }
+
+  // Keep this node's link to a peer up, connecting again a second after
+  // it fails, and handle what the peer sends on it
+  void peerLoop(int node) {
+    PeerLink &peer = *peers[node];
+    while (running) {
+      int peerSocket = connectPeer(node);
+      if (peerSocket >= 0) {
+        auto link = std::make_shared<GatewayLink>();
+        link->socket = peerSocket;
+
+        // This node's users, before any change the publisher sends
+        std::vector<char> batch;
+        PresenceDeltaHeader header;
+        header.count = 0;
+        header.full = 1;
+        appendBytes(batch, &header, sizeof(header));
+        {
+          std::lock_guard<std::mutex> lock(peer.mutex);
+          for (const auto &user : db.getOnlineUsers()) {
+            if (cluster.owns(user.userId)) {
+              appendPresenceDelta(batch, PRESENCE_JOINED, user);
+              header.count++;
+            }
+          }
+          memcpy(batch.data(), &header, sizeof(header));
+          std::vector<char> record;
+          appendMuxRecord(record, 0, CLUSTER_PRESENCE, batch.data(),
+                          batch.size());
+          if (writeGateway(*link, record)) {
+            peer.link = link;
+            peer.opened.clear();
+          }
+        }
+
+        if (peer.link) {
+          std::cout << "[+] Linked to cluster node " << node << std::endl;
+          readPeerLink(node, peerSocket);
+          std::cout << "[-] Lost link to cluster node " << node << std::endl;
+        }
+        {
+          std::lock_guard<std::mutex> lock(peer.mutex);
+          peer.link.reset();
+          peer.opened.clear();
+        }
+        close(peerSocket);
+      }
+      std::this_thread::sleep_for(std::chrono::seconds(PEER_RETRY_SEC));
+    }
+  }
+
+  // Connected and greeted link to a peer, or -1
+  int connectPeer(int node) {
+    const Cluster::Node &peer = cluster.node(node);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(peer.port);
+    if (inet_pton(AF_INET, peer.host.c_str(), &addr.sin_addr) != 1)
+      return -1;
+    int peerSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (peerSocket < 0)
+      return -1;
+    if (connect(peerSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      close(peerSocket);
+      return -1;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = GATEWAY_SEND_TIMEOUT_SEC;
+    timeout.tv_usec = 0;
+    setsockopt(peerSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+    int one = 1;
+    setsockopt(peerSocket, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    // The peer proves it holds the cluster key before this node does
+    PeerHello ours = cluster.hello();
+    PeerHello theirs;
+    if (!writeKeyHello(peerSocket, MSG_PEER_HELLO, ours) ||
+        !readKeyHello(peerSocket, MSG_PEER_HELLO, theirs) ||
+        (int)theirs.id != node ||
+        !cluster.verify(false, ours, theirs)) {
+      close(peerSocket);
+      return -1;
+    }
+    cluster.prove(false, theirs, ours);
+    if (!writeKeyHello(peerSocket, MSG_PEER_HELLO, ours)) {
+      close(peerSocket);
+      return -1;
+    }
+    return peerSocket;
+  }
+
+  // One hello of a key handshake (shared_key.h), in v1 framing
+  static bool writeKeyHello(int socket, uint16_t type, const KeyHello &hello) {
+    std::vector<char> frame =
+        WireCodec::frame(WIRE_V1, type, 0, 0, &hello, sizeof(hello));
+    return send(socket, frame.data(), frame.size(), MSG_NOSIGNAL) ==
+           (ssize_t)frame.size();
+  }
+
+  static bool readKeyHello(int socket, uint16_t type, KeyHello &hello) {
+    MessageHeader header;
+    std::vector<char> payload;
+    size_t wireBytes;
+    uint32_t tag;
+    auto read = [socket](void *buffer, size_t len) {
+      return recvAll(socket, buffer, len) > 0;
+    };
+    if (!WireCodec::readFrame(WIRE_V1, read, header, payload, wireBytes,
+                              tag) ||
+        header.type != type || payload.size() != sizeof(hello))
+      return false;
+    memcpy(&hello, payload.data(), sizeof(hello));
+    return true;
+  }
+
+  // What a peer sends on this node's link to it: frames for local users,
+  // requests to close their sessions there, and games to resume them in
+  void readPeerLink(int node, int peerSocket) {
+    PeerLink &peer = *peers[node];
+    while (running) {
+      MuxHeader header;
+      if (recvAll(peerSocket, &header, sizeof(header)) <= 0 ||
+          header.length > MUX_RECORD_MAX)
+        return;
+      std::vector<char> data(header.length);
+      if (header.length > 0 &&
+          recvAll(peerSocket, data.data(), header.length) <= 0)
+        return;
+
+      uint32_t userId = header.connection;
+      if (header.kind == MUX_DATA) {
+        relayToUser(userId, data);
+      } else if (header.kind == MUX_CLOSE) {
+        std::lock_guard<std::mutex> lock(peer.mutex);
+        if (peer.link && peer.opened.erase(userId) > 0) {
+          std::vector<char> record;
+          appendMuxRecord(record, userId, MUX_CLOSE);
+          writeGateway(*peer.link, record);
+        }
+      } else if (header.kind == CLUSTER_SEAT) {
+        resumeFromPeer(userId, data);
+      }
+    }
+  }
+
+  // Frames a peer sent a local user, passed on in the user's own wire
+  // version with their tags kept
+  void relayToUser(uint32_t userId, const std::vector<char> &data) {
+    size_t at = 0;
+    auto read = [&](void *buffer, size_t len) {
+      if (data.size() - at < len)
+        return false;
+      memcpy(buffer, data.data() + at, len);
+      at += len;
+      return true;
+    };
+    MessageHeader header;
+    std::vector<char> payload;
+    size_t wireBytes;
+    uint32_t tag;
+    while (at < data.size() &&
+           WireCodec::readFrame(WIRE_V3, read, header, payload, wireBytes,
+                                tag)) {
+      int socket = socketOf(userId);
+      if (socket < 0)
+        return; // Suspended; a resume gets the game back
+      std::shared_ptr<SocketWriter> writer = socketWriter(socket);
+      std::lock_guard<std::mutex> lock(writer->mutex);
+      writeFrame(socket, *writer,
+                 buildFrame(writer->version, header.type, userId, 0,
+                            payload.data(), payload.size(), tag,
+                            writer->compress));
+    }
+  }
+
+  // Resume a local user in their game on a peer, from its CLUSTER_SEAT
+  void resumeFromPeer(uint32_t userId, const std::vector<char> &data) {
+    BoardSnapshot snapshot;
+    if (data.size() < sizeof(snapshot))
+      return;
+    memcpy(&snapshot, data.data(), sizeof(snapshot));
+    if (data.size() < sizeof(snapshot) + boardCells(snapshot.boardSize))
+      return;
+    int socket = socketOf(userId);
+    SessionPtr session = sessions.find(socket);
+    if (!session)
+      return;
+
+    ResumeResponse response;
+    memset(&response, 0, sizeof(response));
+    response.success = 1;
+    response.userId = userId;
+    response.sessionId = session->sessionId;
+    response.gameId = snapshot.gameId;
+    std::vector<char> payload;
+    appendBytes(payload, &response, sizeof(response));
+    appendBytes(payload, data.data(), data.size());
+    sendMessage(socket, MSG_RESUME_RESPONSE, userId, session->sessionId,
+                payload.data(), payload.size());
+  }
+
+  // In a cluster an account is served only by the node owning its name;
+  // a client that came to another one is told where to go
+  bool redirectAccount(int clientSocket, uint16_t type,
+                       const std::string &username) {
+    int node = cluster.ownerOfName(username);
+    if (node == cluster.selfIndex())
+      return false;
+    LoginResponse response;
+    memset(&response, 0, sizeof(response));
+    response.success = 0;
+    snprintf(response.message, sizeof(response.message),
+             "Account is served by cluster node %d at %s:%d", node,
+             cluster.node(node).host.c_str(), cluster.node(node).port);
+    sendMessage(clientSocket, type, 0, 0, &response, sizeof(response));
+    return true;
+  }
+
+  // ==================== AUTHENTICATION ====================
+
+  // Password hashing takes tens of milliseconds, so registration and
+  // login are handed to authPool and answered from the worker. The
+  // connection id taken here tells the worker whether the client is still
+  // the one on this socket when the answer is ready, and the request's tag
+  // goes along with it.
+
+  void handleRegister(int clientSocket, const RegisterRequestView &req) {
+    uint64_t connection = connectionId(clientSocket);
+    uint32_t tag = replyTo.tag;
+    std::string username = req.username();
+    std::string email = req.email();
+    std::string password = req.password();
+    if (redirectAccount(clientSocket, MSG_REGISTER_RESPONSE, username))
+      return;
+
+    bool queued = authPool.submit([=]() {
+      ReplyScope scope(clientSocket, tag, connection);
+      LoginResponse response;
+      memset(&response, 0, sizeof(response));
+      if (db.createUser(username.c_str(), email.c_str(), password.c_str())) {
+        response.success = 1;
+        strcpy(response.message, "Registration successful! Please login.");
+      } else {
+        response.success = 0;
+        strcpy(response.message, "Username already exists");
+      }
+      sendAuthResponse(clientSocket, connection, MSG_REGISTER_RESPONSE,
+                       response, nullptr);
+    });
+    if (!queued) {
+      sendAuthBusy(clientSocket, MSG_REGISTER_RESPONSE);
+    }
+  }
+
+  void handleLogin(int clientSocket, const LoginRequestView &req) {
+    uint64_t connection = connectionId(clientSocket);
+    uint32_t tag = replyTo.tag;
+    std::string username = req.username();
+    std::string password = req.password();
+    if (redirectAccount(clientSocket, MSG_LOGIN_RESPONSE, username))
+      return;
+
+    bool queued = authPool.submit([=]() {
+      ReplyScope scope(clientSocket, tag, connection);
+      LoginResponse response;
+      memset(&response, 0, sizeof(response));
+      User user;
+      if (db.authenticateUser(username.c_str(), password.c_str(), user)) {
+        response.success = 1;
+        response.userId = user.userId;
+        response.eloRating = user.eloRating;
+        response.wins = user.wins;
+        response.losses = user.losses;
+        response.draws = user.draws;
+        strcpy(response.message, "Login successful!");
+        sendAuthResponse(clientSocket, connection, MSG_LOGIN_RESPONSE,
+                         response, &user);
+      } else {
+        response.success = 0;
+        strcpy(response.message, "Invalid username or password");
+        sendAuthResponse(clientSocket, connection, MSG_LOGIN_RESPONSE,
+                         response, nullptr);
+      }
+    });
+    if (!queued) {
+      sendAuthBusy(clientSocket, MSG_LOGIN_RESPONSE);
+    }
+  }
+
+  // Runs on an auth worker. The socket's write lock is held from the
+  // connection check until the reply is written, so the client cannot be
+  // replaced by a new connection on the same descriptor in between. A
+  // logged-in user's session is opened in the same step, and its id is
+  // filled into the response.
+  void sendAuthResponse(int clientSocket, uint64_t connection, uint16_t type,
+                        LoginResponse response, const User *user) {
+    if (connection == 0 || connectionId(clientSocket) != connection)
+      return; // Client left while its password was being hashed
+
+    SessionPtr session;
+    {
+      std::shared_ptr<SocketWriter> writer = socketWriter(clientSocket);
+      std::lock_guard<std::mutex> sendLock(writer->mutex);
+      {
+        std::lock_guard<std::mutex> lock(clientMutex);
+        auto it = connectionIds.find(clientSocket);
+        if (it == connectionIds.end() || it->second != connection)
+          return;
+        if (user) {
+          session = sessions.open(clientSocket, user->userId, user->username);
+          response.sessionId = session->sessionId;
+          response.resumeToken = session->resumeToken;
+        }
+      }
+
+      if (user) {
+        db.setUserOnline(user->userId, true);
+        std::cout << "[*] User logged in: " << user->username
+                  << " (ID: " << user->userId << ")" << std::endl;
+      }
+      writeFrame(clientSocket, *writer,
+                 buildFrame(writer->version, type, 0, 0, &response,
+                            sizeof(response), replyTag(clientSocket)));
+    }
+
+    // A user who logs in again instead of resuming is still seated in their
+    // game; send them back to it. This waits until the socket's write lock
+    // is released, since senders take a game's lock before a socket's.
+    std::shared_ptr<GameState> game = session ? gameOf(session->userId)
+                                              : nullptr;
+    if (session && !game && cluster.enabled()) {
+      reseatRemote(session->userId);
+    }
+    if (game) {
+      std::lock_guard<std::mutex> lock(game->mutex);
+      if (!game->finished) {
+        std::vector<char> payload;
+        appendResume(payload, *session, game.get());
+        sendMessage(clientSocket, MSG_RESUME_RESPONSE, session->userId,
+                    session->sessionId, payload.data(), payload.size());
+      }
+    }
+  }
+
+  // A client that reconnects within the grace period gets its session back
+  // and, if it is playing, one snapshot of the board and clocks instead of
+  // the game's move history. The game's lock is held from the rebind until
+  // the reply is written, so no move reaches the new socket ahead of the
+  // snapshot it would be applied to.
+  void handleResume(int clientSocket, const ResumeRequestView &req) {
+    std::shared_ptr<GameState> game = gameOf(req.userId());
+    std::unique_lock<std::mutex> gameLock;
+    if (game) {
+      gameLock = std::unique_lock<std::mutex>(game->mutex);
+    }
+
+    SessionPtr session = sessions.resume(clientSocket, req.sessionId(),
+                                         req.userId(), req.resumeToken());
+    if (!session) {
+      ResumeResponse response;
+      memset(&response, 0, sizeof(response));
+      sendMessage(clientSocket, MSG_RESUME_RESPONSE, 0, 0, &response,
+                  sizeof(response));
+      return;
+    }
+
+    std::vector<char> payload;
+    appendResume(payload, *session, game && !game->finished ? game.get()
+                                                             : nullptr);
+    sendMessage(clientSocket, MSG_RESUME_RESPONSE, session->userId,
+                session->sessionId, payload.data(), payload.size());
+    if (!game && cluster.enabled()) {
+      reseatRemote(session->userId);
+    }
+
+    std::cout << "[*] Session resumed: " << session->username << std::endl;
+  }
+
+  // ResumeResponse, followed by a BoardSnapshot when `game` is set. The
+  // caller holds game->mutex.
+  void appendResume(std::vector<char> &buffer, const Session &session,
+                    GameState *game) {
+    ResumeResponse response;
+    memset(&response, 0, sizeof(response));
+    response.success = 1;
+    response.userId = session.userId;
+    response.sessionId = session.sessionId;
+    response.gameId = game ? game->gameId : 0;
+    appendBytes(buffer, &response, sizeof(response));
+    if (game) {
+      appendSnapshot(buffer, game);
+    }
+  }
+
+  // BoardSnapshot and packed board; the caller holds game->mutex
+  void appendSnapshot(std::vector<char> &buffer, GameState *game) {
+    BoardSnapshot snapshot;
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.gameId = game->gameId;
+    snapshot.player1Id = game->player1Id;
+    snapshot.player2Id = game->player2Id;
+    db.getUser(game->player1Id)
+        .username.copy(snapshot.player1Name, sizeof(snapshot.player1Name) - 1);
+    db.getUser(game->player2Id)
+        .username.copy(snapshot.player2Name, sizeof(snapshot.player2Name) - 1);
+    snapshot.boardSize = game->boardSize;
+    snapshot.currentTurn = game->currentTurn;
+    snapshot.moveCount = game->moveCount;
+    snapshot.timeLimit = game->timeLimit;
+    snapshot.player1Time = GameLogic::getRemainingTime(game, game->player1Id);
+    snapshot.player2Time = GameLogic::getRemainingTime(game, game->player2Id);
+    snapshot.drawOfferedBy = game->drawOffered ? game->drawOfferedBy : 0;
+    appendBytes(buffer, &snapshot, sizeof(snapshot));
+
+    size_t offset = buffer.size();
+    buffer.resize(offset + boardCells(game->boardSize));
+    GameLogic::packBoard(game, (uint8_t *)buffer.data() + offset);
+  }
+
+  void handleLogout(int clientSocket) {
+    {
+      std::lock_guard<std::mutex> lock(subscriberMutex);
+      presenceSubscribers.erase(clientSocket);
+    }
+    SessionPtr session = sessions.close(clientSocket);
+    if (session) {
+      matchmaker.remove(session->userId);
+      closePeerSessions(session->userId, true);
+      endSession(*session);
+    }
+  }
+
+  void sendAuthBusy(int clientSocket, uint16_t type) {
+    LoginResponse response;
+    memset(&response, 0, sizeof(response));
+    response.success = 0;
+    strcpy(response.message, "Server busy, please try again");
+    sendMessage(clientSocket, type, 0, 0, &response, sizeof(response));
+  }
+
+  // ==================== PLAYER LIST ====================
+
+  void handleGetOnlinePlayers(int clientSocket, uint32_t userId) {
+    std::vector<PresenceEntry> onlineUsers = db.getOnlineUsers();
+
+    // Count followed by one PlayerInfo per player, excluding self
+    std::vector<char> buffer(sizeof(uint32_t));
+    uint32_t count = 0;
+    for (const auto &user : onlineUsers) {
+      if (user.userId != userId) {
+        PlayerInfo info;
+        memset(&info, 0, sizeof(info));
+        info.userId = user.userId;
+        user.username.copy(info.username, sizeof(info.username) - 1);
+        info.eloRating = user.eloRating;
+        info.wins = user.wins;
+        info.losses = user.losses;
+        info.draws = user.draws;
+        info.isOnline = 1;
+        info.inGame = user.inGame ? 1 : 0;
+
+        appendBytes(buffer, &info, sizeof(info));
+        count++;
+      }
+    }
+    memcpy(buffer.data(), &count, sizeof(count));
+
+    sendMessage(clientSocket, MSG_ONLINE_PLAYERS_LIST, userId, 0,
+                buffer.data(), buffer.size());
+  }
+
+  void handleSubscribePresence(int clientSocket, uint32_t userId) {
+    {
+      std::lock_guard<std::mutex> lock(subscriberMutex);
+      presenceSubscribers.insert(clientSocket);
+    }
+
+    // Start the subscriber off with a full list; later batches are deltas
+    std::vector<PresenceEntry> onlineUsers = db.getOnlineUsers();
+    std::vector<char> batch;
+    PresenceDeltaHeader header;
+    header.count = onlineUsers.size();
+    header.full = 1;
+    appendBytes(batch, &header, sizeof(header));
+    for (const auto &user : onlineUsers) {
+      appendPresenceDelta(batch, PRESENCE_JOINED, user);
+    }
+
+    sendMessage(clientSocket, MSG_PRESENCE_DELTA, userId, 0, batch.data(),
+                batch.size());
+  }
+
+  void handleUnsubscribePresence(int clientSocket) {
+    std::lock_guard<std::mutex> lock(subscriberMutex);
+    presenceSubscribers.erase(clientSocket);
+  }
+
+  // ==================== CHALLENGE SYSTEM ====================
+
+  void handleSendChallenge(int clientSocket, const Session &session,
+                           const ChallengeRequestView &req) {
+    uint32_t challengerId = session.userId;
+    if (req.targetUserId() == challengerId) {
+      sendError(clientSocket, "Cannot challenge yourself");
+      return;
+    }
+    if (isSeated(challengerId)) {
+      sendError(clientSocket, "Already in a game");
+      return;
+    }
+    uint32_t challengeId = db.createChallenge(challengerId, req.targetUserId(),
+                                              req.boardSize(), req.timeLimit());
+
+    // Send to target user
+    int targetSocket = socketOf(req.targetUserId());
+    if (targetSocket >= 0) {
+      ChallengeResponse response;
+      memset(&response, 0, sizeof(response));
+      response.challengeId = challengeId;
+      response.challengerId = challengerId;
+
+      session.username.copy(response.challengerName,
+                            sizeof(response.challengerName) - 1);
+      response.boardSize = req.boardSize();
+      response.timeLimit = req.timeLimit();
+
+      sendMessage(targetSocket, MSG_CHALLENGE_RECEIVED, 0, 0, &response,
+                  sizeof(response));
+
+      std::cout << "[*] Challenge sent: " << session.username << " -> User "
+                << req.targetUserId() << std::endl;
+    }
+
+    // Confirm to sender
+    sendMessage(clientSocket, MSG_CHALLENGE_RESPONSE, challengerId, 0,
+                &challengeId, sizeof(challengeId));
+  }
+
+  void handleAcceptChallenge(int clientSocket, uint32_t userId,
+                             uint32_t challengeId) {
+    if (isSeated(userId)) {
+      sendError(clientSocket, "Already in a game");
+      return;
+    }
+    Challenge challenge;
+    if (!db.takeChallenge(challengeId, userId, challenge)) {
+      sendError(clientSocket, "Challenge not found or expired");
+      return;
+    }
+
+    Matchmaker::Match match;
+    match.player1Id = challenge.challengerId;
+    match.player2Id = userId;
+    match.boardSize = challenge.boardSize;
+    match.timeLimit = challenge.timeLimit;
+    if (!startMatchedGames({match})) {
+      sendError(clientSocket, "Challenger is already in a game");
+    }
+  }
+
+  // Create the games for a batch of pairings and notify both players of
+  // each. Used by accepted challenges, the matchmaking queue and tournament
+  // rounds; the batch is registered under a single acquisition of the game
+  // lock and no global lock is held while sending. False if a pairing was
+  // dropped because a player is already seated.
+  bool startMatchedGames(const std::vector<Matchmaker::Match> &pairings,
+                         uint32_t tournamentId = 0) {
+    // A pairing is dropped if a player was seated in another game after
+    // it was made. The players of the rest are held in `seating` until
+    // their game is registered.
+    std::vector<Matchmaker::Match> matches;
+    std::vector<Matchmaker::Match> unplayable;
+    {
+      std::lock_guard<std::mutex> lock(gameMutex);
+      for (const auto &match : pairings) {
+        if (match.player1Id == match.player2Id ||
+            isSeatedLocked(match.player1Id) ||
+            isSeatedLocked(match.player2Id)) {
+          unplayable.push_back(match);
+        } else {
+          seating.insert(match.player1Id);
+          seating.insert(match.player2Id);
+          matches.push_back(match);
+        }
+      }
+    }
+
+    std::vector<GameStart> starts;
+    starts.reserve(matches.size());
+
+    for (const auto &match : matches) {
+      // A player who is paired elsewhere no longer waits in the queue
+      matchmaker.remove(match.player1Id);
+      matchmaker.remove(match.player2Id);
+
+      uint32_t gameId = db.createGame(match.player1Id, match.player2Id,
+                                      match.boardSize, match.timeLimit);
+      if (tournamentId != 0) {
+        tournaments.bindGame(tournamentId, gameId);
+      }
+
+      // Get player names
+      User player1 = db.getUser(match.player1Id);
+      User player2 = db.getUser(match.player2Id);
+
+      GameStart startMsg;
+      memset(&startMsg, 0, sizeof(startMsg));
+      startMsg.gameId = gameId;
+      startMsg.player1Id = match.player1Id;
+      startMsg.player2Id = match.player2Id;
+      player1.username.copy(startMsg.player1Name,
+                            sizeof(startMsg.player1Name) - 1);
+      player2.username.copy(startMsg.player2Name,
+                            sizeof(startMsg.player2Name) - 1);
+      startMsg.boardSize = match.boardSize;
+      startMsg.currentTurn = match.player1Id;
+      startMsg.timeLimit = match.timeLimit;
+      startMsg.player1Time = match.timeLimit;
+      startMsg.player2Time = match.timeLimit;
+      starts.push_back(startMsg);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(gameMutex);
+      for (const auto &start : starts) {
+        std::shared_ptr<GameState> game = std::make_shared<GameState>();
+        game->gameId = start.gameId;
+        game->player1Id = start.player1Id;
+        game->player2Id = start.player2Id;
+        game->boardSize = start.boardSize;
+        game->board = new uint8_t[start.boardSize * start.boardSize]();
+        game->currentTurn = start.player1Id;
+        game->timeLimit = start.timeLimit;
+        game->player1TimeLeft = start.timeLimit;
+        game->player2TimeLeft = start.timeLimit;
+        game->lastMoveTime = std::chrono::steady_clock::now();
+        game->timerActive = (start.timeLimit > 0);
+
+        activeGames[start.gameId] = game;
+        userToGame[start.player1Id] = start.gameId;
+        userToGame[start.player2Id] = start.gameId;
+        seating.erase(start.player1Id);
+        seating.erase(start.player2Id);
+      }
+    }
+
+    // Players homed on a peer are marked in game there
+    if (cluster.enabled()) {
+      for (const auto &start : starts) {
+        for (uint32_t playerId : {start.player1Id, start.player2Id}) {
+          if (!cluster.owns(playerId)) {
+            notifyHome(playerId, CLUSTER_GAME_START, &start.gameId,
+                       sizeof(start.gameId));
+          }
+        }
+      }
+    }
+
+    if (delayed.enabled()) {
+      for (const auto &start : starts) {
+        delayed.open(start);
+      }
+    }
+
+    // Send game start to both players
+    for (const auto &start : starts) {
+      // A suspended player finds the game in their resume snapshot
+      bool p1Online = sendToUser(start.player1Id, MSG_GAME_START, &start,
+                                 sizeof(start)) ||
+                      sessions.isSuspended(start.player1Id);
+      bool p2Online = sendToUser(start.player2Id, MSG_GAME_START, &start,
+                                 sizeof(start)) ||
+                      sessions.isSuspended(start.player2Id);
+
+      std::cout << "[*] Game started: " << start.player1Name << " vs "
+                << start.player2Name << " (Game #" << start.gameId << ")"
+                << std::endl;
+
+      // A player who disconnected before the start forfeits
+      if (!p1Online || !p2Online) {
+        std::shared_ptr<GameState> game = findGame(start.gameId);
+        if (game) {
+          std::lock_guard<std::mutex> lock(game->mutex);
+          if (!game->finished) {
+            handleGameOver(game.get(),
+                           p1Online ? start.player1Id : start.player2Id, 1);
+          }
+        }
+      }
+    }
+
+    if (!unplayable.empty() && tournamentId != 0) {
+      TournamentManager::Update update;
+      tournaments.unpair(tournamentId, unplayable, update);
+      applyTournamentUpdate(update);
+    }
+    return unplayable.empty();
+  }
+
+  void handleDeclineChallenge(int clientSocket, const Session &session,
+                              uint32_t challengeId) {
+    (void)clientSocket; // Not used in this handler
+    Challenge challenge;
+    if (!db.takeChallenge(challengeId, session.userId, challenge)) {
+      return;
+    }
+
+    // Notify challenger
+    int challengerSocket = socketOf(challenge.challengerId);
+    if (challengerSocket >= 0) {
+      ChallengeDeclinedResponse response;
+      memset(&response, 0, sizeof(response));
+      response.challengeId = challengeId;
+      response.declinerId = session.userId;
+      session.username.copy(response.declinerName,
+                            sizeof(response.declinerName) - 1);
+
+      sendMessage(challengerSocket, MSG_CHALLENGE_DECLINED, 0, 0, &response,
+                  sizeof(response));
+
+      std::cout << "[*] Challenge declined by " << session.username
+                << std::endl;
+    }
+  }
+
+  // ==================== MATCHMAKING ====================
+
+  void handleJoinQueue(int clientSocket, uint32_t userId,
+                       const QueueRequestView &req) {
+    {
+      std::lock_guard<std::mutex> lock(gameMutex);
+      if (userToGame.count(userId)) {
+        sendError(clientSocket, "Already in a game");
+        return;
+      }
+    }
+    if (req.boardSize() < 10 || req.boardSize() > 19) {
+      sendError(clientSocket, "Invalid board size");
+      return;
+    }
+
+    User user = db.getUser(userId);
+    if (user.userId == 0) {
+      sendError(clientSocket, "Not logged in");
       return;
     }
 
-    db.removeChallenge(challengeId);
+    Matchmaker::Match match;
+    bool matched = matchmaker.enqueue(userId, user.eloRating, req.boardSize(),
+                                      req.timeLimit(), match);
 
-    // Create game
-    uint32_t gameId = db.createGame(challenge.challengerId, userId,
-                                    challenge.boardSize, challenge.timeLimit);
+    QueueStatus status;
+    status.inQueue = matched ? 0 : 1;
+    status.boardSize = req.boardSize();
+    status.timeLimit = req.timeLimit();
+    status.waiting = matchmaker.poolSize(req.boardSize(), req.timeLimit());
+    sendMessage(clientSocket, MSG_QUEUE_STATUS, userId, 0, &status,
+                sizeof(status));
 
-    std::lock_guard<std::mutex> lock(gameMutex);
+    if (matched) {
+      startMatchedGames({match});
+    }
+  }
 
-    GameState *game = new GameState();
-    game->gameId = gameId;
-    game->player1Id = challenge.challengerId;
-    game->player2Id = userId;
-    game->boardSize = challenge.boardSize;
-    game->board = new uint8_t[challenge.boardSize * challenge.boardSize]();
-    game->currentTurn = challenge.challengerId;
-    game->timeLimit = challenge.timeLimit;
-    game->player1TimeLeft = challenge.timeLimit;
-    game->player2TimeLeft = challenge.timeLimit;
-    game->lastMoveTime = std::chrono::steady_clock::now();
-    game->timerActive = (challenge.timeLimit > 0);
-
-    activeGames[gameId] = game;
-    userToGame[challenge.challengerId] = gameId;
-    userToGame[userId] = gameId;
-
-    // Get player names
-    User player1 = db.getUser(challenge.challengerId);
-    User player2 = db.getUser(userId);
+  void handleLeaveQueue(int clientSocket, uint32_t userId) {
+    matchmaker.remove(userId);
 
-    // Send game start to both players
-    GameStart startMsg;
-    startMsg.gameId = gameId;
-    startMsg.player1Id = challenge.challengerId;
-    startMsg.player2Id = userId;
-    strcpy(startMsg.player1Name, player1.username.c_str());
-    strcpy(startMsg.player2Name, player2.username.c_str());
-    startMsg.boardSize = challenge.boardSize;
-    startMsg.currentTurn = challenge.challengerId;
-    startMsg.timeLimit = challenge.timeLimit;
-    startMsg.player1Time = challenge.timeLimit;
-    startMsg.player2Time = challenge.timeLimit;
+    QueueStatus status;
+    memset(&status, 0, sizeof(status));
+    sendMessage(clientSocket, MSG_QUEUE_STATUS, userId, 0, &status,
+                sizeof(status));
+  }
 
-    std::lock_guard<std::mutex> clientLock(clientMutex);
-    auto p1Socket = userSockets.find(challenge.challengerId);
-    auto p2Socket = userSockets.find(userId);
+  // ==================== TOURNAMENTS ====================
 
-    if (p1Socket != userSockets.end()) {
-      sendMessage(p1Socket->second, MSG_GAME_START, challenge.challengerId, 0,
-                  &startMsg, sizeof(startMsg));
-    }
-    if (p2Socket != userSockets.end()) {
-      sendMessage(p2Socket->second, MSG_GAME_START, userId, 0, &startMsg,
-                  sizeof(startMsg));
+  void handleCreateTournament(int clientSocket, uint32_t userId,
+                              const TournamentCreateView &req) {
+    if (req.boardSize() < 10 || req.boardSize() > 19 || req.rounds() == 0 ||
+        req.format() > TOURNAMENT_ARENA) {
+      sendError(clientSocket, "Invalid tournament settings");
+      return;
     }
 
-    std::cout << "[*] Game started: " << player1.username << " vs "
-              << player2.username << " (Game #" << gameId << ")" << std::endl;
+    std::string name = req.name();
+    uint32_t tournamentId =
+        tournaments.create(userId, name, req.format(), req.boardSize(),
+                           req.timeLimit(), req.rounds());
+    tournaments.join(tournamentId, userId);
+
+    std::cout << "[*] Tournament #" << tournamentId << " created: " << name
+              << std::endl;
+    sendTournamentStatus(clientSocket, userId, tournamentId);
   }
 
-  void handleDeclineChallenge(int clientSocket, uint32_t userId,
-                              uint32_t challengeId) {
-    (void)clientSocket; // Not used in this handler
-    Challenge challenge = db.getChallenge(challengeId);
-    if (challenge.challengeId == 0) {
+  void handleTournamentAction(int clientSocket, uint32_t userId,
+                              uint16_t action, uint32_t tournamentId) {
+    if (action == MSG_TOURNAMENT_JOIN) {
+      if (!tournaments.join(tournamentId, userId)) {
+        sendError(clientSocket, "Tournament not found or already started");
+        return;
+      }
+      sendTournamentStatus(clientSocket, userId, tournamentId);
       return;
     }
 
-    db.removeChallenge(challengeId);
+    TournamentManager::Update update;
+    if (!tournaments.start(tournamentId, userId, update)) {
+      sendError(clientSocket, "Only the creator can start an open "
+                              "tournament with at least 2 players");
+      return;
+    }
 
-    // Notify challenger
-    std::lock_guard<std::mutex> lock(clientMutex);
-    auto it = userSockets.find(challenge.challengerId);
-    if (it != userSockets.end()) {
-      ChallengeDeclinedResponse response;
-      response.challengeId = challengeId;
-      response.declinerId = userId;
+    std::cout << "[*] Tournament #" << tournamentId << " started"
+              << std::endl;
+    applyTournamentUpdate(update);
+  }
 
-      User decliner = db.getUser(userId);
-      strcpy(response.declinerName, decliner.username.c_str());
+  void handleGetStandings(int clientSocket, uint32_t userId,
+                          const StandingsRequestView &req) {
+    TournamentManager::Info info;
+    if (!tournaments.info(req.tournamentId(), info)) {
+      sendError(clientSocket, "Tournament not found");
+      return;
+    }
 
-      sendMessage(it->second, MSG_CHALLENGE_DECLINED, 0, 0, &response,
-                  sizeof(response));
+    size_t limit = std::min(req.limit(), LEADERBOARD_PAGE_MAX);
+    std::vector<TournamentManager::Standing> page =
+        tournaments.standings(req.tournamentId(), req.offset(), limit);
+
+    std::vector<char> buffer;
+    TournamentStatus status = makeTournamentStatus(info);
+    appendBytes(buffer, &status, sizeof(status));
+    uint16_t count = page.size();
+    appendBytes(buffer, &count, sizeof(count));
+
+    for (size_t i = 0; i < page.size(); i++) {
+      StandingEntry entry;
+      memset(&entry, 0, sizeof(entry));
+      entry.rank = req.offset() + i + 1;
+      entry.userId = page[i].userId;
+      db.getUser(page[i].userId)
+          .username.copy(entry.username, sizeof(entry.username) - 1);
+      entry.points = page[i].points;
+      entry.wins = page[i].wins;
+      entry.draws = page[i].draws;
+      entry.losses = page[i].losses;
+      appendBytes(buffer, &entry, sizeof(entry));
+    }
+
+    sendMessage(clientSocket, MSG_STANDINGS_RESPONSE, userId, 0,
+                buffer.data(), buffer.size());
+  }
+
+  // Start the games of a new round (or arena pairing) as one batch and
+  // tell the participants when the tournament state changed
+  void applyTournamentUpdate(const TournamentManager::Update &update) {
+    if (!update.matches.empty()) {
+      startMatchedGames(update.matches, update.tournamentId);
+    }
 
-      std::cout << "[*] Challenge declined by " << decliner.username
+    if (update.notify.empty()) {
+      return;
+    }
+    TournamentManager::Info info;
+    if (!tournaments.info(update.tournamentId, info)) {
+      return;
+    }
+    TournamentStatus status = makeTournamentStatus(info);
+    for (uint32_t participant : update.notify) {
+      sendToUser(participant, MSG_TOURNAMENT_STATUS, &status, sizeof(status));
+    }
+    if (info.state == TournamentManager::FINISHED) {
+      std::cout << "[*] Tournament #" << info.tournamentId << " finished"
                 << std::endl;
     }
   }
 
-  // ==================== GAME PLAY ====================
+  static TournamentStatus
+  makeTournamentStatus(const TournamentManager::Info &info) {
+    TournamentStatus status;
+    memset(&status, 0, sizeof(status));
+    status.tournamentId = info.tournamentId;
+    info.name.copy(status.name, sizeof(status.name) - 1);
+    status.format = info.format;
+    status.state = info.state;
+    status.round = info.round;
+    status.rounds = info.rounds;
+    status.players = info.players;
+    status.gamesInProgress = info.gamesInProgress;
+    return status;
+  }
 
-  void handleMakeMove(int clientSocket, uint32_t userId, MoveRequest *req) {
-    std::lock_guard<std::mutex> lock(gameMutex);
+  void sendTournamentStatus(int clientSocket, uint32_t userId,
+                            uint32_t tournamentId) {
+    TournamentManager::Info info;
+    if (tournaments.info(tournamentId, info)) {
+      TournamentStatus status = makeTournamentStatus(info);
+      sendMessage(clientSocket, MSG_TOURNAMENT_STATUS, userId, 0, &status,
+                  sizeof(status));
+    }
+  }
+
+  // ==================== GAME PLAY ====================
 
-    auto it = activeGames.find(req->gameId);
-    if (it == activeGames.end()) {
+  void handleMakeMove(int clientSocket, uint32_t userId,
+                      const MoveRequestView &req) {
+    std::shared_ptr<GameState> shared = findGame(req.gameId());
+    if (!shared) {
       sendError(clientSocket, "Game not found");
       return;
     }
 
-    GameState *game = it->second;
+    GameState *game = shared.get();
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->finished) {
+      sendError(clientSocket, "Game not found");
+      return;
+    }
 
     // Validate turn
     if (game->currentTurn != userId) {
@@ -453,7 +2558,7 @@ public:
     }
 
     // Validate move
-    if (!GameLogic::isValidMove(game, req->x, req->y)) {
+    if (!GameLogic::isValidMove(game, req.x(), req.y())) {
       sendError(clientSocket, "Invalid move - cell occupied or out of bounds");
       return;
     }
@@ -463,90 +2568,95 @@ public:
 
     // Make move
     uint8_t player = (game->player1Id == userId) ? 1 : 2;
-    game->board[req->y * game->boardSize + req->x] = player;
+    game->board[req.y() * game->boardSize + req.x()] = player;
     game->moveCount++;
 
     // Log move
-    db.logMove(req->gameId, userId, game->moveCount, req->x, req->y);
+    db.logMove(req.gameId(), userId, game->moveCount, req.x(), req.y());
 
-    // Check win
-    if (GameLogic::checkWin(game, req->x, req->y, player)) {
-      handleGameOver(game, userId, 0); // 0 = normal win
-      return;
-    }
-
-    // Check draw (board full)
-    if (GameLogic::checkDraw(game)) {
-      handleGameDraw(game);
-      return;
-    }
+    // Check win, then draw (board full)
+    bool won = GameLogic::checkWin(game, req.x(), req.y(), player);
+    bool full = !won && GameLogic::checkDraw(game);
 
-    // Continue game
-    game->currentTurn =
-        (game->player1Id == userId) ? game->player2Id : game->player1Id;
-    game->lastMoveTime = std::chrono::steady_clock::now();
+    if (!won && !full) {
+      // Continue game
+      game->currentTurn =
+          (game->player1Id == userId) ? game->player2Id : game->player1Id;
+      game->lastMoveTime = std::chrono::steady_clock::now();
 
-    // Clear draw offer when a move is made
-    game->drawOffered = false;
-    game->drawOfferedBy = 0;
+      // Clear draw offer when a move is made
+      game->drawOffered = false;
+      game->drawOfferedBy = 0;
+    }
 
     MoveResponse response;
     response.success = 1;
-    response.x = req->x;
-    response.y = req->y;
+    response.x = req.x();
+    response.y = req.y();
     response.player = player;
-    response.nextTurn = game->currentTurn;
+    response.nextTurn = (won || full) ? 0 : game->currentTurn;
     response.player1Time = GameLogic::getRemainingTime(game, game->player1Id);
     response.player2Time = GameLogic::getRemainingTime(game, game->player2Id);
     response.moveNumber = game->moveCount;
 
-    // Send to both players
-    std::lock_guard<std::mutex> clientLock(clientMutex);
-    auto p1Socket = userSockets.find(game->player1Id);
-    auto p2Socket = userSockets.find(game->player2Id);
-
-    if (p1Socket != userSockets.end()) {
-      sendMessage(p1Socket->second, MSG_MOVE_RESPONSE, game->player1Id, 0,
-                  &response, sizeof(response));
-    }
-    if (p2Socket != userSockets.end()) {
-      sendMessage(p2Socket->second, MSG_OPPONENT_MOVE, game->player2Id, 0,
-                  &response, sizeof(response));
+    // Spectators see every move, the last one included
+    if (won || full) {
+      publishMove(game->gameId, response);
+      if (won) {
+        handleGameOver(game, userId, 0); // 0 = normal win
+      } else {
+        handleGameDraw(game);
+      }
+      return;
     }
+
+    // Send to both players, then queue for the spectators
+    sendToUser(game->player1Id, MSG_MOVE_RESPONSE, &response, sizeof(response));
+    sendToUser(game->player2Id, MSG_OPPONENT_MOVE, &response, sizeof(response));
+    publishMove(game->gameId, response);
   }
 
   // ==================== RESIGN / DRAW ====================
 
-  void handleResign(int clientSocket, uint32_t userId, ResignRequest *req) {
-    std::lock_guard<std::mutex> lock(gameMutex);
-
-    auto it = activeGames.find(req->gameId);
-    if (it == activeGames.end()) {
+  void handleResign(int clientSocket, const Session &session,
+                    const ResignRequestView &req) {
+    uint32_t userId = session.userId;
+    std::shared_ptr<GameState> shared = findGame(req.gameId());
+    if (!shared || !isPlayer(shared.get(), userId)) {
       sendError(clientSocket, "Game not found");
       return;
     }
 
-    GameState *game = it->second;
+    GameState *game = shared.get();
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->finished) {
+      sendError(clientSocket, "Game not found");
+      return;
+    }
     uint32_t winnerId =
         (game->player1Id == userId) ? game->player2Id : game->player1Id;
 
-    User resigner = db.getUser(userId);
-    std::cout << "[*] " << resigner.username << " resigned from Game #"
-              << req->gameId << std::endl;
+    std::cout << "[*] " << session.username << " resigned from Game #"
+              << req.gameId() << std::endl;
 
     handleGameOver(game, winnerId, 1); // 1 = resign
   }
 
-  void handleOfferDraw(int clientSocket, uint32_t userId, DrawRequest *req) {
-    std::lock_guard<std::mutex> lock(gameMutex);
-
-    auto it = activeGames.find(req->gameId);
-    if (it == activeGames.end()) {
+  void handleOfferDraw(int clientSocket, const Session &session,
+                       const DrawRequestView &req) {
+    uint32_t userId = session.userId;
+    std::shared_ptr<GameState> shared = findGame(req.gameId());
+    if (!shared || !isPlayer(shared.get(), userId)) {
       sendError(clientSocket, "Game not found");
       return;
     }
 
-    GameState *game = it->second;
+    GameState *game = shared.get();
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->finished) {
+      sendError(clientSocket, "Game not found");
+      return;
+    }
 
     if (game->drawOffered) {
       sendError(clientSocket, "Draw already offered");
@@ -560,28 +2670,27 @@ public:
     uint32_t opponentId =
         (game->player1Id == userId) ? game->player2Id : game->player1Id;
 
-    std::lock_guard<std::mutex> clientLock(clientMutex);
-    auto opponentSocket = userSockets.find(opponentId);
-    if (opponentSocket != userSockets.end()) {
-      sendMessage(opponentSocket->second, MSG_DRAW_RECEIVED, 0, 0, req,
-                  sizeof(DrawRequest));
-    }
+    DrawRequest offer = req.value();
+    sendToUser(opponentId, MSG_DRAW_RECEIVED, &offer, sizeof(offer));
 
-    User offerer = db.getUser(userId);
-    std::cout << "[*] " << offerer.username << " offered a draw in Game #"
-              << req->gameId << std::endl;
+    std::cout << "[*] " << session.username << " offered a draw in Game #"
+              << req.gameId() << std::endl;
   }
 
-  void handleAcceptDraw(int clientSocket, uint32_t userId, DrawRequest *req) {
-    std::lock_guard<std::mutex> lock(gameMutex);
-
-    auto it = activeGames.find(req->gameId);
-    if (it == activeGames.end()) {
+  void handleAcceptDraw(int clientSocket, uint32_t userId,
+                        const DrawRequestView &req) {
+    std::shared_ptr<GameState> shared = findGame(req.gameId());
+    if (!shared || !isPlayer(shared.get(), userId)) {
       sendError(clientSocket, "Game not found");
       return;
     }
 
-    GameState *game = it->second;
+    GameState *game = shared.get();
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->finished) {
+      sendError(clientSocket, "Game not found");
+      return;
+    }
 
     if (!game->drawOffered || game->drawOfferedBy == userId) {
       sendError(clientSocket, "No draw offer to accept");
@@ -591,16 +2700,19 @@ public:
     handleGameDraw(game);
   }
 
-  void handleDeclineDraw(int clientSocket, uint32_t userId, DrawRequest *req) {
+  void handleDeclineDraw(int clientSocket, uint32_t userId,
+                         const DrawRequestView &req) {
     (void)clientSocket; // Not used in this handler
-    std::lock_guard<std::mutex> lock(gameMutex);
-
-    auto it = activeGames.find(req->gameId);
-    if (it == activeGames.end()) {
+    std::shared_ptr<GameState> shared = findGame(req.gameId());
+    if (!shared || !isPlayer(shared.get(), userId)) {
       return;
     }
 
-    GameState *game = it->second;
+    GameState *game = shared.get();
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->finished) {
+      return;
+    }
     game->drawOffered = false;
     game->drawOfferedBy = 0;
 
@@ -608,49 +2720,39 @@ public:
     uint32_t offererId =
         (game->player1Id == userId) ? game->player2Id : game->player1Id;
 
-    std::lock_guard<std::mutex> clientLock(clientMutex);
-    auto offererSocket = userSockets.find(offererId);
-    if (offererSocket != userSockets.end()) {
-      DrawRequest response;
-      response.gameId = req->gameId;
-      sendMessage(offererSocket->second, MSG_DECLINE_DRAW, 0, 0, &response,
-                  sizeof(response));
-    }
+    DrawRequest response;
+    response.gameId = req.gameId();
+    sendToUser(offererId, MSG_DECLINE_DRAW, &response, sizeof(response));
   }
 
   // ==================== REMATCH ====================
 
-  void handleRequestRematch(int clientSocket, uint32_t userId,
-                            RematchRequest *req) {
+  void handleRequestRematch(int clientSocket, const Session &session,
+                            const RematchRequestView &req) {
     (void)clientSocket; // Not used in this handler
-    (void)userId;       // Logged from req->opponentId instead
     // Store rematch request
-    pendingRematches[req->lastGameId] = *req;
+    RematchRequest rematch = req.value();
+    {
+      std::lock_guard<std::mutex> lock(gameMutex);
+      pendingRematches[rematch.lastGameId] = rematch;
+    }
 
     // Notify opponent
-    std::lock_guard<std::mutex> lock(clientMutex);
-    auto opponentSocket = userSockets.find(req->opponentId);
-    if (opponentSocket != userSockets.end()) {
-      sendMessage(opponentSocket->second, MSG_REMATCH_RECEIVED, 0, 0, req,
-                  sizeof(RematchRequest));
-    }
+    sendToUser(rematch.opponentId, MSG_REMATCH_RECEIVED, &rematch,
+               sizeof(rematch));
 
-    User requester = db.getUser(userId);
-    std::cout << "[*] " << requester.username << " requested rematch"
+    std::cout << "[*] " << session.username << " requested rematch"
               << std::endl;
   }
 
   void handleAcceptRematch(int clientSocket, uint32_t userId,
                            uint32_t lastGameId) {
-    auto it = pendingRematches.find(lastGameId);
-    if (it == pendingRematches.end()) {
+    RematchRequest req;
+    if (!takePendingRematch(lastGameId, req)) {
       sendError(clientSocket, "Rematch request not found");
       return;
     }
 
-    RematchRequest req = it->second;
-    pendingRematches.erase(it);
-
     // Get previous game settings
     GameRecord prevGame = db.getGameRecord(lastGameId);
 
@@ -664,21 +2766,14 @@ public:
                             uint32_t lastGameId) {
     (void)clientSocket; // Not used in this handler
     (void)userId;       // Not used in this handler
-    auto it = pendingRematches.find(lastGameId);
-    if (it == pendingRematches.end()) {
+    RematchRequest req;
+    if (!takePendingRematch(lastGameId, req)) {
       return;
     }
 
-    RematchRequest req = it->second;
-    pendingRematches.erase(it);
-
     // Notify requester
-    std::lock_guard<std::mutex> lock(clientMutex);
-    auto requesterSocket = userSockets.find(req.opponentId);
-    if (requesterSocket != userSockets.end()) {
-      sendMessage(requesterSocket->second, MSG_REMATCH_DECLINED, 0, 0,
-                  &lastGameId, sizeof(lastGameId));
-    }
+    sendToUser(req.opponentId, MSG_REMATCH_DECLINED, &lastGameId,
+               sizeof(lastGameId));
   }
 
   // ==================== GAME LOGS & HISTORY ====================
@@ -690,51 +2785,126 @@ public:
       return;
     }
 
-    // Send header
-    GameLogHeader header;
-    header.gameId = record.gameId;
-    header.player1Id = record.player1Id;
-    header.player2Id = record.player2Id;
-    strcpy(header.player1Name, record.player1Name.c_str());
-    strcpy(header.player2Name, record.player2Name.c_str());
-    header.boardSize = record.boardSize;
-    header.winnerId = record.winnerId;
-    header.result = record.result;
-    header.totalMoves = record.moves.size();
-    header.gameDuration = record.duration;
-    header.timestamp = record.startTime;
+    // Moves of archived games are loaded from disk on demand and are
+    // already stored in the packed wire format
+    PackedMovesPtr moves = db.getPackedMoves(gameId);
+
+    std::vector<char> buffer(sizeof(GameLogHeader) + moves->size());
+    GameLogHeader *header = (GameLogHeader *)buffer.data();
+    header->gameId = record.gameId;
+    header->player1Id = record.player1Id;
+    header->player2Id = record.player2Id;
+    record.player1Name.copy(header->player1Name,
+                            sizeof(header->player1Name) - 1);
+    record.player2Name.copy(header->player2Name,
+                            sizeof(header->player2Name) - 1);
+    header->boardSize = record.boardSize;
+    header->winnerId = record.winnerId;
+    header->result = record.result;
+    header->totalMoves = MoveCodec::count(moves->data(), moves->size());
+    header->gameDuration = record.duration;
+    header->timestamp = record.startTime;
+    memcpy(buffer.data() + sizeof(GameLogHeader), moves->data(),
+           moves->size());
+
+    sendMessage(clientSocket, MSG_GAME_LOG_RESPONSE, userId, 0, buffer.data(),
+                buffer.size());
+  }
+
+  // Seek opens the game's replay, or reuses the open one if it is the
+  // same game. Games still being played are left to spectator mode, which
+  // applies the broadcast delay.
+  void handleReplay(int clientSocket, uint32_t userId,
+                    const ReplayRequestView &req) {
+    std::shared_ptr<ReplayStream> replay;
+    {
+      std::lock_guard<std::mutex> lock(replayMutex);
+      auto it = replays.find(clientSocket);
+      if (it != replays.end()) {
+        replay = it->second;
+      }
+      if (req.op() == REPLAY_STOP) {
+        replays.erase(clientSocket);
+        return;
+      }
+    }
 
-    sendMessage(clientSocket, MSG_GAME_LOG_RESPONSE, userId, 0, &header,
-                sizeof(header));
+    if (req.op() == REPLAY_SEEK) {
+      if (!replay || replay->gameId() != req.gameId()) {
+        GameRecord record = db.getGameRecord(req.gameId());
+        if (record.gameId == 0) {
+          sendError(clientSocket, "Game not found");
+          return;
+        }
+        if (record.result == 255) {
+          sendError(clientSocket, "Game is still in progress");
+          return;
+        }
+        replay = std::make_shared<ReplayStream>(
+            record, *db.getPackedMoves(req.gameId()));
+        std::lock_guard<std::mutex> lock(replayMutex);
+        replays[clientSocket] = replay;
+      }
+      replay->seek(req.moveNumber());
+    } else if (!replay || replay->gameId() != req.gameId()) {
+      return; // Credit granted while the last chunks were on their way
+    }
 
-    // Send moves
-    for (const auto &move : record.moves) {
-      MoveLogEntry entry;
-      entry.moveNumber = move.moveNumber;
-      entry.playerId = move.playerId;
-      entry.x = move.x;
-      entry.y = move.y;
-      entry.timestamp = move.timestamp;
+    replay->grant(req.credit(), REPLAY_CREDIT_MAX);
+    streamReplay(clientSocket, userId, replay);
+  }
 
-      send(clientSocket, &entry, sizeof(entry), 0);
+  // Send every chunk the client has credit for in a single write
+  void streamReplay(int clientSocket, uint32_t userId,
+                    const std::shared_ptr<ReplayStream> &replay) {
+    std::shared_ptr<SocketWriter> writer = socketWriter(clientSocket);
+    uint8_t version;
+    bool compress;
+    {
+      std::lock_guard<std::mutex> lock(writer->mutex);
+      version = writer->version;
+      compress = writer->compress;
+    }
+    uint32_t tag = replyTag(clientSocket);
+    std::vector<char> frames;
+    std::vector<char> payload;
+    while (replay->nextChunk(payload)) {
+      std::vector<char> frame =
+          buildFrame(version, MSG_REPLAY_DATA, userId, 0, payload.data(),
+                     payload.size(), tag, compress);
+      frames.insert(frames.end(), frame.begin(), frame.end());
+    }
+    if (replay->done()) {
+      std::lock_guard<std::mutex> lock(replayMutex);
+      auto it = replays.find(clientSocket);
+      if (it != replays.end() && it->second == replay) {
+        replays.erase(it);
+      }
     }
+    if (frames.empty())
+      return;
+
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    writeFrame(clientSocket, *writer, frames);
   }
 
   void handleGetGameHistory(int clientSocket, uint32_t userId) {
     std::vector<GameRecord> history = db.getUserGameHistory(userId);
 
     uint32_t count = history.size();
-    sendMessage(clientSocket, MSG_GAME_HISTORY_RESPONSE, userId, 0, &count,
-                sizeof(count));
+    std::vector<char> buffer;
+    appendBytes(buffer, &count, sizeof(count));
 
     for (const auto &record : history) {
       GameHistoryEntry entry;
+      memset(&entry, 0, sizeof(entry));
       entry.gameId = record.gameId;
       entry.opponentId =
           (record.player1Id == userId) ? record.player2Id : record.player1Id;
-      strcpy(entry.opponentName, (record.player1Id == userId)
-                                     ? record.player2Name.c_str()
-                                     : record.player1Name.c_str());
+      const std::string &opponentName = (record.player1Id == userId)
+                                            ? record.player2Name
+                                            : record.player1Name;
+      opponentName.copy(entry.opponentName, sizeof(entry.opponentName) - 1);
 
       if (record.result == 2) {
         entry.result = 2; // Draw
@@ -747,59 +2917,296 @@ public:
       entry.eloChange =
           (record.winnerId == userId) ? record.eloChange : -record.eloChange;
       entry.timestamp = record.startTime;
+      appendBytes(buffer, &entry, sizeof(entry));
+    }
+
+    sendMessage(clientSocket, MSG_GAME_HISTORY_RESPONSE, userId, 0,
+                buffer.data(), buffer.size());
+  }
+
+  // ==================== LEADERBOARD ====================
+
+  void handleGetLeaderboard(int clientSocket, uint32_t userId,
+                            const LeaderboardRequestView &req) {
+    uint32_t total = db.getRankedCount();
+    uint32_t myRank = db.getRank(userId);
+    size_t limit = std::min(req.limit(), LEADERBOARD_PAGE_MAX);
+
+    uint32_t start = 1;
+    if (req.mode() == LEADERBOARD_TOP) {
+      start = req.offset() + 1;
+    } else if (req.mode() == LEADERBOARD_AROUND_ME && myRank > 0) {
+      uint32_t half = limit / 2;
+      start = myRank > half ? myRank - half : 1;
+      if (total >= limit && start + limit > total + 1) {
+        start = total + 1 - limit;
+      }
+    } else {
+      limit = 0;
+    }
+
+    std::vector<User> page = db.getLeaderboard(start, limit);
+
+    std::vector<char> buffer(sizeof(LeaderboardHeader) +
+                             page.size() * sizeof(LeaderboardEntry));
+    LeaderboardHeader *header = (LeaderboardHeader *)buffer.data();
+    header->totalPlayers = total;
+    header->myRank = myRank;
+    header->startRank = start;
+    header->count = page.size();
+
+    LeaderboardEntry *entries =
+        (LeaderboardEntry *)(buffer.data() + sizeof(LeaderboardHeader));
+    for (size_t i = 0; i < page.size(); i++) {
+      LeaderboardEntry &entry = entries[i];
+      memset(&entry, 0, sizeof(entry));
+      entry.rank = start + i;
+      entry.userId = page[i].userId;
+      page[i].username.copy(entry.username, sizeof(entry.username) - 1);
+      entry.eloRating = page[i].eloRating;
+      entry.wins = page[i].wins;
+      entry.losses = page[i].losses;
+      entry.draws = page[i].draws;
+    }
+
+    sendMessage(clientSocket, MSG_LEADERBOARD_RESPONSE, userId, 0,
+                buffer.data(), buffer.size());
+  }
+
+  void handleGetRatingHistory(int clientSocket, uint32_t userId,
+                              const RatingHistoryRequestView &req) {
+    uint32_t targetId = req.userId() ? req.userId() : userId;
+    User user = db.getUser(targetId);
+    if (user.username.empty()) {
+      sendError(clientSocket, "User not found");
+      return;
+    }
+
+    uint32_t to = std::time(nullptr);
+    uint32_t from = 0;
+    if (req.days() > 0) {
+      uint32_t span = req.days() * 86400u;
+      from = to > span ? to - span : 0;
+    }
+    size_t maxPoints = std::min(req.maxPoints(), RATING_HISTORY_POINTS_MAX);
+
+    RatingHistory::Summary summary;
+    bool found = db.getRatingHistory(targetId, from, to, maxPoints, summary);
+    if (!found) {
+      // No rated games in the range: a flat line at the current rating
+      summary.count = 0;
+      summary.first.rating = user.eloRating;
+      summary.minRating = summary.maxRating = user.eloRating;
+      summary.p10 = summary.p50 = summary.p90 = user.eloRating;
+      summary.samples.clear();
+    }
 
-      send(clientSocket, &entry, sizeof(entry), 0);
+    std::vector<char> buffer(sizeof(RatingHistoryHeader) +
+                             summary.samples.size() * sizeof(RatingPoint));
+    RatingHistoryHeader *header = (RatingHistoryHeader *)buffer.data();
+    header->userId = targetId;
+    header->fromTime = from;
+    header->toTime = to;
+    header->count = summary.count;
+    header->currentRating = user.eloRating;
+    header->startRating = summary.first.rating;
+    header->minRating = summary.minRating;
+    header->maxRating = summary.maxRating;
+    header->p10Rating = summary.p10;
+    header->p50Rating = summary.p50;
+    header->p90Rating = summary.p90;
+    header->sampleCount = summary.samples.size();
+
+    RatingPoint *points =
+        (RatingPoint *)(buffer.data() + sizeof(RatingHistoryHeader));
+    for (size_t i = 0; i < summary.samples.size(); i++) {
+      points[i].time = summary.samples[i].time;
+      points[i].rating = summary.samples[i].rating;
     }
+
+    sendMessage(clientSocket, MSG_RATING_HISTORY_RESPONSE, userId, 0,
+                buffer.data(), buffer.size());
+  }
+
+  // ==================== SPECTATORS ====================
+
+  // The watcher is sent the current board through the same queue as the
+  // game's events. It is queued under the game's lock, so no event of the
+  // game can be queued ahead of it. With a spectator delay the board and
+  // events come from the game's delayed feed instead.
+  void handleWatchGame(int clientSocket, uint32_t userId, uint32_t gameId,
+                       uint16_t rewindSeconds) {
+
+    // A watcher that stops reading must not hold a writer thread for long
+    struct timeval timeout = {SPECTATOR_SEND_TIMEOUT_SEC, 0};
+    uint8_t version = wireVersion(clientSocket);
+
+    if (delayed.enabled()) {
+      switch (delayed.watch(gameId, clientSocket, version,
+                            replyTag(clientSocket), userId,
+                            rewindSeconds)) {
+      case BroadcastDelay::WATCH_NO_GAME:
+        sendError(clientSocket, "Game not found");
+        return;
+      case BroadcastDelay::WATCH_PLAYER:
+        sendError(clientSocket, "You are playing this game");
+        return;
+      case BroadcastDelay::WATCH_OK:
+        break;
+      }
+      setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+                 sizeof(timeout));
+      std::cout << "[*] User " << userId << " watching game #" << gameId
+                << " (delayed, " << spectators.watchers(gameId)
+                << " spectators)" << std::endl;
+      return;
+    }
+
+    std::shared_ptr<GameState> game = findGame(gameId);
+    if (!game) {
+      sendError(clientSocket, "Game not found");
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(game->mutex);
+    if (game->finished) {
+      sendError(clientSocket, "Game not found");
+      return;
+    }
+    if (isPlayer(game.get(), userId)) {
+      sendError(clientSocket, "You are playing this game");
+      return;
+    }
+
+    setsockopt(clientSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+               sizeof(timeout));
+
+    WatchResponse response;
+    response.gameId = gameId;
+    response.delaySeconds = 0;
+    response.tailMoves = 0;
+    std::vector<char> payload;
+    appendBytes(payload, &response, sizeof(response));
+    appendSnapshot(payload, game.get());
+    spectators.watch(gameId, clientSocket, version,
+                     std::make_shared<const std::vector<char>>(
+                         buildFrame(version, MSG_WATCH_RESPONSE, 0, 0,
+                                    payload.data(), payload.size(),
+                                    replyTag(clientSocket))));
+
+    std::cout << "[*] User " << userId << " watching game #" << gameId << " ("
+              << spectators.watchers(gameId) << " spectators)" << std::endl;
+  }
+
+  // Serialize an event once for all of the game's spectators
+  void publishToSpectators(uint32_t gameId, uint16_t type, const void *payload,
+                           uint32_t length) {
+    if (spectators.watchers(gameId) == 0)
+      return;
+    spectators.publish(gameId, buildSharedFrames(type, payload, length));
+  }
+
+  void publishMove(uint32_t gameId, const MoveResponse &move) {
+    SpectatorMove spectated;
+    spectated.gameId = gameId;
+    spectated.move = move;
+    if (delayed.enabled()) {
+      delayed.recordMove(spectated);
+      return;
+    }
+    publishToSpectators(gameId, MSG_SPECTATOR_MOVE, &spectated,
+                        sizeof(spectated));
+  }
+
+  void publishClock(const TimeUpdate &update) {
+    if (delayed.enabled()) {
+      delayed.recordClock(update);
+      return;
+    }
+    publishToSpectators(update.gameId, MSG_TIME_UPDATE, &update,
+                        sizeof(update));
+  }
+
+  // The game's last event; its spectators are released afterwards
+  void publishGameOver(const GameOver &gameOver) {
+    if (delayed.enabled()) {
+      delayed.recordGameOver(gameOver);
+      return;
+    }
+    publishToSpectators(gameOver.gameId, MSG_GAME_OVER, &gameOver,
+                        sizeof(gameOver));
+    spectators.endGame(gameOver.gameId);
+  }
+
+  // Runs on a spectator writer thread
+  bool writeSpectatorFrame(int socket, const std::vector<char> &frame) {
+    std::shared_ptr<SocketWriter> writer = socketWriter(socket);
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    if (writeFrame(socket, *writer, frame))
+      return true;
+    // Timed out or failed mid-frame; the stream cannot be continued
+    if (writer->ring) {
+      writer->ring->close();
+    }
+    if (writer->gateway) {
+      closeGatewayClient(*writer->gateway, writer->muxId);
+    } else {
+      shutdown(socket, SHUT_RDWR);
+    }
+    return false;
   }
 
   // ==================== GAME END HANDLING ====================
 
+  // Callers hold game->mutex and have checked that the game is not finished
+
   void handleGameOver(GameState *game, uint32_t winnerId, uint8_t reason) {
-    // Update database
-    uint8_t result = (winnerId == game->player1Id) ? 0 : 1;
-    db.updateGameResult(game->gameId, winnerId, result);
+    game->finished = true;
 
-    // Update ELO
+    // Update ELO first so the game record keeps the rating change
     uint32_t loserId =
         (game->player1Id == winnerId) ? game->player2Id : game->player1Id;
     int16_t eloChange = db.updateEloRating(winnerId, loserId);
 
+    // Update database
+    uint8_t result = (winnerId == game->player1Id) ? 0 : 1;
+    db.updateGameResult(game->gameId, winnerId, result, eloChange);
+    reportRemoteResult(game);
+
     GameOver gameOver;
+    memset(&gameOver, 0, sizeof(gameOver));
     gameOver.gameId = game->gameId;
     gameOver.winnerId = winnerId;
 
     User winner = db.getUser(winnerId);
-    strcpy(gameOver.winnerName, winner.username.c_str());
+    winner.username.copy(gameOver.winnerName, sizeof(gameOver.winnerName) - 1);
     gameOver.eloChange = eloChange;
     gameOver.reason = reason;
     gameOver.totalMoves = game->moveCount;
 
-    // Send to both players
-    std::lock_guard<std::mutex> lock(clientMutex);
-    auto p1Socket = userSockets.find(game->player1Id);
-    auto p2Socket = userSockets.find(game->player2Id);
+    // The seats are free before the players hear of it, so either can
+    // start another game at once
+    cleanupGame(game);
 
-    if (p1Socket != userSockets.end()) {
-      sendMessage(p1Socket->second, MSG_GAME_OVER, game->player1Id, 0,
-                  &gameOver, sizeof(gameOver));
-    }
-    if (p2Socket != userSockets.end()) {
-      sendMessage(p2Socket->second, MSG_GAME_OVER, game->player2Id, 0,
-                  &gameOver, sizeof(gameOver));
-    }
+    // Send to both players and the spectators
+    sendToUser(game->player1Id, MSG_GAME_OVER, &gameOver, sizeof(gameOver));
+    sendToUser(game->player2Id, MSG_GAME_OVER, &gameOver, sizeof(gameOver));
+    publishGameOver(gameOver);
 
     std::cout << "[*] Game #" << game->gameId
               << " ended. Winner: " << winner.username
               << " (Reason: " << (int)reason << ")" << std::endl;
 
-    // Cleanup
-    cleanupGame(game->gameId);
+    recordTournamentResult(game, winnerId);
   }
 
   void handleGameDraw(GameState *game) {
+    game->finished = true;
+
     // Update database
     db.updateGameResult(game->gameId, 0, 2); // 2 = draw
     db.updateDrawStats(game->player1Id, game->player2Id);
+    reportRemoteResult(game);
 
     GameOver gameOver;
     gameOver.gameId = game->gameId;
@@ -809,52 +3216,222 @@ public:
     gameOver.reason = 3; // Draw
     gameOver.totalMoves = game->moveCount;
 
-    // Send to both players
-    std::lock_guard<std::mutex> lock(clientMutex);
-    auto p1Socket = userSockets.find(game->player1Id);
-    auto p2Socket = userSockets.find(game->player2Id);
+    // The seats are free before the players hear of it, so either can
+    // start another game at once
+    cleanupGame(game);
 
-    if (p1Socket != userSockets.end()) {
-      sendMessage(p1Socket->second, MSG_GAME_OVER, game->player1Id, 0,
-                  &gameOver, sizeof(gameOver));
-    }
-    if (p2Socket != userSockets.end()) {
-      sendMessage(p2Socket->second, MSG_GAME_OVER, game->player2Id, 0,
-                  &gameOver, sizeof(gameOver));
-    }
+    // Send to both players and the spectators
+    sendToUser(game->player1Id, MSG_GAME_OVER, &gameOver, sizeof(gameOver));
+    sendToUser(game->player2Id, MSG_GAME_OVER, &gameOver, sizeof(gameOver));
+    publishGameOver(gameOver);
 
     std::cout << "[*] Game #" << game->gameId << " ended in a DRAW"
               << std::endl;
 
-    // Cleanup
-    cleanupGame(game->gameId);
+    recordTournamentResult(game, 0);
   }
 
-  void cleanupGame(uint32_t gameId) {
-    auto it = activeGames.find(gameId);
-    if (it != activeGames.end()) {
-      GameState *game = it->second;
-      userToGame.erase(game->player1Id);
-      userToGame.erase(game->player2Id);
-      delete game;
-      activeGames.erase(gameId);
+  void cleanupGame(GameState *game) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    for (uint32_t playerId : {game->player1Id, game->player2Id}) {
+      auto it = userToGame.find(playerId);
+      if (it != userToGame.end() && it->second == game->gameId) {
+        userToGame.erase(it);
+      }
+    }
+    activeGames.erase(game->gameId);
+  }
+
+  // Runs after cleanupGame so the next round can seat the same players
+  void recordTournamentResult(GameState *game, uint32_t winnerId) {
+    TournamentManager::Update update;
+    if (tournaments.recordResult(game->gameId, game->player1Id,
+                                 game->player2Id, winnerId, update)) {
+      applyTournamentUpdate(update);
     }
   }
 
   // ==================== UTILITIES ====================
 
-  void sendMessage(int socket, uint16_t type, uint32_t userId,
-                   uint32_t sessionId, void *payload, uint32_t length) {
-    MessageHeader header;
-    header.type = type;
-    header.length = length;
-    header.userId = userId;
-    header.sessionId = sessionId;
+  std::shared_ptr<GameState> findGame(uint32_t gameId) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    auto it = activeGames.find(gameId);
+    return it == activeGames.end() ? nullptr : it->second;
+  }
+
+  // Seated in a game here or, in a cluster, on a peer
+  bool isSeated(uint32_t userId) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    return isSeatedLocked(userId);
+  }
+
+  // Caller holds gameMutex
+  bool isSeatedLocked(uint32_t userId) const {
+    return userToGame.count(userId) > 0 || remoteSeats.count(userId) > 0 ||
+           seating.count(userId) > 0;
+  }
+
+  // The game the user is playing, if any
+  std::shared_ptr<GameState> gameOf(uint32_t userId) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    auto gameIt = userToGame.find(userId);
+    if (gameIt == userToGame.end()) {
+      return nullptr;
+    }
+    auto activeGameIt = activeGames.find(gameIt->second);
+    return activeGameIt == activeGames.end() ? nullptr : activeGameIt->second;
+  }
+
+  static bool isPlayer(const GameState *game, uint32_t userId) {
+    return game->player1Id == userId || game->player2Id == userId;
+  }
+
+  bool takePendingRematch(uint32_t lastGameId, RematchRequest &req) {
+    std::lock_guard<std::mutex> lock(gameMutex);
+    auto it = pendingRematches.find(lastGameId);
+    if (it == pendingRematches.end()) {
+      return false;
+    }
+    req = it->second;
+    pendingRematches.erase(it);
+    return true;
+  }
+
+  // Socket of a logged-in user, or -1. The session table is only locked
+  // for the lookup; the send itself is serialized by the socket's own lock.
+  int socketOf(uint32_t userId) { return sessions.socketOf(userId); }
+
+  bool sendToUser(uint32_t userId, uint16_t type, const void *payload,
+                  uint32_t length) {
+    int socket = socketOf(userId);
+    if (socket < 0) {
+      return false;
+    }
+    sendMessage(socket, type, userId, 0, payload, length);
+    return true;
+  }
+
+  static void appendBytes(std::vector<char> &buffer, const void *data,
+                          size_t length) {
+    const char *bytes = (const char *)data;
+    buffer.insert(buffer.end(), bytes, bytes + length);
+  }
+
+  static void appendPresenceDelta(std::vector<char> &buffer, uint8_t kind,
+                                  const PresenceEntry &entry) {
+    PresenceDelta delta;
+    delta.kind = kind;
+    delta.userId = entry.userId;
+    delta.eloRating = entry.eloRating;
+    delta.wins = entry.wins;
+    delta.losses = entry.losses;
+    delta.draws = entry.draws;
+    delta.inGame = entry.inGame ? 1 : 0;
+    appendBytes(buffer, &delta, sizeof(delta));
+
+    if (kind & PRESENCE_JOINED) {
+      char username[32] = {0};
+      entry.username.copy(username, sizeof(username) - 1);
+      appendBytes(buffer, username, sizeof(username));
+    }
+  }
+
+  std::shared_ptr<SocketWriter> socketWriter(int socket) {
+    std::lock_guard<std::mutex> lock(socketWritersMutex);
+    std::shared_ptr<SocketWriter> &w = socketWriters[socket];
+    if (!w)
+      w = std::make_shared<SocketWriter>();
+    return w;
+  }
+
+  uint8_t wireVersion(int socket) {
+    std::shared_ptr<SocketWriter> writer = socketWriter(socket);
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    return writer->version;
+  }
+
+  // Tag for a frame to `socket`: the current request's if it is the one
+  // being answered, otherwise 0
+  static uint32_t replyTag(int socket) {
+    return socket == replyTo.socket ? replyTo.tag : 0;
+  }
+
+  // Compression is only tried when the connection was granted it
+  std::vector<char> buildFrame(uint8_t version, uint16_t type,
+                               uint32_t userId, uint32_t sessionId,
+                               const void *payload, uint32_t length,
+                               uint32_t tag = 0, bool compress = false) {
+    std::vector<char> frame = WireCodec::frame(version, type, userId,
+                                               sessionId, payload, length, tag);
+    if (compress && length >= WireCodec::COMPRESS_MIN) {
+      auto started = std::chrono::steady_clock::now();
+      size_t before = frame.size();
+      WireCodec::compress(version, frame);
+      wireStats.compressed(
+          before, frame.size(),
+          std::chrono::duration_cast<std::chrono::nanoseconds>(
+              std::chrono::steady_clock::now() - started)
+              .count());
+    }
+    wireStats.encoded(version, type, frame.size());
+    return frame;
+  }
+
+  // A broadcast event framed once for each wire version
+  SharedFrames buildSharedFrames(uint16_t type, const void *payload,
+                                 uint32_t length, uint32_t tag = 0) {
+    SharedFrames frames;
+    for (uint8_t v = WIRE_V1; v <= WIRE_VERSION_MAX; v++) {
+      frames[v - 1] = std::make_shared<const std::vector<char>>(
+          buildFrame(v, type, 0, 0, payload, length, tag));
+    }
+    return frames;
+  }
 
-    send(socket, &header, sizeof(header), 0);
-    if (length > 0 && payload) {
-      send(socket, payload, length, 0);
+  // Caller holds the socket's write lock. False if the frame could not be
+  // written whole.
+  bool writeFrame(int socket, const SocketWriter &writer,
+                  const std::vector<char> &frame) {
+    if (writer.gateway) {
+      std::vector<char> record;
+      record.reserve(sizeof(MuxHeader) + frame.size());
+      appendMuxRecord(record, writer.muxId, MUX_DATA, frame.data(),
+                      frame.size());
+      if (!writeGateway(*writer.gateway, record))
+        return false;
+      wireStats.wrote(writer.version, frame.size());
+      return true;
+    }
+    if (writer.ring) {
+      if (!writer.ring->write(frame.data(), frame.size()))
+        return false;
+      wireStats.wrote(writer.version, frame.size());
+      return true;
     }
+    size_t sent = 0;
+    while (sent < frame.size()) {
+      ssize_t n = send(socket, frame.data() + sent, frame.size() - sent,
+                       MSG_NOSIGNAL);
+      if (n <= 0)
+        return false;
+      sent += n;
+    }
+    wireStats.wrote(writer.version, sent);
+    return true;
+  }
+
+  // Frames are written whole under a per-socket lock so messages sent from
+  // different threads to the same client never interleave
+  void sendMessage(int socket, uint16_t type, uint32_t userId,
+                   uint32_t sessionId, const void *payload, uint32_t length) {
+    std::shared_ptr<SocketWriter> writer = socketWriter(socket);
+    std::lock_guard<std::mutex> lock(writer->mutex);
+    if (socket == replyTo.socket && replyTo.connection != 0 &&
+        connectionId(socket) != replyTo.connection)
+      return; // The client left before its answer was ready
+    writeFrame(socket, *writer,
+               buildFrame(writer->version, type, userId, sessionId, payload,
+                          length, replyTag(socket), writer->compress));
   }
 
   void sendError(int socket, const char *message) {
@@ -864,52 +3441,113 @@ public:
     sendMessage(socket, MSG_ERROR, 0, 0, errorMsg, strlen(errorMsg) + 1);
   }
 
+  // A dropped connection only suspends its session. The user stays in
+  // their game and tournament, with the game clock running, until they
+  // resume or the grace period ends.
   void removeClient(int clientSocket) {
-    std::lock_guard<std::mutex> lock(clientMutex);
-    auto it = clientSockets.find(clientSocket);
-    if (it != clientSockets.end()) {
-      uint32_t userId = it->second;
-
-      // Check if user is in a game
-      auto gameIt = userToGame.find(userId);
-      if (gameIt != userToGame.end()) {
-        std::lock_guard<std::mutex> gameLock(gameMutex);
-        auto activeGameIt = activeGames.find(gameIt->second);
-        if (activeGameIt != activeGames.end()) {
-          GameState *game = activeGameIt->second;
-          uint32_t winnerId =
-              (game->player1Id == userId) ? game->player2Id : game->player1Id;
-          handleGameOver(game, winnerId, 1); // Treat as resign
-        }
-      }
-
-      db.setUserOnline(userId, false);
-      userSockets.erase(userId);
-      clientSockets.erase(it);
+    {
+      std::lock_guard<std::mutex> lock(subscriberMutex);
+      presenceSubscribers.erase(clientSocket);
+    }
 
-      User user = db.getUser(userId);
-      std::cout << "[*] User logged out: " << user.username << std::endl;
+    SessionPtr session = sessions.suspend(
+        clientSocket, SessionTable::Clock::now() +
+                          std::chrono::seconds(RESUME_GRACE_SEC));
+    if (!session) {
+      return;
     }
+    matchmaker.remove(session->userId);
+    closePeerSessions(session->userId, false);
+
+    std::cout << "[*] User disconnected: " << session->username
+              << " (session held for " << RESUME_GRACE_SEC << "s)"
+              << std::endl;
   }
 
-  uint32_t generateSessionId() {
-    static uint32_t sessionCounter = 1000;
-    return sessionCounter++;
+  // Log the user out for good, on MSG_LOGOUT or when a suspended session
+  // expires
+  void endSession(const Session &session) {
+    uint32_t userId = session.userId;
+    tournaments.withdraw(userId);
+
+    std::shared_ptr<GameState> game = gameOf(userId);
+    if (game) {
+      std::lock_guard<std::mutex> lock(game->mutex);
+      if (!game->finished) {
+        uint32_t winnerId =
+            (game->player1Id == userId) ? game->player2Id : game->player1Id;
+        handleGameOver(game.get(), winnerId, 1); // Treat as resign
+      }
+    }
+
+    db.setUserOnline(userId, false);
+
+    std::cout << "[*] User logged out: " << session.username << std::endl;
   }
 
   ~GomokuServer() {
     running = false;
     close(serverSocket);
+    if (unixSocket >= 0) {
+      close(unixSocket);
+      unlink(unixPath.c_str());
+    }
   }
 };
 
 int main(int argc, char *argv[]) {
   int port = 8888;
-  if (argc > 1) {
-    port = std::atoi(argv[1]);
+  uint32_t ratingPeriodSeconds = 0; // --glicko-period=SECONDS
+  uint32_t spectatorDelaySeconds = 0; // --spectator-delay=SECONDS
+  std::string unixPath;               // --unix=PATH
+  std::string clusterSpec; // --cluster=HOST:PORT,HOST:PORT,...
+  int node = 0;            // --node=INDEX into the cluster list
+  std::string clusterKey;  // --cluster-key=PATH of the shared key
+  SharedKey gatewayKey('G'); // --gateway-key=PATH, to accept gateways
+
+  for (int i = 1; i < argc; i++) {
+    if (strncmp(argv[i], "--glicko-period=", 16) == 0) {
+      ratingPeriodSeconds = std::atoi(argv[i] + 16);
+    } else if (strncmp(argv[i], "--spectator-delay=", 18) == 0) {
+      spectatorDelaySeconds = std::atoi(argv[i] + 18);
+    } else if (strncmp(argv[i], "--unix=", 7) == 0) {
+      unixPath = argv[i] + 7;
+    } else if (strncmp(argv[i], "--cluster=", 10) == 0) {
+      clusterSpec = argv[i] + 10;
+    } else if (strncmp(argv[i], "--node=", 7) == 0) {
+      node = std::atoi(argv[i] + 7);
+    } else if (strncmp(argv[i], "--cluster-key=", 14) == 0) {
+      clusterKey = argv[i] + 14;
+    } else if (strncmp(argv[i], "--gateway-key=", 14) == 0) {
+      if (!gatewayKey.load(argv[i] + 14)) {
+        std::cerr << "--gateway-key needs a file holding at least 16 bytes"
+                  << std::endl;
+        return 1;
+      }
+    } else {
+      port = std::atoi(argv[i]);
+    }
+  }
+
+  // A cluster node listens on its own entry's port
+  Cluster cluster;
+  if (!clusterSpec.empty()) {
+    if (!cluster.configure(clusterSpec, node)) {
+      std::cerr << "Invalid --cluster or --node" << std::endl;
+      return 1;
+    }
+    // Peers authenticate with the key, so it is required
+    if (cluster.enabled() && !cluster.loadKey(clusterKey)) {
+      std::cerr << "A cluster needs --cluster-key=PATH, a file holding at "
+                   "least 16 bytes"
+                << std::endl;
+      return 1;
+    }
+    port = cluster.node(node).port;
   }
 
-  GomokuServer server(port);
+  GomokuServer server(port, ratingPeriodSeconds, spectatorDelaySeconds,
+                      unixPath, cluster, gatewayKey);
   server.start();
   return 0;
 }
@@ -0,0 +1,201 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Identity of a logged-in connection, resolved once at login and handed
+// to the message handlers. Sessions are immutable; a new login replaces
+// the whole entry.
+struct Session {
+  uint32_t sessionId;
+  uint32_t userId;
+  std::string username;
+  uint64_t resumeToken; // Secret a reconnecting client proves itself with
+};
+
+typedef std::shared_ptr<const Session> SessionPtr;
+
+// Logged-in connections, keyed by socket, session id and user. Every
+// inbound frame is checked against the socket's entry with one hash
+// lookup under a shared lock, so validation never serializes handler
+// threads. Session ids and resume tokens are drawn from the system's
+// random source, so a client cannot derive another connection's from
+// its own.
+//
+// When a connection drops, its session is suspended instead of closed.
+// A client that reconnects before the deadline and presents the session
+// id and resume token gets the same session back on its new socket.
+class SessionTable {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+private:
+  struct Suspended {
+    SessionPtr session;
+    Clock::time_point deadline;
+  };
+
+  mutable std::shared_mutex mutex;
+  std::unordered_map<int, SessionPtr> bySocket;
+  std::unordered_map<uint32_t, int> sessionSockets; // sessionId -> socket
+  std::unordered_map<uint32_t, int> userSockets;    // userId -> socket
+  std::unordered_map<uint32_t, Suspended> suspended; // sessionId -> entry
+  std::unordered_map<uint32_t, uint32_t> suspendedUsers; // userId -> session
+  std::random_device random; // Guarded by mutex
+
+  void bindLocked(int socket, SessionPtr session) {
+    sessionSockets[session->sessionId] = socket;
+    userSockets[session->userId] = socket;
+    bySocket[socket] = std::move(session);
+  }
+
+  // Caller holds the unique lock
+  void eraseLocked(int socket, const Session &s) {
+    sessionSockets.erase(s.sessionId);
+    auto user = userSockets.find(s.userId);
+    if (user != userSockets.end() && user->second == socket)
+      userSockets.erase(user);
+    bySocket.erase(socket);
+  }
+
+public:
+  // Start a session on the socket, replacing any earlier one there. The
+  // user's newest session receives messages addressed to them; a
+  // suspended session of the same user is dropped, since the user is back.
+  SessionPtr open(int socket, uint32_t userId, const std::string &username) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto old = bySocket.find(socket);
+    if (old != bySocket.end())
+      eraseLocked(socket, *old->second);
+    auto held = suspendedUsers.find(userId);
+    if (held != suspendedUsers.end()) {
+      suspended.erase(held->second);
+      suspendedUsers.erase(held);
+    }
+
+    uint32_t sessionId;
+    do {
+      sessionId = random();
+    } while (sessionId == 0 || sessionSockets.count(sessionId) ||
+             suspended.count(sessionId));
+    uint64_t token = (uint64_t)random() << 32 | random();
+
+    auto session = std::make_shared<const Session>(
+        Session{sessionId, userId, username, token});
+    bindLocked(socket, session);
+    return session;
+  }
+
+  // Hold the socket's session until the deadline and return it. A session
+  // the user has since replaced on another socket is dropped instead, and
+  // null returned, since the user is still connected there.
+  SessionPtr suspend(int socket, Clock::time_point deadline) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = bySocket.find(socket);
+    if (it == bySocket.end())
+      return nullptr;
+    SessionPtr session = it->second;
+    eraseLocked(socket, *session);
+    if (userSockets.count(session->userId))
+      return nullptr;
+    suspended[session->sessionId] = Suspended{session, deadline};
+    suspendedUsers[session->userId] = session->sessionId;
+    return session;
+  }
+
+  // Move a suspended session onto a new socket if the ids and token match
+  SessionPtr resume(int socket, uint32_t sessionId, uint32_t userId,
+                    uint64_t token) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = suspended.find(sessionId);
+    if (it == suspended.end())
+      return nullptr;
+    const Session &s = *it->second.session;
+    if (((uint64_t)(s.userId ^ userId) | (s.resumeToken ^ token)) != 0)
+      return nullptr;
+
+    SessionPtr session = it->second.session;
+    suspendedUsers.erase(session->userId);
+    suspended.erase(it);
+    auto old = bySocket.find(socket);
+    if (old != bySocket.end())
+      eraseLocked(socket, *old->second);
+    bindLocked(socket, session);
+    return session;
+  }
+
+  // Remove and return the suspended sessions whose deadline has passed
+  std::vector<SessionPtr> expire(Clock::time_point now) {
+    std::vector<SessionPtr> expired;
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    for (auto it = suspended.begin(); it != suspended.end();) {
+      if (it->second.deadline <= now) {
+        expired.push_back(it->second.session);
+        suspendedUsers.erase(it->second.session->userId);
+        it = suspended.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return expired;
+  }
+
+  // Whether the user is disconnected but may still resume
+  bool isSuspended(uint32_t userId) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return suspendedUsers.count(userId) > 0;
+  }
+
+  // The socket's session if the frame carries its ids, else null
+  SessionPtr validate(int socket, uint32_t sessionId, uint32_t userId) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = bySocket.find(socket);
+    if (it == bySocket.end())
+      return nullptr;
+    const Session &s = *it->second;
+    // Compare both ids without an early exit
+    if (((s.sessionId ^ sessionId) | (s.userId ^ userId)) != 0)
+      return nullptr;
+    return it->second;
+  }
+
+  // The socket's session, for frames that carry no ids, else null
+  SessionPtr find(int socket) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = bySocket.find(socket);
+    return it == bySocket.end() ? nullptr : it->second;
+  }
+
+  // Remove and return the socket's session
+  SessionPtr close(int socket) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = bySocket.find(socket);
+    if (it == bySocket.end())
+      return nullptr;
+    SessionPtr session = it->second;
+    eraseLocked(socket, *session);
+    return session;
+  }
+
+  // Socket of the user's newest session, or -1
+  int socketOf(uint32_t userId) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = userSockets.find(userId);
+    return it == userSockets.end() ? -1 : it->second;
+  }
+
+  size_t size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    return bySocket.size();
+  }
+};
+
+#endif
@@ -0,0 +1,107 @@
+#ifndef SHARED_KEY_H
+#define SHARED_KEY_H
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "password_hash.h"
+
+// A secret held by processes that trust each other: the nodes of a
+// cluster, or a server and its gateways. Both ends of a link prove they
+// hold it without sending it, in three hello frames, each a KeyHello:
+//
+//   connecting side   its id and a fresh nonce, no proof
+//   accepting side    its id, a fresh nonce and its proof
+//   connecting side   the same id and nonce, and its proof
+//
+// A proof is HMAC-SHA256 under the key of the link's domain, the prover's
+// role, both ids and both nonces, the other side's first, so it is good
+// for one handshake only, and never for another kind of link.
+struct KeyHello {
+  uint32_t id;       // Sender's index, where it has one
+  uint8_t nonce[16]; // Fresh for each handshake
+  uint8_t proof[32]; // Zero in the first hello
+} __attribute__((packed));
+
+class SharedKey {
+public:
+  static const size_t KEY_MIN = 16;
+
+  // `domain` tells the kinds of link apart
+  explicit SharedKey(char domain) : domain(domain) {}
+
+  // The key is the file's contents without trailing line breaks
+  bool load(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+    key.assign(std::istreambuf_iterator<char>(file),
+               std::istreambuf_iterator<char>());
+    while (!key.empty() && (key.back() == '\n' || key.back() == '\r'))
+      key.pop_back();
+    return key.size() >= KEY_MIN;
+  }
+
+  bool loaded() const { return key.size() >= KEY_MIN; }
+
+  // A hello with a fresh nonce and no proof yet
+  KeyHello hello(uint32_t id) const {
+    KeyHello out;
+    memset(&out, 0, sizeof(out));
+    out.id = id;
+    std::random_device rd;
+    for (size_t i = 0; i < sizeof(out.nonce); i += 4) {
+      uint32_t word = rd();
+      memcpy(out.nonce + i, &word, 4);
+    }
+    return out;
+  }
+
+  // Sign our hello to the side that sent `theirs`
+  void prove(bool accepting, const KeyHello &theirs, KeyHello &ours) const {
+    mac(accepting, ours.id, theirs.id, theirs.nonce, ours.nonce, ours.proof);
+  }
+
+  // Whether their hello answers ours with a valid proof; `accepting` is
+  // our role, as in prove()
+  bool verify(bool accepting, const KeyHello &ours,
+              const KeyHello &theirs) const {
+    if (!loaded())
+      return false;
+    uint8_t expected[sizeof(theirs.proof)];
+    mac(!accepting, theirs.id, ours.id, ours.nonce, theirs.nonce, expected);
+    uint8_t diff = 0;
+    for (size_t i = 0; i < sizeof(expected); i++) {
+      diff |= expected[i] ^ theirs.proof[i];
+    }
+    return diff == 0;
+  }
+
+private:
+  char domain;
+  std::string key;
+
+  // HMAC-SHA256, as the single block of PBKDF2 with one iteration
+  void mac(bool accepting, uint32_t prover, uint32_t verifier,
+           const uint8_t *challenge, const uint8_t *nonce,
+           uint8_t out[32]) const {
+    std::vector<uint8_t> message;
+    message.push_back(domain);
+    message.push_back(accepting ? 'A' : 'C');
+    message.insert(message.end(), (const uint8_t *)&prover,
+                   (const uint8_t *)&prover + sizeof(prover));
+    message.insert(message.end(), (const uint8_t *)&verifier,
+                   (const uint8_t *)&verifier + sizeof(verifier));
+    message.insert(message.end(), challenge, challenge + 16);
+    message.insert(message.end(), nonce, nonce + 16);
+    Scrypt::pbkdf2((const uint8_t *)key.data(), key.size(), message.data(),
+                   message.size(), 1, out, 32);
+  }
+};
+
+#endif
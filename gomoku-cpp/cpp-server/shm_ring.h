@@ -0,0 +1,361 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <linux/futex.h>
+#include <memory>
+#include <new>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+
+// Shared-memory transport for clients on the same host as the server.
+//
+// A connection moves to shared memory in its Hello, which it must have
+// sent on the server's Unix domain socket. The server creates a channel,
+// an anonymous memory file holding a byte ring for each direction, and
+// passes its descriptor back with MSG_HELLO_RESPONSE as SCM_RIGHTS
+// ancillary data. From then on both ends write their frames, in the
+// negotiated wire version, into one ring and read them from the other.
+// The socket stays open only so each end notices when the other goes away.
+//
+// Each ring has one producer and one consumer. The server already writes
+// a socket's frames whole under its writer lock, and only the
+// connection's thread reads. Positions are free-running byte counts. A
+// reader with nothing to read spins briefly, then sleeps on a futex. The
+// writer only wakes it when it has said it is asleep, so a busy
+// connection makes no system calls. A writer facing a full ring waits
+// the same way, for up to WRITE_TIMEOUT_MS, then gives up and closes the
+// channel.
+//
+// Each end keeps its own position privately and only publishes it; the
+// peer's position is read once per step and checked, since the peer can
+// write anything into the shared page. A position that moved backwards,
+// passed the other one or left more than CAPACITY between them closes the
+// channel.
+class ShmChannel {
+public:
+  static constexpr size_t CAPACITY = 1 << 20; // Bytes per direction
+  static constexpr int WRITE_TIMEOUT_MS = 5000;
+
+  // Waits are cut into slices, after each of which the peer is checked
+  static constexpr int WAIT_SLICE_MS = 50;
+  // Polls of an empty ring before sleeping, on hosts with a core to spare
+  static constexpr unsigned SPIN_LIMIT = 4000;
+
+  ~ShmChannel() {
+    munmap(memory, SIZE);
+    if (memoryFd >= 0)
+      ::close(memoryFd);
+  }
+
+  ShmChannel(const ShmChannel &) = delete;
+  ShmChannel &operator=(const ShmChannel &) = delete;
+
+  // A new channel for the server end of `socket`; null if no memory file
+  // could be made
+  static std::shared_ptr<ShmChannel> create(int socket) {
+    int fd = memfd_create("gomoku-shm", MFD_CLOEXEC);
+    if (fd < 0)
+      return nullptr;
+    if (ftruncate(fd, SIZE) < 0) {
+      ::close(fd);
+      return nullptr;
+    }
+    std::shared_ptr<ShmChannel> channel = map(fd, socket, true);
+    if (channel)
+      new (channel->memory) Layout();
+    return channel;
+  }
+
+  // The client end of a channel received on `socket`; takes the
+  // descriptor either way
+  static std::shared_ptr<ShmChannel> attach(int fd, int socket) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size != SIZE) {
+      ::close(fd);
+      return nullptr;
+    }
+    return map(fd, socket, false);
+  }
+
+  // Descriptor of the memory file, to pass to the client
+  int fd() const { return memoryFd; }
+
+  // Append bytes to the outgoing ring; false if the channel is closed or
+  // stays full for WRITE_TIMEOUT_MS, which also closes it
+  bool write(const void *data, size_t length) {
+    Ring &ring = out;
+    const char *bytes = (const char *)data;
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(WRITE_TIMEOUT_MS);
+    while (length > 0) {
+      uint64_t head = ring.position;
+      uint64_t tail = ring.control->tail.load(std::memory_order_acquire);
+      if (tail < ring.peer || tail > head || head - tail > CAPACITY) {
+        close();
+        return false;
+      }
+      ring.peer = tail;
+      size_t space = CAPACITY - (size_t)(head - tail);
+      if (space == 0) {
+        auto ready = [&]() {
+          return ring.control->tail.load(std::memory_order_acquire) != tail;
+        };
+        if (!wait(ring.control->spaceSignal, ring.control->writerAsleep,
+                  ready, &deadline)) {
+          close();
+          return false;
+        }
+        continue;
+      }
+      size_t n = std::min(space, length);
+      size_t at = head % CAPACITY;
+      size_t first = std::min(n, CAPACITY - at);
+      memcpy(ring.data + at, bytes, first);
+      memcpy(ring.data, bytes + first, n - first);
+      ring.position = head + n;
+      ring.control->head.store(ring.position, std::memory_order_release);
+      wake(ring.control->dataSignal, ring.control->readerAsleep);
+      bytes += n;
+      length -= n;
+    }
+    return true;
+  }
+
+  // Read exactly `length` bytes from the incoming ring; false once the
+  // channel is closed or the peer is gone
+  bool read(void *buffer, size_t length) {
+    Ring &ring = in;
+    char *bytes = (char *)buffer;
+    while (length > 0) {
+      uint64_t tail = ring.position;
+      uint64_t head = ring.control->head.load(std::memory_order_acquire);
+      if (head < ring.peer || head < tail || head - tail > CAPACITY) {
+        close();
+        return false;
+      }
+      ring.peer = head;
+      if (head == tail) {
+        auto ready = [&]() {
+          return ring.control->head.load(std::memory_order_acquire) != tail;
+        };
+        if (!wait(ring.control->dataSignal, ring.control->readerAsleep,
+                  ready, nullptr))
+          return false;
+        continue;
+      }
+      size_t n = std::min((size_t)(head - tail), length);
+      size_t at = tail % CAPACITY;
+      size_t first = std::min(n, CAPACITY - at);
+      memcpy(bytes, ring.data + at, first);
+      memcpy(bytes + first, ring.data, n - first);
+      ring.position = tail + n;
+      ring.control->tail.store(ring.position, std::memory_order_release);
+      wake(ring.control->spaceSignal, ring.control->writerAsleep);
+      bytes += n;
+      length -= n;
+    }
+    return true;
+  }
+
+  // Both ends stop; whoever is waiting is woken
+  void close() {
+    layout()->closed.store(1, std::memory_order_seq_cst);
+    for (Ring *ring : {&in, &out}) {
+      ring->control->dataSignal.fetch_add(1);
+      futex(ring->control->dataSignal, FUTEX_WAKE, INT32_MAX, nullptr);
+      ring->control->spaceSignal.fetch_add(1);
+      futex(ring->control->spaceSignal, FUTEX_WAKE, INT32_MAX, nullptr);
+    }
+  }
+
+  // Send `length` bytes on a Unix socket with `fd` attached to the first
+  static bool sendWithFd(int socket, const void *data, size_t length,
+                         int fd) {
+    struct iovec iov = {(void *)data, length};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    ssize_t n = sendmsg(socket, &msg, MSG_NOSIGNAL);
+    if (n <= 0)
+      return false;
+    for (size_t sent = n; sent < length; sent += n) {
+      n = send(socket, (const char *)data + sent, length - sent,
+               MSG_NOSIGNAL);
+      if (n <= 0)
+        return false;
+    }
+    return true;
+  }
+
+  // Read exactly `length` bytes from a Unix socket, and the descriptor
+  // sent with them if any (-1 if none)
+  static bool recvWithFd(int socket, void *buffer, size_t length, int &fd) {
+    fd = -1;
+    size_t total = 0;
+    while (total < length) {
+      struct iovec iov = {(char *)buffer + total, length - total};
+      char control[CMSG_SPACE(sizeof(int))];
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = &iov;
+      msg.msg_iovlen = 1;
+      msg.msg_control = control;
+      msg.msg_controllen = sizeof(control);
+      ssize_t n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+      if (n <= 0)
+        return false;
+      for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+           cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+            fd < 0) {
+          memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        }
+      }
+      total += n;
+    }
+    return true;
+  }
+
+private:
+  struct alignas(64) Control {
+    alignas(64) std::atomic<uint64_t> head; // Bytes written
+    alignas(64) std::atomic<uint64_t> tail; // Bytes read
+    // Futex words, bumped to wake the reader or the writer, and whether
+    // each is about to sleep on its word
+    alignas(64) std::atomic<uint32_t> dataSignal;
+    std::atomic<uint32_t> readerAsleep;
+    alignas(64) std::atomic<uint32_t> spaceSignal;
+    std::atomic<uint32_t> writerAsleep;
+  };
+
+  struct Layout {
+    Control rings[2]; // Client to server, server to client
+    alignas(64) std::atomic<uint32_t> closed;
+  };
+
+  static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                    std::atomic<uint32_t>::is_always_lock_free,
+                "shared rings need address-free atomics");
+  static constexpr size_t DATA_OFFSET = (sizeof(Layout) + 4095) / 4096 * 4096;
+  static constexpr size_t SIZE = DATA_OFFSET + 2 * CAPACITY;
+
+  struct Ring {
+    Control *control;
+    char *data;
+    uint64_t position = 0; // This end's: head when writing, tail reading
+    uint64_t peer = 0;     // The other end's, as last checked
+  };
+
+  void *memory;
+  int memoryFd;
+  int socket;
+  Ring in;
+  Ring out;
+
+  ShmChannel(void *memory, int fd, int socket, bool server)
+      : memory(memory), memoryFd(fd), socket(socket) {
+    Ring rings[2];
+    for (int i = 0; i < 2; i++) {
+      rings[i].control = &layout()->rings[i];
+      rings[i].data = (char *)memory + DATA_OFFSET + i * CAPACITY;
+    }
+    in = rings[server ? 0 : 1];
+    out = rings[server ? 1 : 0];
+  }
+
+  static std::shared_ptr<ShmChannel> map(int fd, int socket, bool server) {
+    void *memory =
+        mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+      ::close(fd);
+      return nullptr;
+    }
+    return std::shared_ptr<ShmChannel>(
+        new ShmChannel(memory, fd, socket, server));
+  }
+
+  Layout *layout() const { return (Layout *)memory; }
+
+  static long futex(std::atomic<uint32_t> &word, int op, uint32_t value,
+                    const struct timespec *timeout) {
+    return syscall(SYS_futex, (uint32_t *)&word, op, value, timeout, nullptr,
+                   0);
+  }
+
+  static void wake(std::atomic<uint32_t> &signal,
+                   std::atomic<uint32_t> &asleep) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (asleep.load(std::memory_order_relaxed)) {
+      signal.fetch_add(1, std::memory_order_release);
+      futex(signal, FUTEX_WAKE, 1, nullptr);
+    }
+  }
+
+  // Closed by either end, or the peer's socket has hung up. Nothing is
+  // sent on the socket once the channel is in use, so a readable socket
+  // means it was closed.
+  bool gone() {
+    if (layout()->closed.load(std::memory_order_acquire))
+      return true;
+    struct pollfd p = {socket, POLLIN | POLLRDHUP, 0};
+    return poll(&p, 1, 0) != 0;
+  }
+
+  // Until ready() holds; false if the channel goes away or the deadline,
+  // if any, passes first. The flag is raised before ready() is checked
+  // the last time, and the waker checks it after publishing, so a wakeup
+  // cannot fall between the check and the sleep.
+  template <typename Ready>
+  bool wait(std::atomic<uint32_t> &signal, std::atomic<uint32_t> &asleep,
+            Ready ready,
+            const std::chrono::steady_clock::time_point *deadline) {
+    static const unsigned spins =
+        std::thread::hardware_concurrency() > 1 ? SPIN_LIMIT : 0;
+    for (unsigned i = 0; i < spins; i++) {
+      if (ready())
+        return true;
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+
+    const struct timespec slice = {0, WAIT_SLICE_MS * 1000000L};
+    while (!ready()) {
+      if (gone() ||
+          (deadline && std::chrono::steady_clock::now() >= *deadline))
+        return false;
+      uint32_t seen = signal.load(std::memory_order_acquire);
+      asleep.store(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!ready()) {
+        futex(signal, FUTEX_WAIT, seen, &slice);
+      }
+      asleep.store(0, std::memory_order_relaxed);
+    }
+    return true;
+  }
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef SPECTATORS_H
+#define SPECTATORS_H
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+#include "worker_pool.h"
+
+// Serialized frame shared by every connection it is queued for
+typedef std::shared_ptr<const std::vector<char>> SharedFrame;
+
+// One event framed for each wire version, indexed by version - 1
+typedef std::array<SharedFrame, WIRE_VERSION_MAX> SharedFrames;
+
+// Spectators of running games. An event is serialized once per wire
+// version by the caller and the same buffer is queued for every watcher
+// speaking that version, so publishing costs one
+// reference-count increment and one queue push per watcher; the bytes are
+// never copied and no system call is made. The game's thread never writes
+// to a watcher's socket: each connection has its own outbox, drained on a
+// small pool of writer threads.
+//
+// An outbox that falls queueLimit frames behind, or whose write fails, is
+// closed and receives nothing more.
+class SpectatorHub {
+public:
+  // Writes one whole frame to the socket; false if the connection failed
+  typedef std::function<bool(int, const std::vector<char> &)> Writer;
+
+  SpectatorHub(size_t threads, size_t queueLimit, size_t maxOutboxes,
+               int niceness, Writer writer)
+      : queueLimit(queueLimit), writer(std::move(writer)),
+        pool(threads, maxOutboxes, niceness) {}
+
+private:
+  struct Outbox {
+    int socket;
+    uint8_t version; // Wire version the connection speaks
+    std::mutex mutex; // frames, draining, closed
+    std::deque<SharedFrame> frames;
+    bool draining = false; // A drain job is queued or running
+    bool closed = false;
+    std::mutex writeMutex; // Held while a frame is written; see remove()
+    std::set<uint32_t> games; // Guarded by the hub's mutex
+
+    Outbox(int socket, uint8_t version) : socket(socket), version(version) {}
+  };
+  typedef std::shared_ptr<Outbox> OutboxPtr;
+  typedef std::shared_ptr<const std::vector<OutboxPtr>> WatcherList;
+
+  size_t queueLimit;
+  Writer writer;
+
+  mutable std::shared_mutex mutex;
+  // Watcher lists are copied on change, so a publisher only holds the
+  // shared lock long enough to take a reference to the current one
+  std::unordered_map<uint32_t, WatcherList> games;
+  std::unordered_map<int, OutboxPtr> bySocket;
+
+  WorkerPool pool; // Last, so pending drains finish before the rest goes
+
+  static void close(Outbox &box) {
+    box.closed = true;
+    box.frames.clear();
+  }
+
+  // Queue a frame; the caller holds box.mutex
+  void pushLocked(const OutboxPtr &box, const SharedFrame &frame) {
+    if (box->closed)
+      return;
+    if (box->frames.size() >= queueLimit) {
+      close(*box); // Too slow to keep up
+      return;
+    }
+    box->frames.push_back(frame);
+    if (!box->draining) {
+      box->draining = true;
+      if (!pool.submit([this, box]() { drain(box); })) {
+        box->draining = false;
+        close(*box);
+      }
+    }
+  }
+
+  void drain(const OutboxPtr &box) {
+    while (true) {
+      std::lock_guard<std::mutex> writing(box->writeMutex);
+      SharedFrame frame;
+      {
+        std::lock_guard<std::mutex> lock(box->mutex);
+        if (box->closed || box->frames.empty()) {
+          box->draining = false;
+          return;
+        }
+        frame = std::move(box->frames.front());
+        box->frames.pop_front();
+      }
+      if (!writer(box->socket, *frame)) {
+        std::lock_guard<std::mutex> lock(box->mutex);
+        close(*box);
+        box->draining = false;
+        return;
+      }
+    }
+  }
+
+  // Caller holds the unique lock
+  void detachLocked(uint32_t gameId, const OutboxPtr &box) {
+    auto it = games.find(gameId);
+    if (it == games.end())
+      return;
+    auto list = std::make_shared<std::vector<OutboxPtr>>();
+    list->reserve(it->second->size());
+    for (const OutboxPtr &other : *it->second) {
+      if (other != box)
+        list->push_back(other);
+    }
+    if (list->empty()) {
+      games.erase(it);
+    } else {
+      it->second = std::move(list);
+    }
+  }
+
+public:
+  // Add the socket to the game's watchers. `first` is queued ahead of any
+  // later event, so the caller can send the current state while holding
+  // whatever lock orders it before the game's next event.
+  void watch(uint32_t gameId, int socket, uint8_t version,
+             const SharedFrame &first) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    OutboxPtr &box = bySocket[socket];
+    if (box) {
+      std::lock_guard<std::mutex> boxLock(box->mutex);
+      if (box->closed) {
+        // Dropped earlier; start over
+        box = std::make_shared<Outbox>(socket, version);
+      }
+    } else {
+      box = std::make_shared<Outbox>(socket, version);
+    }
+
+    if (box->games.insert(gameId).second) {
+      WatcherList &current = games[gameId];
+      auto list = current ? std::make_shared<std::vector<OutboxPtr>>(*current)
+                          : std::make_shared<std::vector<OutboxPtr>>();
+      list->push_back(box);
+      current = std::move(list);
+    }
+
+    std::lock_guard<std::mutex> boxLock(box->mutex);
+    pushLocked(box, first);
+  }
+
+  void unwatch(uint32_t gameId, int socket) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = bySocket.find(socket);
+    if (it == bySocket.end() || !it->second->games.erase(gameId))
+      return;
+    detachLocked(gameId, it->second);
+  }
+
+  // Forget a closing connection. Returns once no frame is being written to
+  // the socket, so the descriptor can be closed and reused safely.
+  void remove(int socket) {
+    OutboxPtr box;
+    {
+      std::unique_lock<std::shared_mutex> lock(mutex);
+      auto it = bySocket.find(socket);
+      if (it == bySocket.end())
+        return;
+      box = std::move(it->second);
+      bySocket.erase(it);
+      for (uint32_t gameId : box->games) {
+        detachLocked(gameId, box);
+      }
+      box->games.clear();
+    }
+    std::lock_guard<std::mutex> writing(box->writeMutex);
+    std::lock_guard<std::mutex> lock(box->mutex);
+    close(*box);
+  }
+
+  // Queue the event for every watcher of the game, each in its wire
+  // version; returns how many
+  size_t publish(uint32_t gameId, const SharedFrames &frames) {
+    WatcherList list;
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex);
+      auto it = games.find(gameId);
+      if (it == games.end())
+        return 0;
+      list = it->second;
+    }
+    for (const OutboxPtr &box : *list) {
+      std::lock_guard<std::mutex> lock(box->mutex);
+      pushLocked(box, frames[box->version - 1]);
+    }
+    return list->size();
+  }
+
+  // Drop the game's watchers after its last event has been published
+  void endGame(uint32_t gameId) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    auto it = games.find(gameId);
+    if (it == games.end())
+      return;
+    for (const OutboxPtr &box : *it->second) {
+      box->games.erase(gameId);
+    }
+    games.erase(it);
+  }
+
+  size_t watchers(uint32_t gameId) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto it = games.find(gameId);
+    return it == games.end() ? 0 : it->second->size();
+  }
+};
+
+#endif
@@ -0,0 +1,459 @@
+#ifndef TOURNAMENT_H
+#define TOURNAMENT_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "matchmaker.h"
+#include "protocol.h"
+
+// Swiss and arena tournaments. The manager only schedules: it hands out
+// pairings as Matchmaker::Match values, the server starts them as normal
+// games and reports every result back through recordResult().
+//
+// Swiss: a fixed number of rounds. A round is paired once every game of
+// the previous round has finished and no participant is seated in a game
+// elsewhere, top-down within score order while avoiding repeat opponents;
+// an odd player out gets a bye worth a win.
+//
+// Arena: players are re-paired as soon as their game ends, or once a game
+// elsewhere ends, until the arena's duration runs out. Games already
+// running are allowed to finish.
+//
+// Scores are kept in half points (win = 2, draw = 1) and the standings are
+// an ordered set updated per result, so reading a page never sorts.
+class TournamentManager {
+public:
+  enum State : uint8_t { OPEN = 0, RUNNING = 1, FINISHED = 2 };
+
+  struct Standing {
+    uint32_t userId;
+    uint16_t points; // Half points
+    uint16_t wins;
+    uint16_t draws;
+    uint16_t losses;
+  };
+
+  struct Info {
+    uint32_t tournamentId;
+    std::string name;
+    uint32_t creatorId;
+    uint8_t format;
+    uint8_t state;
+    uint8_t boardSize;
+    uint16_t timeLimit;
+    uint16_t round;
+    uint16_t rounds; // Swiss rounds or arena minutes
+    uint32_t players;
+    uint32_t gamesInProgress;
+  };
+
+  // Outcome of a state change: games to start and who should be told
+  struct Update {
+    uint32_t tournamentId = 0;
+    std::vector<Matchmaker::Match> matches;
+    std::vector<uint32_t> notify; // Participants, when the status changed
+  };
+
+  // True for a player seated in any game, tournament or not
+  typedef std::function<bool(uint32_t)> Engaged;
+
+private:
+  struct Player {
+    uint16_t points = 0;
+    uint16_t wins = 0;
+    uint16_t draws = 0;
+    uint16_t losses = 0;
+    uint16_t byes = 0;
+    bool busy = false;      // In a running game of this tournament
+    bool withdrawn = false; // Disconnected; kept in standings, not paired
+    uint32_t lastOpponent = 0;
+    std::set<uint32_t> opponents;
+  };
+
+  // Standings order: points desc, wins desc, userId asc
+  typedef std::tuple<int, int, uint32_t> StandingKey;
+
+  struct Tournament {
+    Info info;
+    std::chrono::steady_clock::time_point endsAt; // Arena only
+    std::map<uint32_t, Player> players;
+    std::set<StandingKey> standings;
+    std::set<uint32_t> games; // Running games
+    bool waiting = false;     // Swiss round due, paired by tick()
+  };
+
+  std::mutex mutex;
+  std::map<uint32_t, Tournament> tournaments;
+  std::unordered_map<uint32_t, uint32_t> gameToTournament;
+  uint32_t idCounter;
+  Engaged engaged;
+
+  static StandingKey key(uint32_t userId, const Player &p) {
+    return StandingKey(-(int)p.points, -(int)p.wins, userId);
+  }
+
+  static void score(Tournament &t, uint32_t userId, uint16_t points,
+                    bool win, bool draw) {
+    Player &p = t.players[userId];
+    t.standings.erase(key(userId, p));
+    p.points += points;
+    if (win)
+      p.wins++;
+    else if (draw)
+      p.draws++;
+    else
+      p.losses++;
+    t.standings.insert(key(userId, p));
+  }
+
+  static std::vector<uint32_t> participants(const Tournament &t) {
+    std::vector<uint32_t> ids;
+    ids.reserve(t.players.size());
+    for (const auto &pair : t.players) {
+      ids.push_back(pair.first);
+    }
+    return ids;
+  }
+
+  // Players that can still be paired
+  static std::vector<uint32_t> active(const Tournament &t) {
+    std::vector<uint32_t> ids;
+    for (const auto &pair : t.players) {
+      if (!pair.second.withdrawn)
+        ids.push_back(pair.first);
+    }
+    return ids;
+  }
+
+  // Every game of the current Swiss round has finished or was unpaired
+  static bool roundOver(const Tournament &t) {
+    if (!t.games.empty())
+      return false;
+    for (const auto &pair : t.players) {
+      if (pair.second.busy)
+        return false;
+    }
+    return true;
+  }
+
+  static Matchmaker::Match makeMatch(const Tournament &t, uint32_t a,
+                                     uint32_t b) {
+    Matchmaker::Match m;
+    m.player1Id = a;
+    m.player2Id = b;
+    m.boardSize = t.info.boardSize;
+    m.timeLimit = t.info.timeLimit;
+    return m;
+  }
+
+  // Pair the given players in standings order. A player is matched with
+  // the highest placed remaining player they have not met yet (or must
+  // not meet again, for arena), falling back to the next one available.
+  std::vector<Matchmaker::Match> pairPlayers(Tournament &t,
+                                             std::vector<uint32_t> pool,
+                                             bool swiss) {
+    std::vector<Matchmaker::Match> matches;
+    std::sort(pool.begin(), pool.end(), [&](uint32_t a, uint32_t b) {
+      return key(a, t.players[a]) < key(b, t.players[b]);
+    });
+
+    // Swiss: the lowest placed player without a bye sits out
+    if (swiss && pool.size() % 2 == 1) {
+      auto bye = pool.end() - 1;
+      for (auto it = pool.rbegin(); it != pool.rend(); ++it) {
+        if (t.players[*it].byes == 0) {
+          bye = std::next(it).base();
+          break;
+        }
+      }
+      t.players[*bye].byes++;
+      score(t, *bye, 2, true, false);
+      pool.erase(bye);
+    }
+
+    std::vector<bool> used(pool.size(), false);
+    for (size_t i = 0; i < pool.size(); i++) {
+      if (used[i])
+        continue;
+      Player &p = t.players[pool[i]];
+      size_t pick = pool.size();
+      for (size_t j = i + 1; j < pool.size(); j++) {
+        if (used[j])
+          continue;
+        if (pick == pool.size())
+          pick = j; // Fallback: next available
+        bool repeat = swiss ? p.opponents.count(pool[j]) > 0
+                            : p.lastOpponent == pool[j];
+        if (!repeat) {
+          pick = j;
+          break;
+        }
+      }
+      if (pick == pool.size())
+        break; // Odd one out waits (arena)
+
+      used[i] = used[pick] = true;
+      matches.push_back(makeMatch(t, pool[i], pool[pick]));
+    }
+
+    for (const auto &m : matches) {
+      for (uint32_t id : {m.player1Id, m.player2Id}) {
+        Player &p = t.players[id];
+        p.busy = true;
+        p.lastOpponent = id == m.player1Id ? m.player2Id : m.player1Id;
+        p.opponents.insert(p.lastOpponent);
+      }
+    }
+    return matches;
+  }
+
+  // Caller holds the mutex. The round waits while a participant is still
+  // seated in another game, so no one misses it.
+  void nextSwissRound(Tournament &t, Update &update) {
+    std::vector<uint32_t> pool = active(t);
+    if (t.info.round >= t.info.rounds || pool.size() < 2) {
+      t.info.state = FINISHED;
+      t.waiting = false;
+      update.notify = participants(t);
+      return;
+    }
+    for (uint32_t id : pool) {
+      if (engaged(id)) {
+        t.waiting = true;
+        return;
+      }
+    }
+    t.waiting = false;
+    t.info.round++;
+    update.matches = pairPlayers(t, pool, true);
+    update.notify = participants(t);
+  }
+
+  void pairIdleArenaPlayers(Tournament &t, Update &update) {
+    if (std::chrono::steady_clock::now() >= t.endsAt) {
+      if (t.games.empty()) {
+        t.info.state = FINISHED;
+        update.notify = participants(t);
+      }
+      return;
+    }
+
+    std::vector<uint32_t> idle;
+    for (const auto &pair : t.players) {
+      if (!pair.second.busy && !pair.second.withdrawn &&
+          !engaged(pair.first))
+        idle.push_back(pair.first);
+    }
+    if (idle.size() >= 2) {
+      update.matches = pairPlayers(t, idle, false);
+      t.info.round++;
+    }
+  }
+
+public:
+  explicit TournamentManager(Engaged engaged)
+      : idCounter(1), engaged(engaged) {}
+
+  uint32_t create(uint32_t creatorId, const std::string &name,
+                  uint8_t format, uint8_t boardSize, uint16_t timeLimit,
+                  uint16_t rounds) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint32_t id = idCounter++;
+    Tournament &t = tournaments[id];
+    t.info.tournamentId = id;
+    t.info.name = name;
+    t.info.creatorId = creatorId;
+    t.info.format = format;
+    t.info.state = OPEN;
+    t.info.boardSize = boardSize;
+    t.info.timeLimit = timeLimit;
+    t.info.round = 0;
+    t.info.rounds = rounds;
+    t.info.players = 0;
+    t.info.gamesInProgress = 0;
+    return id;
+  }
+
+  bool join(uint32_t tournamentId, uint32_t userId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tournaments.find(tournamentId);
+    if (it == tournaments.end() || it->second.info.state != OPEN)
+      return false;
+    Tournament &t = it->second;
+    if (t.players.emplace(userId, Player()).second) {
+      t.standings.insert(key(userId, t.players[userId]));
+      t.info.players = t.players.size();
+    }
+    return true;
+  }
+
+  // Only the creator can start; the first round is paired immediately
+  bool start(uint32_t tournamentId, uint32_t userId, Update &update) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tournaments.find(tournamentId);
+    if (it == tournaments.end())
+      return false;
+    Tournament &t = it->second;
+    if (t.info.state != OPEN || t.info.creatorId != userId ||
+        t.players.size() < 2)
+      return false;
+
+    t.info.state = RUNNING;
+    update.tournamentId = tournamentId;
+    if (t.info.format == TOURNAMENT_ARENA) {
+      t.endsAt = std::chrono::steady_clock::now() +
+                 std::chrono::minutes(t.info.rounds);
+      pairIdleArenaPlayers(t, update);
+    } else {
+      nextSwissRound(t, update);
+    }
+    update.notify = participants(t);
+    return true;
+  }
+
+  // Associate a started game with its tournament
+  void bindGame(uint32_t tournamentId, uint32_t gameId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tournaments.find(tournamentId);
+    if (it == tournaments.end())
+      return;
+    it->second.games.insert(gameId);
+    it->second.info.gamesInProgress = it->second.games.size();
+    gameToTournament[gameId] = tournamentId;
+  }
+
+  // Release pairings whose game was not started because a player had been
+  // seated elsewhere meanwhile. They score nothing for that round.
+  void unpair(uint32_t tournamentId,
+              const std::vector<Matchmaker::Match> &matches,
+              Update &update) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tournaments.find(tournamentId);
+    if (it == tournaments.end())
+      return;
+    Tournament &t = it->second;
+    update.tournamentId = tournamentId;
+
+    for (const auto &m : matches) {
+      for (uint32_t id : {m.player1Id, m.player2Id}) {
+        Player &p = t.players[id];
+        uint32_t other = id == m.player1Id ? m.player2Id : m.player1Id;
+        p.busy = false;
+        p.opponents.erase(other);
+        if (p.lastOpponent == other)
+          p.lastOpponent = 0;
+      }
+    }
+
+    if (t.info.state == RUNNING && t.info.format != TOURNAMENT_ARENA &&
+        roundOver(t))
+      nextSwissRound(t, update);
+  }
+
+  // Record a finished game (winnerId 0 = draw). Returns false for games
+  // that do not belong to a tournament.
+  bool recordResult(uint32_t gameId, uint32_t player1Id, uint32_t player2Id,
+                    uint32_t winnerId, Update &update) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto git = gameToTournament.find(gameId);
+    if (git == gameToTournament.end())
+      return false;
+    uint32_t tournamentId = git->second;
+    gameToTournament.erase(git);
+
+    Tournament &t = tournaments[tournamentId];
+    t.games.erase(gameId);
+    t.info.gamesInProgress = t.games.size();
+    update.tournamentId = tournamentId;
+
+    for (uint32_t id : {player1Id, player2Id}) {
+      bool draw = winnerId == 0;
+      bool win = id == winnerId;
+      score(t, id, win ? 2 : (draw ? 1 : 0), win, draw);
+      t.players[id].busy = false;
+    }
+
+    if (t.info.state != RUNNING)
+      return true;
+    if (t.info.format == TOURNAMENT_ARENA) {
+      pairIdleArenaPlayers(t, update);
+    } else if (roundOver(t)) {
+      nextSwissRound(t, update);
+    }
+    return true;
+  }
+
+  // Pair players who have left games elsewhere, and close arenas whose
+  // time ran out while no game was running
+  std::vector<Update> tick() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Update> updates;
+    for (auto &pair : tournaments) {
+      Tournament &t = pair.second;
+      if (t.info.state != RUNNING)
+        continue;
+      Update update;
+      update.tournamentId = pair.first;
+      if (t.info.format == TOURNAMENT_ARENA) {
+        pairIdleArenaPlayers(t, update);
+      } else if (t.waiting) {
+        nextSwissRound(t, update);
+      }
+      if (!update.matches.empty() || !update.notify.empty())
+        updates.push_back(update);
+    }
+    return updates;
+  }
+
+  // Stop pairing a disconnected player in every tournament they are in.
+  // A running game still reports its result through recordResult().
+  void withdraw(uint32_t userId) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto &pair : tournaments) {
+      auto it = pair.second.players.find(userId);
+      if (it != pair.second.players.end())
+        it->second.withdrawn = true;
+    }
+  }
+
+  bool info(uint32_t tournamentId, Info &out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = tournaments.find(tournamentId);
+    if (it == tournaments.end())
+      return false;
+    out = it->second.info;
+    return true;
+  }
+
+  // One page of the standings starting at 0-based position `offset`
+  std::vector<Standing> standings(uint32_t tournamentId, size_t offset,
+                                  size_t limit) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Standing> page;
+    auto it = tournaments.find(tournamentId);
+    if (it == tournaments.end())
+      return page;
+    Tournament &t = it->second;
+
+    auto pos = t.standings.begin();
+    std::advance(pos, std::min(offset, t.standings.size()));
+    for (; pos != t.standings.end() && page.size() < limit; ++pos) {
+      uint32_t userId = std::get<2>(*pos);
+      const Player &p = t.players[userId];
+      page.push_back(Standing{userId, p.points, p.wins, p.draws, p.losses});
+    }
+    return page;
+  }
+};
+
+#endif
@@ -0,0 +1,581 @@
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "lz_codec.h"
+#include "move_codec.h"
+#include "protocol.h"
+#include "schema.h"
+
+// Framing for every wire version.
+//
+// A v1 frame is a MessageHeader followed by the payload.
+//
+// A v2 frame is
+//
+//   varint  length of the rest of the frame
+//   uint8   type
+//   body
+//
+// and carries no ids: a v2 connection's session is bound to its socket.
+// For the message types listed in message() the body is a compact form of
+// the v1 payload, with integers as varints (zigzag if signed) and names as
+// a varint length and their bytes; any bytes past what the type describes
+// follow unchanged. Other types carry the v1 payload as is.
+//
+// A v3 frame is a v2 frame with a varint correlation tag after the type.
+// A client picks the tag of each request; every frame sent in answer to it
+// carries the same tag, and frames that answer no request carry 0. With
+// tags the client can keep many requests in flight, and the server may
+// answer them out of order.
+//
+// On a connection granted WIRE_COMPRESS, a large payload may be sent
+// compressed; see compress(). Compressed frames are understood on every
+// connection, whichever side sends them.
+//
+// Both ends keep building and handling the v1 structs. Payloads are
+// compacted when framed and expanded when read, so the choice of version
+// stays at the socket.
+class WireCodec {
+public:
+  // Payloads shorter than this are never compressed, and no compressed
+  // payload may expand past the maximum
+  static const size_t COMPRESS_MIN = 256;
+  static const size_t EXPANDED_MAX = 16 << 20;
+
+  // Largest frame a reader accepts, checked against the declared length
+  // before anything is allocated for it
+  static const size_t FRAME_MAX = 16 << 20;
+
+  // Flag in the type of a compressed frame
+  static const uint16_t V1_COMPRESSED = 0x8000;
+  static const uint8_t COMPRESSED = 0x80; // v2 and later
+
+  // Frame a v1 payload for the connection's version; the tag is dropped
+  // below v3
+  static std::vector<char> frame(uint8_t version, uint16_t type,
+                                 uint32_t userId, uint32_t sessionId,
+                                 const void *payload, uint32_t length,
+                                 uint32_t tag = 0) {
+    const char *bytes = (const char *)payload;
+    if (!payload)
+      length = 0;
+
+    std::vector<char> out;
+    if (version == WIRE_V1) {
+      MessageHeader header;
+      header.type = type;
+      header.length = length;
+      header.userId = userId;
+      header.sessionId = sessionId;
+      // v1 sends the history entries after the frame, outside its length
+      if (type == MSG_GAME_HISTORY_RESPONSE && length > sizeof(uint32_t))
+        header.length = sizeof(uint32_t);
+      out.reserve(sizeof(header) + length);
+      out.insert(out.end(), (const char *)&header,
+                 (const char *)&header + sizeof(header));
+      out.insert(out.end(), bytes, bytes + length);
+      return out;
+    }
+
+    std::vector<char> body;
+    body.reserve(length + 1);
+    body.push_back((char)type);
+    if (version >= WIRE_V3)
+      MoveCodec::putVarint(body, tag);
+    Compactor c(bytes, length, body);
+    message(c, type);
+    c.finish();
+
+    out.reserve(body.size() + 5);
+    MoveCodec::putVarint(out, body.size());
+    out.insert(out.end(), body.begin(), body.end());
+    return out;
+  }
+
+  // Compress a frame built by frame() if its payload is at least
+  // COMPRESS_MIN bytes and shrinks; true if it did. The frame is flagged in
+  // its type, and its payload becomes
+  //
+  //   varint  size of the payload before compression
+  //   bytes   LzCodec block
+  //
+  // From v2 on it is the compact body that is compressed; the type and tag
+  // stay in the clear. A v1 history frame is compressed with its entries,
+  // and its length then covers them.
+  static bool compress(uint8_t version, std::vector<char> &frame) {
+    const uint8_t *data = (const uint8_t *)frame.data();
+    const uint8_t *p = data;
+    const uint8_t *end = data + frame.size();
+    if (version == WIRE_V1) {
+      p += sizeof(MessageHeader);
+    } else {
+      uint64_t value;
+      MoveCodec::getVarint(p, end, value); // Frame length
+      const uint8_t *type = p++;
+      if (version >= WIRE_V3)
+        MoveCodec::getVarint(p, end, value);
+      data = type;
+    }
+    size_t raw = end - p;
+    if (raw < COMPRESS_MIN)
+      return false;
+
+    std::vector<char> packed;
+    packed.reserve(raw / 2);
+    MoveCodec::putVarint(packed, raw);
+    LzCodec::compress(p, raw, packed);
+    if (packed.size() >= raw)
+      return false;
+
+    std::vector<char> out;
+    if (version == WIRE_V1) {
+      MessageHeader header;
+      memcpy(&header, frame.data(), sizeof(header));
+      header.type |= V1_COMPRESSED;
+      header.length = packed.size();
+      out.reserve(sizeof(header) + packed.size());
+      out.insert(out.end(), (const char *)&header,
+                 (const char *)&header + sizeof(header));
+    } else {
+      // Type and tag, then the compressed body
+      size_t prefix = p - data;
+      MoveCodec::putVarint(out, prefix + packed.size());
+      out.insert(out.end(), (const char *)data, (const char *)p);
+      out[out.size() - prefix] |= (char)COMPRESSED;
+    }
+    out.insert(out.end(), packed.begin(), packed.end());
+    frame.swap(out);
+    return true;
+  }
+
+  // Size on the wire of the frame at the start of `data`, taken from its
+  // header alone; 0 while the header is not all there. False if the header
+  // is malformed or declares more than FRAME_MAX.
+  static bool frameSize(uint8_t version, const char *data, size_t size,
+                        size_t &total) {
+    total = 0;
+    if (version == WIRE_V1) {
+      MessageHeader header;
+      if (size < sizeof(header))
+        return true;
+      memcpy(&header, data, sizeof(header));
+      if (header.length > FRAME_MAX)
+        return false;
+      total = sizeof(header) + header.length;
+      return true;
+    }
+
+    uint64_t length = 0;
+    for (size_t i = 0; i < size; i++) {
+      if (i > 4)
+        return false;
+      uint8_t byte = data[i];
+      length |= (uint64_t)(byte & 0x7F) << (7 * i);
+      if (!(byte & 0x80)) {
+        if (length == 0 || length > FRAME_MAX)
+          return false;
+        total = i + 1 + length;
+        return true;
+      }
+    }
+    return true;
+  }
+
+  // Read one frame with read(buffer, length), which fills the buffer or
+  // returns false. The payload comes back in its v1 form; header.length is
+  // its size and the ids are 0 from v2 on. `wireBytes` is the frame's size
+  // on the wire, and `tag` its correlation tag, 0 below v3. False if the
+  // connection failed, or the frame is malformed or over FRAME_MAX.
+  template <typename Read>
+  static bool readFrame(uint8_t version, Read read, MessageHeader &header,
+                        std::vector<char> &payload, size_t &wireBytes,
+                        uint32_t &tag) {
+    payload.clear();
+    tag = 0;
+    if (version == WIRE_V1) {
+      if (!read(&header, sizeof(header)) || header.length > FRAME_MAX)
+        return false;
+      payload.resize(header.length);
+      if (header.length > 0 && !read(payload.data(), header.length))
+        return false;
+      wireBytes = sizeof(header) + header.length;
+      if (header.type & V1_COMPRESSED) {
+        std::vector<char> expanded;
+        if (!expand((const uint8_t *)payload.data(), payload.size(),
+                    expanded))
+          return false;
+        payload.swap(expanded);
+        header.type &= ~V1_COMPRESSED;
+        header.length = payload.size();
+      }
+      return true;
+    }
+
+    uint64_t length = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+      if (shift > 28 || !read(&byte, 1))
+        return false;
+      length |= (uint64_t)(byte & 0x7F) << shift;
+      shift += 7;
+    } while (byte & 0x80);
+    if (length == 0 || length > FRAME_MAX)
+      return false;
+
+    std::vector<char> body(length);
+    if (!read(body.data(), length))
+      return false;
+    wireBytes = shift / 7 + length;
+
+    header.type = (uint8_t)body[0];
+    header.userId = 0;
+    header.sessionId = 0;
+    const uint8_t *p = (const uint8_t *)body.data() + 1;
+    const uint8_t *end = (const uint8_t *)body.data() + length;
+    if (version >= WIRE_V3) {
+      uint64_t value = 0;
+      if (!MoveCodec::getVarint(p, end, value) || value > UINT32_MAX)
+        return false;
+      tag = (uint32_t)value;
+    }
+    std::vector<char> expanded;
+    if (header.type & COMPRESSED) {
+      header.type &= ~COMPRESSED;
+      if (!expand(p, end - p, expanded))
+        return false;
+      p = (const uint8_t *)expanded.data();
+      end = p + expanded.size();
+    }
+    Expander e((const char *)p, end - p, payload);
+    message(e, header.type);
+    e.finish();
+    header.length = payload.size();
+    return e.ok();
+  }
+
+private:
+  // Undo compress() on a payload
+  static bool expand(const uint8_t *p, size_t length,
+                     std::vector<char> &out) {
+    const uint8_t *end = p + length;
+    uint64_t raw = 0;
+    if (!MoveCodec::getVarint(p, end, raw) || raw > EXPANDED_MAX)
+      return false;
+    return LzCodec::decompress(p, end - p, raw, out);
+  }
+
+  // Reads fields from a v1 struct and writes their compact form
+  struct Writer {
+    std::vector<char> &out;
+
+    template <typename T> void u8(T &value) { out.push_back((char)value); }
+
+    template <typename T> void var(T &value) {
+      MoveCodec::putVarint(out, (uint64_t)value);
+    }
+
+    template <typename T> void sig(T &value) {
+      int64_t v = value;
+      MoveCodec::putVarint(out, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+    }
+
+    void str(char *text, size_t capacity) {
+      size_t n = strnlen(text, capacity);
+      MoveCodec::putVarint(out, n);
+      out.insert(out.end(), text, text + n);
+    }
+  };
+
+  // Reads a compact form and fills in the fields of a v1 struct
+  struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool ok = true;
+
+    template <typename T> void u8(T &value) {
+      if (p >= end) {
+        ok = false;
+        return;
+      }
+      value = *p++;
+    }
+
+    template <typename T> void var(T &value) {
+      uint64_t v = 0;
+      if (!MoveCodec::getVarint(p, end, v))
+        ok = false;
+      value = (T)v;
+    }
+
+    template <typename T> void sig(T &value) {
+      uint64_t v = 0;
+      if (!MoveCodec::getVarint(p, end, v))
+        ok = false;
+      value = (T)((int64_t)(v >> 1) ^ -(int64_t)(v & 1));
+    }
+
+    void str(char *text, size_t capacity) {
+      uint64_t n = 0;
+      if (!MoveCodec::getVarint(p, end, n) || n > (uint64_t)(end - p)) {
+        ok = false;
+        return;
+      }
+      memcpy(text, p, std::min<uint64_t>(n, capacity - 1));
+      p += n;
+    }
+  };
+
+// A fields() overload per compacted struct, from its list in schema.h.
+// Packed members cannot be bound to references, so each field goes
+// through a copy; `c` is the Writer or Reader and `s` the struct.
+#define WIRE_FIELD(op, field)                                                  \
+  {                                                                            \
+    auto value = s.field;                                                      \
+    c.op(value);                                                               \
+    s.field = value;                                                           \
+  }
+#define WIRE_NAME(field) c.str(s.field, sizeof(s.field));
+#define WIRE_RECORD(field, Type) fields(c, s.field);
+#define WIRE_FIELDS(Struct, LIST)                                              \
+  template <typename C> static void fields(C &c, Struct &s) {                  \
+    LIST(WIRE_FIELD, WIRE_NAME, WIRE_RECORD)                                   \
+  }
+
+  template <typename C> static void fields(C &c, uint32_t &s) { c.var(s); }
+
+  WIRE_FIELDS(MoveRequest, MOVE_REQUEST_SCHEMA)
+  WIRE_FIELDS(MoveResponse, MOVE_RESPONSE_SCHEMA)
+  WIRE_FIELDS(SpectatorMove, SPECTATOR_MOVE_SCHEMA)
+  WIRE_FIELDS(TimeUpdate, TIME_UPDATE_SCHEMA)
+  WIRE_FIELDS(GameStart, GAME_START_SCHEMA)
+  WIRE_FIELDS(GameOver, GAME_OVER_SCHEMA)
+  WIRE_FIELDS(ChallengeResponse, CHALLENGE_RESPONSE_SCHEMA)
+  WIRE_FIELDS(PlayerInfo, PLAYER_INFO_SCHEMA)
+  WIRE_FIELDS(PresenceDeltaHeader, PRESENCE_DELTA_HEADER_SCHEMA)
+  WIRE_FIELDS(PresenceDelta, PRESENCE_DELTA_SCHEMA)
+  WIRE_FIELDS(GameHistoryEntry, GAME_HISTORY_ENTRY_SCHEMA)
+
+#undef WIRE_FIELDS
+#undef WIRE_RECORD
+#undef WIRE_NAME
+#undef WIRE_FIELD
+
+  // Walks a v1 payload, writing the compact form
+  class Compactor {
+  public:
+    Compactor(const char *p, size_t length, std::vector<char> &out)
+        : p(p), end(p + length), writer{out} {}
+
+    // Missing trailing bytes read as zero
+    template <typename T> T record() {
+      T s;
+      memset(&s, 0, sizeof(s));
+      size_t n = std::min<size_t>(sizeof(s), end - p);
+      memcpy(&s, p, n);
+      p += n;
+      fields(writer, s);
+      return s;
+    }
+
+    void name(size_t capacity) {
+      std::vector<char> text(capacity, 0);
+      size_t n = std::min<size_t>(capacity, end - p);
+      memcpy(text.data(), p, n);
+      p += n;
+      writer.str(text.data(), capacity);
+    }
+
+    bool more() const { return p < end; }
+    void finish() { writer.out.insert(writer.out.end(), p, end); }
+
+  private:
+    const char *p;
+    const char *end;
+    Writer writer;
+  };
+
+  // Walks a compact body, rebuilding the v1 payload
+  class Expander {
+  public:
+    Expander(const char *p, size_t length, std::vector<char> &out)
+        : reader{(const uint8_t *)p, (const uint8_t *)p + length}, out(out) {}
+
+    template <typename T> T record() {
+      T s;
+      memset(&s, 0, sizeof(s));
+      fields(reader, s);
+      append(&s, sizeof(s));
+      return s;
+    }
+
+    void name(size_t capacity) {
+      std::vector<char> text(capacity, 0);
+      reader.str(text.data(), capacity);
+      append(text.data(), capacity);
+    }
+
+    bool more() const { return reader.ok && reader.p < reader.end; }
+    bool ok() const { return reader.ok; }
+
+    void finish() {
+      if (reader.ok)
+        append(reader.p, reader.end - reader.p);
+    }
+
+  private:
+    Reader reader;
+    std::vector<char> &out;
+
+    void append(const void *data, size_t length) {
+      const char *bytes = (const char *)data;
+      out.insert(out.end(), bytes, bytes + length);
+    }
+  };
+
+  // The compact layout of each message type; the same walk compacts and
+  // expands. Lists stop early if the input runs out.
+  template <typename C> static void message(C &c, uint16_t type) {
+    switch (type) {
+    case MSG_MAKE_MOVE:
+      c.template record<MoveRequest>();
+      break;
+    case MSG_MOVE_RESPONSE:
+    case MSG_OPPONENT_MOVE:
+      c.template record<MoveResponse>();
+      break;
+    case MSG_SPECTATOR_MOVE:
+      c.template record<SpectatorMove>();
+      break;
+    case MSG_TIME_UPDATE:
+      c.template record<TimeUpdate>();
+      break;
+    case MSG_GAME_START:
+      c.template record<GameStart>();
+      break;
+    case MSG_GAME_OVER:
+      c.template record<GameOver>();
+      break;
+    case MSG_CHALLENGE_RECEIVED:
+      c.template record<ChallengeResponse>();
+      break;
+    case MSG_ONLINE_PLAYERS_LIST: {
+      uint32_t count = c.template record<uint32_t>();
+      for (uint32_t i = 0; i < count && c.more(); i++)
+        c.template record<PlayerInfo>();
+      break;
+    }
+    case MSG_PRESENCE_DELTA: {
+      PresenceDeltaHeader header = c.template record<PresenceDeltaHeader>();
+      for (uint32_t i = 0; i < header.count && c.more(); i++) {
+        PresenceDelta delta = c.template record<PresenceDelta>();
+        if (delta.kind & PRESENCE_JOINED)
+          c.name(32);
+      }
+      break;
+    }
+    case MSG_GAME_HISTORY_RESPONSE: {
+      uint32_t count = c.template record<uint32_t>();
+      for (uint32_t i = 0; i < count && c.more(); i++)
+        c.template record<GameHistoryEntry>();
+      break;
+    }
+    default:
+      break;
+    }
+  }
+};
+
+// Traffic by wire version, for comparing the two. Bytes are counted as
+// they are written and read; frames by type as they are encoded, so a
+// frame fanned out to many spectators counts once there.
+class WireStats {
+public:
+  WireStats() {
+    for (int v = 0; v < WIRE_VERSION_MAX; v++) {
+      bytesOut[v] = 0;
+      bytesIn[v] = 0;
+      for (int t = 0; t < 256; t++) {
+        frames[v][t] = 0;
+        frameBytes[v][t] = 0;
+      }
+    }
+  }
+
+  void encoded(uint8_t version, uint16_t type, size_t size) {
+    int v = version - 1;
+    frames[v][type & 0xFF]++;
+    frameBytes[v][type & 0xFF] += size;
+  }
+
+  void wrote(uint8_t version, size_t size) { bytesOut[version - 1] += size; }
+
+  // A frame offered for compression: its size before and after, equal if
+  // it was sent as it was, and the time spent on it
+  void compressed(size_t before, size_t after, uint64_t nanos) {
+    compressOffered++;
+    if (after < before)
+      compressApplied++;
+    compressBefore += before;
+    compressAfter += after;
+    compressNanos += nanos;
+  }
+  void read(uint8_t version, size_t size) { bytesIn[version - 1] += size; }
+
+  // One line per version that has seen traffic, with the average size of
+  // a move event and of a lobby update
+  std::string report() const {
+    static const uint16_t moves[] = {MSG_MOVE_RESPONSE, MSG_OPPONENT_MOVE,
+                                     MSG_SPECTATOR_MOVE};
+    static const uint16_t lobby[] = {MSG_ONLINE_PLAYERS_LIST,
+                                     MSG_PRESENCE_DELTA};
+    std::ostringstream out;
+    for (int v = 0; v < WIRE_VERSION_MAX; v++) {
+      if (bytesOut[v] == 0 && bytesIn[v] == 0)
+        continue;
+      out << (out.tellp() > 0 ? "\n" : "") << "[*] Wire v" << v + 1 << ": "
+          << bytesOut[v] << " bytes out, " << bytesIn[v] << " in; move "
+          << average(v, moves, 3) << " B/frame, lobby "
+          << average(v, lobby, 2) << " B/frame";
+    }
+    if (compressOffered > 0) {
+      uint64_t before = compressBefore, after = compressAfter;
+      out << (out.tellp() > 0 ? "\n" : "") << "[*] Compression: "
+          << compressApplied << " of " << compressOffered << " frames, "
+          << before << " -> " << after << " bytes ("
+          << (before ? 100 * (before - after) / before : 0) << "% less), "
+          << compressNanos / 1000 << " us";
+    }
+    return out.str();
+  }
+
+private:
+  std::atomic<uint64_t> bytesOut[WIRE_VERSION_MAX];
+  std::atomic<uint64_t> bytesIn[WIRE_VERSION_MAX];
+  std::atomic<uint64_t> frames[WIRE_VERSION_MAX][256];
+  std::atomic<uint64_t> frameBytes[WIRE_VERSION_MAX][256];
+  std::atomic<uint64_t> compressOffered{0};
+  std::atomic<uint64_t> compressApplied{0};
+  std::atomic<uint64_t> compressBefore{0};
+  std::atomic<uint64_t> compressAfter{0};
+  std::atomic<uint64_t> compressNanos{0};
+
+  double average(int v, const uint16_t *types, int n) const {
+    uint64_t count = 0, bytes = 0;
+    for (int i = 0; i < n; i++) {
+      count += frames[v][types[i]];
+      bytes += frameBytes[v][types[i]];
+    }
+    return count ? (double)bytes / count : 0.0;
+  }
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Fixed set of threads running queued jobs for CPU-heavy requests, so a
+// burst of them cannot take over the machine or the handler threads. The
+// queue is bounded: submit() refuses work instead of letting a backlog
+// grow without limit. Workers run at a lower scheduling priority than the
+// connection threads, so interactive traffic wins under contention.
+class WorkerPool {
+public:
+  typedef std::function<void()> Job;
+
+  WorkerPool(size_t threads, size_t capacity, int niceness = 0)
+      : capacity(capacity), stopping(false) {
+    for (size_t i = 0; i < threads; i++) {
+      workers.emplace_back(&WorkerPool::run, this, niceness);
+    }
+  }
+
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    cv.notify_all();
+    for (auto &worker : workers) {
+      worker.join();
+    }
+  }
+
+  // Queue a job; false if the queue is full
+  bool submit(Job job) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (stopping || jobs.size() >= capacity)
+        return false;
+      jobs.push_back(std::move(job));
+    }
+    cv.notify_one();
+    return true;
+  }
+
+  size_t pending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return jobs.size();
+  }
+
+  size_t threads() const { return workers.size(); }
+
+private:
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::deque<Job> jobs;
+  std::vector<std::thread> workers;
+  size_t capacity;
+  bool stopping;
+
+  void run(int niceness) {
+    if (niceness != 0) {
+      // Linux applies the nice value per thread
+      setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), niceness);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+      if (jobs.empty())
+        return;
+      Job job = std::move(jobs.front());
+      jobs.pop_front();
+      lock.unlock();
+      job();
+      lock.lock();
+    }
+  }
+};
+
+#endif